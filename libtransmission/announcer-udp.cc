@@ -8,6 +8,7 @@
 
 #include <cerrno> /* errno, EAFNOSUPPORT */
 #include <cstring> /* memcpy(), memset() */
+#include <unordered_map>
 #include <vector>
 
 #include <event2/buffer.h>
@@ -153,6 +154,7 @@ static auto constexpr TauRequestTtl = int{ 60 };
 
 struct tau_scrape_request
 {
+    /* the whole datagram; its first 8 bytes are filled with the connection_id when sent */
     std::vector<uint8_t> payload;
 
     time_t sent_at;
@@ -166,13 +168,13 @@ struct tau_scrape_request
 
 static struct tau_scrape_request* tau_scrape_request_new(
     tr_scrape_request const* in,
+    tau_transaction_t transaction_id,
     tr_scrape_response_func callback,
     void* user_data)
 {
-    tau_transaction_t const transaction_id = tau_transaction_new();
-
     /* build the payload */
     auto* buf = evbuffer_new();
+    evbuffer_add_hton_64(buf, 0); /* connection_id placeholder */
     evbuffer_add_hton_32(buf, TAU_ACTION_SCRAPE);
     evbuffer_add_hton_32(buf, transaction_id);
     for (int i = 0; i < in->info_hash_count; ++i)
@@ -268,6 +270,7 @@ static void on_scrape_response(struct tau_scrape_request* request, tau_action_t
 
 struct tau_announce_request
 {
+    /* the whole datagram; its first 8 bytes are filled with the connection_id when sent */
     std::vector<uint8_t> payload;
 
     time_t created_at;
@@ -308,13 +311,13 @@ static tau_announce_event get_tau_announce_event(tr_announce_event e)
 
 static struct tau_announce_request* tau_announce_request_new(
     tr_announce_request const* in,
+    tau_transaction_t transaction_id,
     tr_announce_response_func callback,
     void* user_data)
 {
-    tau_transaction_t const transaction_id = tau_transaction_new();
-
     /* build the payload */
     auto* buf = evbuffer_new();
+    evbuffer_add_hton_64(buf, 0); /* connection_id placeholder */
     evbuffer_add_hton_32(buf, TAU_ACTION_ANNOUNCE);
     evbuffer_add_hton_32(buf, transaction_id);
     evbuffer_add(buf, std::data(in->info_hash), std::size(in->info_hash));
@@ -405,6 +408,44 @@ static void on_announce_response(struct tau_announce_request* request, tau_actio
         tr_free(errmsg);
     }
 }
+/****
+*****
+*****  TRANSACTIONS
+*****
+****/
+
+struct tau_tracker;
+
+struct tr_announcer_udp
+{
+    /* tau_tracker */
+    tr_ptrArray trackers = {};
+
+    /* every transaction_id that's awaiting a response -> the tracker that sent it.
+       lets tau_handle_message() route a response without walking every request */
+    std::unordered_map<tau_transaction_t, tau_tracker*> transactions;
+
+    tr_session* session = nullptr;
+};
+
+/* Returns a new transaction_id that no other pending request is using
+   and indexes it so that its response can be found again in O(1) */
+static tau_transaction_t tau_transaction_add(tr_announcer_udp* tau, tau_tracker* tracker)
+{
+    auto transaction_id = tau_transaction_new();
+
+    while (!tau->transactions.try_emplace(transaction_id, tracker).second)
+    {
+        transaction_id = tau_transaction_new();
+    }
+
+    return transaction_id;
+}
+
+static void tau_transaction_remove(tr_announcer_udp* tau, tau_transaction_t transaction_id)
+{
+    tau->transactions.erase(transaction_id);
+}
 
 /****
 *****
@@ -415,6 +456,7 @@ static void on_announce_response(struct tau_announce_request* request, tau_actio
 struct tau_tracker
 {
     tr_session* const session;
+    tr_announcer_udp* const tau;
 
     tr_quark const key;
     tr_quark const host;
@@ -431,11 +473,16 @@ struct tau_tracker
 
     time_t close_at = 0;
 
-    tr_ptrArray announces = {};
-    tr_ptrArray scrapes = {};
+    /* pending requests, keyed by transaction_id */
+    std::unordered_map<tau_transaction_t, tau_announce_request*> announces;
+    std::unordered_map<tau_transaction_t, tau_scrape_request*> scrapes;
+
+    /* transaction_ids of the requests that haven't been sent yet, oldest first */
+    std::vector<tau_transaction_t> queued;
 
-    tau_tracker(tr_session* session_in, tr_quark key_in, tr_quark host_in, int port_in)
-        : session{ session_in }
+    tau_tracker(tr_announcer_udp* tau_in, tr_quark key_in, tr_quark host_in, int port_in)
+        : session{ tau_in->session }
+        , tau{ tau_in }
         , key{ key_in }
         , host{ host_in }
         , port{ port_in }
@@ -454,36 +501,44 @@ static void tau_tracker_free(struct tau_tracker* t)
         evutil_freeaddrinfo(t->addr);
     }
 
-    tr_ptrArrayDestruct(&t->announces, (PtrArrayForeachFunc)tau_announce_request_free);
-    tr_ptrArrayDestruct(&t->scrapes, (PtrArrayForeachFunc)tau_scrape_request_free);
+    for (auto& [transaction_id, req] : t->announces)
+    {
+        tau_announce_request_free(req);
+    }
+
+    for (auto& [transaction_id, req] : t->scrapes)
+    {
+        tau_scrape_request_free(req);
+    }
+
     delete t;
 }
 
 static void tau_tracker_fail_all(struct tau_tracker* tracker, bool did_connect, bool did_timeout, char const* errmsg)
 {
-    /* fail all the scrapes */
-    tr_ptrArray* reqs = &tracker->scrapes;
+    /* take ownership of the pending requests first,
+       since the callbacks are free to queue new ones on this tracker */
+    auto scrapes = decltype(tracker->scrapes){};
+    auto announces = decltype(tracker->announces){};
+    std::swap(scrapes, tracker->scrapes);
+    std::swap(announces, tracker->announces);
+    tracker->queued.clear();
 
-    for (int i = 0, n = tr_ptrArraySize(reqs); i < n; ++i)
+    /* fail all the scrapes */
+    for (auto& [transaction_id, req] : scrapes)
     {
-        auto* req = static_cast<struct tau_scrape_request*>(tr_ptrArrayNth(reqs, i));
+        tau_transaction_remove(tracker->tau, transaction_id);
         tau_scrape_request_fail(req, did_connect, did_timeout, errmsg);
+        tau_scrape_request_free(req);
     }
 
-    tr_ptrArrayDestruct(reqs, (PtrArrayForeachFunc)tau_scrape_request_free);
-    *reqs = {};
-
     /* fail all the announces */
-    reqs = &tracker->announces;
-
-    for (int i = 0, n = tr_ptrArraySize(reqs); i < n; ++i)
+    for (auto& [transaction_id, req] : announces)
     {
-        auto* req = static_cast<struct tau_announce_request*>(tr_ptrArrayNth(reqs, i));
+        tau_transaction_remove(tracker->tau, transaction_id);
         tau_announce_request_fail(req, did_connect, did_timeout, errmsg);
+        tau_announce_request_free(req);
     }
-
-    tr_ptrArrayDestruct(reqs, (PtrArrayForeachFunc)tau_announce_request_free);
-    *reqs = {};
 }
 
 static void tau_tracker_on_dns(int errcode, struct evutil_addrinfo* addr, void* vtracker)
@@ -508,16 +563,16 @@ static void tau_tracker_on_dns(int errcode, struct evutil_addrinfo* addr, void*
     }
 }
 
-static void tau_tracker_send_request(struct tau_tracker* tracker, void const* payload, size_t payload_len)
+static void tau_tracker_send_request(struct tau_tracker* tracker, std::vector<uint8_t>& payload)
 {
-    struct evbuffer* buf = evbuffer_new();
     dbgmsg(tracker->key, "sending request w/connection id %" PRIu64 "\n", tracker->connection_id);
-    evbuffer_add_hton_64(buf, tracker->connection_id);
-    evbuffer_add_reference(buf, payload, payload_len, nullptr, nullptr);
-    (void)tau_sendto(tracker->session, tracker->addr, tracker->port, evbuffer_pullup(buf, -1), evbuffer_get_length(buf));
-    evbuffer_free(buf);
+    auto const connection_id = tr_htonll(tracker->connection_id);
+    memcpy(std::data(payload), &connection_id, sizeof(connection_id));
+    (void)tau_sendto(tracker->session, tracker->addr, tracker->port, std::data(payload), std::size(payload));
 }
 
+/* Sends everything that's been queued since the last call in a single pass,
+   so that one connection_id serves the whole batch */
 static void tau_tracker_send_reqs(struct tau_tracker* tracker)
 {
     TR_ASSERT(tracker->dns_request == nullptr);
@@ -528,46 +583,39 @@ static void tau_tracker_send_reqs(struct tau_tracker* tracker)
 
     TR_ASSERT(tracker->connection_expiration_time > now);
 
-    tr_ptrArray* reqs = &tracker->announces;
+    auto queued = std::vector<tau_transaction_t>{};
+    std::swap(queued, tracker->queued);
 
-    for (int i = 0, n = tr_ptrArraySize(reqs); i < n; ++i)
+    for (auto const transaction_id : queued)
     {
-        auto* req = static_cast<struct tau_announce_request*>(tr_ptrArrayNth(reqs, i));
-
-        if (req->sent_at == 0)
+        if (auto const ait = tracker->announces.find(transaction_id);
+            ait != std::end(tracker->announces) && ait->second->sent_at == 0)
         {
+            auto* const req = ait->second;
             dbgmsg(tracker->key, "sending announce req %p", (void*)req);
             req->sent_at = now;
-            tau_tracker_send_request(tracker, std::data(req->payload), std::size(req->payload));
+            tau_tracker_send_request(tracker, req->payload);
 
             if (req->callback == nullptr)
             {
+                tracker->announces.erase(ait);
+                tau_transaction_remove(tracker->tau, transaction_id);
                 tau_announce_request_free(req);
-                tr_ptrArrayRemove(reqs, i);
-                --i;
-                --n;
             }
         }
-    }
-
-    reqs = &tracker->scrapes;
-
-    for (int i = 0, n = tr_ptrArraySize(reqs); i < n; ++i)
-    {
-        auto* req = static_cast<struct tau_scrape_request*>(tr_ptrArrayNth(reqs, i));
-
-        if (req->sent_at == 0)
+        else if (auto const sit = tracker->scrapes.find(transaction_id);
+                 sit != std::end(tracker->scrapes) && sit->second->sent_at == 0)
         {
+            auto* const req = sit->second;
             dbgmsg(tracker->key, "sending scrape req %p", (void*)req);
             req->sent_at = now;
-            tau_tracker_send_request(tracker, std::data(req->payload), std::size(req->payload));
+            tau_tracker_send_request(tracker, req->payload);
 
             if (req->callback == nullptr)
             {
+                tracker->scrapes.erase(sit);
+                tau_transaction_remove(tracker->tau, transaction_id);
                 tau_scrape_request_free(req);
-                tr_ptrArrayRemove(reqs, i);
-                --i;
-                --n;
             }
         }
     }
@@ -577,6 +625,7 @@ static void on_tracker_connection_response(struct tau_tracker* tracker, tau_acti
 {
     time_t const now = tr_time();
 
+    tau_transaction_remove(tracker->tau, tracker->connection_transaction_id);
     tracker->connecting_at = 0;
     tracker->connection_transaction_id = 0;
 
@@ -611,44 +660,58 @@ static void tau_tracker_timeout_reqs(struct tau_tracker* tracker)
         on_tracker_connection_response(tracker, TAU_ACTION_ERROR, nullptr);
     }
 
-    tr_ptrArray* reqs = &tracker->announces;
+    /* unlink the expired requests before failing them,
+       since the callbacks are free to queue new ones on this tracker */
+    auto expired_announces = std::vector<tau_announce_request*>{};
 
-    for (int i = 0, n = tr_ptrArraySize(reqs); i < n; ++i)
+    for (auto it = std::begin(tracker->announces); it != std::end(tracker->announces);)
     {
-        auto* req = static_cast<struct tau_announce_request*>(tr_ptrArrayNth(reqs, i));
-
-        if (cancel_all || req->created_at + TauRequestTtl < now)
+        if (auto* const req = it->second; cancel_all || req->created_at + TauRequestTtl < now)
         {
-            dbgmsg(tracker->key, "timeout announce req %p", (void*)req);
-            tau_announce_request_fail(req, false, true, nullptr);
-            tau_announce_request_free(req);
-            tr_ptrArrayRemove(reqs, i);
-            --i;
-            --n;
+            tau_transaction_remove(tracker->tau, it->first);
+            expired_announces.push_back(req);
+            it = tracker->announces.erase(it);
+        }
+        else
+        {
+            ++it;
         }
     }
 
-    reqs = &tracker->scrapes;
-
-    for (int i = 0, n = tr_ptrArraySize(reqs); i < n; ++i)
+    for (auto* const req : expired_announces)
     {
-        auto* const req = static_cast<struct tau_scrape_request*>(tr_ptrArrayNth(reqs, i));
+        dbgmsg(tracker->key, "timeout announce req %p", (void*)req);
+        tau_announce_request_fail(req, false, true, nullptr);
+        tau_announce_request_free(req);
+    }
+
+    auto expired_scrapes = std::vector<tau_scrape_request*>{};
 
-        if (cancel_all || req->created_at + TauRequestTtl < now)
+    for (auto it = std::begin(tracker->scrapes); it != std::end(tracker->scrapes);)
+    {
+        if (auto* const req = it->second; cancel_all || req->created_at + TauRequestTtl < now)
         {
-            dbgmsg(tracker->key, "timeout scrape req %p", (void*)req);
-            tau_scrape_request_fail(req, false, true, nullptr);
-            tau_scrape_request_free(req);
-            tr_ptrArrayRemove(reqs, i);
-            --i;
-            --n;
+            tau_transaction_remove(tracker->tau, it->first);
+            expired_scrapes.push_back(req);
+            it = tracker->scrapes.erase(it);
         }
+        else
+        {
+            ++it;
+        }
+    }
+
+    for (auto* const req : expired_scrapes)
+    {
+        dbgmsg(tracker->key, "timeout scrape req %p", (void*)req);
+        tau_scrape_request_fail(req, false, true, nullptr);
+        tau_scrape_request_free(req);
     }
 }
 
 static bool tau_tracker_is_idle(struct tau_tracker const* tracker)
 {
-    return tr_ptrArrayEmpty(&tracker->announces) && tr_ptrArrayEmpty(&tracker->scrapes) && tracker->dns_request == nullptr;
+    return std::empty(tracker->announces) && std::empty(tracker->scrapes) && tracker->dns_request == nullptr;
 }
 
 static void tau_tracker_upkeep_ex(struct tau_tracker* tracker, bool timeout_reqs)
@@ -703,7 +766,7 @@ static void tau_tracker_upkeep_ex(struct tau_tracker* tracker, bool timeout_reqs
     {
         struct evbuffer* buf = evbuffer_new();
         tracker->connecting_at = now;
-        tracker->connection_transaction_id = tau_transaction_new();
+        tracker->connection_transaction_id = tau_transaction_add(tracker->tau, tracker);
         dbgmsg(tracker->key, "Trying to connect. Transaction ID is %u", tracker->connection_transaction_id);
         evbuffer_add_hton_64(buf, 0x41727101980LL);
         evbuffer_add_hton_32(buf, TAU_ACTION_CONNECT);
@@ -735,14 +798,6 @@ static void tau_tracker_upkeep(struct tau_tracker* tracker)
 *****
 ****/
 
-struct tr_announcer_udp
-{
-    /* tau_tracker */
-    tr_ptrArray trackers;
-
-    tr_session* session;
-};
-
 static struct tr_announcer_udp* announcer_udp_get(tr_session* session)
 {
     if (session->announcer_udp != nullptr)
@@ -750,8 +805,7 @@ static struct tr_announcer_udp* announcer_udp_get(tr_session* session)
         return session->announcer_udp;
     }
 
-    auto* const tau = tr_new0(tr_announcer_udp, 1);
-    tau->trackers = {};
+    auto* const tau = new tr_announcer_udp{};
     tau->session = session;
     session->announcer_udp = tau;
     return tau;
@@ -783,7 +837,7 @@ static tau_tracker* tau_session_get_tracker(tr_announcer_udp* tau, tr_quark anno
     }
 
     // we don't have it -- build a new one
-    auto* const tracker = new tau_tracker{ tau->session, key, tr_quark_new(parsed->host), parsed->port };
+    auto* const tracker = new tau_tracker{ tau, key, tr_quark_new(parsed->host), parsed->port };
     tr_ptrArrayAppend(&tau->trackers, tracker);
     dbgmsg(tracker->key, "New tau_tracker created");
     return tracker;
@@ -833,7 +887,7 @@ void tr_tracker_udp_close(tr_session* session)
     {
         session->announcer_udp = nullptr;
         tr_ptrArrayDestruct(&tau->trackers, (PtrArrayForeachFunc)tau_tracker_free);
-        tr_free(tau);
+        delete tau;
     }
 }
 
@@ -890,55 +944,51 @@ bool tau_handle_message(tr_session* session, uint8_t const* msg, size_t msglen)
     /* extract the transaction_id and look for a match */
     struct tr_announcer_udp* const tau = session->announcer_udp;
     tau_transaction_t const transaction_id = evbuffer_read_ntoh_32(buf);
+    auto const transaction = tau->transactions.find(transaction_id);
 
-    for (int i = 0, n = tr_ptrArraySize(&tau->trackers); i < n; ++i)
+    if (transaction == std::end(tau->transactions))
     {
-        auto* tracker = static_cast<struct tau_tracker*>(tr_ptrArrayNth(&tau->trackers, i));
-
-        /* is it a connection response? */
-        if (tracker->connecting_at != 0 && transaction_id == tracker->connection_transaction_id)
-        {
-            dbgmsg(tracker->key, "%" PRIu32 " is my connection request!", transaction_id);
-            on_tracker_connection_response(tracker, action_id, buf);
-            evbuffer_free(buf);
-            return true;
-        }
-
-        /* is it a response to one of this tracker's announces? */
-        tr_ptrArray* reqs = &tracker->announces;
+        /* no match... */
+        evbuffer_free(buf);
+        return false;
+    }
 
-        for (int j = 0, jn = tr_ptrArraySize(reqs); j < jn; ++j)
-        {
-            auto* req = static_cast<struct tau_announce_request*>(tr_ptrArrayNth(reqs, j));
+    auto* const tracker = transaction->second;
 
-            if (req->sent_at != 0 && transaction_id == req->transaction_id)
-            {
-                dbgmsg(tracker->key, "%" PRIu32 " is an announce request!", transaction_id);
-                tr_ptrArrayRemove(reqs, j);
-                on_announce_response(req, action_id, buf);
-                tau_announce_request_free(req);
-                evbuffer_free(buf);
-                return true;
-            }
-        }
-
-        /* is it a response to one of this tracker's scrapes? */
-        reqs = &tracker->scrapes;
+    /* is it a connection response? */
+    if (tracker->connecting_at != 0 && transaction_id == tracker->connection_transaction_id)
+    {
+        dbgmsg(tracker->key, "%" PRIu32 " is my connection request!", transaction_id);
+        on_tracker_connection_response(tracker, action_id, buf);
+        evbuffer_free(buf);
+        return true;
+    }
 
-        for (int j = 0, jn = tr_ptrArraySize(reqs); j < jn; ++j)
-        {
-            auto* const req = static_cast<struct tau_scrape_request*>(tr_ptrArrayNth(reqs, j));
+    /* is it a response to one of this tracker's announces? */
+    if (auto const it = tracker->announces.find(transaction_id);
+        it != std::end(tracker->announces) && it->second->sent_at != 0)
+    {
+        auto* const req = it->second;
+        dbgmsg(tracker->key, "%" PRIu32 " is an announce request!", transaction_id);
+        tracker->announces.erase(it);
+        tau_transaction_remove(tau, transaction_id);
+        on_announce_response(req, action_id, buf);
+        tau_announce_request_free(req);
+        evbuffer_free(buf);
+        return true;
+    }
 
-            if (req->sent_at != 0 && transaction_id == req->transaction_id)
-            {
-                dbgmsg(tracker->key, "%" PRIu32 " is a scrape request!", transaction_id);
-                tr_ptrArrayRemove(reqs, j);
-                on_scrape_response(req, action_id, buf);
-                tau_scrape_request_free(req);
-                evbuffer_free(buf);
-                return true;
-            }
-        }
+    /* is it a response to one of this tracker's scrapes? */
+    if (auto const it = tracker->scrapes.find(transaction_id); it != std::end(tracker->scrapes) && it->second->sent_at != 0)
+    {
+        auto* const req = it->second;
+        dbgmsg(tracker->key, "%" PRIu32 " is a scrape request!", transaction_id);
+        tracker->scrapes.erase(it);
+        tau_transaction_remove(tau, transaction_id);
+        on_scrape_response(req, action_id, buf);
+        tau_scrape_request_free(req);
+        evbuffer_free(buf);
+        return true;
     }
 
     /* no match... */
@@ -959,8 +1009,10 @@ void tr_tracker_udp_announce(
         return;
     }
 
-    tau_announce_request* r = tau_announce_request_new(request, response_func, user_data);
-    tr_ptrArrayAppend(&tracker->announces, r);
+    auto const transaction_id = tau_transaction_add(tau, tracker);
+    tau_announce_request* r = tau_announce_request_new(request, transaction_id, response_func, user_data);
+    tracker->announces.emplace(transaction_id, r);
+    tracker->queued.push_back(transaction_id);
     tau_tracker_upkeep_ex(tracker, false);
 }
 
@@ -977,7 +1029,9 @@ void tr_tracker_udp_scrape(
         return;
     }
 
-    tau_scrape_request* r = tau_scrape_request_new(request, response_func, user_data);
-    tr_ptrArrayAppend(&tracker->scrapes, r);
+    auto const transaction_id = tau_transaction_add(tau, tracker);
+    tau_scrape_request* r = tau_scrape_request_new(request, transaction_id, response_func, user_data);
+    tracker->scrapes.emplace(transaction_id, r);
+    tracker->queued.push_back(transaction_id);
     tau_tracker_upkeep_ex(tracker, false);
 }
@@ -24,65 +24,6 @@
 ****
 ***/
 
-unsigned int Bandwidth::getSpeedBytesPerSecond(RateControl& r, unsigned int interval_msec, uint64_t now)
-{
-    if (now == 0)
-    {
-        now = tr_time_msec();
-    }
-
-    if (now != r.cache_time_)
-    {
-        uint64_t bytes = 0;
-        uint64_t const cutoff = now - interval_msec;
-
-        for (int i = r.newest_; r.transfers_[i].date_ > cutoff;)
-        {
-            bytes += r.transfers_[i].size_;
-
-            if (--i == -1)
-            {
-                i = HistorySize - 1; /* circular history */
-            }
-
-            if (i == r.newest_)
-            {
-                break; /* we've come all the way around */
-            }
-        }
-
-        r.cache_val_ = unsigned(bytes * 1000U / interval_msec);
-        r.cache_time_ = now;
-    }
-
-    return r.cache_val_;
-}
-
-void Bandwidth::notifyBandwidthConsumedBytes(uint64_t const now, RateControl* r, size_t size)
-{
-    if (r->transfers_[r->newest_].date_ + GranularityMSec >= now)
-    {
-        r->transfers_[r->newest_].size_ += size;
-    }
-    else
-    {
-        if (++r->newest_ == HistorySize)
-        {
-            r->newest_ = 0;
-        }
-
-        r->transfers_[r->newest_].date_ = now;
-        r->transfers_[r->newest_].size_ = size;
-    }
-
-    /* invalidate cache_val*/
-    r->cache_time_ = 0;
-}
-
-/***
-****
-***/
-
 Bandwidth::Bandwidth(Bandwidth* new_parent)
 {
     this->band_[TR_UP].honor_parent_limits_ = true;
@@ -325,11 +266,11 @@ void Bandwidth::notifyBandwidthConsumed(tr_direction dir, size_t byte_count, boo
 
 #endif
 
-    notifyBandwidthConsumedBytes(now, &band->raw_, byte_count);
+    band->raw_.add(now, byte_count);
 
     if (is_piece_data)
     {
-        notifyBandwidthConsumedBytes(now, &band->piece_, byte_count);
+        band->piece_.add(now, byte_count);
     }
 
     if (this->parent_ != nullptr)
@@ -16,7 +16,9 @@
 #include <vector>
 
 #include "transmission.h"
+#include "history.h"
 #include "tr-assert.h"
+#include "utils.h" /* tr_time_msec() */
 
 class tr_peerIo;
 
@@ -128,7 +130,7 @@ public:
     {
         TR_ASSERT(tr_isDirection(dir));
 
-        return getSpeedBytesPerSecond(this->band_[dir].raw_, HistoryMSec, now);
+        return this->band_[dir].raw_.rate(now != 0 ? now : tr_time_msec());
     }
 
     /** @brief Get the number of piece data bytes read or sent by this bandwidth subtree. */
@@ -136,7 +138,7 @@ public:
     {
         TR_ASSERT(tr_isDirection(dir));
 
-        return getSpeedBytesPerSecond(this->band_[dir].piece_, HistoryMSec, now);
+        return this->band_[dir].piece_.rate(now != 0 ? now : tr_time_msec());
     }
 
     /**
@@ -201,39 +203,17 @@ public:
         return this->band_[direction].honor_parent_limits_;
     }
 
-    static constexpr size_t HistoryMSec = 2000U;
-    static constexpr size_t IntervalMSec = HistoryMSec;
-    static constexpr size_t GranularityMSec = 200;
-    static constexpr size_t HistorySize = (IntervalMSec / GranularityMSec);
-
-    struct RateControl
-    {
-        struct Transfer
-        {
-            uint64_t date_;
-            uint64_t size_;
-        };
-        std::array<Transfer, HistorySize> transfers_;
-        uint64_t cache_time_;
-        unsigned int cache_val_;
-        int newest_;
-    };
-
     struct Band
     {
-        RateControl raw_;
-        RateControl piece_;
-        unsigned int bytes_left_;
-        unsigned int desired_speed_bps_;
-        bool is_limited_;
-        bool honor_parent_limits_;
+        tr_rateMeter raw_;
+        tr_rateMeter piece_;
+        unsigned int bytes_left_ = 0;
+        unsigned int desired_speed_bps_ = 0;
+        bool is_limited_ = false;
+        bool honor_parent_limits_ = false;
     };
 
 private:
-    static unsigned int getSpeedBytesPerSecond(RateControl& r, unsigned int interval_msec, uint64_t now);
-
-    static void notifyBandwidthConsumedBytes(uint64_t now, RateControl* r, size_t size);
-
     [[nodiscard]] unsigned int clamp(uint64_t now, tr_direction dir, unsigned int byte_count) const;
 
     static void phaseOne(std::vector<tr_peerIo*>& peer_array, tr_direction dir);
@@ -0,0 +1,119 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // int64_t
+#include <string_view>
+#include <vector>
+
+enum tr_benc_token
+{
+    TR_BENC_TOKEN_INT,
+    TR_BENC_TOKEN_STR,
+    TR_BENC_TOKEN_LIST, /* start of a list */
+    TR_BENC_TOKEN_DICT, /* start of a dict */
+    TR_BENC_TOKEN_END, /* end of the innermost list or dict */
+    TR_BENC_TOKEN_ERROR
+};
+
+/**
+ * A pull parser for bencoded data.
+ *
+ * Tokens are read one at a time and strings are returned as views into
+ * the source buffer, so callers can pick out the fields they care about
+ * without building a tr_variant tree. Nesting is tracked with an explicit
+ * stack rather than recursion, so deeply-nested input can't smash the stack,
+ * and dicts are checked to hold string keys and an even number of children.
+ *
+ * Like tr_variantParseBenc(), stray bytes that can't start a token are
+ * skipped. Once an error is seen, the reader stays failed and every read
+ * returns an error or false.
+ */
+class tr_benc_reader
+{
+public:
+    explicit tr_benc_reader(std::string_view benc)
+        : benc_{ benc }
+    {
+    }
+
+    [[nodiscard]] tr_benc_token next();
+
+    [[nodiscard]] int64_t intValue() const
+    {
+        return int_;
+    }
+
+    [[nodiscard]] std::string_view strValue() const
+    {
+        return str_;
+    }
+
+    /* where the next token starts */
+    [[nodiscard]] char const* pos() const
+    {
+        return std::data(benc_);
+    }
+
+    [[nodiscard]] size_t depth() const
+    {
+        return std::size(stack_);
+    }
+
+    [[nodiscard]] bool failed() const
+    {
+        return failed_;
+    }
+
+    /* Skips the rest of the list or dict that was just entered. */
+    bool skipContainer();
+
+    /* Reads and discards the next value, containers included. */
+    bool skipValue();
+
+    /* Reads the next key of the dict being read. Returns false,
+     * having consumed the dict's end, when there are no more keys. */
+    bool nextKey(std::string_view* setme);
+
+    /* Returns true if the list being read has another item. Returns
+     * false, having consumed the list's end, when there are no more. */
+    bool hasNextItem();
+
+    /* These read the next value. If it has the requested type, they
+     * return true and, for containers, leave the caller positioned to
+     * read its contents. Otherwise the value is skipped and they return
+     * false, so optional fields of an unexpected type can be ignored. */
+    bool readInt(int64_t* setme);
+    bool readStr(std::string_view* setme);
+    bool enterList();
+    bool enterDict();
+
+private:
+    enum ContainerState : uint8_t
+    {
+        List,
+        DictKey, /* the dict's next token must be a key or its end */
+        DictValue
+    };
+
+    [[nodiscard]] tr_benc_token lex();
+    void skipJunk();
+    bool skipUnwanted(tr_benc_token token);
+
+    std::string_view benc_;
+    std::string_view str_;
+    int64_t int_ = 0;
+    std::vector<ContainerState> stack_;
+    bool failed_ = false;
+};
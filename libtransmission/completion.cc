@@ -156,6 +156,7 @@ void tr_completion::addBlock(tr_block_index_t block)
 
     blocks_.set(block);
     size_now_ += block_info_->blockSize(block);
+    addFileBytes(block, true);
 
     has_valid_.reset();
 }
@@ -168,6 +169,14 @@ void tr_completion::setBlocks(tr_bitfield blocks)
     size_now_ = countHasBytesInSpan({ 0, tr_block_index_t(std::size(blocks_)) });
     size_when_done_.reset();
     has_valid_.reset();
+    recountFileBytes();
+}
+
+void tr_completion::setFileOffsets(std::vector<uint64_t> file_offsets)
+{
+    file_offsets_ = std::move(file_offsets);
+    file_offsets_.push_back(block_info_->total_size);
+    recountFileBytes();
 }
 
 void tr_completion::addPiece(tr_piece_index_t piece)
@@ -185,6 +194,18 @@ void tr_completion::removePiece(tr_piece_index_t piece)
     auto const [begin, end] = block_info_->blockSpanForPiece(piece);
     size_now_ -= countHasBytesInSpan(block_info_->blockSpanForPiece(piece));
     has_valid_.reset();
+
+    if (!std::empty(file_bytes_))
+    {
+        for (tr_block_index_t block = begin; block < end; ++block)
+        {
+            if (hasBlock(block))
+            {
+                addFileBytes(block, false);
+            }
+        }
+    }
+
     blocks_.unsetSpan(begin, end);
 }
 
@@ -202,3 +223,88 @@ uint64_t tr_completion::countHasBytesInSpan(tr_block_span_t span) const
 
     return n;
 }
+
+/* add or remove a block's bytes from the counts of the files it overlaps */
+void tr_completion::addFileBytes(tr_block_index_t block, bool is_add)
+{
+    if (std::empty(file_bytes_))
+    {
+        return;
+    }
+
+    auto const block_begin = uint64_t{ block } * block_info_->block_size;
+    auto const block_end = block_begin + block_info_->blockSize(block);
+
+    // the last file that begins at or before this block does
+    auto const n_files = std::size(file_bytes_);
+    auto const it = std::upper_bound(std::begin(file_offsets_), std::begin(file_offsets_) + n_files, block_begin);
+    auto file = size_t(std::distance(std::begin(file_offsets_), it));
+    file = file > 0 ? file - 1 : 0;
+
+    for (; file < n_files && file_offsets_[file] < block_end; ++file)
+    {
+        auto const begin = std::max(block_begin, file_offsets_[file]);
+        auto const end = std::min(block_end, file_offsets_[file + 1]);
+
+        if (begin < end)
+        {
+            auto& bytes = file_bytes_[file];
+            bytes = is_add ? bytes + (end - begin) : bytes - std::min(bytes, end - begin);
+        }
+    }
+}
+
+void tr_completion::recountFileBytes()
+{
+    if (std::empty(file_offsets_))
+    {
+        return;
+    }
+
+    auto const n_files = std::size(file_offsets_) - 1;
+    file_bytes_.assign(n_files, 0);
+
+    if (!hasMetainfo() || blocks_.hasNone())
+    {
+        return;
+    }
+
+    for (size_t file = 0; file < n_files; ++file)
+    {
+        auto const file_begin = file_offsets_[file];
+        auto const file_end = file_offsets_[file + 1];
+
+        if (file_begin == file_end)
+        {
+            continue;
+        }
+
+        auto const begin = block_info_->blockOf(file_begin);
+        auto const end = block_info_->blockOf(file_end - 1) + 1;
+        auto total = uint64_t{};
+
+        // the first and last blocks may be shared with other files...
+        for (auto const block : { begin, end - 1 })
+        {
+            if (hasBlock(block))
+            {
+                auto const block_begin = uint64_t{ block } * block_info_->block_size;
+                auto const block_end = block_begin + block_info_->blockSize(block);
+                total += std::min(block_end, file_end) - std::max(block_begin, file_begin);
+            }
+
+            if (begin == end - 1)
+            {
+                break;
+            }
+        }
+
+        // ...but the ones in between are all this file's
+        if (end - begin > 2)
+        {
+            total += uint64_t{ blocks_.count(begin + 1, end - 1) } * block_info_->block_size;
+        }
+
+        file_bytes_[file] = total;
+    }
+}
@@ -65,6 +65,13 @@ struct tr_completion
         return !hasMetainfo() || blocks_.hasNone();
     }
 
+    /* @return how many bytes of the file we have. This is only known
+     * once setFileOffsets() has been called, and is 0 until then. */
+    [[nodiscard]] uint64_t fileBytesCompleted(tr_file_index_t file) const
+    {
+        return file < std::size(file_bytes_) ? file_bytes_[file] : 0;
+    }
+
     [[nodiscard]] bool hasPiece(tr_piece_index_t piece) const
     {
         return block_info_->piece_size != 0 && countMissingBlocksInPiece(piece) == 0;
@@ -125,6 +132,10 @@ struct tr_completion
 
     void setBlocks(tr_bitfield blocks);
 
+    /* Tells us where each file begins, in torrent order, so that we can
+     * keep count of how many bytes we have of each as blocks come and go. */
+    void setFileOffsets(std::vector<uint64_t> file_offsets);
+
     void invalidateSizeWhenDone()
     {
         size_when_done_.reset();
@@ -140,6 +151,9 @@ private:
     [[nodiscard]] uint64_t computeSizeWhenDone() const;
     [[nodiscard]] uint64_t countHasBytesInSpan(tr_block_span_t) const;
 
+    void addFileBytes(tr_block_index_t block, bool is_add);
+    void recountFileBytes();
+
     torrent_view const* tor_;
     tr_block_info const* block_info_;
 
@@ -155,4 +169,11 @@ private:
 
     // Number of bytes we have now. [0..sizeWhenDone]
     uint64_t size_now_ = 0;
+
+    // Where each file begins, followed by the torrent's total size
+    std::vector<uint64_t> file_offsets_;
+
+    // Number of bytes we have of each file, kept up to date as blocks are
+    // added and removed so that file progress doesn't need a bitfield scan
+    std::vector<uint64_t> file_bytes_;
 };
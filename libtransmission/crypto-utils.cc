@@ -6,9 +6,14 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cstdarg>
 #include <cstring> /* memcpy(), memmove(), memset(), strcmp(), strlen() */
+#include <numeric> /* std::accumulate() */
 #include <random> /* random_device, mt19937, uniform_int_distribution*/
+#include <thread>
+#include <vector>
 
 #include <arc4.h>
 
@@ -84,6 +89,155 @@ bool tr_sha1(uint8_t* hash, void const* data1, int data1_length, ...)
     return false;
 }
 
+static bool sha1One(uint8_t const* buf, size_t len, tr_sha1_digest_t* setme)
+{
+    tr_sha1_ctx_t sha = tr_sha1_init();
+
+    if (sha == nullptr)
+    {
+        return false;
+    }
+
+    if (!tr_sha1_update(sha, buf, len))
+    {
+        tr_sha1_final(sha, nullptr);
+        return false;
+    }
+
+    return tr_sha1_final(sha, reinterpret_cast<uint8_t*>(std::data(*setme)));
+}
+
+/* don't spin up a worker thread for less than this much data */
+static auto constexpr Sha1BatchMinBytesPerThread = size_t{ 1024 * 1024 };
+
+bool tr_sha1_batch(size_t n, uint8_t const* const* bufs, size_t const* lens, tr_sha1_digest_t* setme, size_t max_threads)
+{
+    if (max_threads == 0)
+    {
+        max_threads = std::thread::hardware_concurrency();
+    }
+
+    auto const total = std::accumulate(lens, lens + n, uint64_t{});
+    auto const n_threads = std::min({ uint64_t{ n }, uint64_t{ max_threads }, total / Sha1BatchMinBytesPerThread });
+
+    auto next = std::atomic<size_t>{ 0 };
+    auto ok = std::atomic<bool>{ true };
+    auto const hash_some = [&]()
+    {
+        for (size_t i = next++; i < n; i = next++)
+        {
+            if (!sha1One(bufs[i], lens[i], &setme[i]))
+            {
+                ok = false;
+            }
+        }
+    };
+
+    /* the calling thread does its share of the work too */
+    auto workers = std::vector<std::thread>{};
+    for (uint64_t i = 1; i < n_threads; ++i)
+    {
+        workers.emplace_back(hash_some);
+    }
+
+    hash_some();
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    return ok;
+}
+
+tr_sha1_workers::tr_sha1_workers(size_t n_threads)
+{
+    if (n_threads == 0)
+    {
+        n_threads = std::thread::hardware_concurrency();
+    }
+
+    n_threads = std::max(size_t{ 1 }, n_threads);
+
+    threads_.reserve(n_threads);
+    for (size_t i = 0; i < n_threads; ++i)
+    {
+        threads_.emplace_back([this]() { run(); });
+    }
+}
+
+tr_sha1_workers::~tr_sha1_workers()
+{
+    {
+        auto const lock = std::lock_guard(mutex_);
+        stopping_ = true;
+    }
+
+    work_cv_.notify_all();
+
+    for (auto& thread : threads_)
+    {
+        thread.join();
+    }
+}
+
+void tr_sha1_workers::start(size_t n, uint8_t const* const* bufs, size_t const* lens, tr_sha1_digest_t* setme)
+{
+    {
+        auto const lock = std::lock_guard(mutex_);
+        TR_ASSERT(n_done_ == n_);
+
+        bufs_ = bufs;
+        lens_ = lens;
+        setme_ = setme;
+        n_ = n;
+        next_ = 0;
+        n_done_ = 0;
+        ok_ = true;
+    }
+
+    work_cv_.notify_all();
+}
+
+bool tr_sha1_workers::wait()
+{
+    auto lock = std::unique_lock(mutex_);
+    done_cv_.wait(lock, [this]() { return n_done_ == n_; });
+    return ok_;
+}
+
+void tr_sha1_workers::run()
+{
+    auto lock = std::unique_lock(mutex_);
+
+    for (;;)
+    {
+        work_cv_.wait(lock, [this]() { return stopping_ || next_ < n_; });
+
+        if (stopping_)
+        {
+            return;
+        }
+
+        /* claim the next buffer, then hash it without holding the lock */
+        auto const i = next_++;
+        auto const* const buf = bufs_[i];
+        auto const len = lens_[i];
+        auto* const setme = &setme_[i];
+
+        lock.unlock();
+        auto const hashed = sha1One(buf, len, setme);
+        lock.lock();
+
+        ok_ = ok_ && hashed;
+
+        if (++n_done_ == n_)
+        {
+            done_cv_.notify_all();
+        }
+    }
+}
+
 /***
 ****
 ***/
@@ -10,10 +10,14 @@
 #define TR_CRYPTO_UTILS_H
 
 #include <cinttypes>
+#include <condition_variable>
 #include <cstddef>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 #include "transmission.h" /* SHA_DIGEST_LENGTH */
 #include "tr-macros.h"
@@ -58,6 +62,67 @@ bool tr_sha1_final(tr_sha1_ctx_t handle, uint8_t* setme);
 
 std::optional<tr_sha1_digest_t> tr_sha1_final(tr_sha1_ctx_t handle);
 
+/**
+ * @brief Generate SHA1 hashes of `n` independent buffers.
+ *
+ * Large batches are spread across worker threads, so this is the
+ * preferred way to hash many pieces at once.
+ *
+ * @param max_threads upper bound on the number of threads to use, or 0 for one per CPU core
+ */
+bool tr_sha1_batch(
+    size_t n,
+    uint8_t const* const* bufs,
+    size_t const* lens,
+    tr_sha1_digest_t* setme,
+    size_t max_threads = 0);
+
+/**
+ * @brief A fixed set of threads for hashing one batch of buffers after another.
+ *
+ * tr_sha1_batch() starts and joins its threads on every call. Callers
+ * that hash many batches, such as verify and torrent creation, start
+ * these workers once and hand them each batch in turn.
+ */
+class tr_sha1_workers
+{
+public:
+    /** @param n_threads how many threads to start, or 0 for one per CPU core */
+    explicit tr_sha1_workers(size_t n_threads = 0);
+    ~tr_sha1_workers();
+
+    tr_sha1_workers(tr_sha1_workers const&) = delete;
+    tr_sha1_workers& operator=(tr_sha1_workers const&) = delete;
+
+    /**
+     * @brief Start hashing `n` buffers into `setme`.
+     *
+     * The buffers must stay valid until wait() returns, and a new batch
+     * can't be started until then.
+     */
+    void start(size_t n, uint8_t const* const* bufs, size_t const* lens, tr_sha1_digest_t* setme);
+
+    /** @brief Wait for the batch to finish. Returns true if every buffer was hashed. */
+    bool wait();
+
+private:
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::vector<std::thread> threads_;
+
+    uint8_t const* const* bufs_ = nullptr;
+    size_t const* lens_ = nullptr;
+    tr_sha1_digest_t* setme_ = nullptr;
+    size_t n_ = 0;
+    size_t next_ = 0;
+    size_t n_done_ = 0;
+    bool ok_ = true;
+    bool stopping_ = false;
+};
+
 /**
  * @brief Allocate and initialize new Diffie-Hellman (DH) key exchange context.
  */
@@ -6,7 +6,13 @@
  *
  */
 
+#include <algorithm>
+#include <array>
+#include <condition_variable>
 #include <cstring> /* memcpy(), memmove(), memset() */
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <arc4.h>
 
@@ -40,15 +46,159 @@ static uint8_t const dh_G[] = { 2 };
 ***
 **/
 
+static tr_dh_ctx_t makeKey(uint8_t* setme_public_key)
+{
+    size_t public_key_length = 0;
+    tr_dh_ctx_t dh = tr_dh_new(dh_P, sizeof(dh_P), dh_G, sizeof(dh_G));
+    tr_dh_make_key(dh, DH_PRIVKEY_LEN, setme_public_key, &public_key_length);
+
+    TR_ASSERT(public_key_length == KEY_LEN);
+    return dh;
+}
+
+/**
+***  Generating a keypair is a modular exponentiation with the 768-bit
+***  MSE prime, which is slow enough to show up in handshake latency when
+***  many peers connect at once. Keep a pool of keypairs that a background
+***  thread tops up so that handshakes on the event thread rarely wait.
+**/
+
+namespace
+{
+
+class DhKeyPool
+{
+public:
+    DhKeyPool()
+        : thread_{ &DhKeyPool::refillLoop, this }
+    {
+    }
+
+    ~DhKeyPool()
+    {
+        {
+            auto const lock = std::lock_guard(mutex_);
+            is_closing_ = true;
+        }
+
+        cv_.notify_one();
+        thread_.join();
+
+        for (auto& key : keys_)
+        {
+            tr_dh_free(key.dh);
+        }
+    }
+
+    DhKeyPool(DhKeyPool const&) = delete;
+    DhKeyPool& operator=(DhKeyPool const&) = delete;
+
+    // returns nullptr if the pool is empty
+    tr_dh_ctx_t take(uint8_t* setme_public_key)
+    {
+        auto lock = std::unique_lock(mutex_);
+
+        if (std::empty(keys_))
+        {
+            return nullptr;
+        }
+
+        auto const key = keys_.back();
+        keys_.pop_back();
+        lock.unlock();
+
+        cv_.notify_one();
+        std::copy(std::begin(key.public_key), std::end(key.public_key), setme_public_key);
+        return key.dh;
+    }
+
+private:
+    static auto constexpr TargetSize = size_t{ 32 };
+
+    struct Key
+    {
+        tr_dh_ctx_t dh;
+        std::array<uint8_t, KEY_LEN> public_key;
+    };
+
+    void refillLoop()
+    {
+        auto lock = std::unique_lock(mutex_);
+
+        for (;;)
+        {
+            cv_.wait(lock, [this]() { return is_closing_ || std::size(keys_) < TargetSize; });
+
+            if (is_closing_)
+            {
+                break;
+            }
+
+            lock.unlock();
+            auto key = Key{};
+            key.dh = makeKey(std::data(key.public_key));
+            lock.lock();
+
+            keys_.push_back(key);
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Key> keys_;
+    bool is_closing_ = false;
+    std::thread thread_;
+};
+
+/* guards pool and pool_count */
+std::mutex pool_mutex;
+DhKeyPool* pool = nullptr;
+int pool_count = 0;
+
+} // namespace
+
+void tr_cryptoStartKeyPool(void)
+{
+    auto const lock = std::lock_guard(pool_mutex);
+
+    if (pool_count++ == 0)
+    {
+        pool = new DhKeyPool{};
+    }
+}
+
+void tr_cryptoStopKeyPool(void)
+{
+    auto const lock = std::lock_guard(pool_mutex);
+
+    TR_ASSERT(pool_count > 0);
+
+    if (--pool_count == 0)
+    {
+        delete pool;
+        pool = nullptr;
+    }
+}
+
 static void ensureKeyExists(tr_crypto* crypto)
 {
-    if (crypto->dh == nullptr)
+    if (crypto->dh != nullptr)
     {
-        size_t public_key_length = 0;
-        crypto->dh = tr_dh_new(dh_P, sizeof(dh_P), dh_G, sizeof(dh_G));
-        tr_dh_make_key(crypto->dh, DH_PRIVKEY_LEN, crypto->myPublicKey, &public_key_length);
+        return;
+    }
 
-        TR_ASSERT(public_key_length == KEY_LEN);
+    {
+        auto const lock = std::lock_guard(pool_mutex);
+
+        if (pool != nullptr)
+        {
+            crypto->dh = pool->take(crypto->myPublicKey);
+        }
+    }
+
+    if (crypto->dh == nullptr)
+    {
+        crypto->dh = makeKey(crypto->myPublicKey);
     }
 }
 
@@ -42,6 +42,11 @@ struct tr_crypto
     bool torrentHashIsSet;
 };
 
+/* Start and stop the pool of pregenerated DH keys. These nest, so each
+ * session can start its own. Without a running pool, keys are made on demand. */
+void tr_cryptoStartKeyPool(void);
+void tr_cryptoStopKeyPool(void);
+
 /** @brief construct a new tr_crypto object */
 void tr_cryptoConstruct(tr_crypto* crypto, uint8_t const* torrentHash, bool isIncoming);
 
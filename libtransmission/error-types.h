@@ -21,6 +21,7 @@
 #define TR_ERROR_IS_ENOSPC(code) ((code) == ERROR_DISK_FULL)
 
 #define TR_ERROR_EINVAL ERROR_INVALID_PARAMETER
+#define TR_ERROR_EIO ERROR_WRITE_FAULT
 #define TR_ERROR_EISDIR ERROR_DIRECTORY_NOT_SUPPORTED
 
 #else /* _WIN32 */
@@ -31,6 +32,7 @@
 #define TR_ERROR_IS_ENOSPC(code) ((code) == ENOSPC)
 
 #define TR_ERROR_EINVAL EINVAL
+#define TR_ERROR_EIO EIO
 #define TR_ERROR_EISDIR EISDIR
 
 #endif /* _WIN32 */
@@ -7,7 +7,9 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <cstring> /* strcmp(), strlen(), strncmp() */
 
 #include <event2/buffer.h>
@@ -118,6 +120,7 @@ struct tr_handshake
     uint32_t crypto_select;
     uint32_t crypto_provide;
     uint8_t myReq1[SHA_DIGEST_LENGTH];
+    uint64_t startedAt;
     struct event* timeout_timer;
 
     std::optional<tr_peer_id_t> peer_id;
@@ -141,6 +144,62 @@ struct tr_handshake
         } \
     } while (0)
 
+/**
+***  Latency histograms
+**/
+
+namespace
+{
+
+class LatencyHistogram
+{
+public:
+    void add(uint64_t value)
+    {
+        size_t bucket = 0;
+
+        while (value > 0 && bucket + 1 < TR_HANDSHAKE_HISTOGRAM_BUCKETS)
+        {
+            value >>= 1;
+            ++bucket;
+        }
+
+        ++buckets_[bucket];
+    }
+
+    auto get() const
+    {
+        auto ret = std::array<uint32_t, TR_HANDSHAKE_HISTOGRAM_BUCKETS>{};
+        std::copy(std::begin(buckets_), std::end(buckets_), std::begin(ret));
+        return ret;
+    }
+
+private:
+    std::array<std::atomic<uint32_t>, TR_HANDSHAKE_HISTOGRAM_BUCKETS> buckets_ = {};
+};
+
+LatencyHistogram connect_latency;
+LatencyHistogram dh_latency;
+
+} // namespace
+
+tr_handshake_latency tr_handshakeGetLatency()
+{
+    auto ret = tr_handshake_latency{};
+    ret.connect_msec = connect_latency.get();
+    ret.dh_usec = dh_latency.get();
+    return ret;
+}
+
+static bool computeSecret(tr_handshake* handshake, uint8_t const* peer_public_key)
+{
+    auto const begin = std::chrono::steady_clock::now();
+    bool const ok = tr_cryptoComputeSecret(handshake->crypto, peer_public_key);
+    auto const elapsed = std::chrono::steady_clock::now() - begin;
+    dh_latency.add(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    return ok;
+}
+
 static char const* getStateName(handshake_state_t const state)
 {
     static char const* const state_strings[N_STATES] = {
@@ -402,7 +461,7 @@ static ReadState readYb(tr_handshake* handshake, struct evbuffer* inbuf)
     /* compute the secret */
     evbuffer_remove(inbuf, yb, KEY_LEN);
 
-    if (!tr_cryptoComputeSecret(handshake->crypto, yb))
+    if (!computeSecret(handshake, yb))
     {
         return tr_handshakeDone(handshake, false);
     }
@@ -721,7 +780,7 @@ static ReadState readYa(tr_handshake* handshake, struct evbuffer* inbuf)
     uint8_t ya[KEY_LEN];
     evbuffer_remove(inbuf, ya, KEY_LEN);
 
-    if (!tr_cryptoComputeSecret(handshake->crypto, ya))
+    if (!computeSecret(handshake, ya))
     {
         return tr_handshakeDone(handshake, false);
     }
@@ -1096,6 +1155,12 @@ static void tr_handshakeFree(tr_handshake* handshake)
 static ReadState tr_handshakeDone(tr_handshake* handshake, bool isOK)
 {
     dbgmsg(handshake, "handshakeDone: %s", isOK ? "connected" : "aborting");
+
+    if (isOK)
+    {
+        connect_latency.add(tr_time_msec() - handshake->startedAt);
+    }
+
     tr_peerIoSetIOFuncs(handshake->io, nullptr, nullptr, nullptr, nullptr);
 
     bool const success = fireDoneFunc(handshake, isOK);
@@ -1185,6 +1250,7 @@ tr_handshake* tr_handshakeNew(
     handshake->done_func = done_func;
     handshake->done_func_user_data = done_func_user_data;
     handshake->session = session;
+    handshake->startedAt = tr_time_msec();
     handshake->timeout_timer = evtimer_new(session->event_base, handshakeTimeout, handshake);
     tr_timerAdd(handshake->timeout_timer, HANDSHAKE_TIMEOUT_SEC, 0);
 
@@ -12,6 +12,8 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <array>
+#include <cstdint>
 #include <optional>
 
 #include "transmission.h"
@@ -52,4 +54,20 @@ void tr_handshakeAbort(tr_handshake* handshake);
 
 tr_peerIo* tr_handshakeStealIO(tr_handshake* handshake);
 
+/* Bucket 0 counts samples under 1 unit, bucket i counts samples in
+   [2^(i-1), 2^i), and the last bucket counts everything larger. */
+auto inline constexpr TR_HANDSHAKE_HISTOGRAM_BUCKETS = size_t{ 16 };
+
+/** @brief handshake latency histograms, shared by every session in the process */
+struct tr_handshake_latency
+{
+    /* time from tr_handshakeNew() to a successful connection, in msec */
+    std::array<uint32_t, TR_HANDSHAKE_HISTOGRAM_BUCKETS> connect_msec;
+
+    /* time spent computing the DH shared secret, in usec */
+    std::array<uint32_t, TR_HANDSHAKE_HISTOGRAM_BUCKETS> dh_usec;
+};
+
+tr_handshake_latency tr_handshakeGetLatency();
+
 /** @} */
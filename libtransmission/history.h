@@ -12,8 +12,11 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <algorithm> // std::min, std::max
 #include <array>
+#include <atomic>
 #include <cstddef> // size_t
+#include <cstdint> // uint64_t
 #include <ctime> // time_t
 #include <numeric> // std::accumulate
 
@@ -70,3 +73,133 @@ private:
 
     std::array<slice_t, TR_RECENT_HISTORY_PERIOD_SEC> slices = {};
 };
+
+/**
+ * Measures a transfer rate over the last WindowMSec msec, like
+ * Bandwidth's old RateControl did, so that N bytes per second reads
+ * as N and an idle meter reads zero once the window has passed.
+ *
+ * Bytes are counted in slots of TickMSec msec. Each slot is one atomic
+ * that packs the tick it belongs to with the bytes counted in it, so
+ * adding is a single compare-and-swap and reading sums a fixed number
+ * of slots. Neither waits for other threads, so meters can be read
+ * from any thread without a lock.
+ */
+class tr_rateMeter
+{
+public:
+    /* how far back the rate looks */
+    static auto constexpr WindowMSec = uint64_t{ 2000 };
+
+    /* how finely bytes are bucketed in time */
+    static auto constexpr TickMSec = uint64_t{ 200 };
+
+    /**
+     * @brief count bytes that were just transferred.
+     * @param now_msec the current time in msec, such as from tr_time_msec()
+     */
+    void add(uint64_t now_msec, uint64_t n_bytes)
+    {
+        auto const tick = tickSinceBase(now_msec);
+        auto& slot = slots_[tick % NumSlots];
+        auto packed = slot.load(std::memory_order_acquire);
+
+        for (;;)
+        {
+            auto const slot_tick = tickOf(packed);
+
+            /* the slot has moved on to a newer tick, so these bytes are already out of the window */
+            if (slot_tick > tick)
+            {
+                return;
+            }
+
+            auto const base_bytes = slot_tick == tick ? uint64_t{ bytesOf(packed) } : uint64_t{ 0 };
+            auto const sum = std::min(base_bytes + n_bytes, uint64_t{ UINT32_MAX });
+            if (slot.compare_exchange_weak(packed, pack(tick, uint32_t(sum)), std::memory_order_acq_rel))
+            {
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief get the average rate over the last WindowMSec msec, in bytes per second.
+     * @param now_msec the current time in msec, such as from tr_time_msec()
+     */
+    [[nodiscard]] unsigned int rate(uint64_t now_msec) const
+    {
+        auto const base = base_tick_.load(std::memory_order_acquire);
+        if (base == NoBase)
+        {
+            return 0;
+        }
+
+        /* count the current tick and the ones before it that are still in the window */
+        auto const now_tick = toTick(now_msec, base);
+        auto const oldest = now_tick >= NumSlots - 1 ? now_tick - (NumSlots - 1) : 0;
+        auto bytes = uint64_t{};
+
+        for (auto const& slot : slots_)
+        {
+            auto const packed = slot.load(std::memory_order_acquire);
+            auto const tick = tickOf(packed);
+
+            if (oldest <= tick && tick <= now_tick)
+            {
+                bytes += bytesOf(packed);
+            }
+        }
+
+        return static_cast<unsigned int>(bytes * 1000U / WindowMSec);
+    }
+
+private:
+    static auto constexpr NumSlots = uint32_t{ WindowMSec / TickMSec };
+
+    static auto constexpr NoBase = ~uint64_t{ 0 };
+
+    /* Packing a tick into 32 bits can't hold `now_msec / TickMSec' for
+     * real epoch times, so ticks are counted from the first add() instead.
+     * That leaves room for about 27 years of ticks. */
+    static uint32_t toTick(uint64_t now_msec, uint64_t base)
+    {
+        auto const tick = now_msec / TickMSec;
+
+        /* an older `now' than the base's goes in with the first tick */
+        return tick > base ? static_cast<uint32_t>(std::min(tick - base, uint64_t{ UINT32_MAX })) : 0;
+    }
+
+    uint32_t tickSinceBase(uint64_t now_msec)
+    {
+        auto base = base_tick_.load(std::memory_order_acquire);
+
+        if (base == NoBase && base_tick_.compare_exchange_strong(base, now_msec / TickMSec, std::memory_order_acq_rel))
+        {
+            base = now_msec / TickMSec;
+        }
+
+        return toTick(now_msec, base);
+    }
+
+    /* Each slot packs a tick, relative to `base_tick_', into its high
+     * 32 bits and the bytes counted during that tick into its low 32 bits. */
+
+    static constexpr uint64_t pack(uint32_t tick, uint32_t bytes)
+    {
+        return (uint64_t{ tick } << 32) | bytes;
+    }
+
+    static constexpr uint32_t tickOf(uint64_t packed)
+    {
+        return static_cast<uint32_t>(packed >> 32);
+    }
+
+    static constexpr uint32_t bytesOf(uint64_t packed)
+    {
+        return static_cast<uint32_t>(packed);
+    }
+
+    std::atomic<uint64_t> base_tick_{ NoBase };
+    std::array<std::atomic<uint64_t>, NumSlots> slots_ = {};
+};
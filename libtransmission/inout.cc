@@ -8,8 +8,8 @@
 
 #include <algorithm>
 #include <cerrno>
-#include <cstdlib> /* bsearch() */
 #include <cstring> /* memcmp() */
+#include <iterator> /* std::prev() */
 #include <optional>
 #include <vector>
 
@@ -150,24 +150,6 @@ static int readOrWriteBytes(
     return err;
 }
 
-static int compareOffsetToFile(void const* a, void const* b)
-{
-    auto const offset = *static_cast<uint64_t const*>(a);
-    auto const* file = static_cast<tr_file const*>(b);
-
-    if (offset < file->offset)
-    {
-        return -1;
-    }
-
-    if (offset >= file->offset + file->length)
-    {
-        return 1;
-    }
-
-    return 0;
-}
-
 void tr_ioFindFileLocation(
     tr_torrent const* tor,
     tr_piece_index_t pieceIndex,
@@ -177,21 +159,33 @@ void tr_ioFindFileLocation(
 {
     TR_ASSERT(tr_isTorrent(tor));
 
+    auto const& info = tor->info;
     uint64_t const offset = tr_pieceOffset(tor, pieceIndex, pieceOffset, 0);
-    TR_ASSERT(offset < tor->info.totalSize);
+    TR_ASSERT(offset < info.totalSize);
 
-    auto const* file = static_cast<tr_file const*>(
-        bsearch(&offset, tor->info.files, tor->info.fileCount, sizeof(tr_file), compareOffsetToFile));
-    TR_ASSERT(file != nullptr);
+    auto index = tr_file_index_t{ 0 };
 
-    if (file != nullptr)
+    if (info.fileCount > 1)
     {
-        *fileIndex = file - tor->info.files;
-        *fileOffset = offset - file->offset;
-        TR_ASSERT(*fileIndex < tor->info.fileCount);
-        TR_ASSERT(*fileOffset < file->length);
-        TR_ASSERT(tor->info.files[*fileIndex].offset + *fileOffset == offset);
+        // only the files between this piece's first file and the next
+        // piece's first file can hold `offset', so search just those
+        auto const* const begin = info.files + tor->pieceFirstFile(pieceIndex);
+        auto const* const end = pieceIndex + 1 < info.pieceCount ? info.files + tor->pieceFirstFile(pieceIndex + 1) + 1 :
+                                                                   info.files + info.fileCount;
+        auto const* const it = std::upper_bound(
+            begin,
+            end,
+            offset,
+            [](uint64_t o, tr_file const& file) { return o < file.offset; });
+        TR_ASSERT(it != begin);
+        index = tr_file_index_t(std::prev(it) - info.files);
     }
+
+    *fileIndex = index;
+    *fileOffset = offset - info.files[index].offset;
+    TR_ASSERT(*fileIndex < info.fileCount);
+    TR_ASSERT(*fileOffset < info.files[index].length);
+    TR_ASSERT(info.files[*fileIndex].offset + *fileOffset == offset);
 }
 
 /* returns 0 on success, or an errno on failure */
@@ -287,5 +281,6 @@ static std::optional<tr_sha1_digest_t> recalculateHash(tr_torrent* tor, tr_piece
 bool tr_ioTestPiece(tr_torrent* tor, tr_piece_index_t piece)
 {
     auto const hash = recalculateHash(tor, piece);
-    return hash && *hash == tor->pieceHash(piece);
+    auto const expected = tor->pieceHash(piece);
+    return hash && expected && *hash == *expected;
 }
@@ -6,11 +6,20 @@
  *
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
+#include <cstring>
 #include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
 
-#include <event2/buffer.h>
+#include <event2/util.h>
 
 #include "transmission.h"
 #include "file.h"
@@ -18,9 +27,11 @@
 #include "tr-assert.h"
 #include "utils.h"
 
-tr_log_level __tr_message_level = TR_LOG_ERROR;
+using namespace std::literals;
 
-static bool myQueueEnabled = false;
+std::atomic<tr_log_level> __tr_message_level{ TR_LOG_ERROR };
+
+static std::atomic<bool> myQueueEnabled{ false };
 static tr_log_message* myQueue = nullptr;
 static tr_log_message** myQueueTail = &myQueue;
 static int myQueueLength = 0;
@@ -39,46 +50,36 @@ static inline bool IsDebuggerPresent(void)
 ****
 ***/
 
-tr_log_level tr_logGetLevel(void)
+void tr_logSetLevel(tr_log_level level)
 {
-    return __tr_message_level;
+    __tr_message_level.store(level, std::memory_order_relaxed);
 }
 
-/***
-****
-***/
-
-static std::recursive_mutex message_mutex_;
-
 tr_sys_file_t tr_logGetFile(void)
 {
-    static bool initialized = false;
-    static tr_sys_file_t file = TR_BAD_SYS_FILE;
-
-    if (!initialized)
+    static auto const file = []()
     {
-        int const fd = tr_env_get_int("TR_DEBUG_FD", 0);
-
-        switch (fd)
+        switch (tr_env_get_int("TR_DEBUG_FD", 0))
         {
         case 1:
-            file = tr_sys_file_get_std(TR_STD_SYS_FILE_OUT, nullptr);
-            break;
+            return tr_sys_file_get_std(TR_STD_SYS_FILE_OUT, nullptr);
 
         case 2:
-            file = tr_sys_file_get_std(TR_STD_SYS_FILE_ERR, nullptr);
-            break;
-        }
+            return tr_sys_file_get_std(TR_STD_SYS_FILE_ERR, nullptr);
 
-        initialized = true;
-    }
+        default:
+            return TR_BAD_SYS_FILE;
+        }
+    }();
 
     return file;
 }
 
-void tr_logSetLevel(tr_log_level level)
+/* If TR_LOG_JSON is set, log lines are written as JSON objects, one per line */
+static bool tr_logGetJsonEnabled(void)
 {
-    __tr_message_level = level;
+    static auto const enabled = tr_env_get_int("TR_LOG_JSON", 0) != 0;
+    return enabled;
 }
 
 void tr_logSetQueueEnabled(bool isEnabled)
@@ -91,40 +92,14 @@ bool tr_logGetQueueEnabled(void)
     return myQueueEnabled;
 }
 
-tr_log_message* tr_logGetQueue(void)
-{
-    auto const lock = std::lock_guard(message_mutex_);
-
-    auto* const ret = myQueue;
-    myQueue = nullptr;
-    myQueueTail = &myQueue;
-    myQueueLength = 0;
-
-    return ret;
-}
-
-void tr_logFreeQueue(tr_log_message* list)
-{
-    while (list != nullptr)
-    {
-        tr_log_message* next = list->next;
-        tr_free(list->message);
-        tr_free(list->name);
-        tr_free(list);
-        list = next;
-    }
-}
-
 /**
 ***
 **/
 
-char* tr_logGetTimeStr(char* buf, size_t buflen)
+static char* tr_logFormatTime(struct timeval const* tv, char* buf, size_t buflen)
 {
-    struct timeval tv;
-    tr_gettimeofday(&tv);
-    time_t const seconds = tv.tv_sec;
-    int const milliseconds = (int)(tv.tv_usec / 1000);
+    time_t const seconds = tv->tv_sec;
+    int const milliseconds = (int)(tv->tv_usec / 1000);
     char msec_str[8];
     tr_snprintf(msec_str, sizeof msec_str, "%03d", milliseconds);
 
@@ -137,150 +112,590 @@ char* tr_logGetTimeStr(char* buf, size_t buflen)
     return buf;
 }
 
+char* tr_logGetTimeStr(char* buf, size_t buflen)
+{
+    struct timeval tv;
+    tr_gettimeofday(&tv);
+    return tr_logFormatTime(&tv, buf, buflen);
+}
+
 bool tr_logGetDeepEnabled(void)
 {
-    static int8_t deepLoggingIsActive = -1;
+    static auto const deepLoggingIsActive = IsDebuggerPresent() || tr_logGetFile() != TR_BAD_SYS_FILE;
+    return deepLoggingIsActive;
+}
+
+/***
+****  The message ring
+***/
+
+namespace
+{
+
+struct LogEntry
+{
+    tr_log_level level;
+
+    /* true if this came from tr_logAddDeep(), false if from tr_logAddMessage() */
+    bool deep;
+
+    bool has_name;
 
-    if (deepLoggingIsActive < 0)
+    struct timeval when;
+
+    char const* file;
+
+    int line;
+
+    size_t message_len;
+
+    std::array<char, 512> name;
+
+    std::array<char, 1024> message;
+};
+
+/* A bounded multi-producer queue. Producers claim a cell with a single
+ * compare-and-swap and publish it by bumping the cell's sequence number,
+ * so logging threads never block on each other. There's one consumer at
+ * a time, serialized by consumer_mutex below. */
+class LogRing
+{
+public:
+    static auto constexpr Capacity = size_t{ 256 }; /* must be a power of two */
+
+    LogRing()
     {
-        deepLoggingIsActive = (int8_t)(IsDebuggerPresent() || tr_logGetFile() != TR_BAD_SYS_FILE);
+        for (size_t i = 0; i < Capacity; ++i)
+        {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
     }
 
-    return deepLoggingIsActive != 0;
+    /* Returns a cell to fill in and then publish(), or nullptr if the ring is full */
+    LogEntry* claim(size_t* setme_pos)
+    {
+        auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            auto& cell = cells_[pos & (Capacity - 1)];
+            auto const seq = cell.sequence.load(std::memory_order_acquire);
+            auto const diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+            if (diff == 0)
+            {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    *setme_pos = pos;
+                    return &cell.entry;
+                }
+            }
+            else if (diff < 0)
+            {
+                return nullptr;
+            }
+            else
+            {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void publish(size_t pos)
+    {
+        cells_[pos & (Capacity - 1)].sequence.store(pos + 1);
+    }
+
+    /* Returns the oldest published entry, or nullptr if there isn't one.
+     * Only call this while holding consumer_mutex. */
+    LogEntry* front()
+    {
+        auto& cell = cells_[dequeue_pos_ & (Capacity - 1)];
+        return cell.sequence.load(std::memory_order_acquire) == dequeue_pos_ + 1 ? &cell.entry : nullptr;
+    }
+
+    void pop()
+    {
+        cells_[dequeue_pos_ & (Capacity - 1)].sequence.store(dequeue_pos_ + Capacity, std::memory_order_release);
+        ++dequeue_pos_;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        LogEntry entry;
+    };
+
+    std::array<Cell, Capacity> cells_;
+    std::atomic<size_t> enqueue_pos_ = {};
+    size_t dequeue_pos_ = 0;
+};
+
+LogRing& getRing()
+{
+    static auto* const ring = new LogRing{};
+    return *ring;
 }
 
-void tr_logAddDeep(char const* file, int line, char const* name, char const* fmt, ...)
+/* messages lost because the ring was full */
+std::atomic<size_t> dropped_count = {};
+
+/* serializes the consumers: the writer thread, tr_logFlush() and tr_logGetQueue().
+ * Also guards myQueue. */
+std::mutex consumer_mutex;
+
+/* the writer thread */
+std::mutex writer_mutex;
+std::mutex wake_mutex;
+std::condition_variable wake;
+std::atomic<bool> wake_pending = {}; /* set by producers, cleared by the writer before each drain */
+std::thread writer;
+std::atomic<bool> writer_running = {};
+bool writer_stop = false;
+int writer_count = 0;
+
+char const* getBaseName(char const* file)
+{
+    for (char const* it = file; *it != '\0'; ++it)
+    {
+        if (*it == '/' || *it == '\\')
+        {
+            file = it + 1;
+        }
+    }
+
+    return file;
+}
+
+char const* getLevelName(LogEntry const& entry)
 {
-    tr_sys_file_t const fp = tr_logGetFile();
+    if (entry.deep)
+    {
+        return "deep";
+    }
 
-    if (fp != TR_BAD_SYS_FILE || IsDebuggerPresent())
+    switch (entry.level)
     {
-        struct evbuffer* buf = evbuffer_new();
-        char* base = tr_sys_path_basename(file, nullptr);
+    case TR_LOG_ERROR:
+        return "error";
+
+    case TR_LOG_INFO:
+        return "info";
+
+    default:
+        return "debug";
+    }
+}
 
-        char timestr[64];
-        evbuffer_add_printf(buf, "[%s] ", tr_logGetTimeStr(timestr, sizeof(timestr)));
+void appendJsonString(std::string& out, std::string_view str)
+{
+    out += '"';
 
-        if (name != nullptr)
+    for (auto const ch : str)
+    {
+        switch (ch)
         {
-            evbuffer_add_printf(buf, "%s ", name);
+        case '"':
+            out += "\\\""sv;
+            break;
+
+        case '\\':
+            out += "\\\\"sv;
+            break;
+
+        case '\n':
+            out += "\\n"sv;
+            break;
+
+        case '\r':
+            out += "\\r"sv;
+            break;
+
+        case '\t':
+            out += "\\t"sv;
+            break;
+
+        default:
+            if (static_cast<unsigned char>(ch) < 0x20)
+            {
+                char buf[8];
+                tr_snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(ch));
+                out += buf;
+            }
+            else
+            {
+                out += ch;
+            }
+
+            break;
         }
+    }
 
-        va_list args;
-        va_start(args, fmt);
-        evbuffer_add_vprintf(buf, fmt, args);
-        va_end(args);
-        evbuffer_add_printf(buf, " (%s:%d)" TR_NATIVE_EOL_STR, base, line);
+    out += '"';
+}
 
-        size_t message_len = 0;
-        char* const message = evbuffer_free_to_str(buf, &message_len);
+void appendLine(std::string& out, LogEntry const& entry)
+{
+    auto const message = std::string_view{ std::data(entry.message), entry.message_len };
+    char timestr[64];
+    tr_logFormatTime(&entry.when, timestr, sizeof(timestr));
 
-#ifdef _WIN32
-        OutputDebugStringA(message);
-#endif
+    if (tr_logGetJsonEnabled())
+    {
+        out += "{\"time\":"sv;
+        appendJsonString(out, timestr);
+        out += ",\"level\":"sv;
+        appendJsonString(out, getLevelName(entry));
 
-        if (fp != TR_BAD_SYS_FILE)
+        if (entry.has_name)
         {
-            tr_sys_file_write(fp, message, message_len, nullptr, nullptr);
+            out += ",\"name\":"sv;
+            appendJsonString(out, std::data(entry.name));
         }
 
-        tr_free(message);
-        tr_free(base);
+        out += ",\"message\":"sv;
+        appendJsonString(out, message);
+        out += ",\"file\":"sv;
+        appendJsonString(out, getBaseName(entry.file));
+        out += ",\"line\":"sv;
+        out += std::to_string(entry.line);
+        out += "}" TR_NATIVE_EOL_STR ""sv;
+        return;
+    }
+
+    out += '[';
+    out += timestr;
+    out += "] "sv;
+
+    if (entry.has_name)
+    {
+        out += std::data(entry.name);
+        out += entry.deep ? " "sv : ": "sv;
+    }
+
+    out += message;
+
+    if (entry.deep)
+    {
+        out += " ("sv;
+        out += getBaseName(entry.file);
+        out += ':';
+        out += std::to_string(entry.line);
+        out += ')';
+    }
+
+    out += TR_NATIVE_EOL_STR ""sv;
+}
+
+void enqueueMessage(LogEntry const& entry)
+{
+    auto* const newmsg = tr_new0(tr_log_message, 1);
+    newmsg->level = entry.level;
+    newmsg->when = entry.when.tv_sec;
+    newmsg->message = tr_strndup(std::data(entry.message), entry.message_len);
+    newmsg->file = entry.file;
+    newmsg->line = entry.line;
+    newmsg->name = entry.has_name ? tr_strdup(std::data(entry.name)) : nullptr;
+
+    *myQueueTail = newmsg;
+    myQueueTail = &newmsg->next;
+    ++myQueueLength;
+
+    if (myQueueLength > TR_LOG_MAX_QUEUE_LENGTH)
+    {
+        tr_log_message* old = myQueue;
+        myQueue = old->next;
+        old->next = nullptr;
+        tr_logFreeQueue(old);
+        --myQueueLength;
+        TR_ASSERT(myQueueLength == TR_LOG_MAX_QUEUE_LENGTH);
     }
 }
 
-/***
-****
-***/
+/* Routes a message to the message queue or appends it to `out` */
+void consume(std::string& out, LogEntry const& entry)
+{
+    if (entry.message_len == 0)
+    {
+        return;
+    }
 
-void tr_logAddMessage(char const* file, int line, tr_log_level level, char const* name, char const* fmt, ...)
+    if (entry.deep)
+    {
+        if (tr_logGetFile() != TR_BAD_SYS_FILE)
+        {
+            appendLine(out, entry);
+        }
+    }
+    else if (tr_logGetQueueEnabled())
+    {
+        enqueueMessage(entry);
+    }
+    else
+    {
+        appendLine(out, entry);
+    }
+}
+
+/* Consumes every published message. The caller must hold consumer_mutex. */
+void drainLocked()
 {
-    int const err = errno; /* message logging shouldn't affect errno */
-    char buf[1024];
-    va_list ap;
+    auto& ring = getRing();
+    auto out = std::string{};
 
-    auto const lock = std::lock_guard(message_mutex_);
+    for (LogEntry* entry = ring.front(); entry != nullptr; entry = ring.front())
+    {
+        consume(out, *entry);
+        ring.pop();
+    }
 
-    /* build the text message */
-    *buf = '\0';
-    va_start(ap, fmt);
-    int const buf_len = evutil_vsnprintf(buf, sizeof(buf), fmt, ap);
-    va_end(ap);
+    if (auto const dropped = dropped_count.exchange(0); dropped != 0)
+    {
+        auto entry = LogEntry{};
+        entry.level = TR_LOG_ERROR;
+        tr_gettimeofday(&entry.when);
+        entry.file = __FILE__;
+        entry.line = __LINE__;
+        int const len = tr_snprintf(
+            std::data(entry.message),
+            std::size(entry.message),
+            "%zu log messages were dropped because the log couldn't keep up",
+            dropped);
+        entry.message_len = len > 0 ? size_t(len) : 0;
+        consume(out, entry);
+    }
 
-    if (buf_len < 0)
+    if (!std::empty(out))
     {
-        goto FINISH;
+        tr_sys_file_t fp = tr_logGetFile();
+
+        if (fp == TR_BAD_SYS_FILE)
+        {
+            fp = tr_sys_file_get_std(TR_STD_SYS_FILE_ERR, nullptr);
+        }
+
+        tr_sys_file_write(fp, std::data(out), std::size(out), nullptr, nullptr);
+        tr_sys_file_flush(fp, nullptr);
     }
+}
 
-#ifdef _WIN32
+void writerMain()
+{
+    auto lock = std::unique_lock(wake_mutex);
 
-    if ((size_t)buf_len < sizeof(buf) - 3)
+    for (;;)
     {
-        buf[buf_len + 0] = '\r';
-        buf[buf_len + 1] = '\n';
-        buf[buf_len + 2] = '\0';
-        OutputDebugStringA(buf);
-        buf[buf_len + 0] = '\0';
+        wake.wait(lock, []() { return writer_stop || wake_pending; });
+
+        if (writer_stop)
+        {
+            break;
+        }
+
+        /* clear the flag before draining so that anything published
+         * while we're busy wakes us up again */
+        wake_pending.exchange(false);
+        lock.unlock();
+
+        {
+            auto const consumer_lock = std::lock_guard(consumer_mutex);
+            drainLocked();
+        }
+
+        lock.lock();
     }
-    else
+}
+
+void addEntry(char const* file, int line, tr_log_level level, bool deep, char const* name, char const* fmt, va_list args)
+    TR_GNUC_PRINTF(6, 0);
+
+void addEntry(char const* file, int line, tr_log_level level, bool deep, char const* name, char const* fmt, va_list args)
+{
+    auto& ring = getRing();
+    auto pos = size_t{};
+    auto* const entry = ring.claim(&pos);
+
+    /* if the ring is full, count the message so that the next drain can
+     * report it. Whoever published the messages in the ring has already
+     * made sure they'll be drained. */
+    if (entry == nullptr)
     {
-        OutputDebugStringA(buf);
+        ++dropped_count;
+        return;
+    }
+
+    entry->level = level;
+    entry->deep = deep;
+    entry->file = file;
+    entry->line = line;
+    tr_gettimeofday(&entry->when);
+
+    entry->has_name = name != nullptr;
+    if (entry->has_name)
+    {
+        tr_strlcpy(std::data(entry->name), name, std::size(entry->name));
+    }
+
+    int const len = evutil_vsnprintf(std::data(entry->message), std::size(entry->message), fmt, args);
+    entry->message_len = len > 0 ? std::min(size_t(len), std::size(entry->message) - 1) : 0;
+
+#ifdef _WIN32
+
+    if (entry->message_len != 0)
+    {
+        OutputDebugStringA(std::data(entry->message));
+        OutputDebugStringA(TR_NATIVE_EOL_STR);
     }
 
 #endif
 
-    if (!tr_str_is_empty(buf))
+    ring.publish(pos);
+
+    if (writer_running)
     {
-        if (tr_logGetQueueEnabled())
+        /* only the first producer since the last drain needs to wake the writer.
+         * Taking wake_mutex ensures the writer is either asleep or hasn't yet
+         * checked wake_pending, so the notification can't be missed. */
+        if (!wake_pending.exchange(true))
         {
-            auto* const newmsg = tr_new0(tr_log_message, 1);
-            newmsg->level = level;
-            newmsg->when = tr_time();
-            newmsg->message = tr_strndup(buf, buf_len);
-            newmsg->file = file;
-            newmsg->line = line;
-            newmsg->name = tr_strdup(name);
-
-            *myQueueTail = newmsg;
-            myQueueTail = &newmsg->next;
-            ++myQueueLength;
-
-            if (myQueueLength > TR_LOG_MAX_QUEUE_LENGTH)
-            {
-                tr_log_message* old = myQueue;
-                myQueue = old->next;
-                old->next = nullptr;
-                tr_logFreeQueue(old);
-                --myQueueLength;
-                TR_ASSERT(myQueueLength == TR_LOG_MAX_QUEUE_LENGTH);
-            }
+            auto const wake_lock = std::lock_guard(wake_mutex);
+            wake.notify_one();
         }
-        else
+    }
+    else
+    {
+        auto const lock = std::lock_guard(consumer_mutex);
+        drainLocked();
+    }
+}
+
+} // namespace
+
+void tr_logStartWriter(void)
+{
+    auto const lock = std::lock_guard(writer_mutex);
+
+    if (writer_count++ == 0)
+    {
+        writer_stop = false;
+        writer = std::thread(writerMain);
+        writer_running = true;
+    }
+}
+
+void tr_logStopWriter(void)
+{
+    auto const lock = std::lock_guard(writer_mutex);
+
+    TR_ASSERT(writer_count > 0);
+
+    if (--writer_count == 0)
+    {
+        /* from here on, producers write their own messages */
+        writer_running = false;
+
         {
-            char timestr[64];
+            auto const wake_lock = std::lock_guard(wake_mutex);
+            writer_stop = true;
+        }
 
-            tr_sys_file_t fp = tr_logGetFile();
+        wake.notify_one();
+        writer.join();
+        tr_logFlush();
+    }
+}
 
-            if (fp == TR_BAD_SYS_FILE)
-            {
-                fp = tr_sys_file_get_std(TR_STD_SYS_FILE_ERR, nullptr);
-            }
+void tr_logFlush(void)
+{
+    auto const lock = std::lock_guard(consumer_mutex);
+    drainLocked();
+}
 
-            tr_logGetTimeStr(timestr, sizeof(timestr));
+tr_log_message* tr_logGetQueue(void)
+{
+    auto const lock = std::lock_guard(consumer_mutex);
 
-            if (name != nullptr)
-            {
-                tr_sys_file_write_fmt(fp, "[%s] %s: %s" TR_NATIVE_EOL_STR, nullptr, timestr, name, buf);
-            }
-            else
-            {
-                tr_sys_file_write_fmt(fp, "[%s] %s" TR_NATIVE_EOL_STR, nullptr, timestr, buf);
-            }
+    drainLocked();
+
+    auto* const ret = myQueue;
+    myQueue = nullptr;
+    myQueueTail = &myQueue;
+    myQueueLength = 0;
+
+    return ret;
+}
+
+void tr_logFreeQueue(tr_log_message* list)
+{
+    while (list != nullptr)
+    {
+        tr_log_message* next = list->next;
+        tr_free(list->message);
+        tr_free(list->name);
+        tr_free(list);
+        list = next;
+    }
+}
+
+bool tr_log_call_site::allow(char const* file, int line, tr_log_level level, char const* name)
+{
+    if (level <= TR_LOG_ERROR)
+    {
+        return true;
+    }
+
+    /* The counters are updated without a lock, so the limit is approximate
+     * when several threads log from the same call site at once. */
+    auto const now = time(nullptr);
+
+    if (second_.load(std::memory_order_relaxed) != now)
+    {
+        second_.store(now, std::memory_order_relaxed);
+        count_.store(0, std::memory_order_relaxed);
 
-            tr_sys_file_flush(fp, nullptr);
+        if (auto const suppressed = suppressed_.exchange(0, std::memory_order_relaxed); suppressed != 0)
+        {
+            tr_logAddMessage(file, line, level, name, "(%d similar messages were suppressed)", suppressed);
         }
     }
 
-FINISH:
+    if (count_.fetch_add(1, std::memory_order_relaxed) < MaxPerSecond)
+    {
+        return true;
+    }
+
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+/***
+****
+***/
+
+void tr_logAddDeep(char const* file, int line, char const* name, char const* fmt, ...)
+{
+    if (tr_logGetFile() != TR_BAD_SYS_FILE || IsDebuggerPresent())
+    {
+        int const err = errno; /* message logging shouldn't affect errno */
+
+        va_list args;
+        va_start(args, fmt);
+        addEntry(file, line, TR_LOG_DEBUG, true, name, fmt, args);
+        va_end(args);
+
+        errno = err;
+    }
+}
+
+void tr_logAddMessage(char const* file, int line, tr_log_level level, char const* name, char const* fmt, ...)
+{
+    int const err = errno; /* message logging shouldn't affect errno */
+
+    va_list args;
+    va_start(args, fmt);
+    addEntry(file, line, level, false, name, fmt, args);
+    va_end(args);
+
     errno = err;
 }
@@ -9,28 +9,69 @@
 #pragma once
 
 #include <stddef.h> /* size_t */
+#include <atomic>
+#include <ctime> // time_t
 
 #include "file.h" /* tr_sys_file_t */
 #include "tr-macros.h"
 
 #define TR_LOG_MAX_QUEUE_LENGTH 10000
 
-tr_log_level tr_logGetLevel(void);
+extern std::atomic<tr_log_level> __tr_message_level;
+
+static inline tr_log_level tr_logGetLevel(void)
+{
+    return __tr_message_level.load(std::memory_order_relaxed);
+}
 
 static inline bool tr_logLevelIsActive(tr_log_level level)
 {
     return tr_logGetLevel() >= level;
 }
 
+/* Messages are formatted by the caller and handed to a lock-free queue.
+ * While a session is open, a writer thread drains it to the log file or
+ * the message queue, so logging never waits on disk. Otherwise, the caller
+ * writes the message itself. If the queue fills up, messages are dropped
+ * and the writer reports how many were lost. */
 void tr_logAddMessage(char const* file, int line, tr_log_level level, char const* torrent, char const* fmt, ...)
     TR_GNUC_PRINTF(5, 6);
 
+/* Start and stop the writer thread. These nest, so each session can
+ * start its own. Stopping the last writer flushes any pending messages. */
+void tr_logStartWriter(void);
+void tr_logStopWriter(void);
+
+/* Wait until every message logged so far has been written out. */
+void tr_logFlush(void);
+
+/* Limits how many messages a single tr_logAdd*() call site can log per
+ * second, so that a chatty code path can't flood the log. The number of
+ * messages suppressed is reported once the call site may log again.
+ * Errors are never suppressed. */
+class tr_log_call_site
+{
+public:
+    static auto constexpr MaxPerSecond = int{ 50 };
+
+    bool allow(char const* file, int line, tr_log_level level, char const* name);
+
+private:
+    std::atomic<time_t> second_ = {};
+    std::atomic<int> count_ = {};
+    std::atomic<int> suppressed_ = {};
+};
+
 #define tr_logAddNamed(level, name, ...) \
     do \
     { \
         if (tr_logLevelIsActive(level)) \
         { \
-            tr_logAddMessage(__FILE__, __LINE__, level, name, __VA_ARGS__); \
+            static auto tr_log_site = tr_log_call_site{}; \
+            if (tr_log_site.allow(__FILE__, __LINE__, level, name)) \
+            { \
+                tr_logAddMessage(__FILE__, __LINE__, level, name, __VA_ARGS__); \
+            } \
         } \
     } while (0)
 
@@ -50,6 +91,9 @@ void tr_logAddMessage(char const* file, int line, tr_log_level level, char const
 #define tr_logAddInfo(...) tr_logAdd(TR_LOG_INFO, __VA_ARGS__)
 #define tr_logAddDebug(...) tr_logAdd(TR_LOG_DEBUG, __VA_ARGS__)
 
+/* Deep logging goes to stdout if the TR_DEBUG_FD environment variable
+ * is 1, or to stderr if it's 2. If TR_LOG_JSON is set to a nonzero value,
+ * log lines are written as JSON objects, one per line. */
 tr_sys_file_t tr_logGetFile(void);
 
 /** @brief return true if deep logging has been enabled by the user, false otherwise */
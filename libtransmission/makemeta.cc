@@ -7,16 +7,20 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <cerrno>
 #include <cstdlib> /* qsort */
 #include <cstring> /* strcmp, strlen */
 #include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
 
 #include <event2/util.h> /* evutil_ascii_strcasecmp() */
 
 #include "transmission.h"
 
-#include "crypto-utils.h" /* tr_sha1 */
+#include "crypto-utils.h" /* tr_sha1_workers */
 #include "error.h"
 #include "file.h"
 #include "log.h"
@@ -251,101 +255,162 @@ void tr_metaInfoBuilderFree(tr_metainfo_builder* builder)
 *****
 ****/
 
-static uint8_t* getHashInfo(tr_metainfo_builder* b)
+/* How much file data to read in for each batch of pieces handed to the hashers.
+ * Two batches are in flight at once, one being read and one being hashed. */
+static auto constexpr HashBatchBytes = size_t{ 1024 * 1024 * 32 };
+
+struct HashReader
 {
+    tr_sys_file_t fd = TR_BAD_SYS_FILE;
     uint32_t fileIndex = 0;
-    uint8_t* ret = tr_new0(uint8_t, SHA_DIGEST_LENGTH * b->pieceCount);
-    uint8_t* walk = ret;
     uint64_t off = 0;
-    tr_error* error = nullptr;
+    uint64_t totalRemain = 0;
+};
 
-    if (b->totalSize == 0)
-    {
-        return ret;
-    }
+struct HashBatch
+{
+    std::vector<uint8_t> buf;
+    std::vector<uint8_t const*> pieces;
+    std::vector<size_t> lens;
+};
 
-    auto* const buf = static_cast<uint8_t*>(tr_malloc(b->pieceSize));
-    b->pieceIndex = 0;
-    uint64_t totalRemain = b->totalSize;
+/* read up to `max_pieces` pieces into consecutive slots of `batch` */
+static bool readHashBatch(tr_metainfo_builder* b, HashReader& r, HashBatch& batch, size_t max_pieces)
+{
+    batch.pieces.clear();
+    batch.lens.clear();
 
-    tr_sys_file_t fd = tr_sys_file_open(b->files[fileIndex].filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
-    if (fd == TR_BAD_SYS_FILE)
-    {
-        b->my_errno = error->code;
-        tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
-        b->result = TR_MAKEMETA_IO_READ;
-        tr_free(buf);
-        tr_free(ret);
-        tr_error_free(error);
-        return nullptr;
-    }
+    uint8_t* bufptr = std::data(batch.buf);
 
-    while (totalRemain != 0)
+    while (r.totalRemain != 0 && std::size(batch.pieces) < max_pieces)
     {
-        TR_ASSERT(b->pieceIndex < b->pieceCount);
-
-        uint8_t* bufptr = buf;
-        uint32_t const thisPieceSize = std::min(uint64_t{ b->pieceSize }, totalRemain);
+        uint8_t const* const piece = bufptr;
+        uint32_t const thisPieceSize = std::min(uint64_t{ b->pieceSize }, r.totalRemain);
         uint64_t leftInPiece = thisPieceSize;
 
         while (leftInPiece != 0)
         {
-            uint64_t const n_this_pass = std::min(b->files[fileIndex].size - off, leftInPiece);
+            if (r.fd == TR_BAD_SYS_FILE)
+            {
+                tr_error* error = nullptr;
+                r.fd = tr_sys_file_open(b->files[r.fileIndex].filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
+
+                if (r.fd == TR_BAD_SYS_FILE)
+                {
+                    b->my_errno = error->code;
+                    tr_strlcpy(b->errfile, b->files[r.fileIndex].filename, sizeof(b->errfile));
+                    b->result = TR_MAKEMETA_IO_READ;
+                    tr_error_free(error);
+                    return false;
+                }
+            }
+
+            uint64_t const n_this_pass = std::min(b->files[r.fileIndex].size - r.off, leftInPiece);
             uint64_t n_read = 0;
-            (void)tr_sys_file_read(fd, bufptr, n_this_pass, &n_read, nullptr);
+            (void)tr_sys_file_read(r.fd, bufptr, n_this_pass, &n_read, nullptr);
             bufptr += n_read;
-            off += n_read;
+            r.off += n_read;
             leftInPiece -= n_read;
 
-            if (off == b->files[fileIndex].size)
+            if (r.off == b->files[r.fileIndex].size)
             {
-                off = 0;
-                tr_sys_file_close(fd, nullptr);
-                fd = TR_BAD_SYS_FILE;
-
-                if (++fileIndex < b->fileCount)
-                {
-                    fd = tr_sys_file_open(b->files[fileIndex].filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
-
-                    if (fd == TR_BAD_SYS_FILE)
-                    {
-                        b->my_errno = error->code;
-                        tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
-                        b->result = TR_MAKEMETA_IO_READ;
-                        tr_free(buf);
-                        tr_free(ret);
-                        tr_error_free(error);
-                        return nullptr;
-                    }
-                }
+                r.off = 0;
+                tr_sys_file_close(r.fd, nullptr);
+                r.fd = TR_BAD_SYS_FILE;
+                ++r.fileIndex;
             }
         }
 
-        TR_ASSERT(bufptr - buf == (int)thisPieceSize);
-        TR_ASSERT(leftInPiece == 0);
-        tr_sha1(walk, buf, (int)thisPieceSize, nullptr);
-        walk += SHA_DIGEST_LENGTH;
+        TR_ASSERT(bufptr - piece == (int)thisPieceSize);
+        batch.pieces.push_back(piece);
+        batch.lens.push_back(thisPieceSize);
+        r.totalRemain -= thisPieceSize;
+    }
+
+    return true;
+}
+
+/* Reading and hashing are pipelined: while one batch of pieces is being
+ * hashed by the workers, the next batch is read into a second buffer. */
+static std::optional<std::vector<tr_sha1_digest_t>> getHashInfo(tr_metainfo_builder* b)
+{
+    auto hashes = std::vector<tr_sha1_digest_t>(b->pieceCount);
+
+    b->pieceIndex = 0;
+
+    if (b->totalSize == 0)
+    {
+        return hashes;
+    }
+
+    /* a piece can be bigger than a batch, so always allow at least one.
+     * Small torrents don't need a whole batch, and any more hashers than
+     * there are pieces in a batch would just sit idle. */
+    size_t const max_pieces = std::min(std::max(size_t{ 1 }, HashBatchBytes / b->pieceSize), size_t{ b->pieceCount });
+    size_t const n_threads = std::min(
+        max_pieces,
+        size_t{ b->hashThreadCount != 0 ? b->hashThreadCount : std::thread::hardware_concurrency() });
+    auto batches = std::array<HashBatch, 2>{};
+    for (auto& batch : batches)
+    {
+        batch.buf.resize(std::min(uint64_t{ max_pieces * b->pieceSize }, b->totalSize));
+    }
+
+    /* started once and reused for every batch */
+    auto workers = tr_sha1_workers{ n_threads };
+
+    auto reader = HashReader{};
+    reader.totalRemain = b->totalSize;
+
+    bool ok = readHashBatch(b, reader, batches[0], max_pieces);
+
+    for (size_t cur = 0; ok && !std::empty(batches[cur].pieces); cur = 1 - cur)
+    {
+        TR_ASSERT(b->pieceIndex < b->pieceCount);
+
+        auto const& batch = batches[cur];
+        workers.start(std::size(batch.pieces), std::data(batch.pieces), std::data(batch.lens), &hashes[b->pieceIndex]);
+
+        ok = readHashBatch(b, reader, batches[1 - cur], max_pieces);
+
+        auto const hashed = workers.wait();
+
+        if (ok && !hashed)
+        {
+            b->my_errno = EIO;
+            tr_strlcpy(b->errfile, b->top, sizeof(b->errfile));
+            b->result = TR_MAKEMETA_IO_READ;
+            ok = false;
+        }
+
+        if (!ok)
+        {
+            break;
+        }
+
+        b->pieceIndex += std::size(batch.pieces);
 
         if (b->abortFlag)
         {
             b->result = TR_MAKEMETA_CANCELLED;
             break;
         }
-
-        totalRemain -= thisPieceSize;
-        ++b->pieceIndex;
     }
 
-    TR_ASSERT(b->abortFlag || walk - ret == (int)(SHA_DIGEST_LENGTH * b->pieceCount));
-    TR_ASSERT(b->abortFlag || !totalRemain);
+    TR_ASSERT(!ok || b->abortFlag || b->pieceIndex == b->pieceCount);
+    TR_ASSERT(!ok || b->abortFlag || reader.totalRemain == 0);
 
-    if (fd != TR_BAD_SYS_FILE)
+    if (reader.fd != TR_BAD_SYS_FILE)
     {
-        tr_sys_file_close(fd, nullptr);
+        tr_sys_file_close(reader.fd, nullptr);
     }
 
-    tr_free(buf);
-    return ret;
+    if (!ok)
+    {
+        return {};
+    }
+
+    return hashes;
 }
 
 static void getFileInfo(
@@ -409,11 +474,10 @@ static void makeInfoDict(tr_variant* dict, tr_metainfo_builder* builder)
 
     tr_variantDictAddInt(dict, TR_KEY_piece_length, builder->pieceSize);
 
-    uint8_t* const pch = getHashInfo(builder);
-    if (pch != nullptr)
+    auto const hashes = getHashInfo(builder);
+    if (hashes)
     {
-        tr_variantDictAddRaw(dict, TR_KEY_pieces, pch, SHA_DIGEST_LENGTH * builder->pieceCount);
-        tr_free(pch);
+        tr_variantDictAddRaw(dict, TR_KEY_pieces, std::data(*hashes), std::size(*hashes) * sizeof(tr_sha1_digest_t));
     }
 
     tr_variantDictAddInt(dict, TR_KEY_private, builder->isPrivate ? 1 : 0);
@@ -41,6 +41,10 @@ struct tr_metainfo_builder
     uint32_t pieceCount;
     bool isFolder;
 
+    /* how many threads to hash pieces with, or 0 for one per CPU core.
+       The client may change this before calling tr_makeMetaInfo(). */
+    uint32_t hashThreadCount;
+
     /**
     ***  These are set inside tr_makeMetaInfo()
     ***  by copying the arguments passed to it,
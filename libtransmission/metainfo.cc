@@ -10,11 +10,13 @@
 #include <array>
 #include <cstring>
 #include <iterator>
+#include <optional>
 #include <string_view>
 #include <vector>
 
 #include "transmission.h"
 
+#include "benc.h"
 #include "crypto-utils.h" /* tr_sha1 */
 #include "error.h"
 #include "error-types.h"
@@ -110,28 +112,385 @@ bool tr_metainfoAppendSanitizedPathComponent(std::string& out, std::string_view
     return std::size(out) > original_out_len;
 }
 
-static bool getfile(char** setme, bool* is_adjusted, std::string_view root, tr_variant* path, std::string& buf)
+/***
+****  Pulling the fields we need out of the bencoded metainfo
+***/
+
+namespace
+{
+
+struct PathField
+{
+    bool found = false; // true if the key was present and its value was a list
+    bool valid = true; // false if any of its components wasn't a string
+    std::vector<std::string_view> components;
+};
+
+struct FileFields
+{
+    bool is_dict = false;
+    std::optional<int64_t> length;
+    PathField path;
+    PathField path_utf8;
+};
+
+struct InfoFields
+{
+    std::string_view raw; // the bencoded info dict, for the info-hash
+    std::optional<std::string_view> name;
+    std::optional<std::string_view> name_utf8;
+    std::optional<std::string_view> source;
+    std::optional<std::string_view> pieces;
+    std::optional<int64_t> is_private;
+    std::optional<int64_t> piece_length;
+    std::optional<int64_t> length;
+    bool has_files = false; // true if "files" was present and was a list
+    std::vector<FileFields> files;
+};
+
+struct MagnetFields
+{
+    std::optional<std::string_view> info_hash;
+    std::optional<std::string_view> display_name;
+};
+
+struct MetainfoFields
+{
+    std::optional<InfoFields> info;
+    std::optional<MagnetFields> magnet_info;
+    std::optional<std::string_view> comment;
+    std::optional<std::string_view> comment_utf8;
+    std::optional<std::string_view> created_by;
+    std::optional<std::string_view> created_by_utf8;
+    std::optional<std::string_view> source;
+    std::optional<std::string_view> announce;
+    std::optional<int64_t> creation_date;
+    std::optional<int64_t> is_private;
+    std::optional<std::vector<std::vector<std::string_view>>> announce_list;
+    std::optional<std::vector<std::string_view>> url_list;
+};
+
+} // namespace
+
+static tr_quark readKey(tr_benc_reader& reader, bool* has_key)
+{
+    auto key = std::string_view{};
+    *has_key = reader.nextKey(&key);
+    if (!*has_key)
+    {
+        return TR_KEY_NONE;
+    }
+
+    return tr_quark_lookup(key).value_or(TR_KEY_NONE);
+}
+
+static void readOptionalStr(tr_benc_reader& reader, std::optional<std::string_view>* setme)
+{
+    if (auto sv = std::string_view{}; reader.readStr(&sv))
+    {
+        *setme = sv;
+    }
+}
+
+static void readOptionalInt(tr_benc_reader& reader, std::optional<int64_t>* setme)
+{
+    if (auto i = int64_t{}; reader.readInt(&i))
+    {
+        *setme = i;
+    }
+}
+
+static void readPath(tr_benc_reader& reader, PathField* path)
+{
+    if (!reader.enterList())
+    {
+        return;
+    }
+
+    path->found = true;
+
+    while (reader.hasNextItem())
+    {
+        if (auto sv = std::string_view{}; reader.readStr(&sv))
+        {
+            path->components.push_back(sv);
+        }
+        else
+        {
+            path->valid = false;
+        }
+    }
+}
+
+static void readFiles(tr_benc_reader& reader, InfoFields* info)
+{
+    if (!reader.enterList())
+    {
+        return;
+    }
+
+    info->has_files = true;
+
+    while (reader.hasNextItem())
+    {
+        auto& file = info->files.emplace_back();
+        file.is_dict = reader.enterDict();
+        if (!file.is_dict)
+        {
+            continue;
+        }
+
+        for (bool has_key = true; has_key;)
+        {
+            switch (readKey(reader, &has_key))
+            {
+            case TR_KEY_length:
+                readOptionalInt(reader, &file.length);
+                break;
+
+            case TR_KEY_path:
+                readPath(reader, &file.path);
+                break;
+
+            case TR_KEY_path_utf_8:
+                readPath(reader, &file.path_utf8);
+                break;
+
+            default:
+                if (has_key)
+                {
+                    reader.skipValue();
+                }
+                break;
+            }
+        }
+    }
+}
+
+static void readInfo(tr_benc_reader& reader, InfoFields* info)
+{
+    for (bool has_key = true; has_key;)
+    {
+        switch (readKey(reader, &has_key))
+        {
+        case TR_KEY_name:
+            readOptionalStr(reader, &info->name);
+            break;
+
+        case TR_KEY_name_utf_8:
+            readOptionalStr(reader, &info->name_utf8);
+            break;
+
+        case TR_KEY_source:
+            readOptionalStr(reader, &info->source);
+            break;
+
+        case TR_KEY_pieces:
+            readOptionalStr(reader, &info->pieces);
+            break;
+
+        case TR_KEY_private:
+            readOptionalInt(reader, &info->is_private);
+            break;
+
+        case TR_KEY_piece_length:
+            readOptionalInt(reader, &info->piece_length);
+            break;
+
+        case TR_KEY_length:
+            readOptionalInt(reader, &info->length);
+            break;
+
+        case TR_KEY_files:
+            readFiles(reader, info);
+            break;
+
+        default:
+            if (has_key)
+            {
+                reader.skipValue();
+            }
+            break;
+        }
+    }
+}
+
+static void readMagnetInfo(tr_benc_reader& reader, MagnetFields* magnet)
+{
+    for (bool has_key = true; has_key;)
+    {
+        switch (readKey(reader, &has_key))
+        {
+        case TR_KEY_info_hash:
+            readOptionalStr(reader, &magnet->info_hash);
+            break;
+
+        case TR_KEY_display_name:
+            readOptionalStr(reader, &magnet->display_name);
+            break;
+
+        default:
+            if (has_key)
+            {
+                reader.skipValue();
+            }
+            break;
+        }
+    }
+}
+
+static void readAnnounceList(tr_benc_reader& reader, std::optional<std::vector<std::vector<std::string_view>>>* setme)
+{
+    if (!reader.enterList())
+    {
+        return;
+    }
+
+    auto& tiers = setme->emplace();
+
+    while (reader.hasNextItem())
+    {
+        auto& tier = tiers.emplace_back();
+        if (!reader.enterList())
+        {
+            continue;
+        }
+
+        while (reader.hasNextItem())
+        {
+            if (auto url = std::string_view{}; reader.readStr(&url))
+            {
+                tier.push_back(url);
+            }
+        }
+    }
+}
+
+static void readUrlList(tr_benc_reader& reader, std::optional<std::vector<std::string_view>>* setme)
+{
+    auto const token = reader.next();
+
+    if (token == TR_BENC_TOKEN_STR) /* handle single items in webseeds */
+    {
+        setme->emplace().push_back(reader.strValue());
+    }
+    else if (token == TR_BENC_TOKEN_LIST)
+    {
+        auto& urls = setme->emplace();
+
+        while (reader.hasNextItem())
+        {
+            if (auto url = std::string_view{}; reader.readStr(&url))
+            {
+                urls.push_back(url);
+            }
+        }
+    }
+    else if (token == TR_BENC_TOKEN_DICT)
+    {
+        reader.skipContainer();
+    }
+}
+
+static bool readMetainfo(std::string_view benc, MetainfoFields* meta)
+{
+    auto reader = tr_benc_reader{ benc };
+    if (!reader.enterDict())
+    {
+        return false;
+    }
+
+    for (bool has_key = true; has_key;)
+    {
+        switch (readKey(reader, &has_key))
+        {
+        case TR_KEY_info:
+            {
+                auto const* const begin = reader.pos();
+                auto info = InfoFields{};
+                if (reader.enterDict())
+                {
+                    readInfo(reader, &info);
+                    info.raw = std::string_view{ begin, size_t(reader.pos() - begin) };
+                    meta->info = std::move(info);
+                }
+                break;
+            }
+
+        case TR_KEY_magnet_info:
+            if (reader.enterDict())
+            {
+                readMagnetInfo(reader, &meta->magnet_info.emplace());
+            }
+            break;
+
+        case TR_KEY_comment:
+            readOptionalStr(reader, &meta->comment);
+            break;
+
+        case TR_KEY_comment_utf_8:
+            readOptionalStr(reader, &meta->comment_utf8);
+            break;
+
+        case TR_KEY_created_by:
+            readOptionalStr(reader, &meta->created_by);
+            break;
+
+        case TR_KEY_created_by_utf_8:
+            readOptionalStr(reader, &meta->created_by_utf8);
+            break;
+
+        case TR_KEY_creation_date:
+            readOptionalInt(reader, &meta->creation_date);
+            break;
+
+        case TR_KEY_private:
+            readOptionalInt(reader, &meta->is_private);
+            break;
+
+        case TR_KEY_source:
+            readOptionalStr(reader, &meta->source);
+            break;
+
+        case TR_KEY_announce:
+            readOptionalStr(reader, &meta->announce);
+            break;
+
+        case TR_KEY_announce_list:
+            readAnnounceList(reader, &meta->announce_list);
+            break;
+
+        case TR_KEY_url_list:
+            readUrlList(reader, &meta->url_list);
+            break;
+
+        default:
+            if (has_key)
+            {
+                reader.skipValue();
+            }
+            break;
+        }
+    }
+
+    return !reader.failed();
+}
+
+static bool getfile(char** setme, bool* is_adjusted, std::string_view root, PathField const& path, std::string& buf)
 {
     bool success = false;
 
     *setme = nullptr;
     *is_adjusted = false;
 
-    if (tr_variantIsList(path))
+    if (path.found && path.valid)
     {
         success = true;
 
         buf = root;
 
-        for (int i = 0, n = tr_variantListSize(path); i < n; i++)
+        for (auto const raw : path.components)
         {
-            auto raw = std::string_view{};
-            if (!tr_variantGetStrView(tr_variantListChild(path, i), &raw))
-            {
-                success = false;
-                break;
-            }
-
             auto is_component_adjusted = bool{};
             auto const pos = std::size(buf);
             if (!tr_metainfoAppendSanitizedPathComponent(buf, raw, &is_component_adjusted))
@@ -159,9 +518,8 @@ static bool getfile(char** setme, bool* is_adjusted, std::string_view root, tr_v
     return success;
 }
 
-static char const* parseFiles(tr_info* inf, tr_variant* files, tr_variant const* length)
+static char const* parseFiles(tr_info* inf, InfoFields const& info)
 {
-    int64_t len = 0;
     inf->totalSize = 0;
 
     bool is_root_adjusted = false;
@@ -173,27 +531,27 @@ static char const* parseFiles(tr_info* inf, tr_variant* files, tr_variant const*
 
     char const* errstr = nullptr;
 
-    if (tr_variantIsList(files)) /* multi-file mode */
+    if (info.has_files) /* multi-file mode */
     {
         auto buf = std::string{};
         errstr = nullptr;
 
         inf->isFolder = true;
-        inf->fileCount = tr_variantListSize(files);
+        inf->fileCount = std::size(info.files);
         inf->files = tr_new0(tr_file, inf->fileCount);
 
         for (tr_file_index_t i = 0; i < inf->fileCount; i++)
         {
-            auto* const file = tr_variantListChild(files, i);
+            auto const& file = info.files[i];
 
-            if (!tr_variantIsDict(file))
+            if (!file.is_dict)
             {
                 errstr = "files";
                 break;
             }
 
-            tr_variant* path = nullptr;
-            if (!tr_variantDictFindList(file, TR_KEY_path_utf_8, &path) && !tr_variantDictFindList(file, TR_KEY_path, &path))
+            auto const& path = file.path_utf8.found ? file.path_utf8 : file.path;
+            if (!path.found)
             {
                 errstr = "path";
                 break;
@@ -206,26 +564,26 @@ static char const* parseFiles(tr_info* inf, tr_variant* files, tr_variant const*
                 break;
             }
 
-            if (!tr_variantDictFindInt(file, TR_KEY_length, &len))
+            if (!file.length)
             {
                 errstr = "length";
                 break;
             }
 
-            inf->files[i].length = len;
+            inf->files[i].length = *file.length;
             inf->files[i].is_renamed = is_root_adjusted || is_file_adjusted;
-            inf->totalSize += len;
+            inf->totalSize += *file.length;
         }
     }
-    else if (tr_variantGetInt(length, &len)) /* single-file mode */
+    else if (info.length) /* single-file mode */
     {
         inf->isFolder = false;
         inf->fileCount = 1;
         inf->files = tr_new0(tr_file, 1);
         inf->files[0].name = tr_strndup(root_name.c_str(), std::size(root_name));
-        inf->files[0].length = len;
+        inf->files[0].length = *info.length;
         inf->files[0].is_renamed = is_root_adjusted;
-        inf->totalSize += len;
+        inf->totalSize += *info.length;
     }
     else
     {
@@ -271,50 +629,43 @@ static char* tr_convertAnnounceToScrape(std::string_view url)
     return scrape;
 }
 
-static char const* getannounce(tr_info* inf, tr_variant* meta)
+static char const* getannounce(tr_info* inf, MetainfoFields const& meta)
 {
     tr_tracker_info* trackers = nullptr;
     int trackerCount = 0;
-    auto url = std::string_view{};
 
     /* Announce-list */
-    tr_variant* tiers = nullptr;
-    if (tr_variantDictFindList(meta, TR_KEY_announce_list, &tiers))
+    if (meta.announce_list)
     {
-        int const numTiers = tr_variantListSize(tiers);
-        int n = 0;
+        auto const& tiers = *meta.announce_list;
+        auto n = size_t{};
 
-        for (int i = 0; i < numTiers; i++)
+        for (auto const& tier : tiers)
         {
-            n += tr_variantListSize(tr_variantListChild(tiers, i));
+            n += std::size(tier);
         }
 
         trackers = tr_new0(tr_tracker_info, n);
 
         int validTiers = 0;
-        for (int i = 0; i < numTiers; ++i)
+        for (auto const& tier : tiers)
         {
-            tr_variant* tier = tr_variantListChild(tiers, i);
-            int const tierSize = tr_variantListSize(tier);
             bool anyAdded = false;
 
-            for (int j = 0; j < tierSize; j++)
+            for (auto url : tier)
             {
-                if (tr_variantGetStrView(tr_variantListChild(tier, j), &url))
+                url = tr_strvStrip(url);
+
+                if (tr_urlIsValidTracker(url))
                 {
-                    url = tr_strvStrip(url);
-
-                    if (tr_urlIsValidTracker(url))
-                    {
-                        tr_tracker_info* t = trackers + trackerCount;
-                        t->tier = validTiers;
-                        t->announce = tr_strvDup(url);
-                        t->scrape = tr_convertAnnounceToScrape(url);
-                        t->id = trackerCount;
-
-                        anyAdded = true;
-                        ++trackerCount;
-                    }
+                    tr_tracker_info* t = trackers + trackerCount;
+                    t->tier = validTiers;
+                    t->announce = tr_strvDup(url);
+                    t->scrape = tr_convertAnnounceToScrape(url);
+                    t->id = trackerCount;
+
+                    anyAdded = true;
+                    ++trackerCount;
                 }
             }
 
@@ -333,9 +684,9 @@ static char const* getannounce(tr_info* inf, tr_variant* meta)
     }
 
     /* Regular announce value */
-    if (trackerCount == 0 && tr_variantDictFindStrView(meta, TR_KEY_announce, &url))
+    if (trackerCount == 0 && meta.announce)
     {
-        url = tr_strvStrip(url);
+        auto const url = tr_strvStrip(*meta.announce);
 
         if (tr_urlIsValidTracker(url))
         {
@@ -382,38 +733,24 @@ static char* fix_webseed_url(tr_info const* inf, std::string_view url)
     return tr_strvDup(url);
 }
 
-static void geturllist(tr_info* inf, tr_variant* meta)
+static void geturllist(tr_info* inf, MetainfoFields const& meta)
 {
-    tr_variant* urls = nullptr;
-    auto url = std::string_view{};
-
-    if (tr_variantDictFindList(meta, TR_KEY_url_list, &urls))
+    if (!meta.url_list)
     {
-        int const n = tr_variantListSize(urls);
+        return;
+    }
 
-        inf->webseedCount = 0;
-        inf->webseeds = tr_new0(char*, n);
+    auto const& urls = *meta.url_list;
 
-        for (int i = 0; i < n; i++)
-        {
-            if (tr_variantGetStrView(tr_variantListChild(urls, i), &url))
-            {
-                char* const fixed_url = fix_webseed_url(inf, url);
-                if (fixed_url != nullptr)
-                {
-                    inf->webseeds[inf->webseedCount++] = fixed_url;
-                }
-            }
-        }
-    }
-    else if (tr_variantDictFindStrView(meta, TR_KEY_url_list, &url)) /* handle single items in webseeds */
+    inf->webseedCount = 0;
+    inf->webseeds = tr_new0(char*, std::size(urls));
+
+    for (auto const url : urls)
     {
         char* const fixed_url = fix_webseed_url(inf, url);
         if (fixed_url != nullptr)
         {
-            inf->webseedCount = 1;
-            inf->webseeds = tr_new0(char*, 1);
-            inf->webseeds[0] = fixed_url;
+            inf->webseeds[inf->webseedCount++] = fixed_url;
         }
     }
 }
@@ -422,31 +759,37 @@ static char const* tr_metainfoParseImpl(
     tr_session const* session,
     tr_info* inf,
     std::vector<tr_sha1_digest_t>* pieces,
+    uint64_t* pieces_offset,
     uint64_t* infoDictLength,
-    tr_variant const* meta_in)
+    std::string_view benc)
 {
-    int64_t i = 0;
     auto sv = std::string_view{};
-    tr_variant* const meta = const_cast<tr_variant*>(meta_in);
+    auto meta = MetainfoFields{};
     bool isMagnet = false;
 
+    if (!readMetainfo(benc, &meta))
+    {
+        return "metainfo";
+    }
+
     /* info_hash: urlencoded 20-byte SHA1 hash of the value of the info key
      * from the Metainfo file. Note that the value will be a bencoded
      * dictionary, given the definition of the info key above. */
-    tr_variant* infoDict = nullptr;
-    if (bool b = tr_variantDictFindDict(meta, TR_KEY_info, &infoDict); !b)
+    auto const* const info = meta.info ? &*meta.info : nullptr;
+    if (info == nullptr)
     {
         /* no info dictionary... is this a magnet link? */
-        if (tr_variant* d = nullptr; tr_variantDictFindDict(meta, TR_KEY_magnet_info, &d))
+        if (meta.magnet_info)
         {
             isMagnet = true;
 
             // get the info-hash
-            if (!tr_variantDictFindStrView(d, TR_KEY_info_hash, &sv))
+            if (!meta.magnet_info->info_hash)
             {
                 return "info_hash";
             }
 
+            sv = *meta.magnet_info->info_hash;
             if (std::size(sv) != SHA_DIGEST_LENGTH)
             {
                 return "info_hash";
@@ -456,8 +799,9 @@ static char const* tr_metainfoParseImpl(
             tr_sha1_to_hex(inf->hashString, inf->hash);
 
             // maybe get the display name
-            if (tr_variantDictFindStrView(d, TR_KEY_display_name, &sv))
+            if (meta.magnet_info->display_name)
             {
+                sv = *meta.magnet_info->display_name;
                 tr_free(inf->name);
                 tr_free(inf->originalName);
                 inf->name = tr_strvDup(sv);
@@ -481,27 +825,20 @@ static char const* tr_metainfoParseImpl(
     }
     else
     {
-        size_t blen = 0;
-        char* bstr = tr_variantToStr(infoDict, TR_VARIANT_FMT_BENC, &blen);
-        tr_sha1(inf->hash, bstr, (int)blen, nullptr);
+        /* hash the info dict as it appears in the file, without re-encoding it */
+        tr_sha1(inf->hash, std::data(info->raw), (int)std::size(info->raw), nullptr);
         tr_sha1_to_hex(inf->hashString, inf->hash);
 
         if (infoDictLength != nullptr)
         {
-            *infoDictLength = blen;
+            *infoDictLength = std::size(info->raw);
         }
-
-        tr_free(bstr);
     }
 
     /* name */
     if (!isMagnet)
     {
-        if (!tr_variantDictFindStrView(infoDict, TR_KEY_name_utf_8, &sv) &&
-            !tr_variantDictFindStrView(infoDict, TR_KEY_name, &sv))
-        {
-            sv = ""sv;
-        }
+        sv = info->name_utf8.value_or(info->name.value_or(""sv));
 
         if (std::empty(sv))
         {
@@ -515,65 +852,45 @@ static char const* tr_metainfoParseImpl(
     }
 
     /* comment */
-    if (!tr_variantDictFindStrView(meta, TR_KEY_comment_utf_8, &sv) && !tr_variantDictFindStrView(meta, TR_KEY_comment, &sv))
-    {
-        sv = ""sv;
-    }
-
     tr_free(inf->comment);
-    inf->comment = tr_utf8clean(sv);
+    inf->comment = tr_utf8clean(meta.comment_utf8.value_or(meta.comment.value_or(""sv)));
 
     /* created by */
-    if (!tr_variantDictFindStrView(meta, TR_KEY_created_by_utf_8, &sv) &&
-        !tr_variantDictFindStrView(meta, TR_KEY_created_by, &sv))
-    {
-        sv = ""sv;
-    }
-
     tr_free(inf->creator);
-    inf->creator = tr_utf8clean(sv);
+    inf->creator = tr_utf8clean(meta.created_by_utf8.value_or(meta.created_by.value_or(""sv)));
 
     /* creation date */
-    i = 0;
-    (void)!tr_variantDictFindInt(meta, TR_KEY_creation_date, &i);
-    inf->dateCreated = i;
+    inf->dateCreated = meta.creation_date.value_or(0);
 
     /* private */
-    if (!tr_variantDictFindInt(infoDict, TR_KEY_private, &i) && !tr_variantDictFindInt(meta, TR_KEY_private, &i))
-    {
-        i = 0;
-    }
-
-    inf->isPrivate = i != 0;
+    auto const is_private = info != nullptr && info->is_private ? info->is_private : meta.is_private;
+    inf->isPrivate = is_private.value_or(0) != 0;
 
     /* source */
-    if (!tr_variantDictFindStrView(infoDict, TR_KEY_source, &sv) && !tr_variantDictFindStrView(meta, TR_KEY_source, &sv))
-    {
-        sv = ""sv;
-    }
-
+    auto const source = info != nullptr && info->source ? info->source : meta.source;
     tr_free(inf->source);
-    inf->source = tr_utf8clean(sv);
+    inf->source = tr_utf8clean(source.value_or(""sv));
 
     /* piece length */
     if (!isMagnet)
     {
-        if (!tr_variantDictFindInt(infoDict, TR_KEY_piece_length, &i) || (i < 1))
+        if (!info->piece_length || *info->piece_length < 1)
         {
             return "piece length";
         }
 
-        inf->pieceSize = i;
+        inf->pieceSize = *info->piece_length;
     }
 
     /* pieces and files */
     if (!isMagnet)
     {
-        if (!tr_variantDictFindStrView(infoDict, TR_KEY_pieces, &sv))
+        if (!info->pieces)
         {
             return "pieces";
         }
 
+        sv = *info->pieces;
         if (std::size(sv) % SHA_DIGEST_LENGTH != 0)
         {
             return "pieces";
@@ -581,13 +898,11 @@ static char const* tr_metainfoParseImpl(
 
         auto const n_pieces = std::size(sv) / SHA_DIGEST_LENGTH;
         inf->pieceCount = n_pieces;
+        *pieces_offset = std::data(sv) - std::data(benc);
         pieces->resize(n_pieces);
         std::copy_n(std::data(sv), std::size(sv), reinterpret_cast<uint8_t*>(std::data(*pieces)));
 
-        auto const* const errstr = parseFiles(
-            inf,
-            tr_variantDictFind(infoDict, TR_KEY_files),
-            tr_variantDictFind(infoDict, TR_KEY_length));
+        auto const* const errstr = parseFiles(inf, *info);
         if (errstr != nullptr)
         {
             return errstr;
@@ -621,11 +936,17 @@ static char const* tr_metainfoParseImpl(
     return nullptr;
 }
 
-std::optional<tr_metainfo_parsed> tr_metainfoParse(tr_session const* session, tr_variant const* meta_in, tr_error** error)
+std::optional<tr_metainfo_parsed> tr_metainfoParse(tr_session const* session, std::string_view benc, tr_error** error)
 {
     auto out = tr_metainfo_parsed{};
 
-    char const* bad_tag = tr_metainfoParseImpl(session, &out.info, &out.pieces, &out.info_dict_length, meta_in);
+    char const* bad_tag = tr_metainfoParseImpl(
+        session,
+        &out.info,
+        &out.pieces,
+        &out.pieces_offset,
+        &out.info_dict_length,
+        benc);
     if (bad_tag != nullptr)
     {
         tr_error_set(error, TR_ERROR_EINVAL, _("Error parsing metainfo: %s"), bad_tag);
@@ -636,6 +957,15 @@ std::optional<tr_metainfo_parsed> tr_metainfoParse(tr_session const* session, tr
     return std::optional<tr_metainfo_parsed>{ std::move(out) };
 }
 
+std::optional<tr_metainfo_parsed> tr_metainfoParse(tr_session const* session, tr_variant const* meta_in, tr_error** error)
+{
+    auto len = size_t{};
+    auto* const benc = tr_variantToStr(meta_in, TR_VARIANT_FMT_BENC, &len);
+    auto parsed = tr_metainfoParse(session, std::string_view{ benc, len }, error);
+    tr_free(benc);
+    return parsed;
+}
+
 void tr_metainfoFree(tr_info* inf)
 {
     for (unsigned int i = 0; i < inf->webseedCount; i++)
@@ -35,6 +35,9 @@ struct tr_metainfo_parsed
     uint64_t info_dict_length = 0;
     std::vector<tr_sha1_digest_t> pieces;
 
+    /* where the piece hashes start in the parsed benc */
+    uint64_t pieces_offset = 0;
+
     tr_metainfo_parsed() = default;
 
     tr_metainfo_parsed(tr_metainfo_parsed&& that) noexcept
@@ -42,6 +45,7 @@ struct tr_metainfo_parsed
         std::swap(this->info, that.info);
         std::swap(this->pieces, that.pieces);
         std::swap(this->info_dict_length, that.info_dict_length);
+        std::swap(this->pieces_offset, that.pieces_offset);
     }
 
     tr_metainfo_parsed(tr_metainfo_parsed const&) = delete;
@@ -54,6 +58,10 @@ struct tr_metainfo_parsed
     }
 };
 
+/* Reads the bencoded metainfo directly, without building a tr_variant tree.
+ * The info-hash is the SHA1 of the info dict exactly as it appears in `benc`. */
+std::optional<tr_metainfo_parsed> tr_metainfoParse(tr_session const* session, std::string_view benc, tr_error** error);
+
 std::optional<tr_metainfo_parsed> tr_metainfoParse(tr_session const* session, tr_variant const* variant, tr_error** error);
 
 void tr_metainfoRemoveSaved(tr_session const* session, tr_info const* info);
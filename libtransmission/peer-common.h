@@ -48,6 +48,8 @@ enum PeerEventType
     TR_PEER_CLIENT_GOT_HAVE,
     TR_PEER_CLIENT_GOT_HAVE_ALL,
     TR_PEER_CLIENT_GOT_HAVE_NONE,
+    TR_PEER_CLIENT_GOT_INTERESTED,
+    TR_PEER_CLIENT_GOT_NOT_INTERESTED,
     TR_PEER_PEER_GOT_PIECE_DATA,
     TR_PEER_ERROR
 };
@@ -57,7 +59,8 @@ struct tr_peer_event
     PeerEventType eventType;
 
     uint32_t pieceIndex; /* for GOT_BLOCK, GOT_HAVE, CANCEL, ALLOWED, SUGGEST */
-    tr_bitfield* bitfield; /* for GOT_BITFIELD */
+    tr_bitfield* bitfield; /* for GOT_BITFIELD. This and GOT_HAVE_ALL / GOT_HAVE_NONE
+                              are published before tr_peer::have is replaced */
     uint32_t offset; /* for GOT_BLOCK */
     uint32_t length; /* for GOT_BLOCK + GOT_PIECE_DATA */
     int err; /* errno for GOT_ERROR */
@@ -103,6 +106,10 @@ public:
     tr_bitfield blame;
     tr_bitfield have;
 
+    /* how many of the pieces in `have' we'd want from them.
+       NOTE: private to peer-mgr.c */
+    size_t interestingPieceCount = 0;
+
     /* the client name.
        For BitTorrent peers, this is the app name derived from the `v' string in LTEP's handshake dictionary */
     tr_quark client = TR_KEY_NONE;
@@ -112,6 +119,10 @@ public:
 
     tr_recentHistory cancelsSentToClient;
     tr_recentHistory cancelsSentToPeer;
+
+    /* HAVE messages sent to the peer, and ones skipped because it already had the piece */
+    uint32_t havesSentToPeer = 0;
+    uint32_t havesSuppressed = 0;
 };
 
 /** Update the tr_peer.progress field based on the 'have' bitset. */
@@ -335,11 +335,22 @@ static int tr_evbuffer_write(tr_peerIo* io, int fd, size_t howmuch)
 {
     char errstr[256];
 
+    /* libevent hands every chain in the outbuf to a single writev() here,
+       so message headers and block payloads go out together */
     EVUTIL_SET_SOCKET_ERROR(0);
     int const n = evbuffer_write_atmost(io->outbuf, fd, howmuch);
     int const e = EVUTIL_SOCKET_ERROR();
     dbgmsg(io, "wrote %d to peer (%s)", n, (n == -1 ? tr_net_strerror(errstr, sizeof(errstr), e) : ""));
 
+    if (n > 0)
+    {
+        io->tcp_bytes_written += n;
+        ++io->tcp_write_calls;
+    }
+
+    /* restore the socket error for the callers */
+    EVUTIL_SET_SOCKET_ERROR(e);
+
     return n;
 }
 
@@ -1069,23 +1080,37 @@ static inline void processBuffer(
     size_t size,
     void (*callback)(tr_crypto*, size_t, void const*, void*))
 {
+    /* process the chain in place, peeking a handful of chunks per call
+       rather than walking the evbuffer again for every chunk */
+    auto constexpr MaxVecs = int{ 16 };
     struct evbuffer_ptr pos;
-    struct evbuffer_iovec iovec;
+    struct evbuffer_iovec iovecs[MaxVecs];
 
     evbuffer_ptr_set(buffer, &pos, offset, EVBUFFER_PTR_SET);
 
-    do
+    while (size > 0)
     {
-        if (evbuffer_peek(buffer, size, &pos, &iovec, 1) <= 0)
+        int const n_vecs = std::min(evbuffer_peek(buffer, size, &pos, iovecs, MaxVecs), MaxVecs);
+        if (n_vecs <= 0)
         {
             break;
         }
 
-        callback(crypto, iovec.iov_len, iovec.iov_base, iovec.iov_base);
+        size_t processed = 0;
+        for (int i = 0; i < n_vecs && processed < size; ++i)
+        {
+            size_t const len = std::min(iovecs[i].iov_len, size - processed);
+            callback(crypto, len, iovecs[i].iov_base, iovecs[i].iov_base);
+            processed += len;
+        }
 
-        TR_ASSERT(size >= iovec.iov_len);
-        size -= iovec.iov_len;
-    } while (evbuffer_ptr_set(buffer, &pos, iovec.iov_len, EVBUFFER_PTR_ADD) == 0);
+        size -= processed;
+
+        if (size > 0 && evbuffer_ptr_set(buffer, &pos, processed, EVBUFFER_PTR_ADD) != 0)
+        {
+            break;
+        }
+    }
 
     TR_ASSERT(size == 0);
 }
@@ -1135,6 +1160,43 @@ void tr_peerIoWriteBytes(tr_peerIo* io, void const* bytes, size_t byteCount, boo
     addDatatype(io, byteCount, isPieceData);
 }
 
+uint8_t* tr_peerIoReserveBytes(tr_peerIo* io, size_t byteCount)
+{
+    TR_ASSERT(tr_isPeerIo(io));
+
+    struct evbuffer_iovec iovec = {};
+    if (evbuffer_reserve_space(io->outbuf, byteCount, &iovec, 1) != 1)
+    {
+        return nullptr;
+    }
+
+    io->reserved_space = iovec.iov_base;
+    io->reserved_space_len = byteCount;
+    return static_cast<uint8_t*>(iovec.iov_base);
+}
+
+void tr_peerIoCommitBytes(tr_peerIo* io, size_t byteCount, bool isPieceData)
+{
+    TR_ASSERT(tr_isPeerIo(io));
+    TR_ASSERT(io->reserved_space != nullptr);
+    TR_ASSERT(byteCount <= io->reserved_space_len);
+
+    struct evbuffer_iovec iovec = {};
+    iovec.iov_base = io->reserved_space;
+    iovec.iov_len = byteCount;
+
+    if (io->encryption_type == PEER_ENCRYPTION_RC4)
+    {
+        tr_cryptoEncrypt(&io->crypto, iovec.iov_len, iovec.iov_base, iovec.iov_base);
+    }
+
+    evbuffer_commit_space(io->outbuf, &iovec, 1);
+    io->reserved_space = nullptr;
+    io->reserved_space_len = 0;
+
+    addDatatype(io, byteCount, isPieceData);
+}
+
 /***
 ****
 ***/
@@ -105,6 +105,14 @@ public:
     evbuffer* const outbuf;
     struct tr_datatype* outbuf_datatypes = nullptr;
 
+    /* space at the end of outbuf handed out by tr_peerIoReserveBytes() */
+    void* reserved_space = nullptr;
+    size_t reserved_space_len = 0;
+
+    /* how many bytes each write() to a TCP socket managed to send */
+    uint64_t tcp_bytes_written = 0;
+    uint32_t tcp_write_calls = 0;
+
     struct event* event_read = nullptr;
     struct event* event_write = nullptr;
 
@@ -250,6 +258,17 @@ void tr_peerIoWriteBytes(tr_peerIo* io, void const* writeme, size_t writemeLen,
 
 void tr_peerIoWriteBuf(tr_peerIo* io, struct evbuffer* buf, bool isPieceData);
 
+/**
+ * Reserve `byteCount` contiguous bytes at the end of the outbuf so that a
+ * message can be assembled in place, without a temporary evbuffer.
+ * Nothing is queued until tr_peerIoCommitBytes() is called; if the caller
+ * gives up instead, the reservation is silently discarded.
+ */
+uint8_t* tr_peerIoReserveBytes(tr_peerIo* io, size_t byteCount);
+
+/** Encrypt (if needed) and queue the bytes filled in after tr_peerIoReserveBytes() */
+void tr_peerIoCommitBytes(tr_peerIo* io, size_t byteCount, bool isPieceData);
+
 /**
 ***
 **/
@@ -307,6 +326,12 @@ void tr_peerIoDrain(tr_peerIo* io, struct evbuffer* inbuf, size_t byteCount);
 
 size_t tr_peerIoGetWriteBufferSpace(tr_peerIo const* io, uint64_t now);
 
+/* average number of bytes sent per socket write, or 0 if nothing's been written yet */
+constexpr size_t tr_peerIoGetBytesPerWrite(tr_peerIo const* io)
+{
+    return io->tcp_write_calls == 0 ? 0 : io->tcp_bytes_written / io->tcp_write_calls;
+}
+
 static inline void tr_peerIoSetParent(tr_peerIo* io, Bandwidth* parent)
 {
     TR_ASSERT(tr_isPeerIo(io));
@@ -27,12 +27,19 @@ struct Candidate
     tr_piece_index_t piece;
     size_t n_blocks_missing;
     tr_priority_t priority;
+    size_t replication;
     uint8_t salt;
 
-    Candidate(tr_piece_index_t piece_in, size_t missing_in, tr_priority_t priority_in, uint8_t salt_in)
+    Candidate(
+        tr_piece_index_t piece_in,
+        size_t missing_in,
+        tr_priority_t priority_in,
+        size_t replication_in,
+        uint8_t salt_in)
         : piece{ piece_in }
         , n_blocks_missing{ missing_in }
         , priority{ priority_in }
+        , replication{ replication_in }
         , salt{ salt_in }
     {
     }
@@ -51,6 +58,12 @@ struct Candidate
             return priority > that.priority ? -1 : 1;
         }
 
+        // prefer rarer pieces
+        if (replication != that.replication)
+        {
+            return replication < that.replication ? -1 : 1;
+        }
+
         if (salt != that.salt)
         {
             return salt < that.salt ? -1 : 1;
@@ -96,7 +109,7 @@ std::vector<Candidate> getCandidates(Wishlist::PeerInfo const& peer_info)
     for (size_t i = 0; i < n; ++i)
     {
         auto const [piece, n_missing] = wanted_pieces[i];
-        candidates.emplace_back(piece, n_missing, peer_info.priority(piece), saltbuf[i]);
+        candidates.emplace_back(piece, n_missing, peer_info.priority(piece), peer_info.countPeersWithPiece(piece), saltbuf[i]);
     }
 
     return candidates;
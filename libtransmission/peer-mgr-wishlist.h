@@ -31,6 +31,7 @@ public:
         virtual tr_block_span_t blockSpan(tr_piece_index_t) const = 0;
         virtual tr_piece_index_t countAllPieces() const = 0;
         virtual tr_priority_t priority(tr_piece_index_t) const = 0;
+        virtual size_t countPeersWithPiece(tr_piece_index_t) const = 0;
     };
 
     // get a list of the next blocks that we should request from a peer
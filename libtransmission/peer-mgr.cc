@@ -11,9 +11,13 @@
 #include <climits> /* INT_MAX */
 #include <cstdlib> /* qsort */
 #include <cstring> /* memcpy, memcmp, strstr */
+#include <functional> /* std::hash */
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <set>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <event2/event.h>
@@ -96,6 +100,18 @@ static auto constexpr RequestTtlSecs = int{ 90 };
 
 static auto constexpr CancelHistorySec = int{ 60 };
 
+// if an atom can't be a connection candidate for some reason other than
+// its reconnect interval, this is how long until we look at it again
+static auto constexpr CandidateRecheckSecs = int{ 60 };
+
+// where a peer_atom is in its swarm's connection candidate index
+enum CandidateState : uint8_t
+{
+    CandidateUnindexed,
+    CandidateWaiting,
+    CandidateReady
+};
+
 /**
 ***
 **/
@@ -111,15 +127,6 @@ static auto constexpr CancelHistorySec = int{ 60 };
  */
 struct peer_atom
 {
-    uint8_t fromFirst; /* where the peer was first found */
-    uint8_t fromBest; /* the "best" value of where the peer has been found */
-    uint8_t flags; /* these match the added_f flags */
-    uint8_t flags2; /* flags that aren't defined in added_f */
-    int8_t blocklisted; /* -1 for unknown, true for blocklisted, false for not blocklisted */
-
-    tr_port port;
-    bool utp_failed; /* We recently failed to connect over uTP */
-    uint16_t numFails;
     time_t time; /* when the peer's connection status last changed */
     time_t piece_data_time;
 
@@ -130,7 +137,134 @@ struct peer_atom
      * if the swarm is small, the atom will be kept past this date. */
     time_t shelf_date;
     tr_peer* peer; /* will be nullptr if not connected */
+
+    uint64_t candidate_key; /* this atom's key in the candidate index */
+
     tr_address addr;
+    uint32_t pool_pos; /* this atom's position in its AtomPool */
+    tr_port port;
+    uint16_t numFails;
+
+    uint8_t fromFirst; /* where the peer was first found */
+    uint8_t fromBest; /* the "best" value of where the peer has been found */
+    uint8_t flags; /* these match the added_f flags */
+    uint8_t flags2; /* flags that aren't defined in added_f */
+    int8_t blocklisted; /* -1 for unknown, true for blocklisted, false for not blocklisted */
+    bool utp_failed; /* We recently failed to connect over uTP */
+    uint8_t candidate_state; /* a CandidateState */
+    uint8_t candidate_salt;
+};
+
+/**
+ * A swarm's peer_atoms.
+ *
+ * Atoms are carved out of fixed-size slabs, so adding one doesn't need an
+ * allocation of its own and pointers to them stay valid until they're
+ * erased. Erased atoms go on a free list for reuse; the slabs themselves
+ * are kept until the pool is destroyed, since PEX and tracker bursts tend
+ * to recur. Lookups by address go through a hash table and iteration
+ * walks a dense array, so neither needs the atoms to be kept sorted.
+ */
+class AtomPool
+{
+public:
+    AtomPool() = default;
+    AtomPool(AtomPool const&) = delete;
+    AtomPool& operator=(AtomPool const&) = delete;
+
+    [[nodiscard]] size_t size() const
+    {
+        return std::size(atoms_);
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return std::empty(atoms_);
+    }
+
+    [[nodiscard]] auto begin() const
+    {
+        return std::begin(atoms_);
+    }
+
+    [[nodiscard]] auto end() const
+    {
+        return std::end(atoms_);
+    }
+
+    [[nodiscard]] peer_atom* find(tr_address const& addr) const
+    {
+        auto const it = index_.find(addr);
+        return it == std::end(index_) ? nullptr : it->second;
+    }
+
+    /* @return a new, zeroed atom for `addr', which must not be in the pool yet */
+    peer_atom* emplace(tr_address const& addr)
+    {
+        TR_ASSERT(find(addr) == nullptr);
+
+        if (std::empty(free_))
+        {
+            auto const& slab = slabs_.emplace_back(new peer_atom[SlabSize]);
+
+            for (size_t i = SlabSize; i > 0; --i)
+            {
+                free_.push_back(&slab[i - 1]);
+            }
+        }
+
+        auto* const atom = free_.back();
+        free_.pop_back();
+
+        *atom = peer_atom{};
+        atom->addr = addr;
+        atom->pool_pos = static_cast<uint32_t>(std::size(atoms_));
+        atoms_.push_back(atom);
+        index_.emplace(addr, atom);
+        return atom;
+    }
+
+    void erase(peer_atom* atom)
+    {
+        TR_ASSERT(atom->pool_pos < std::size(atoms_));
+        TR_ASSERT(atoms_[atom->pool_pos] == atom);
+
+        index_.erase(atom->addr);
+
+        auto* const last = atoms_.back();
+        last->pool_pos = atom->pool_pos;
+        atoms_[atom->pool_pos] = last;
+        atoms_.pop_back();
+
+        free_.push_back(atom);
+    }
+
+private:
+    static auto constexpr SlabSize = size_t{ 64 };
+
+    struct AddressHash
+    {
+        size_t operator()(tr_address const& addr) const
+        {
+            auto const* const bytes = addr.type == TR_AF_INET ? reinterpret_cast<char const*>(&addr.addr.addr4) :
+                                                                reinterpret_cast<char const*>(&addr.addr.addr6.s6_addr);
+            auto const len = addr.type == TR_AF_INET ? sizeof(addr.addr.addr4) : sizeof(addr.addr.addr6.s6_addr);
+            return std::hash<std::string_view>{}(std::string_view{ bytes, len });
+        }
+    };
+
+    struct AddressEqual
+    {
+        bool operator()(tr_address const& a, tr_address const& b) const
+        {
+            return tr_address_compare(&a, &b) == 0;
+        }
+    };
+
+    std::vector<std::unique_ptr<peer_atom[]>> slabs_;
+    std::vector<peer_atom*> free_;
+    std::vector<peer_atom*> atoms_;
+    std::unordered_map<tr_address, peer_atom*, AddressHash, AddressEqual> index_;
 };
 
 #ifndef TR_ENABLE_ASSERTS
@@ -160,23 +294,207 @@ public:
     tr_swarm(tr_peerMgr* manager_in, tr_torrent* tor_in)
         : manager{ manager_in }
         , tor{ tor_in }
+        , piece_replication(tor_in->info.pieceCount)
+    {
+    }
+
+    [[nodiscard]] size_t countPeersWithPiece(tr_piece_index_t piece) const
+    {
+        return piece < std::size(piece_replication) ? piece_replication[piece] : 0;
+    }
+
+    /* add or remove a peer's pieces from the replication counts */
+    void updateReplication(tr_bitfield const& have, bool is_add)
+    {
+        auto const n = std::size(piece_replication);
+
+        if (have.hasAll())
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                updateReplication(i, is_add);
+            }
+        }
+        else if (!have.hasNone())
+        {
+            for (size_t i = 0, end = std::min(n, have.size()); i < end; ++i)
+            {
+                if (have.test(i))
+                {
+                    updateReplication(i, is_add);
+                }
+            }
+        }
+    }
+
+    void updateReplication(tr_piece_index_t piece, bool is_add)
+    {
+        if (piece >= std::size(piece_replication))
+        {
+            return;
+        }
+
+        auto& count = piece_replication[piece];
+
+        if (is_add)
+        {
+            ++count;
+        }
+        else
+        {
+            TR_ASSERT(count > 0);
+            count = count > 0 ? count - 1 : 0;
+        }
+    }
+
+    void rebuildReplication()
+    {
+        piece_replication.assign(tor->info.pieceCount, 0);
+
+        for (int i = 0, n = tr_ptrArraySize(&peers); i < n; ++i)
+        {
+            updateReplication(static_cast<tr_peer const*>(tr_ptrArrayNth(&peers, i))->have, true);
+        }
+    }
+
+    /* count how many of `interesting_pieces' are in `have' */
+    [[nodiscard]] size_t countInterestingPieces(tr_bitfield const& have) const
+    {
+        if (have.hasNone())
+        {
+            return 0;
+        }
+
+        if (have.hasAll())
+        {
+            return interesting_pieces.count();
+        }
+
+        auto count = size_t{};
+
+        for (size_t i = 0, end = std::min(interesting_pieces.size(), have.size()); i < end; ++i)
+        {
+            if (interesting_pieces.test(i) && have.test(i))
+            {
+                ++count;
+            }
+        }
+
+        return count;
+    }
+
+    /* bring one piece of `interesting_pieces' up to date with the torrent */
+    void updateInterestingPiece(tr_piece_index_t piece)
     {
+        if (piece >= interesting_pieces.size())
+        {
+            return;
+        }
+
+        bool const is_interesting = !tor->pieceIsDnd(piece) && !tor->hasPiece(piece);
+
+        if (interesting_pieces.test(piece) == is_interesting)
+        {
+            return;
+        }
+
+        interesting_pieces.set(piece, is_interesting);
+
+        for (int i = 0, n = tr_ptrArraySize(&peers); i < n; ++i)
+        {
+            auto* const peer = static_cast<tr_peer*>(tr_ptrArrayNth(&peers, i));
+
+            if (peer->have.test(piece))
+            {
+                if (is_interesting)
+                {
+                    ++peer->interestingPieceCount;
+                }
+                else
+                {
+                    TR_ASSERT(peer->interestingPieceCount > 0);
+                    --peer->interestingPieceCount;
+                }
+            }
+        }
+    }
+
+    /* bring all of `interesting_pieces' up to date with the torrent */
+    void updateInterestingPieces()
+    {
+        auto const n = tor->info.pieceCount;
+
+        if (interesting_pieces.size() == n)
+        {
+            for (tr_piece_index_t i = 0; i < n; ++i)
+            {
+                updateInterestingPiece(i);
+            }
+        }
+        else
+        {
+            interesting_pieces = tr_bitfield{ n };
+
+            for (tr_piece_index_t i = 0; i < n; ++i)
+            {
+                interesting_pieces.set(i, !tor->pieceIsDnd(i) && !tor->hasPiece(i));
+            }
+
+            for (int i = 0, n_peers = tr_ptrArraySize(&peers); i < n_peers; ++i)
+            {
+                auto* const peer = static_cast<tr_peer*>(tr_ptrArrayNth(&peers, i));
+                peer->interestingPieceCount = countInterestingPieces(peer->have);
+            }
+        }
+
+        interestingPiecesDirty = false;
     }
 
 public:
     tr_swarm_stats stats = {};
 
     tr_ptrArray outgoingHandshakes = {}; /* tr_handshake */
-    tr_ptrArray pool = {}; /* struct peer_atom */
+    AtomPool pool;
     tr_ptrArray peers = {}; /* tr_peerMsgs */
     tr_ptrArray webseeds = {}; /* tr_webseed */
 
+    /* The atoms we might want to connect to. Ones that were candidates
+     * when last looked at are in `candidates_ready', ordered by score.
+     * The rest are in `candidates_waiting', keyed by when to look again.
+     * This lets reconnectPulse() find the best few without scoring
+     * every atom in the swarm. */
+    std::set<std::pair<uint64_t, peer_atom*>> candidates_ready;
+    std::set<std::pair<uint64_t, peer_atom*>> candidates_waiting;
+
     tr_peerMgr* const manager;
     tr_torrent* const tor;
 
+    /* how many connected peers have each piece. This is kept up to date
+     * as peers tell us what they have and as they disconnect, so that
+     * availability doesn't need a walk over every peer's bitfield.
+     * The counts are wider than the 16-bit peer limits so that they
+     * can't wrap. */
+    std::vector<uint32_t> piece_replication;
+
+    /* the pieces we'd want from a peer: ones that aren't DND and that we
+     * don't have yet. Each peer's `interestingPieceCount' is how many of
+     * these it has, which lets rechokeDownloads() decide interest without
+     * scanning every peer's bitfield. Completed and corrupt pieces are
+     * updated as they happen. DND changes, verifies and restarts set
+     * `interestingPiecesDirty' and are caught up on the next rechoke. */
+    tr_bitfield interesting_pieces = tr_bitfield{ 0 };
+    bool interestingPiecesDirty = true;
+
     tr_peerMsgs* optimistic = nullptr; /* the optimistic peer, or nullptr if none */
     int optimisticUnchokeTimeScaler = 0;
 
+    /* rechokeUploads() is skipped for swarms where nothing it looks at has
+     * changed since it last ran. `uploadRechokeNeeded' is set by changes to
+     * the peer list and to peers' interest, seed status and transfer rates;
+     * `uploadRechokeKey' holds the torrent-wide state it last saw. */
+    bool uploadRechokeNeeded = true;
+    uint64_t uploadRechokeKey = 0;
+
     bool poolIsAllSeeds = false;
     bool poolIsAllSeedsDirty = true; /* true if poolIsAllSeeds needs to be recomputed */
     bool isRunning = false;
@@ -271,23 +589,6 @@ static inline tr_handshake* getExistingHandshake(tr_ptrArray* handshakes, tr_add
     return static_cast<tr_handshake*>(tr_ptrArrayFindSorted(handshakes, addr, handshakeCompareToAddr));
 }
 
-static int comparePeerAtomToAddress(void const* va, void const* vb)
-{
-    auto const* const a = static_cast<struct peer_atom const*>(va);
-    auto const* const b = static_cast<tr_address const*>(vb);
-
-    return tr_address_compare(&a->addr, b);
-}
-
-static int compareAtomsByAddress(void const* va, void const* vb)
-{
-    auto const* const b = static_cast<struct peer_atom const*>(vb);
-
-    TR_ASSERT(tr_isAtom(b));
-
-    return comparePeerAtomToAddress(va, &b->addr);
-}
-
 /**
 ***
 **/
@@ -313,8 +614,7 @@ static int peerCompare(void const* va, void const* vb)
 
 static struct peer_atom* getExistingAtom(tr_swarm const* cswarm, tr_address const* addr)
 {
-    auto* swarm = const_cast<tr_swarm*>(cswarm);
-    return static_cast<struct peer_atom*>(tr_ptrArrayFindSorted(&swarm->pool, addr, comparePeerAtomToAddress));
+    return cswarm->pool.find(*addr);
 }
 
 static bool peerIsInUse(tr_swarm const* cs, struct peer_atom const* atom)
@@ -337,7 +637,6 @@ static void swarmFree(void* vs)
     TR_ASSERT(tr_ptrArrayEmpty(&s->peers));
 
     tr_ptrArrayDestruct(&s->webseeds, [](void* peer) { delete static_cast<tr_peer*>(peer); });
-    tr_ptrArrayDestruct(&s->pool, (PtrArrayForeachFunc)tr_free);
     tr_ptrArrayDestruct(&s->outgoingHandshakes, nullptr);
     tr_ptrArrayDestruct(&s->peers, nullptr);
     s->stats = {};
@@ -347,6 +646,10 @@ static void swarmFree(void* vs)
 
 static void peerCallbackFunc(tr_peer*, tr_peer_event const*, void*);
 
+static void updatePeerCandidate(tr_swarm* s, peer_atom* atom);
+
+static void removePeerCandidate(tr_swarm* s, peer_atom* atom);
+
 static void rebuildWebseedArray(tr_swarm* s, tr_torrent* tor)
 {
     tr_info const* inf = &tor->info;
@@ -431,9 +734,8 @@ void tr_peerMgrOnBlocklistChanged(tr_peerMgr* mgr)
     {
         tr_swarm* s = tor->swarm;
 
-        for (int i = 0, n = tr_ptrArraySize(&s->pool); i < n; ++i)
+        for (auto* const atom : s->pool)
         {
-            auto* const atom = static_cast<struct peer_atom*>(tr_ptrArrayNth(&s->pool, i));
             atom->blocklisted = -1;
         }
     }
@@ -463,6 +765,8 @@ static void atomSetSeed(tr_swarm* s, struct peer_atom* atom)
     tordbg(s, "marking peer %s as a seed", tr_atomAddrStr(atom));
     atom->flags |= ADDED_F_SEED_FLAG;
     s->poolIsAllSeedsDirty = true;
+    s->uploadRechokeNeeded = true;
+    updatePeerCandidate(s, atom);
 }
 
 bool tr_peerMgrPeerIsSeed(tr_torrent const* tor, tr_address const* addr)
@@ -609,6 +913,11 @@ std::vector<tr_block_span_t> tr_peerMgrGetNextRequests(tr_torrent* torrent, tr_p
             return torrent_->piecePriority(piece);
         }
 
+        size_t countPeersWithPiece(tr_piece_index_t piece) const override
+        {
+            return swarm_->countPeersWithPiece(piece);
+        }
+
     private:
         tr_torrent const* const torrent_;
         tr_swarm const* const swarm_;
@@ -767,6 +1076,7 @@ void tr_peerMgrPieceCompleted(tr_torrent* tor, tr_piece_index_t p)
 
     /* bookkeeping */
     s->needsCompletenessCheck = true;
+    s->updateInterestingPiece(p);
 }
 
 static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
@@ -793,6 +1103,7 @@ static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
                 peer->atom->piece_data_time = now;
             }
 
+            s->uploadRechokeNeeded = true;
             break;
         }
 
@@ -812,15 +1123,54 @@ static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
                 peer->atom->piece_data_time = now;
             }
 
+            s->uploadRechokeNeeded = true;
             break;
         }
 
     case TR_PEER_CLIENT_GOT_HAVE:
+        s->updateReplication(e->pieceIndex, true);
+
+        if (e->pieceIndex < s->interesting_pieces.size() && s->interesting_pieces.test(e->pieceIndex))
+        {
+            ++peer->interestingPieceCount;
+        }
+
+        if (peer->have.hasAll()) /* they just became a seed */
+        {
+            s->uploadRechokeNeeded = true;
+        }
+
+        break;
+
     case TR_PEER_CLIENT_GOT_HAVE_ALL:
     case TR_PEER_CLIENT_GOT_HAVE_NONE:
     case TR_PEER_CLIENT_GOT_BITFIELD:
-        /* TODO: if we don't need these, should these events be removed? */
-        /* noop */
+        /* these replace the peer's `have' field, which still holds the old value */
+        s->updateReplication(peer->have, false);
+
+        if (e->eventType == TR_PEER_CLIENT_GOT_BITFIELD)
+        {
+            s->updateReplication(*e->bitfield, true);
+            peer->interestingPieceCount = s->countInterestingPieces(*e->bitfield);
+        }
+        else if (e->eventType == TR_PEER_CLIENT_GOT_HAVE_ALL)
+        {
+            auto all = tr_bitfield{ 0 };
+            all.setHasAll();
+            s->updateReplication(all, true);
+            peer->interestingPieceCount = s->countInterestingPieces(all);
+        }
+        else
+        {
+            peer->interestingPieceCount = 0;
+        }
+
+        s->uploadRechokeNeeded = true;
+        break;
+
+    case TR_PEER_CLIENT_GOT_INTERESTED:
+    case TR_PEER_CLIENT_GOT_NOT_INTERESTED:
+        s->uploadRechokeNeeded = true;
         break;
 
     case TR_PEER_CLIENT_GOT_REJ:
@@ -927,15 +1277,13 @@ static struct peer_atom* ensureAtomExists(
     if (a == nullptr)
     {
         int const jitter = tr_rand_int_weak(60 * 10);
-        a = tr_new0(struct peer_atom, 1);
-        a->addr = *addr;
+        a = s->pool.emplace(*addr);
         a->port = port;
         a->flags = flags;
         a->fromFirst = from;
         a->fromBest = from;
         a->shelf_date = tr_time() + getDefaultShelfLife(from) + jitter;
         a->blocklisted = -1;
-        tr_ptrArrayInsertSorted(&s->pool, a, compareAtomsByAddress);
 
         tordbg(s, "got a new atom: %s", tr_atomAddrStr(a));
     }
@@ -950,6 +1298,7 @@ static struct peer_atom* ensureAtomExists(
     }
 
     s->poolIsAllSeedsDirty = true;
+    updatePeerCandidate(s, a);
 
     return a;
 }
@@ -977,6 +1326,7 @@ static void createBitTorrentPeer(tr_torrent* tor, tr_peerIo* io, struct peer_ato
     atom->peer = peer;
 
     tr_ptrArrayInsertSorted(&swarm->peers, peer, peerCompare);
+    swarm->uploadRechokeNeeded = true;
     ++swarm->stats.peerCount;
     ++swarm->stats.peerFromCount[atom->fromFirst];
 
@@ -1028,6 +1378,8 @@ static bool on_handshake_done(tr_handshake_result const& result)
                     tordbg(s, "marking peer %s as unreachable... numFails is %d", tr_atomAddrStr(atom), (int)atom->numFails);
                     atom->flags2 |= MyflagUnreachable;
                 }
+
+                updatePeerCandidate(s, atom);
             }
         }
     }
@@ -1086,6 +1438,8 @@ static bool on_handshake_done(tr_handshake_result const& result)
                 success = true;
             }
         }
+
+        updatePeerCandidate(s, atom);
     }
 
     return success;
@@ -1147,11 +1501,9 @@ void tr_peerMgrSetSwarmIsAllSeeds(tr_torrent* tor)
     auto const lock = tor->unique_lock();
 
     tr_swarm* const swarm = tor->swarm;
-    auto atomCount = int{};
-    struct peer_atom** atoms = (struct peer_atom**)tr_ptrArrayPeek(&swarm->pool, &atomCount);
-    for (int i = 0; i < atomCount; ++i)
+    for (auto* const atom : swarm->pool)
     {
-        atomSetSeed(swarm, atoms[i]);
+        atomSetSeed(swarm, atom);
     }
 
     swarm->poolIsAllSeeds = true;
@@ -1262,6 +1614,8 @@ void tr_peerMgrGotBadPiece(tr_torrent* tor, tr_piece_index_t pieceIndex)
     }
 
     tr_announcerAddBytes(tor, TR_ANN_CORRUPT, byteCount);
+
+    s->updateInterestingPiece(pieceIndex);
 }
 
 int tr_pexCompare(void const* va, void const* vb)
@@ -1370,15 +1724,13 @@ int tr_peerMgrGetPeers(tr_torrent const* tor, tr_pex** setme_pex, uint8_t af, ui
     }
     else /* TR_PEERS_INTERESTING */
     {
-        struct peer_atom** atomBase = (struct peer_atom**)tr_ptrArrayBase(&s->pool);
-        int const n = tr_ptrArraySize(&s->pool);
-        atoms = tr_new(struct peer_atom*, n);
+        atoms = tr_new(struct peer_atom*, std::size(s->pool));
 
-        for (int i = 0; i < n; ++i)
+        for (auto* const atom : s->pool)
         {
-            if (isAtomInteresting(tor, atomBase[i]))
+            if (isAtomInteresting(tor, atom))
             {
-                atoms[atomCount++] = atomBase[i];
+                atoms[atomCount++] = atom;
             }
         }
     }
@@ -1466,6 +1818,7 @@ void tr_peerMgrStartTorrent(tr_torrent* tor)
 
     s->isRunning = true;
     s->maxPeers = tor->maxConnectedPeers;
+    s->interestingPiecesDirty = true; /* e.g. a verify may have changed which pieces we have */
 
     // rechoke soon
     tr_timerAddMsec(s->manager->rechokeTimer, 100);
@@ -1552,6 +1905,10 @@ void tr_peerMgrOnTorrentGotMetainfo(tr_torrent* tor)
     /* the webseed list may have changed... */
     rebuildWebseedArray(tor->swarm, tor);
 
+    /* now that we know how many pieces there are, we can count them */
+    tor->swarm->rebuildReplication();
+    tor->swarm->interestingPiecesDirty = true;
+
     /* some peer_msgs' progress fields may not be accurate if we
        didn't have the metadata before now... so refresh them all... */
     int const peerCount = tr_ptrArraySize(&tor->swarm->peers);
@@ -1571,6 +1928,35 @@ void tr_peerMgrOnTorrentGotMetainfo(tr_torrent* tor)
     }
 }
 
+void tr_peerMgrOnPiecesWantedChanged(tr_torrent* tor)
+{
+    if (tor->swarm != nullptr)
+    {
+        tor->swarm->interestingPiecesDirty = true;
+    }
+}
+
+std::vector<size_t> tr_peerMgrInterestingPieceCounts(tr_torrent* tor)
+{
+    auto const lock = tor->unique_lock();
+
+    tr_swarm* const s = tor->swarm;
+
+    /* catch up the same way rechokeDownloads() does */
+    if (s->interestingPiecesDirty)
+    {
+        s->updateInterestingPieces();
+    }
+
+    auto counts = std::vector<size_t>{};
+    for (int i = 0, n = tr_ptrArraySize(&s->peers); i < n; ++i)
+    {
+        counts.push_back(static_cast<tr_peer const*>(tr_ptrArrayNth(&s->peers, i))->interestingPieceCount);
+    }
+
+    return counts;
+}
+
 void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned int tabCount)
 {
     TR_ASSERT(tr_isTorrent(tor));
@@ -1581,8 +1967,6 @@ void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned
 
     if (tr_torrentHasMetadata(tor))
     {
-        int const peerCount = tr_ptrArraySize(&tor->swarm->peers);
-        tr_peer const** peers = (tr_peer const**)tr_ptrArrayBase(&tor->swarm->peers);
         float const interval = tor->info.pieceCount / (float)tabCount;
         bool const isSeed = tr_torrentGetCompleteness(tor) == TR_SEED;
 
@@ -1594,20 +1978,27 @@ void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned
             {
                 tab[i] = -1;
             }
-            else if (peerCount != 0)
+            else
             {
-                for (int j = 0; j < peerCount; ++j)
-                {
-                    if (peers[j]->have.test(piece))
-                    {
-                        ++tab[i];
-                    }
-                }
+                tab[i] = int8_t(std::min(tor->swarm->countPeersWithPiece(piece), size_t{ INT8_MAX }));
             }
         }
     }
 }
 
+int tr_peerMgrPieceAvailability(tr_torrent const* tor, tr_piece_index_t piece)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(piece < tor->info.pieceCount);
+
+    if (tor->hasPiece(piece))
+    {
+        return -1;
+    }
+
+    return int(tor->swarm->countPeersWithPiece(piece));
+}
+
 void tr_swarmGetStats(tr_swarm const* swarm, tr_swarm_stats* setme)
 {
     TR_ASSERT(swarm != nullptr);
@@ -1677,23 +2068,10 @@ uint64_t tr_peerMgrGetDesiredAvailable(tr_torrent const* tor)
 
     auto desired_available = uint64_t{};
     auto const n_pieces = tor->info.pieceCount;
-    auto have = std::vector<bool>(n_pieces);
-
-    for (size_t i = 0; i < n_peers; ++i)
-    {
-        auto* peer = peers[i];
-        for (size_t j = 0; j < n_pieces; ++j)
-        {
-            if (peer->have.test(j))
-            {
-                have[j] = true;
-            }
-        }
-    }
 
     for (size_t i = 0; i < n_pieces; ++i)
     {
-        if (!tor->pieceIsDnd(i) && have.at(i))
+        if (!tor->pieceIsDnd(i) && s->countPeersWithPiece(i) != 0)
         {
             desired_available += tor->countMissingBytesInPiece(i);
         }
@@ -1735,118 +2113,179 @@ double* tr_peerMgrWebSpeeds_KBps(tr_torrent const* tor)
     return ret;
 }
 
-static auto getPeerStats(tr_peerMsgs const* peer, time_t now, uint64_t now_msec)
+static void getPeerSnapshot(tr_peerMsgs const* peer, time_t now, uint64_t now_msec, tr_peer_snapshot* setme)
 {
-    auto stats = tr_peer_stat{};
     auto const* const atom = peer->atom;
 
-    tr_address_to_string_with_buf(&atom->addr, stats.addr, sizeof(stats.addr));
-    tr_strlcpy(stats.client, tr_quark_get_string(peer->client), sizeof(stats.client));
-    stats.port = ntohs(peer->atom->port);
-    stats.from = atom->fromFirst;
-    stats.progress = peer->progress;
-    stats.isUTP = peer->is_utp_connection();
-    stats.isEncrypted = peer->is_encrypted();
-    stats.rateToPeer_KBps = toSpeedKBps(tr_peerGetPieceSpeed_Bps(peer, now_msec, TR_CLIENT_TO_PEER));
-    stats.rateToClient_KBps = toSpeedKBps(tr_peerGetPieceSpeed_Bps(peer, now_msec, TR_PEER_TO_CLIENT));
-    stats.peerIsChoked = peer->is_peer_choked();
-    stats.peerIsInterested = peer->is_peer_interested();
-    stats.clientIsChoked = peer->is_client_choked();
-    stats.clientIsInterested = peer->is_client_interested();
-    stats.isIncoming = peer->is_incoming_connection();
-    stats.isDownloadingFrom = peer->is_active(TR_PEER_TO_CLIENT);
-    stats.isUploadingTo = peer->is_active(TR_CLIENT_TO_PEER);
-    stats.isSeed = tr_peerIsSeed(peer);
-
-    stats.blocksToPeer = peer->blocksSentToPeer.count(now, CancelHistorySec);
-    stats.blocksToClient = peer->blocksSentToClient.count(now, CancelHistorySec);
-    stats.cancelsToPeer = peer->cancelsSentToPeer.count(now, CancelHistorySec);
-    stats.cancelsToClient = peer->cancelsSentToClient.count(now, CancelHistorySec);
-
-    stats.pendingReqsToPeer = peer->swarm->active_requests.count(peer);
-    stats.pendingReqsToClient = peer->pendingReqsToClient;
-
-    char* pch = stats.flagStr;
-
-    if (stats.isUTP)
+    setme->addr = atom->addr;
+    setme->client = peer->client;
+    setme->port = atom->port;
+    setme->from = atom->fromFirst;
+    setme->progress = peer->progress;
+    setme->isUTP = peer->is_utp_connection();
+    setme->isEncrypted = peer->is_encrypted();
+    setme->rateToPeer_Bps = tr_peerGetPieceSpeed_Bps(peer, now_msec, TR_CLIENT_TO_PEER);
+    setme->rateToClient_Bps = tr_peerGetPieceSpeed_Bps(peer, now_msec, TR_PEER_TO_CLIENT);
+    setme->peerIsChoked = peer->is_peer_choked();
+    setme->peerIsInterested = peer->is_peer_interested();
+    setme->clientIsChoked = peer->is_client_choked();
+    setme->clientIsInterested = peer->is_client_interested();
+    setme->isIncoming = peer->is_incoming_connection();
+    setme->isDownloadingFrom = peer->is_active(TR_PEER_TO_CLIENT);
+    setme->isUploadingTo = peer->is_active(TR_CLIENT_TO_PEER);
+    setme->isSeed = tr_peerIsSeed(peer);
+    setme->isOptimistic = peer->swarm->optimistic == peer;
+
+    setme->blocksToPeer = peer->blocksSentToPeer.count(now, CancelHistorySec);
+    setme->blocksToClient = peer->blocksSentToClient.count(now, CancelHistorySec);
+    setme->cancelsToPeer = peer->cancelsSentToPeer.count(now, CancelHistorySec);
+    setme->cancelsToClient = peer->cancelsSentToClient.count(now, CancelHistorySec);
+
+    setme->pendingReqsToPeer = peer->swarm->active_requests.count(peer);
+    setme->pendingReqsToClient = peer->pendingReqsToClient;
+    setme->desiredReqsToPeer = peer->get_desired_request_count();
+    setme->rttMsec = peer->get_rtt_msec();
+    setme->bytesPerWrite = peer->get_bytes_per_write();
+    setme->havesToPeer = peer->havesSentToPeer;
+    setme->havesSuppressed = peer->havesSuppressed;
+}
+
+void tr_peerMgrPeerSnapshots(tr_torrent const* tor, std::vector<tr_peer_snapshot>* setme)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(tor->swarm->manager != nullptr);
+
+    auto** const peers = reinterpret_cast<tr_peerMsgs**>(tr_ptrArrayBase(&tor->swarm->peers));
+    auto const size = size_t(tr_ptrArraySize(&tor->swarm->peers));
+    setme->resize(size);
+
+    time_t const now = tr_time();
+    uint64_t const now_msec = tr_time_msec();
+    for (size_t i = 0; i < size; ++i)
+    {
+        getPeerSnapshot(peers[i], now, now_msec, &(*setme)[i]);
+    }
+}
+
+void tr_peerSnapshotFlagStr(tr_peer_snapshot const* snapshot, char* buf, size_t buflen)
+{
+    char flags[32];
+    char* pch = flags;
+
+    if (snapshot->isUTP)
     {
         *pch++ = 'T';
     }
 
-    if (peer->swarm->optimistic == peer)
+    if (snapshot->isOptimistic)
     {
         *pch++ = 'O';
     }
 
-    if (stats.isDownloadingFrom)
+    if (snapshot->isDownloadingFrom)
     {
         *pch++ = 'D';
     }
-    else if (stats.clientIsInterested)
+    else if (snapshot->clientIsInterested)
     {
         *pch++ = 'd';
     }
 
-    if (stats.isUploadingTo)
+    if (snapshot->isUploadingTo)
     {
         *pch++ = 'U';
     }
-    else if (stats.peerIsInterested)
+    else if (snapshot->peerIsInterested)
     {
         *pch++ = 'u';
     }
 
-    if (!stats.clientIsChoked && !stats.clientIsInterested)
+    if (!snapshot->clientIsChoked && !snapshot->clientIsInterested)
     {
         *pch++ = 'K';
     }
 
-    if (!stats.peerIsChoked && !stats.peerIsInterested)
+    if (!snapshot->peerIsChoked && !snapshot->peerIsInterested)
     {
         *pch++ = '?';
     }
 
-    if (stats.isEncrypted)
+    if (snapshot->isEncrypted)
     {
         *pch++ = 'E';
     }
 
-    if (stats.from == TR_PEER_FROM_DHT)
+    if (snapshot->from == TR_PEER_FROM_DHT)
     {
         *pch++ = 'H';
     }
-    else if (stats.from == TR_PEER_FROM_PEX)
+    else if (snapshot->from == TR_PEER_FROM_PEX)
     {
         *pch++ = 'X';
     }
 
-    if (stats.isIncoming)
+    if (snapshot->isIncoming)
     {
         *pch++ = 'I';
     }
 
     *pch = '\0';
+    tr_strlcpy(buf, flags, buflen);
+}
+
+static auto getPeerStats(tr_peer_snapshot const& snapshot)
+{
+    auto stats = tr_peer_stat{};
+
+    tr_address_to_string_with_buf(&snapshot.addr, stats.addr, sizeof(stats.addr));
+    tr_strlcpy(stats.client, tr_quark_get_string(snapshot.client), sizeof(stats.client));
+    tr_peerSnapshotFlagStr(&snapshot, stats.flagStr, sizeof(stats.flagStr));
+    stats.port = ntohs(snapshot.port);
+    stats.from = snapshot.from;
+    stats.progress = snapshot.progress;
+    stats.isUTP = snapshot.isUTP;
+    stats.isEncrypted = snapshot.isEncrypted;
+    stats.rateToPeer_KBps = toSpeedKBps(snapshot.rateToPeer_Bps);
+    stats.rateToClient_KBps = toSpeedKBps(snapshot.rateToClient_Bps);
+    stats.peerIsChoked = snapshot.peerIsChoked;
+    stats.peerIsInterested = snapshot.peerIsInterested;
+    stats.clientIsChoked = snapshot.clientIsChoked;
+    stats.clientIsInterested = snapshot.clientIsInterested;
+    stats.isIncoming = snapshot.isIncoming;
+    stats.isDownloadingFrom = snapshot.isDownloadingFrom;
+    stats.isUploadingTo = snapshot.isUploadingTo;
+    stats.isSeed = snapshot.isSeed;
+
+    stats.blocksToPeer = snapshot.blocksToPeer;
+    stats.blocksToClient = snapshot.blocksToClient;
+    stats.cancelsToPeer = snapshot.cancelsToPeer;
+    stats.cancelsToClient = snapshot.cancelsToClient;
+
+    stats.pendingReqsToPeer = snapshot.pendingReqsToPeer;
+    stats.pendingReqsToClient = snapshot.pendingReqsToClient;
+    stats.desiredReqsToPeer = snapshot.desiredReqsToPeer;
+    stats.rttMsec = snapshot.rttMsec;
+    stats.bytesPerWrite = snapshot.bytesPerWrite;
+    stats.havesToPeer = snapshot.havesToPeer;
+    stats.havesSuppressed = snapshot.havesSuppressed;
 
     return stats;
 }
 
 struct tr_peer_stat* tr_peerMgrPeerStats(tr_torrent const* tor, int* setmeCount)
 {
-    TR_ASSERT(tr_isTorrent(tor));
-    TR_ASSERT(tor->swarm->manager != nullptr);
+    auto snapshots = std::vector<tr_peer_snapshot>{};
+    tr_peerMgrPeerSnapshots(tor, &snapshots);
 
-    tr_peerMsgs** peers = (tr_peerMsgs**)tr_ptrArrayBase(&tor->swarm->peers);
-    int const size = tr_ptrArraySize(&tor->swarm->peers);
+    auto const size = std::size(snapshots);
     tr_peer_stat* ret = tr_new0(tr_peer_stat, size);
 
-    time_t const now = tr_time();
-    uint64_t const now_msec = tr_time_msec();
-    for (int i = 0; i < size; ++i)
+    for (size_t i = 0; i < size; ++i)
     {
-        ret[i] = getPeerStats(peers[i], now, now_msec);
+        ret[i] = getPeerStats(snapshots[i]);
     }
 
-    *setmeCount = size;
+    *setmeCount = int(size);
     return ret;
 }
 
@@ -1869,8 +2308,11 @@ void tr_peerMgrClearInterest(tr_torrent* tor)
     }
 }
 
-/* does this peer have any pieces that we want? */
-static bool isPeerInteresting(tr_torrent* const tor, bool const* const piece_is_interesting, tr_peer const* const peer)
+#ifdef TR_ENABLE_ASSERTS
+
+/* does this peer have any pieces that we want? This is the slow way of
+ * finding out, used to check the swarm's `interesting_pieces' bookkeeping */
+static bool isPeerInteresting(tr_torrent const* const tor, tr_peer const* const peer)
 {
     /* these cases should have already been handled by the calling code... */
     TR_ASSERT(!tr_torrentIsSeed(tor));
@@ -1883,7 +2325,7 @@ static bool isPeerInteresting(tr_torrent* const tor, bool const* const piece_is_
 
     for (tr_piece_index_t i = 0; i < tor->info.pieceCount; ++i)
     {
-        if (piece_is_interesting[i] && peer->have.test(i))
+        if (!tor->pieceIsDnd(i) && !tor->hasPiece(i) && peer->have.test(i))
         {
             return true;
         }
@@ -1892,6 +2334,8 @@ static bool isPeerInteresting(tr_torrent* const tor, bool const* const piece_is_
     return false;
 }
 
+#endif
+
 enum tr_rechoke_state
 {
     RECHOKE_STATE_GOOD,
@@ -2013,15 +2457,9 @@ static void rechokeDownloads(tr_swarm* s)
 
     if (peerCount > 0)
     {
-        tr_torrent const* const tor = s->tor;
-        int const n = tor->info.pieceCount;
-
-        /* build a bitfield of interesting pieces... */
-        bool* const piece_is_interesting = tr_new(bool, n);
-
-        for (int i = 0; i < n; ++i)
+        if (s->interestingPiecesDirty)
         {
-            piece_is_interesting[i] = !tor->pieceIsDnd(i) && !tor->hasPiece(i);
+            s->updateInterestingPieces();
         }
 
         /* decide WHICH peers to be interested in (based on their cancel-to-block ratio) */
@@ -2029,7 +2467,10 @@ static void rechokeDownloads(tr_swarm* s)
         {
             auto* const peer = static_cast<tr_peerMsgs*>(tr_ptrArrayNth(&s->peers, i));
 
-            if (!isPeerInteresting(s->tor, piece_is_interesting, peer))
+            bool const is_interesting = tr_peerIsSeed(peer) || peer->interestingPieceCount > 0;
+            TR_ASSERT(is_interesting == isPeerInteresting(s->tor, peer));
+
+            if (!is_interesting)
             {
                 peer->set_interested(false);
             }
@@ -2072,7 +2513,6 @@ static void rechokeDownloads(tr_swarm* s)
             }
         }
 
-        tr_free(piece_is_interesting);
     }
 
     if ((rechoke != nullptr) && (rechoke_count > 0))
@@ -2174,6 +2614,36 @@ static inline bool isBandwidthMaxedOut(Bandwidth const* b, uint64_t const now_ms
     return got >= want;
 }
 
+/* the torrent-wide state that rechokeUploads() depends on */
+static uint64_t getUploadRechokeKey(tr_swarm const* s, uint64_t const now)
+{
+    tr_torrent const* const tor = s->tor;
+    auto key = uint64_t(std::max(s->manager->session->uploadSlotsPerTorrent, 0));
+    key = (key << 1) | (tr_torrentIsPieceTransferAllowed(tor, TR_CLIENT_TO_PEER) ? 1 : 0);
+    key = (key << 1) | (isBandwidthMaxedOut(tor->bandwidth, now, TR_UP) ? 1 : 0);
+    key = (key << 1) | (tr_torrentIsSeed(tor) ? 1 : 0);
+    key = (key << 1) | (tr_torrentIsPrivate(tor) ? 1 : 0);
+    return key;
+}
+
+/* If nothing that rechokeUploads() looks at has changed since it last ran,
+ * it would make the same choices again, so it doesn't need to run. */
+static bool isUploadRechokeNeeded(tr_swarm const* s, uint64_t const now)
+{
+    if (s->uploadRechokeNeeded)
+    {
+        return true;
+    }
+
+    /* the optimistic unchoke is up */
+    if (s->optimistic != nullptr && s->optimisticUnchokeTimeScaler == 0)
+    {
+        return true;
+    }
+
+    return s->uploadRechokeKey != getUploadRechokeKey(s, now);
+}
+
 static void rechokeUploads(tr_swarm* s, uint64_t const now)
 {
     auto const lock = s->manager->unique_lock();
@@ -2185,6 +2655,9 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
     bool const chokeAll = !tr_torrentIsPieceTransferAllowed(s->tor, TR_CLIENT_TO_PEER);
     bool const isMaxedOut = isBandwidthMaxedOut(s->tor->bandwidth, now, TR_UP);
 
+    s->uploadRechokeNeeded = false;
+    s->uploadRechokeKey = getUploadRechokeKey(s, now);
+
     /* an optimistic unchoke peer's "optimistic"
      * state lasts for N calls to rechokeUploads(). */
     if (s->optimisticUnchokeTimeScaler > 0)
@@ -2223,6 +2696,12 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
             n->rate = getRate(s->tor, atom, now);
             n->salt = tr_rand_int_weak(INT_MAX);
             n->isChoked = true;
+
+            /* until the rates settle at zero, they need watching */
+            if (n->rate != 0)
+            {
+                s->uploadRechokeNeeded = true;
+            }
         }
     }
 
@@ -2310,7 +2789,16 @@ static void rechokePulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
 
             if (s->stats.peerCount > 0)
             {
-                rechokeUploads(s, now);
+                if (isUploadRechokeNeeded(s, now))
+                {
+                    rechokeUploads(s, now);
+                }
+                else if (s->optimisticUnchokeTimeScaler > 0)
+                {
+                    /* keep the optimistic unchoke's clock running */
+                    --s->optimisticUnchokeTimeScaler;
+                }
+
                 rechokeDownloads(s);
             }
         }
@@ -2319,6 +2807,20 @@ static void rechokePulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
     tr_timerAddMsec(mgr->rechokeTimer, RechokePeriodMsec);
 }
 
+bool tr_peerMgrRechokeUploadsIfNeeded(tr_torrent* tor)
+{
+    auto const lock = tor->unique_lock();
+    uint64_t const now = tr_time_msec();
+
+    if (!isUploadRechokeNeeded(tor->swarm, now))
+    {
+        return false;
+    }
+
+    rechokeUploads(tor->swarm, now);
+    return true;
+}
+
 /***
 ****
 ****  Life and Death
@@ -2464,6 +2966,8 @@ static void removePeer(tr_peer* peer)
     atom->time = tr_time();
 
     tr_ptrArrayRemoveSortedPointer(&s->peers, peer, peerCompare);
+    s->updateReplication(peer->have, false);
+    s->uploadRechokeNeeded = true;
     --s->stats.peerCount;
     --s->stats.peerFromCount[atom->fromFirst];
 
@@ -2471,6 +2975,8 @@ static void removePeer(tr_peer* peer)
     TR_ASSERT(s->stats.peerFromCount[atom->fromFirst] >= 0);
 
     delete peer;
+
+    updatePeerCandidate(s, atom);
 }
 
 static void closePeer(tr_peer* peer)
@@ -2729,17 +3235,6 @@ static void bandwidthPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
 ****
 ***/
 
-static int compareAtomPtrsByAddress(void const* va, void const* vb)
-{
-    struct peer_atom const* a = *(struct peer_atom const* const*)va;
-    struct peer_atom const* b = *(struct peer_atom const* const*)vb;
-
-    TR_ASSERT(tr_isAtom(a));
-    TR_ASSERT(tr_isAtom(b));
-
-    return tr_address_compare(&a->addr, &b->addr);
-}
-
 /* best come first, worst go last */
 static int compareAtomPtrsByShelfDate(void const* va, void const* vb)
 {
@@ -2786,80 +3281,73 @@ static int getMaxAtomCount(tr_torrent const* tor)
     return std::min(50, tor->maxConnectedPeers * 3);
 }
 
-static void atomPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
+/* if the swarm has more atoms than it needs, forget the least useful ones */
+static void pruneAtoms(tr_swarm* s)
 {
-    auto* mgr = static_cast<tr_peerMgr*>(vmgr);
-    auto const lock = mgr->unique_lock();
+    auto const maxAtomCount = static_cast<size_t>(getMaxAtomCount(s->tor));
+    auto const atomCount = std::size(s->pool);
 
-    for (auto* tor : mgr->session->torrents)
+    if (atomCount <= maxAtomCount)
     {
-        tr_swarm* s = tor->swarm;
-        int const maxAtomCount = getMaxAtomCount(tor);
-        auto atomCount = int{};
-        peer_atom** const atoms = (peer_atom**)tr_ptrArrayPeek(&s->pool, &atomCount);
-
-        if (atomCount > maxAtomCount) /* we've got too many atoms... time to prune */
-        {
-            int keepCount = 0;
-            int testCount = 0;
-            struct peer_atom** keep = tr_new(struct peer_atom*, atomCount);
-            struct peer_atom** test = tr_new(struct peer_atom*, atomCount);
-
-            /* keep the ones that are in use */
-            for (int i = 0; i < atomCount; ++i)
-            {
-                struct peer_atom* atom = atoms[i];
-
-                if (peerIsInUse(s, atom))
-                {
-                    keep[keepCount++] = atom;
-                }
-                else
-                {
-                    test[testCount++] = atom;
-                }
-            }
-
-            /* if there's room, keep the best of what's left */
-            int i = 0;
+        return;
+    }
 
-            if (keepCount < maxAtomCount)
-            {
-                qsort(test, testCount, sizeof(struct peer_atom*), compareAtomPtrsByShelfDate);
+    auto keepCount = size_t{};
+    auto test = std::vector<peer_atom*>{};
+    test.reserve(atomCount);
 
-                while (i < testCount && keepCount < maxAtomCount)
-                {
-                    keep[keepCount++] = test[i++];
-                }
-            }
+    /* keep the ones that are in use */
+    for (auto* const atom : s->pool)
+    {
+        if (peerIsInUse(s, atom))
+        {
+            ++keepCount;
+        }
+        else
+        {
+            test.push_back(atom);
+        }
+    }
 
-            /* free the culled atoms */
-            while (i < testCount)
-            {
-                tr_free(test[i++]);
-            }
+    /* if there's room, keep the best of what's left */
+    auto const room = keepCount < maxAtomCount ? std::min(maxAtomCount - keepCount, std::size(test)) : size_t{};
+    auto const cull = std::begin(test) + room;
+    std::nth_element(
+        std::begin(test),
+        cull,
+        std::end(test),
+        [](auto const* a, auto const* b) { return compareAtomPtrsByShelfDate(&a, &b) < 0; });
 
-            /* rebuild Torrent.pool with what's left */
-            tr_ptrArrayDestruct(&s->pool, nullptr);
-            s->pool = {};
-            qsort(keep, keepCount, sizeof(struct peer_atom*), compareAtomPtrsByAddress);
+    /* free the culled atoms */
+    for (auto it = cull; it != std::end(test); ++it)
+    {
+        removePeerCandidate(s, *it);
+        s->pool.erase(*it);
+    }
 
-            for (i = 0; i < keepCount; ++i)
-            {
-                tr_ptrArrayAppend(&s->pool, keep[i]);
-            }
+    tordbg(s, "max atom count is %zu... pruned from %zu to %zu\n", maxAtomCount, atomCount, std::size(s->pool));
+}
 
-            tordbg(s, "max atom count is %d... pruned from %d to %d\n", maxAtomCount, atomCount, keepCount);
+static void atomPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
+{
+    auto* mgr = static_cast<tr_peerMgr*>(vmgr);
+    auto const lock = mgr->unique_lock();
 
-            /* cleanup */
-            tr_free(test);
-            tr_free(keep);
-        }
+    for (auto* tor : mgr->session->torrents)
+    {
+        pruneAtoms(tor->swarm);
     }
 
     tr_timerAddMsec(mgr->atomTimer, AtomPeriodMsec);
 }
 
+void tr_peerMgrPruneAtoms(tr_torrent* tor)
+{
+    auto const lock = tor->unique_lock();
+
+    pruneAtoms(tor->swarm);
+}
+
 /***
 ****
 ****
@@ -2921,20 +3409,11 @@ static constexpr uint64_t addValToKey(uint64_t value, int width, uint64_t addme)
     return value;
 }
 
-/* smaller value is better */
-static uint64_t getPeerCandidateScore(tr_torrent const* tor, struct peer_atom const* atom, uint8_t salt)
+/* the part of a candidate's score that depends on its torrent */
+static uint64_t getTorrentCandidateScore(tr_torrent const* tor)
 {
     auto i = uint64_t{};
     auto score = uint64_t{};
-    bool const failed = atom->lastConnectionAt < atom->lastConnectionAttemptAt;
-
-    /* prefer peers we've connected to, or never tried, over peers we failed to connect to. */
-    i = failed ? 1 : 0;
-    score = addValToKey(score, 1, i);
-
-    /* prefer the one we attempted least recently (to cycle through all peers) */
-    i = atom->lastConnectionAttemptAt;
-    score = addValToKey(score, 32, i);
 
     /* prefer peers belonging to a torrent of a higher priority */
     switch (tr_torrentGetPriority(tor))
@@ -2962,6 +3441,27 @@ static uint64_t getPeerCandidateScore(tr_torrent const* tor, struct peer_atom co
     i = tr_torrentIsSeed(tor) ? 1 : 0;
     score = addValToKey(score, 1, i);
 
+    return score;
+}
+
+/* smaller value is better. Atoms in the same swarm compare the same way
+ * whatever `torrent_score' is, so the candidate index can leave it out. */
+static uint64_t getPeerCandidateScore(struct peer_atom const* atom, uint64_t torrent_score)
+{
+    auto i = uint64_t{};
+    auto score = uint64_t{};
+    bool const failed = atom->lastConnectionAt < atom->lastConnectionAttemptAt;
+
+    /* prefer peers we've connected to, or never tried, over peers we failed to connect to. */
+    i = failed ? 1 : 0;
+    score = addValToKey(score, 1, i);
+
+    /* prefer the one we attempted least recently (to cycle through all peers) */
+    i = atom->lastConnectionAttemptAt;
+    score = addValToKey(score, 32, i);
+
+    score = addValToKey(score, 6, torrent_score);
+
     /* prefer peers that are known to be connectible */
     i = (atom->flags & ADDED_F_CONNECTABLE) != 0 ? 0 : 1;
     score = addValToKey(score, 1, i);
@@ -2975,25 +3475,94 @@ static uint64_t getPeerCandidateScore(tr_torrent const* tor, struct peer_atom co
     score = addValToKey(score, 4, atom->fromBest);
 
     /* salt */
-    score = addValToKey(score, 8, salt);
+    score = addValToKey(score, 8, atom->candidate_salt);
 
     return score;
 }
 
-static bool calculateAllSeeds(tr_swarm* swarm)
+static void removePeerCandidate(tr_swarm* s, peer_atom* atom)
+{
+    switch (atom->candidate_state)
+    {
+    case CandidateReady:
+        s->candidates_ready.erase({ atom->candidate_key, atom });
+        break;
+
+    case CandidateWaiting:
+        s->candidates_waiting.erase({ atom->candidate_key, atom });
+        break;
+
+    default:
+        break;
+    }
+
+    atom->candidate_state = CandidateUnindexed;
+}
+
+/* Files `atom' in the candidate index according to its current state.
+ * This needs to be called whenever something that goes into its score or
+ * its reconnect interval changes. */
+static void updatePeerCandidate(tr_swarm* s, peer_atom* atom)
 {
-    int nAtoms = 0;
-    struct peer_atom** atoms = (struct peer_atom**)tr_ptrArrayPeek(&swarm->pool, &nAtoms);
+    removePeerCandidate(s, atom);
 
-    for (int i = 0; i < nAtoms; ++i)
+    time_t const now = tr_time();
+
+    if (isPeerCandidate(s->tor, atom, now))
+    {
+        atom->candidate_salt = tr_rand_int_weak(256);
+        atom->candidate_key = getPeerCandidateScore(atom, 0);
+        atom->candidate_state = CandidateReady;
+        s->candidates_ready.emplace(atom->candidate_key, atom);
+    }
+    else
     {
-        if (!atomIsSeed(atoms[i]))
+        /* The reconnect interval can only grow as time passes, so this is
+         * the soonest it might become a candidate. If it's already passed,
+         * something else is in the way; check back in a while. */
+        time_t when = atom->time + getReconnectIntervalSecs(atom, now);
+
+        if (when <= now)
         {
-            return false;
+            when = now + CandidateRecheckSecs;
         }
+
+        atom->candidate_key = static_cast<uint64_t>(when);
+        atom->candidate_state = CandidateWaiting;
+        s->candidates_waiting.emplace(atom->candidate_key, atom);
     }
+}
 
-    return true;
+/* re-file the atoms whose wait is over */
+static void promotePeerCandidates(tr_swarm* s, time_t const now)
+{
+    auto& waiting = s->candidates_waiting;
+
+    while (!std::empty(waiting) && std::begin(waiting)->first <= static_cast<uint64_t>(now))
+    {
+        updatePeerCandidate(s, std::begin(waiting)->second);
+    }
+}
+
+using candidate_iterator = std::set<std::pair<uint64_t, peer_atom*>>::iterator;
+
+/* @return the first ready atom, starting at `it', that's still a candidate.
+ * Any that aren't anymore are sent back to wait. */
+static candidate_iterator findPeerCandidate(tr_swarm* s, candidate_iterator it, time_t const now)
+{
+    while (it != std::end(s->candidates_ready) && !isPeerCandidate(s->tor, it->second, now))
+    {
+        auto* const atom = it->second;
+        ++it;
+        updatePeerCandidate(s, atom);
+    }
+
+    return it;
+}
+
+static bool calculateAllSeeds(tr_swarm* swarm)
+{
+    return std::all_of(std::begin(swarm->pool), std::end(swarm->pool), [](auto const* atom) { return atomIsSeed(atom); });
 }
 
 static bool swarmIsAllSeeds(tr_swarm* swarm)
@@ -3007,87 +3576,164 @@ static bool swarmIsAllSeeds(tr_swarm* swarm)
     return swarm->poolIsAllSeeds;
 }
 
-/** @return an array of all the atoms we might want to connect to */
-static std::vector<peer_candidate> getPeerCandidates(tr_session* session, size_t max)
+/* whether there's room in the session for new outgoing connections */
+static bool sessionWantsPeers(tr_session const* session)
 {
-    time_t const now = tr_time();
-    uint64_t const now_msec = tr_time_msec();
     /* leave 5% of connection slots for incoming connections -- ticket #2609 */
     int const maxCandidates = tr_sessionGetPeerLimit(session) * 0.95;
 
-    /* count how many peers and atoms we've got */
-    int atomCount = 0;
+    /* count how many peers we've got */
     int peerCount = 0;
     for (auto const* tor : session->torrents)
     {
-        atomCount += tr_ptrArraySize(&tor->swarm->pool);
         peerCount += tr_ptrArraySize(&tor->swarm->peers);
     }
 
     /* don't start any new handshakes if we're full up */
-    if (maxCandidates <= peerCount)
+    return peerCount < maxCandidates;
+}
+
+/* whether we'd start new connections for this torrent */
+static bool swarmWantsPeers(tr_torrent* tor, uint64_t const now_msec)
+{
+    if (!tor->swarm->isRunning)
+    {
+        return false;
+    }
+
+    /* if everyone in the swarm is seeds and pex is disabled because
+     * the torrent is private, then don't initiate connections */
+    bool const seeding = tr_torrentIsSeed(tor);
+    if (seeding && swarmIsAllSeeds(tor->swarm) && tr_torrentIsPrivate(tor))
+    {
+        return false;
+    }
+
+    /* if we've already got enough peers in this torrent... */
+    if (tr_torrentGetPeerLimit(tor) <= tr_ptrArraySize(&tor->swarm->peers))
+    {
+        return false;
+    }
+
+    /* if we've already got enough speed in this torrent... */
+    if (seeding && isBandwidthMaxedOut(tor->bandwidth, now_msec, TR_UP))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/** @return the best `max' atoms we might want to connect to */
+static std::vector<peer_candidate> getPeerCandidates(tr_session* session, size_t max)
+{
+    time_t const now = tr_time();
+    uint64_t const now_msec = tr_time_msec();
+
+    if (!sessionWantsPeers(session))
     {
         return {};
     }
 
-    auto candidates = std::vector<peer_candidate>{};
-    candidates.reserve(atomCount);
+    /* each swarm's best remaining candidate, merged across swarms */
+    struct swarm_head
+    {
+        uint64_t score;
+        uint64_t torrent_score;
+        tr_torrent* tor;
+        candidate_iterator it;
+    };
+
+    auto const worse = [](auto const& a, auto const& b) { return a.score > b.score; };
+
+    auto heads = std::vector<swarm_head>{};
 
-    /* populate the candidate array */
     for (auto* tor : session->torrents)
     {
-        if (!tor->swarm->isRunning)
+        if (!swarmWantsPeers(tor, now_msec))
         {
             continue;
         }
 
-        /* if everyone in the swarm is seeds and pex is disabled because
-         * the torrent is private, then don't initiate connections */
-        bool const seeding = tr_torrentIsSeed(tor);
-        if (seeding && swarmIsAllSeeds(tor->swarm) && tr_torrentIsPrivate(tor))
+        tr_swarm* const s = tor->swarm;
+        promotePeerCandidates(s, now);
+
+        auto const it = findPeerCandidate(s, std::begin(s->candidates_ready), now);
+
+        if (it != std::end(s->candidates_ready))
         {
-            continue;
+            auto const torrent_score = getTorrentCandidateScore(tor);
+            heads.push_back({ getPeerCandidateScore(it->second, torrent_score), torrent_score, tor, it });
         }
+    }
+
+    std::make_heap(std::begin(heads), std::end(heads), worse);
+
+    auto candidates = std::vector<peer_candidate>{};
+    candidates.reserve(std::min(max, std::size(heads)));
 
-        /* if we've already got enough peers in this torrent... */
-        if (tr_torrentGetPeerLimit(tor) <= tr_ptrArraySize(&tor->swarm->peers))
+    while (std::size(candidates) < max && !std::empty(heads))
+    {
+        std::pop_heap(std::begin(heads), std::end(heads), worse);
+        auto& head = heads.back();
+        candidates.push_back({ head.score, head.tor, head.it->second });
+
+        tr_swarm* const s = head.tor->swarm;
+        head.it = findPeerCandidate(s, std::next(head.it), now);
+
+        if (head.it == std::end(s->candidates_ready))
         {
-            continue;
+            heads.pop_back();
         }
-
-        /* if we've already got enough speed in this torrent... */
-        if (seeding && isBandwidthMaxedOut(tor->bandwidth, now_msec, TR_UP))
+        else
         {
-            continue;
+            head.score = getPeerCandidateScore(head.it->second, head.torrent_score);
+            std::push_heap(std::begin(heads), std::end(heads), worse);
         }
+    }
 
-        auto nAtoms = int{};
-        peer_atom** atoms = (peer_atom**)tr_ptrArrayPeek(&tor->swarm->pool, &nAtoms);
+    return candidates;
+}
+
+std::pair<std::vector<uint64_t>, std::vector<uint64_t>> tr_peerMgrPeerCandidateScores(tr_session* session, size_t max)
+{
+    auto const lock = session->unique_lock();
 
-        for (int i = 0; i < nAtoms; ++i)
+    auto indexed = std::vector<uint64_t>{};
+    for (auto const& candidate : getPeerCandidates(session, max))
+    {
+        indexed.push_back(candidate.score);
+    }
+
+    /* score every atom in every swarm, the way it was done before the index */
+    auto scanned = std::vector<uint64_t>{};
+    time_t const now = tr_time();
+    uint64_t const now_msec = tr_time_msec();
+
+    if (sessionWantsPeers(session))
+    {
+        for (auto* tor : session->torrents)
         {
-            struct peer_atom* atom = atoms[i];
+            if (!swarmWantsPeers(tor, now_msec))
+            {
+                continue;
+            }
 
-            if (isPeerCandidate(tor, atom, now))
+            auto const torrent_score = getTorrentCandidateScore(tor);
+            for (auto* const atom : tor->swarm->pool)
             {
-                uint8_t const salt = tr_rand_int_weak(1024);
-                candidates.push_back({ getPeerCandidateScore(tor, atom, salt), tor, atom });
+                if (isPeerCandidate(tor, atom, now))
+                {
+                    scanned.push_back(getPeerCandidateScore(atom, torrent_score));
+                }
             }
         }
     }
 
-    // only keep the best `max` candidates
-    if (std::size(candidates) > max)
-    {
-        std::partial_sort(
-            std::begin(candidates),
-            std::begin(candidates) + max,
-            std::end(candidates),
-            [](auto const& a, auto const& b) { return a.score < b.score; });
-        candidates.resize(max);
-    }
+    std::sort(std::begin(scanned), std::end(scanned));
+    scanned.resize(std::min(max, std::size(scanned)));
 
-    return candidates;
+    return { indexed, scanned };
 }
 
 static void initiateConnection(tr_peerMgr* mgr, tr_swarm* s, struct peer_atom* atom)
@@ -3133,6 +3779,7 @@ static void initiateConnection(tr_peerMgr* mgr, tr_swarm* s, struct peer_atom* a
 
     atom->lastConnectionAttemptAt = now;
     atom->time = now;
+    updatePeerCandidate(s, atom);
 }
 
 static void initiateCandidateConnection(tr_peerMgr* mgr, peer_candidate& c)
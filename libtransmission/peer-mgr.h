@@ -13,6 +13,8 @@
 #endif
 
 #include <inttypes.h> /* uint16_t */
+#include <utility> /* std::pair */
+#include <vector>
 
 #ifdef _WIN32
 #include <winsock2.h> /* struct in_addr */
@@ -130,14 +132,97 @@ void tr_peerMgrRemoveTorrent(tr_torrent* tor);
 
 void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned int tabCount);
 
+/* Returns how many connected peers have a piece, or -1 if we have it too. */
+int tr_peerMgrPieceAvailability(tr_torrent const* tor, tr_piece_index_t piece);
+
 uint64_t tr_peerMgrGetDesiredAvailable(tr_torrent const* tor);
 
 void tr_peerMgrOnTorrentGotMetainfo(tr_torrent* tor);
 
+/* call when pieces have been marked or unmarked as DND,
+ * or when a verify has changed which pieces we have */
+void tr_peerMgrOnPiecesWantedChanged(tr_torrent* tor);
+
+/** @brief Private function that's exposed here only for unit tests */
+std::vector<size_t> tr_peerMgrInterestingPieceCounts(tr_torrent* tor);
+
+/**
+ * @brief Private function that's exposed here only for unit tests
+ *
+ * Returns the scores of the best `max` atoms to connect to, first as
+ * picked from the candidate index and then by scoring every atom.
+ */
+std::pair<std::vector<uint64_t>, std::vector<uint64_t>> tr_peerMgrPeerCandidateScores(tr_session* session, size_t max);
+
+/** @brief Private function that's exposed here only for unit tests */
+void tr_peerMgrPruneAtoms(tr_torrent* tor);
+
+/**
+ * @brief Private function that's exposed here only for unit tests
+ *
+ * Does what the rechoke timer does for `tor`'s uploads, and returns
+ * false if that was skipped because nothing had changed.
+ */
+bool tr_peerMgrRechokeUploadsIfNeeded(tr_torrent* tor);
+
 void tr_peerMgrOnBlocklistChanged(tr_peerMgr* manager);
 
 struct tr_peer_stat* tr_peerMgrPeerStats(tr_torrent const* tor, int* setmeCount);
 
+/**
+ * The same information as a tr_peer_stat, but kept in binary form
+ * so that taking a snapshot doesn't need any string formatting.
+ * @see tr_peerMgrPeerSnapshots()
+ */
+struct tr_peer_snapshot
+{
+    tr_address addr;
+    tr_quark client;
+
+    float progress;
+    unsigned int rateToPeer_Bps;
+    unsigned int rateToClient_Bps;
+
+    uint32_t blocksToPeer;
+    uint32_t blocksToClient;
+    uint32_t cancelsToPeer;
+    uint32_t cancelsToClient;
+
+    int pendingReqsToClient;
+    int pendingReqsToPeer;
+    int desiredReqsToPeer;
+
+    uint32_t rttMsec;
+    uint32_t bytesPerWrite;
+    uint32_t havesToPeer;
+    uint32_t havesSuppressed;
+
+    tr_port port; /* this field is in network byte order */
+    uint8_t from;
+
+    bool isUTP;
+    bool isEncrypted;
+    bool isDownloadingFrom;
+    bool isUploadingTo;
+    bool isSeed;
+    bool isOptimistic;
+    bool peerIsChoked;
+    bool peerIsInterested;
+    bool clientIsChoked;
+    bool clientIsInterested;
+    bool isIncoming;
+};
+
+/**
+ * Replace the contents of `setme' with a snapshot of the torrent's peers.
+ * `setme' keeps its capacity, so a caller that polls often can reuse one
+ * vector and not allocate at all once it's grown to the swarm's size.
+ */
+void tr_peerMgrPeerSnapshots(tr_torrent const* tor, std::vector<tr_peer_snapshot>* setme);
+
+/** Writes a snapshot's flags, as described for tr_peer_stat.flagStr, into `buf' */
+void tr_peerSnapshotFlagStr(tr_peer_snapshot const* snapshot, char* buf, size_t buflen);
+
 double* tr_peerMgrWebSpeeds_KBps(tr_torrent const* tor);
 
 unsigned int tr_peerGetPieceSpeed_Bps(tr_peer const* peer, uint64_t now, tr_direction direction);
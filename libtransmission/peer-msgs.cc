@@ -14,6 +14,7 @@
 #include <iostream>
 #include <memory> // std::unique_ptr
 #include <optional>
+#include <vector>
 
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
@@ -120,10 +121,20 @@ static auto constexpr LowPriorityIntervalSecs = int{ 10 };
 // how many blocks to keep prefetched per peer
 static auto constexpr PrefetchSize = int{ 18 };
 
-// when we're making requests from another peer,
-// batch them together to send enough requests to
-// meet our bandwidth goals for the next N seconds
-static auto constexpr RequestBufSecs = int{ 10 };
+// when we're making requests from another peer, keep enough of them
+// in flight to cover the bandwidth-delay product (the peer's rate times
+// its round-trip time) plus N more seconds at that rate, so that the
+// pipe doesn't run dry between refills
+static auto constexpr RequestBufSecs = int{ 3 };
+
+// how many requests to keep in flight before we've timed a round trip
+static auto constexpr InitialRequestCount = size_t{ 32 };
+
+// never let the request queue shrink below this
+static auto constexpr MinRequestCount = size_t{ 4 };
+
+// give up on timing a request if it hasn't been answered by now
+static auto constexpr RttProbeTimeoutMsec = uint64_t{ 60 * 1000 };
 
 namespace
 {
@@ -187,9 +198,10 @@ static void didWrite(tr_peerIo* io, size_t bytesWritten, bool wasPieceData, void
 static void gotError(tr_peerIo* io, short what, void* vmsgs);
 static void peerPulse(void* vmsgs);
 static void pexPulse(evutil_socket_t fd, short what, void* vmsgs);
+static void pokeBatchPeriod(tr_peerMsgsImpl* msgs, int interval);
 static void protocolSendCancel(tr_peerMsgsImpl* msgs, struct peer_request const& req);
 static void protocolSendChoke(tr_peerMsgsImpl* msgs, bool choke);
-static void protocolSendHave(tr_peerMsgsImpl* msgs, tr_piece_index_t index);
+static void protocolSendHaves(tr_peerMsgsImpl* msgs);
 static void protocolSendPort(tr_peerMsgsImpl* msgs, uint16_t port);
 static void sendInterest(tr_peerMsgsImpl* msgs, bool b);
 static void sendLtepHandshake(tr_peerMsgsImpl* msgs);
@@ -331,6 +343,11 @@ public:
         return tr_peerIoIsEncrypted(io);
     }
 
+    size_t get_bytes_per_write() const override
+    {
+        return tr_peerIoGetBytesPerWrite(io);
+    }
+
     bool is_incoming_connection() const override
     {
         return tr_peerIoIsIncoming(io);
@@ -363,9 +380,62 @@ public:
 
     void cancel_block_request(tr_block_index_t block) override
     {
+        cancel_rtt_probe(block);
         protocolSendCancel(this, blockToReq(torrent, block));
     }
 
+    uint32_t get_rtt_msec() const override
+    {
+        return srtt_msec;
+    }
+
+    size_t get_desired_request_count() const override
+    {
+        return desired_request_count;
+    }
+
+    // start timing the request for `block` unless we're already timing one
+    void start_rtt_probe(tr_block_index_t block, size_t n_requests_ahead, uint64_t now_msec)
+    {
+        if (!rtt_probe || rtt_probe->sent_at_msec + RttProbeTimeoutMsec < now_msec)
+        {
+            rtt_probe = RttProbe{ block, now_msec, n_requests_ahead };
+        }
+    }
+
+    void cancel_rtt_probe(tr_block_index_t block)
+    {
+        if (rtt_probe && rtt_probe->block == block)
+        {
+            rtt_probe.reset();
+        }
+    }
+
+    // fold the probe's round trip into srtt_msec if `block` is the one we were timing
+    void finish_rtt_probe(tr_block_index_t block, uint64_t now_msec)
+    {
+        if (!rtt_probe || rtt_probe->block != block)
+        {
+            return;
+        }
+
+        auto latency_msec = now_msec - rtt_probe->sent_at_msec;
+
+        // some of that time was spent waiting for the peer to
+        // send the blocks we'd requested before this one
+        if (auto const rate_Bps = tr_peerGetPieceSpeed_Bps(this, now_msec, TR_PEER_TO_CLIENT); rate_Bps > 0)
+        {
+            auto const queued_msec = uint64_t{ rtt_probe->n_requests_ahead } * torrent->block_size * 1000U / rate_Bps;
+            latency_msec = latency_msec > queued_msec ? latency_msec - queued_msec : 0;
+        }
+
+        auto const sample_msec = static_cast<uint32_t>(std::clamp(latency_msec, uint64_t{ 1 }, RttProbeTimeoutMsec));
+
+        // smooth it the same way TCP does (RFC 6298)
+        srtt_msec = srtt_msec == 0 ? sample_msec : (7 * srtt_msec + sample_msec) / 8;
+        rtt_probe.reset();
+    }
+
     void set_choke(bool peer_is_choked) override
     {
         time_t const now = tr_time();
@@ -397,7 +467,17 @@ public:
 
     void on_piece_completed(tr_piece_index_t piece) override
     {
-        protocolSendHave(this, piece);
+        // HAVEs are batched and sent when outMessages is next flushed.
+        // There's no point in telling a peer about a piece it already has.
+        if (have.test(piece))
+        {
+            ++havesSuppressed;
+        }
+        else
+        {
+            pending_haves.push_back(piece);
+            pokeBatchPeriod(this, LowPriorityIntervalSecs);
+        }
 
         // since we have more pieces now, we might not be interested in this peer
         update_interest();
@@ -469,6 +549,13 @@ public:
         publish(e);
     }
 
+    void publishClientGotInterested(bool interested)
+    {
+        auto e = tr_peer_event{};
+        e.eventType = interested ? TR_PEER_CLIENT_GOT_INTERESTED : TR_PEER_CLIENT_GOT_NOT_INTERESTED;
+        publish(e);
+    }
+
     void publishClientGotPieceData(uint32_t length)
     {
         auto e = tr_peer_event{};
@@ -585,8 +672,24 @@ public:
 
     size_t desired_request_count = 0;
 
+    /* smoothed round-trip time, or 0 if we haven't timed a request yet */
+    uint32_t srtt_msec = 0;
+
+    /* the block request we're timing to update srtt_msec */
+    struct RttProbe
+    {
+        tr_block_index_t block;
+        uint64_t sent_at_msec;
+        size_t n_requests_ahead;
+    };
+
+    std::optional<RttProbe> rtt_probe;
+
     int prefetchCount = 0;
 
+    /* pieces we've completed but haven't sent HAVE messages for yet */
+    std::vector<tr_piece_index_t> pending_haves;
+
     /* how long the outMessages batch should be allowed to grow before
      * it's flushed -- some messages (like requests >:) should be sent
      * very quickly; others aren't as urgent. */
@@ -659,34 +762,23 @@ static void myDebug(char const* file, int line, tr_peerMsgsImpl const* msgs, cha
 
 static void myDebug(char const* file, int line, tr_peerMsgsImpl const* msgs, char const* fmt, ...)
 {
-    tr_sys_file_t const fp = tr_logGetFile();
-
-    if (fp != TR_BAD_SYS_FILE)
-    {
-        va_list args;
-        char timestr[64];
-        char addrstr[TR_ADDRSTRLEN];
-        struct evbuffer* buf = evbuffer_new();
-        char* base = tr_sys_path_basename(file, nullptr);
-
-        evbuffer_add_printf(
-            buf,
-            "[%s] %s - %s [%s]: ",
-            tr_logGetTimeStr(timestr, sizeof(timestr)),
-            tr_torrentName(msgs->torrent),
-            tr_peerIoGetAddrStr(msgs->io, addrstr, sizeof(addrstr)),
-            tr_quark_get_string(msgs->client));
-        va_start(args, fmt);
-        evbuffer_add_vprintf(buf, fmt, args);
-        va_end(args);
-        evbuffer_add_printf(buf, " (%s:%d)", base, line);
-
-        char* const message = evbuffer_free_to_str(buf, nullptr);
-        tr_sys_file_write_line(fp, message, nullptr);
-
-        tr_free(base);
-        tr_free(message);
-    }
+    char addrstr[TR_ADDRSTRLEN];
+    char name[512];
+    tr_snprintf(
+        name,
+        sizeof(name),
+        "%s - %s [%s]:",
+        tr_torrentName(msgs->torrent),
+        tr_peerIoGetAddrStr(msgs->io, addrstr, sizeof(addrstr)),
+        tr_quark_get_string(msgs->client));
+
+    char message[1024];
+    va_list args;
+    va_start(args, fmt);
+    evutil_vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+
+    tr_logAddDeep(file, line, name, "%s", message);
 }
 
 #define dbgmsg(msgs, ...) \
@@ -716,6 +808,14 @@ static void dbgOutMessageLen(tr_peerMsgsImpl* msgs)
     dbgmsg(msgs, "outMessage size is now %zu", evbuffer_get_length(msgs->outMessages));
 }
 
+/* for building messages directly in reserved buffer space */
+static uint8_t* writeUint32(uint8_t* walk, uint32_t val)
+{
+    val = htonl(val);
+    memcpy(walk, &val, sizeof(val));
+    return walk + sizeof(val);
+}
+
 static void protocolSendReject(tr_peerMsgsImpl* msgs, struct peer_request const* req)
 {
     TR_ASSERT(tr_peerIoSupportsFEXT(msgs->io));
@@ -772,17 +872,58 @@ static void protocolSendPort(tr_peerMsgsImpl* msgs, uint16_t port)
     evbuffer_add_uint16(out, port);
 }
 
-static void protocolSendHave(tr_peerMsgsImpl* msgs, tr_piece_index_t index)
+static void protocolSendHaves(tr_peerMsgsImpl* msgs)
 {
+    auto& pending = msgs->pending_haves;
+
+    // the peer may have gotten some of these pieces while they were queued
+    auto const it = std::remove_if(
+        std::begin(pending),
+        std::end(pending),
+        [msgs](tr_piece_index_t piece) { return msgs->have.test(piece); });
+    msgs->havesSuppressed += std::distance(it, std::end(pending));
+    pending.erase(it, std::end(pending));
+
+    if (std::empty(pending))
+    {
+        return;
+    }
+
+    /* write them all in one go rather than three evbuffer_add()s per HAVE */
+    auto constexpr MsgLen = sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t);
+    auto const n = std::size(pending);
     struct evbuffer* out = msgs->outMessages;
+    struct evbuffer_iovec iovec;
+
+    if (evbuffer_reserve_space(out, n * MsgLen, &iovec, 1) == 1 && iovec.iov_len >= n * MsgLen)
+    {
+        auto* walk = static_cast<uint8_t*>(iovec.iov_base);
+        for (auto const piece : pending)
+        {
+            walk = writeUint32(walk, sizeof(uint8_t) + sizeof(uint32_t));
+            *walk++ = BtHave;
+            walk = writeUint32(walk, piece);
+        }
+
+        iovec.iov_len = n * MsgLen;
+        evbuffer_commit_space(out, &iovec, 1);
+    }
+    else
+    {
+        /* couldn't get the space in one piece; add them one at a time */
+        for (auto const piece : pending)
+        {
+            evbuffer_add_uint32(out, sizeof(uint8_t) + sizeof(uint32_t));
+            evbuffer_add_uint8(out, BtHave);
+            evbuffer_add_uint32(out, piece);
+        }
+    }
 
-    evbuffer_add_uint32(out, sizeof(uint8_t) + sizeof(uint32_t));
-    evbuffer_add_uint8(out, BtHave);
-    evbuffer_add_uint32(out, index);
+    msgs->havesSentToPeer += n;
+    pending.clear();
 
-    dbgmsg(msgs, "sending Have %u", index);
+    dbgmsg(msgs, "sending %zu Haves (%u sent, %u suppressed so far)", n, msgs->havesSentToPeer, msgs->havesSuppressed);
     dbgOutMessageLen(msgs);
-    pokeBatchPeriod(msgs, LowPriorityIntervalSecs);
 }
 
 #if 0
@@ -1663,6 +1804,7 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
     case BtChoke:
         dbgmsg(msgs, "got Choke");
         msgs->client_is_choked_ = true;
+        msgs->rtt_probe.reset();
 
         if (!fext)
         {
@@ -1681,13 +1823,25 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
 
     case BtInterested:
         dbgmsg(msgs, "got Interested");
-        msgs->peer_is_interested_ = true;
+
+        if (!msgs->peer_is_interested_)
+        {
+            msgs->peer_is_interested_ = true;
+            msgs->publishClientGotInterested(true);
+        }
+
         msgs->update_active(TR_CLIENT_TO_PEER);
         break;
 
     case BtNotInterested:
         dbgmsg(msgs, "got Not Interested");
-        msgs->peer_is_interested_ = false;
+
+        if (msgs->peer_is_interested_)
+        {
+            msgs->peer_is_interested_ = false;
+            msgs->publishClientGotInterested(false);
+        }
+
         msgs->update_active(TR_CLIENT_TO_PEER);
         break;
 
@@ -1716,8 +1870,10 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
             uint8_t* tmp = tr_new(uint8_t, msglen);
             dbgmsg(msgs, "got a bitfield");
             tr_peerIoReadBytes(msgs->io, inbuf, tmp, msglen);
-            msgs->have.setRaw(tmp, msglen);
-            msgs->publishClientGotBitfield(&msgs->have);
+            auto bitfield = tr_bitfield{ msgs->have.size() };
+            bitfield.setRaw(tmp, msglen);
+            msgs->publishClientGotBitfield(&bitfield);
+            msgs->have = std::move(bitfield);
             updatePeerProgress(msgs);
             tr_free(tmp);
             break;
@@ -1810,8 +1966,8 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
 
         if (fext)
         {
-            msgs->have.setHasAll();
             msgs->publishClientGotHaveAll();
+            msgs->have.setHasAll();
             updatePeerProgress(msgs);
         }
         else
@@ -1827,8 +1983,8 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
 
         if (fext)
         {
-            msgs->have.setHasNone();
             msgs->publishClientGotHaveNone();
+            msgs->have.setHasNone();
             updatePeerProgress(msgs);
         }
         else
@@ -1849,6 +2005,7 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
 
             if (fext)
             {
+                msgs->cancel_rtt_probe(msgs->torrent->blockOf(r.index, r.offset));
                 msgs->publishGotRej(&r);
             }
             else
@@ -1899,6 +2056,8 @@ static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* data, struct p
         return EMSGSIZE;
     }
 
+    msgs->finish_rtt_probe(block, tr_time_msec());
+
     dbgmsg(msgs, "got block %u:%u->%u", req->index, req->offset, req->length);
 
     if (!tr_peerMgrDidPeerRequest(msgs->torrent, msgs, block))
@@ -2023,13 +2182,13 @@ static void updateDesiredRequestCount(tr_peerMsgsImpl* msgs)
             rate_Bps = std::min(rate_Bps, irate_Bps);
         }
 
-        /* use this desired rate to figure out how
-         * many requests we should send to this peer */
-        size_t constexpr Floor = 32;
-        size_t constexpr Seconds = RequestBufSecs;
-        size_t const estimated_blocks_in_period = (rate_Bps * Seconds) / torrent->block_size;
-        size_t const ceil = msgs->reqq ? *msgs->reqq : 250;
-        msgs->desired_request_count = std::clamp(estimated_blocks_in_period, Floor, ceil);
+        /* use this desired rate and the peer's round-trip time to figure
+         * out how many requests we should keep in flight to this peer */
+        auto const pipeline_msec = uint64_t{ msgs->srtt_msec } + RequestBufSecs * 1000U;
+        auto const estimated_blocks_in_pipeline = size_t(rate_Bps * pipeline_msec / 1000U / torrent->block_size);
+        auto const floor = msgs->srtt_msec == 0 ? InitialRequestCount : MinRequestCount;
+        auto const ceil = std::max(floor, msgs->reqq ? *msgs->reqq : size_t{ 250 });
+        msgs->desired_request_count = std::clamp(estimated_blocks_in_pipeline, floor, ceil);
     }
 }
 
@@ -2086,10 +2245,13 @@ static void updateBlockRequests(tr_peerMsgsImpl* msgs)
     TR_ASSERT(!msgs->is_client_choked());
 
     // std::cout << __FILE__ << ':' << __LINE__ << " wants " << n_wanted << " blocks to request" << std::endl;
+    auto const now_msec = tr_time_msec();
+    auto n_requests_ahead = n_active;
     for (auto const span : tr_peerMgrGetNextRequests(msgs->torrent, msgs, n_wanted))
     {
         for (tr_block_index_t block = span.begin; block < span.end; ++block)
         {
+            msgs->start_rtt_probe(block, n_requests_ahead++, now_msec);
             protocolSendRequest(msgs, blockToReq(msgs->torrent, block));
         }
 
@@ -2102,7 +2264,7 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
 {
     size_t bytesWritten = 0;
     struct peer_request req;
-    bool const haveMessages = evbuffer_get_length(msgs->outMessages) != 0;
+    bool const haveMessages = evbuffer_get_length(msgs->outMessages) != 0 || !std::empty(msgs->pending_haves);
     bool const fext = tr_peerIoSupportsFEXT(msgs->io);
 
     /**
@@ -2116,11 +2278,16 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
     }
     else if (haveMessages && now - msgs->outMessagesBatchedAt >= msgs->outMessagesBatchPeriod)
     {
+        protocolSendHaves(msgs);
+
         size_t const len = evbuffer_get_length(msgs->outMessages);
         /* flush the protocol messages */
         dbgmsg(msgs, "flushing outMessages... to %p (length is %zu)", (void*)msgs->io, len);
-        tr_peerIoWriteBuf(msgs->io, msgs->outMessages, false);
-        msgs->clientSentAnythingAt = now;
+        if (len != 0)
+        {
+            tr_peerIoWriteBuf(msgs->io, msgs->outMessages, false);
+            msgs->clientSentAnythingAt = now;
+        }
         msgs->outMessagesBatchedAt = 0;
         msgs->outMessagesBatchPeriod = LowPriorityIntervalSecs;
         bytesWritten += len;
@@ -2201,26 +2368,21 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
         if (requestIsValid(msgs, &req) && msgs->torrent->hasPiece(req.index))
         {
             uint32_t const msglen = 4 + 1 + 4 + 4 + req.length;
-            struct evbuffer_iovec iovec[1];
-
-            auto* const out = evbuffer_new();
-            evbuffer_expand(out, msglen);
-
-            evbuffer_add_uint32(out, sizeof(uint8_t) + 2 * sizeof(uint32_t) + req.length);
-            evbuffer_add_uint8(out, BtPiece);
-            evbuffer_add_uint32(out, req.index);
-            evbuffer_add_uint32(out, req.offset);
-
-            evbuffer_reserve_space(out, req.length, iovec, 1);
-            bool err = tr_cacheReadBlock(
-                           msgs->session->cache,
-                           msgs->torrent,
-                           req.index,
-                           req.offset,
-                           req.length,
-                           static_cast<uint8_t*>(iovec[0].iov_base)) != 0;
-            iovec[0].iov_len = req.length;
-            evbuffer_commit_space(out, iovec, 1);
+
+            /* assemble the header and read the block straight into the
+               peer's outbuf, so the payload is never copied twice */
+            auto* const walk = tr_peerIoReserveBytes(msgs->io, msglen);
+            bool err = walk == nullptr;
+
+            if (!err)
+            {
+                auto* payload = writeUint32(walk, sizeof(uint8_t) + 2 * sizeof(uint32_t) + req.length);
+                *payload++ = BtPiece;
+                payload = writeUint32(payload, req.index);
+                payload = writeUint32(payload, req.offset);
+
+                err = tr_cacheReadBlock(msgs->session->cache, msgs->torrent, req.index, req.offset, req.length, payload) != 0;
+            }
 
             /* check the piece if it needs checking... */
             if (!err)
@@ -2244,17 +2406,13 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
             }
             else
             {
-                size_t const n = evbuffer_get_length(out);
                 dbgmsg(msgs, "sending block %u:%u->%u", req.index, req.offset, req.length);
-                TR_ASSERT(n == msglen);
-                tr_peerIoWriteBuf(msgs->io, out, true);
-                bytesWritten += n;
+                tr_peerIoCommitBytes(msgs->io, msglen, true);
+                bytesWritten += msglen;
                 msgs->clientSentAnythingAt = now;
                 msgs->blocksSentToPeer.add(tr_time(), 1);
             }
 
-            evbuffer_free(out);
-
             if (err)
             {
                 bytesWritten = 0;
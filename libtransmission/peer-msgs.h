@@ -52,6 +52,15 @@ public:
 
     virtual void cancel_block_request(tr_block_index_t block) = 0;
 
+    /* smoothed round-trip time in msec, or 0 if it hasn't been measured yet */
+    virtual uint32_t get_rtt_msec() const = 0;
+
+    /* how many block requests we're trying to keep in flight to this peer */
+    virtual size_t get_desired_request_count() const = 0;
+
+    /* average bytes sent per socket write, or 0 if unknown */
+    virtual size_t get_bytes_per_write() const = 0;
+
     virtual void set_choke(bool peer_is_choked) = 0;
     virtual void set_interested(bool client_is_interested) = 0;
 
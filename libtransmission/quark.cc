@@ -10,7 +10,10 @@
 #include <array>
 #include <cstring> // strlen()
 #include <iterator>
+#include <mutex>
+#include <shared_mutex>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "transmission.h"
@@ -23,7 +26,7 @@ using namespace std::literals;
 namespace
 {
 
-auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
+auto constexpr my_static = std::array<std::string_view, 400>{ ""sv,
                                                               "activeTorrentCount"sv,
                                                               "activity-date"sv,
                                                               "activityDate"sv,
@@ -47,6 +50,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "anti-brute-force-enabled"sv,
                                                               "anti-brute-force-threshold"sv,
                                                               "arguments"sv,
+                                                              "availability"sv,
                                                               "bandwidth-priority"sv,
                                                               "bandwidthPriority"sv,
                                                               "bind-address-ipv4"sv,
@@ -68,6 +72,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "compact-view"sv,
                                                               "complete"sv,
                                                               "config-dir"sv,
+                                                              "connectMsec"sv,
                                                               "cookies"sv,
                                                               "corrupt"sv,
                                                               "corruptEver"sv,
@@ -84,6 +89,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "destination"sv,
                                                               "details-window-height"sv,
                                                               "details-window-width"sv,
+                                                              "dhUsec"sv,
                                                               "dht-enabled"sv,
                                                               "display-name"sv,
                                                               "dnd"sv,
@@ -137,6 +143,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "fromLtep"sv,
                                                               "fromPex"sv,
                                                               "fromTracker"sv,
+                                                              "handshake-latency"sv,
                                                               "hasAnnounced"sv,
                                                               "hasScraped"sv,
                                                               "hashString"sv,
@@ -248,6 +255,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "piece"sv,
                                                               "piece length"sv,
                                                               "pieceCount"sv,
+                                                              "pieceHashBytes"sv,
                                                               "pieceSize"sv,
                                                               "pieces"sv,
                                                               "play-download-complete-sound"sv,
@@ -383,6 +391,8 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "trackerReplace"sv,
                                                               "trackerStats"sv,
                                                               "trackers"sv,
+                                                              "transfersDone"sv,
+                                                              "transfersOnReusedConnection"sv,
                                                               "trash-can-enabled"sv,
                                                               "trash-original-torrent-files"sv,
                                                               "umask"sv,
@@ -413,6 +423,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "warning message"sv,
                                                               "watch-dir"sv,
                                                               "watch-dir-enabled"sv,
+                                                              "web-stats"sv,
                                                               "webseeds"sv,
                                                               "webseedsSendingToUs"sv };
 
@@ -433,13 +444,21 @@ size_t constexpr quarks_are_sorted = ( //
 static_assert(quarks_are_sorted, "Predefined quarks must be sorted by their string value");
 static_assert(std::size(my_static) == TR_N_KEYS);
 
-auto& my_runtime{ *new std::vector<std::string_view>{} };
+/* Quarks added at runtime, e.g. for unknown dict keys or tracker URLs.
+ * There can be many of these, so they're indexed by a hash table, and
+ * they're guarded by a lock since parsing can happen off the event thread.
+ * Like the strings themselves, this is never freed. */
+struct RuntimeQuarks
+{
+    std::shared_mutex mutex;
+    std::vector<std::string_view> strings;
+    std::unordered_map<std::string_view, tr_quark> index;
+};
 
-} // namespace
+auto& my_runtime{ *new RuntimeQuarks{} };
 
-std::optional<tr_quark> tr_quark_lookup(std::string_view key)
+std::optional<tr_quark> lookupStatic(std::string_view key)
 {
-    // is it in our static array?
     auto constexpr sbegin = std::begin(my_static), send = std::end(my_static);
     auto const sit = std::lower_bound(sbegin, send, key);
     if (sit != send && *sit == key)
@@ -447,17 +466,36 @@ std::optional<tr_quark> tr_quark_lookup(std::string_view key)
         return std::distance(sbegin, sit);
     }
 
-    /* was it added during runtime? */
-    auto const rbegin = std::begin(my_runtime), rend = std::end(my_runtime);
-    auto const rit = std::find(rbegin, rend, key);
-    if (rit != rend)
+    return {};
+}
+
+// the caller must hold my_runtime.mutex
+std::optional<tr_quark> lookupRuntime(std::string_view key)
+{
+    auto const it = my_runtime.index.find(key);
+    if (it != std::end(my_runtime.index))
     {
-        return TR_N_KEYS + std::distance(rbegin, rit);
+        return it->second;
     }
 
     return {};
 }
 
+} // namespace
+
+std::optional<tr_quark> tr_quark_lookup(std::string_view key)
+{
+    // is it in our static array?
+    if (auto const quark = lookupStatic(key); quark)
+    {
+        return quark;
+    }
+
+    /* was it added during runtime? */
+    auto const lock = std::shared_lock{ my_runtime.mutex };
+    return lookupRuntime(key);
+}
+
 tr_quark tr_quark_new(std::string_view str)
 {
     auto const prior = tr_quark_lookup(str);
@@ -466,14 +504,30 @@ tr_quark tr_quark_new(std::string_view str)
         return *prior;
     }
 
-    auto const ret = TR_N_KEYS + std::size(my_runtime);
-    my_runtime.emplace_back(tr_strndup(std::data(str), std::size(str)), std::size(str));
+    auto const lock = std::unique_lock{ my_runtime.mutex };
+
+    // another thread may have added it while we were unlocked
+    if (auto const quark = lookupRuntime(str); quark)
+    {
+        return *quark;
+    }
+
+    auto const ret = TR_N_KEYS + std::size(my_runtime.strings);
+    auto const copy = std::string_view{ tr_strndup(std::data(str), std::size(str)), std::size(str) };
+    my_runtime.strings.push_back(copy);
+    my_runtime.index.emplace(copy, ret);
     return ret;
 }
 
 std::string_view tr_quark_get_string_view(tr_quark q)
 {
-    return q < TR_N_KEYS ? my_static[q] : my_runtime[q - TR_N_KEYS];
+    if (q < TR_N_KEYS)
+    {
+        return my_static[q];
+    }
+
+    auto const lock = std::shared_lock{ my_runtime.mutex };
+    return my_runtime.strings[q - TR_N_KEYS];
 }
 
 char const* tr_quark_get_string(tr_quark q, size_t* len)
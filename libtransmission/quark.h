@@ -50,6 +50,7 @@ enum
     TR_KEY_anti_brute_force_enabled, /* rpc */
     TR_KEY_anti_brute_force_threshold, /* rpc */
     TR_KEY_arguments, /* rpc */
+    TR_KEY_availability, /* rpc */
     TR_KEY_bandwidth_priority,
     TR_KEY_bandwidthPriority,
     TR_KEY_bind_address_ipv4,
@@ -71,6 +72,7 @@ enum
     TR_KEY_compact_view,
     TR_KEY_complete,
     TR_KEY_config_dir,
+    TR_KEY_connectMsec,
     TR_KEY_cookies,
     TR_KEY_corrupt,
     TR_KEY_corruptEver,
@@ -87,6 +89,7 @@ enum
     TR_KEY_destination,
     TR_KEY_details_window_height,
     TR_KEY_details_window_width,
+    TR_KEY_dhUsec,
     TR_KEY_dht_enabled,
     TR_KEY_display_name,
     TR_KEY_dnd,
@@ -140,6 +143,7 @@ enum
     TR_KEY_fromLtep,
     TR_KEY_fromPex,
     TR_KEY_fromTracker,
+    TR_KEY_handshake_latency,
     TR_KEY_hasAnnounced,
     TR_KEY_hasScraped,
     TR_KEY_hashString,
@@ -251,6 +255,7 @@ enum
     TR_KEY_piece,
     TR_KEY_piece_length,
     TR_KEY_pieceCount,
+    TR_KEY_pieceHashBytes,
     TR_KEY_pieceSize,
     TR_KEY_pieces,
     TR_KEY_play_download_complete_sound,
@@ -386,6 +391,8 @@ enum
     TR_KEY_trackerReplace,
     TR_KEY_trackerStats,
     TR_KEY_trackers,
+    TR_KEY_transfersDone,
+    TR_KEY_transfersOnReusedConnection,
     TR_KEY_trash_can_enabled,
     TR_KEY_trash_original_torrent_files,
     TR_KEY_umask,
@@ -416,6 +423,7 @@ enum
     TR_KEY_warning_message,
     TR_KEY_watch_dir,
     TR_KEY_watch_dir_enabled,
+    TR_KEY_web_stats,
     TR_KEY_webseeds,
     TR_KEY_webseedsSendingToUs,
     TR_N_KEYS
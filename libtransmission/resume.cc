@@ -230,15 +230,19 @@ static uint64_t loadFilePriorities(tr_variant* dict, tr_torrent* tor)
     tr_variant* list = nullptr;
     if (tr_variantDictFindList(dict, TR_KEY_priority, &list) && tr_variantListSize(list) == n)
     {
+        auto priorities = std::vector<tr_priority_t>{};
+        priorities.reserve(n);
+
         for (tr_file_index_t i = 0; i < n; ++i)
         {
             auto priority = int64_t{};
-            if (tr_variantGetInt(tr_variantListChild(list, i), &priority))
-            {
-                tr_torrentInitFilePriority(tor, i, priority);
-            }
+            priorities.push_back(
+                tr_variantGetInt(tr_variantListChild(list, i), &priority) ? tr_priority_t(priority) :
+                                                                           tor->info.files[i].priority);
         }
 
+        tr_torrentInitFileStates(tor, std::data(priorities), nullptr);
+
         ret = TR_FR_FILE_PRIORITIES;
     }
 
@@ -734,6 +738,7 @@ static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, bool* didRe
     auto fieldsLoaded = uint64_t{};
     auto i = int64_t{};
     auto top = tr_variant{};
+    auto arena = tr_variant_arena{};
     auto sv = std::string_view{};
     tr_error* error = nullptr;
 
@@ -747,6 +752,7 @@ static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, bool* didRe
     if (!tr_loadFile(buf, filename.c_str(), &error) ||
         !tr_variantFromBuf(
             &top,
+            arena,
             TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE,
             { std::data(buf), std::size(buf) },
             nullptr,
@@ -27,7 +27,9 @@
 #include "error.h"
 #include "fdlimit.h"
 #include "file.h"
+#include "handshake.h" /* tr_handshakeGetLatency() */
 #include "log.h"
+#include "peer-mgr.h" /* tr_peerMgrPieceAvailability(), tr_peerMgrPeerSnapshots() */
 #include "platform-quota.h" /* tr_device_info_get_disk_space() */
 #include "rpcimpl.h"
 #include "session.h"
@@ -462,36 +464,38 @@ static void addTrackerStats(tr_tracker_stat const* st, int n, tr_variant* list)
     }
 }
 
-static void addPeers(tr_torrent* tor, tr_variant* list)
+/* `peers' is scratch space owned by the caller, reused across torrents */
+static void addPeers(tr_torrent* tor, tr_variant* list, std::vector<tr_peer_snapshot>* peers)
 {
-    auto peerCount = int{};
-    tr_peer_stat* peers = tr_torrentPeers(tor, &peerCount);
+    tr_peerMgrPeerSnapshots(tor, peers);
 
-    tr_variantInitList(list, peerCount);
+    tr_variantInitList(list, std::size(*peers));
 
-    for (int i = 0; i < peerCount; ++i)
+    for (auto const& peer : *peers)
     {
+        char addr[TR_INET6_ADDRSTRLEN];
+        char flags[32];
+        tr_address_to_string_with_buf(&peer.addr, addr, sizeof(addr));
+        tr_peerSnapshotFlagStr(&peer, flags, sizeof(flags));
+
         tr_variant* d = tr_variantListAddDict(list, 16);
-        tr_peer_stat const* peer = peers + i;
-        tr_variantDictAddStr(d, TR_KEY_address, peer->addr);
-        tr_variantDictAddStr(d, TR_KEY_clientName, peer->client);
-        tr_variantDictAddBool(d, TR_KEY_clientIsChoked, peer->clientIsChoked);
-        tr_variantDictAddBool(d, TR_KEY_clientIsInterested, peer->clientIsInterested);
-        tr_variantDictAddStr(d, TR_KEY_flagStr, peer->flagStr);
-        tr_variantDictAddBool(d, TR_KEY_isDownloadingFrom, peer->isDownloadingFrom);
-        tr_variantDictAddBool(d, TR_KEY_isEncrypted, peer->isEncrypted);
-        tr_variantDictAddBool(d, TR_KEY_isIncoming, peer->isIncoming);
-        tr_variantDictAddBool(d, TR_KEY_isUploadingTo, peer->isUploadingTo);
-        tr_variantDictAddBool(d, TR_KEY_isUTP, peer->isUTP);
-        tr_variantDictAddBool(d, TR_KEY_peerIsChoked, peer->peerIsChoked);
-        tr_variantDictAddBool(d, TR_KEY_peerIsInterested, peer->peerIsInterested);
-        tr_variantDictAddInt(d, TR_KEY_port, peer->port);
-        tr_variantDictAddReal(d, TR_KEY_progress, peer->progress);
-        tr_variantDictAddInt(d, TR_KEY_rateToClient, toSpeedBytes(peer->rateToClient_KBps));
-        tr_variantDictAddInt(d, TR_KEY_rateToPeer, toSpeedBytes(peer->rateToPeer_KBps));
-    }
-
-    tr_torrentPeersFree(peers, peerCount);
+        tr_variantDictAddStr(d, TR_KEY_address, addr);
+        tr_variantDictAddQuark(d, TR_KEY_clientName, peer.client);
+        tr_variantDictAddBool(d, TR_KEY_clientIsChoked, peer.clientIsChoked);
+        tr_variantDictAddBool(d, TR_KEY_clientIsInterested, peer.clientIsInterested);
+        tr_variantDictAddStr(d, TR_KEY_flagStr, flags);
+        tr_variantDictAddBool(d, TR_KEY_isDownloadingFrom, peer.isDownloadingFrom);
+        tr_variantDictAddBool(d, TR_KEY_isEncrypted, peer.isEncrypted);
+        tr_variantDictAddBool(d, TR_KEY_isIncoming, peer.isIncoming);
+        tr_variantDictAddBool(d, TR_KEY_isUploadingTo, peer.isUploadingTo);
+        tr_variantDictAddBool(d, TR_KEY_isUTP, peer.isUTP);
+        tr_variantDictAddBool(d, TR_KEY_peerIsChoked, peer.peerIsChoked);
+        tr_variantDictAddBool(d, TR_KEY_peerIsInterested, peer.peerIsInterested);
+        tr_variantDictAddInt(d, TR_KEY_port, ntohs(peer.port));
+        tr_variantDictAddReal(d, TR_KEY_progress, peer.progress);
+        tr_variantDictAddInt(d, TR_KEY_rateToClient, peer.rateToClient_Bps);
+        tr_variantDictAddInt(d, TR_KEY_rateToPeer, peer.rateToPeer_Bps);
+    }
 }
 
 static void initField(
@@ -499,7 +503,8 @@ static void initField(
     tr_info const* const inf,
     tr_stat const* const st,
     tr_variant* const initme,
-    tr_quark key)
+    tr_quark key,
+    std::vector<tr_peer_snapshot>* peers)
 {
     char* str = nullptr;
 
@@ -513,6 +518,14 @@ static void initField(
         tr_variantInitInt(initme, st->addedDate);
         break;
 
+    case TR_KEY_availability:
+        tr_variantInitList(initme, inf->pieceCount);
+        for (tr_piece_index_t piece = 0; piece < inf->pieceCount; ++piece)
+        {
+            tr_variantListAddInt(initme, tr_peerMgrPieceAvailability(tor, piece));
+        }
+        break;
+
     case TR_KEY_bandwidthPriority:
         tr_variantInitInt(initme, tr_torrentGetPriority(tor));
         break;
@@ -658,7 +671,7 @@ static void initField(
         break;
 
     case TR_KEY_peers:
-        addPeers(tor, initme);
+        addPeers(tor, initme, peers);
         break;
 
     case TR_KEY_peersConnected:
@@ -706,6 +719,10 @@ static void initField(
         tr_variantInitInt(initme, inf->pieceCount);
         break;
 
+    case TR_KEY_pieceHashBytes:
+        tr_variantInitInt(initme, st->pieceHashBytes);
+        break;
+
     case TR_KEY_pieceSize:
         tr_variantInitInt(initme, inf->pieceSize);
         break;
@@ -846,7 +863,13 @@ static void initField(
     }
 }
 
-static void addTorrentInfo(tr_torrent* tor, tr_format format, tr_variant* entry, tr_quark const* fields, size_t fieldCount)
+static void addTorrentInfo(
+    tr_torrent* tor,
+    tr_format format,
+    tr_variant* entry,
+    tr_quark const* fields,
+    size_t fieldCount,
+    std::vector<tr_peer_snapshot>* peers)
 {
     if (format == TR_FORMAT_TABLE)
     {
@@ -866,7 +889,7 @@ static void addTorrentInfo(tr_torrent* tor, tr_format format, tr_variant* entry,
         {
             tr_variant* child = format == TR_FORMAT_TABLE ? tr_variantListAdd(entry) : tr_variantDictAdd(entry, fields[i]);
 
-            initField(tor, inf, st, child, fields[i]);
+            initField(tor, inf, st, child, fields[i], peers);
         }
     }
 }
@@ -934,9 +957,13 @@ static char const* torrentGet(tr_session* session, tr_variant* args_in, tr_varia
             }
         }
 
+        /* torrent-get is an immediate method that can run in any caller's
+         * thread, so each call gets its own snapshot buffer to share among
+         * its torrents rather than one shared by every call */
+        auto peers = std::vector<tr_peer_snapshot>{};
         for (auto* tor : torrents)
         {
-            addTorrentInfo(tor, format, tr_variantListAdd(list), keys, keyCount);
+            addTorrentInfo(tor, format, tr_variantListAdd(list), keys, keyCount, &peers);
         }
 
         tr_free(keys);
@@ -980,12 +1007,12 @@ static char const* setLabels(tr_torrent* tor, tr_variant* list)
     return nullptr;
 }
 
-static char const* setFilePriorities(tr_torrent* tor, int priority, tr_variant* list)
+/* calls `func' for each file index in `list', or for every file if `list' is empty */
+template<typename Func>
+static char const* forEachFileInList(tr_torrent const* tor, tr_variant* list, Func func)
 {
-    int fileCount = 0;
-    size_t const n = tr_variantListSize(list);
     char const* errmsg = nullptr;
-    tr_file_index_t* files = tr_new0(tr_file_index_t, tor->info.fileCount);
+    size_t const n = tr_variantListSize(list);
 
     if (n != 0)
     {
@@ -996,7 +1023,7 @@ static char const* setFilePriorities(tr_torrent* tor, int priority, tr_variant*
             {
                 if (0 <= tmp && tmp < tor->info.fileCount)
                 {
-                    files[fileCount++] = tmp;
+                    func(tr_file_index_t(tmp));
                 }
                 else
                 {
@@ -1009,60 +1036,38 @@ static char const* setFilePriorities(tr_torrent* tor, int priority, tr_variant*
     {
         for (tr_file_index_t t = 0; t < tor->info.fileCount; ++t)
         {
-            files[fileCount++] = t;
+            func(t);
         }
     }
 
-    if (fileCount != 0)
-    {
-        tr_torrentSetFilePriorities(tor, files, fileCount, priority);
-    }
-
-    tr_free(files);
     return errmsg;
 }
 
-static char const* setFileDLs(tr_torrent* tor, bool do_download, tr_variant* list)
+/* changes are collected in `priorities' so they can all be applied at once */
+static char const* setFilePriorities(tr_torrent* tor, tr_priority_t priority, tr_variant* list, tr_priority_t** priorities)
 {
-    char const* errmsg = nullptr;
-
-    int fileCount = 0;
-    size_t const n = tr_variantListSize(list);
-    tr_file_index_t* files = tr_new0(tr_file_index_t, tor->info.fileCount);
-
-    if (n != 0) /* if argument list, process them */
+    if (*priorities == nullptr)
     {
-        for (size_t i = 0; i < n; ++i)
-        {
-            auto tmp = int64_t{};
-            if (tr_variantGetInt(tr_variantListChild(list, i), &tmp))
-            {
-                if (0 <= tmp && tmp < tor->info.fileCount)
-                {
-                    files[fileCount++] = tmp;
-                }
-                else
-                {
-                    errmsg = "file index out of range";
-                }
-            }
-        }
+        *priorities = tr_torrentGetFilePriorities(tor);
     }
-    else /* if empty set, apply to all */
+
+    return forEachFileInList(tor, list, [priorities, priority](tr_file_index_t i) { (*priorities)[i] = priority; });
+}
+
+/* changes are collected in `wanted' so they can all be applied at once */
+static char const* setFileDLs(tr_torrent* tor, bool do_download, tr_variant* list, bool** wanted)
+{
+    if (*wanted == nullptr)
     {
-        for (tr_file_index_t t = 0; t < tor->info.fileCount; ++t)
+        *wanted = tr_new(bool, tor->info.fileCount);
+
+        for (tr_file_index_t i = 0; i < tor->info.fileCount; ++i)
         {
-            files[fileCount++] = t;
+            (*wanted)[i] = !tor->info.files[i].dnd;
         }
     }
 
-    if (fileCount != 0)
-    {
-        tr_torrentSetFileDLs(tor, files, fileCount, do_download);
-    }
-
-    tr_free(files);
-    return errmsg;
+    return forEachFileInList(tor, list, [wanted, do_download](tr_file_index_t i) { (*wanted)[i] = do_download; });
 }
 
 static bool hasAnnounceUrl(tr_tracker_info const* t, int n, std::string_view url)
@@ -1250,6 +1255,8 @@ static char const* torrentSet(
         auto d = double{};
         auto boolVal = bool{};
         tr_variant* tmp_variant = nullptr;
+        tr_priority_t* file_priorities = nullptr;
+        bool* file_wanted = nullptr;
 
         if (tr_variantDictFindInt(args_in, TR_KEY_bandwidthPriority, &tmp))
         {
@@ -1268,12 +1275,12 @@ static char const* torrentSet(
 
         if (errmsg == nullptr && tr_variantDictFindList(args_in, TR_KEY_files_unwanted, &tmp_variant))
         {
-            errmsg = setFileDLs(tor, false, tmp_variant);
+            errmsg = setFileDLs(tor, false, tmp_variant, &file_wanted);
         }
 
         if (errmsg == nullptr && tr_variantDictFindList(args_in, TR_KEY_files_wanted, &tmp_variant))
         {
-            errmsg = setFileDLs(tor, true, tmp_variant);
+            errmsg = setFileDLs(tor, true, tmp_variant, &file_wanted);
         }
 
         if (tr_variantDictFindInt(args_in, TR_KEY_peer_limit, &tmp))
@@ -1283,17 +1290,24 @@ static char const* torrentSet(
 
         if (errmsg == nullptr && tr_variantDictFindList(args_in, TR_KEY_priority_high, &tmp_variant))
         {
-            errmsg = setFilePriorities(tor, TR_PRI_HIGH, tmp_variant);
+            errmsg = setFilePriorities(tor, TR_PRI_HIGH, tmp_variant, &file_priorities);
         }
 
         if (errmsg == nullptr && tr_variantDictFindList(args_in, TR_KEY_priority_low, &tmp_variant))
         {
-            errmsg = setFilePriorities(tor, TR_PRI_LOW, tmp_variant);
+            errmsg = setFilePriorities(tor, TR_PRI_LOW, tmp_variant, &file_priorities);
         }
 
         if (errmsg == nullptr && tr_variantDictFindList(args_in, TR_KEY_priority_normal, &tmp_variant))
         {
-            errmsg = setFilePriorities(tor, TR_PRI_NORMAL, tmp_variant);
+            errmsg = setFilePriorities(tor, TR_PRI_NORMAL, tmp_variant, &file_priorities);
+        }
+
+        if (file_priorities != nullptr || file_wanted != nullptr)
+        {
+            tr_torrentSetFileStates(tor, file_priorities, file_wanted);
+            tr_free(file_priorities);
+            tr_free(file_wanted);
         }
 
         if (tr_variantDictFindInt(args_in, TR_KEY_downloadLimit, &tmp))
@@ -1644,7 +1658,8 @@ static void addTorrentImpl(struct tr_rpc_idle_data* data, tr_ctor* ctor)
             TR_KEY_hashString,
         };
 
-        addTorrentInfo(tor, TR_FORMAT_OBJECT, tr_variantDictAdd(data->args_out, key), fields, TR_N_ELEMENTS(fields));
+        auto peers = std::vector<tr_peer_snapshot>{};
+        addTorrentInfo(tor, TR_FORMAT_OBJECT, tr_variantDictAdd(data->args_out, key), fields, TR_N_ELEMENTS(fields), &peers);
 
         if (result == nullptr)
         {
@@ -2156,6 +2171,24 @@ static char const* sessionStats(
     tr_variantDictAddInt(d, TR_KEY_sessionCount, currentStats.sessionCount);
     tr_variantDictAddInt(d, TR_KEY_uploadedBytes, currentStats.uploadedBytes);
 
+    auto const latency = tr_handshakeGetLatency();
+    auto const add_histogram = [](tr_variant* dict, tr_quark key, auto const& buckets)
+    {
+        tr_variant* list = tr_variantDictAddList(dict, key, std::size(buckets));
+        for (auto const count : buckets)
+        {
+            tr_variantListAddInt(list, count);
+        }
+    };
+    d = tr_variantDictAddDict(args_out, TR_KEY_handshake_latency, 2);
+    add_histogram(d, TR_KEY_connectMsec, latency.connect_msec);
+    add_histogram(d, TR_KEY_dhUsec, latency.dh_usec);
+
+    auto const web_stats = tr_webGetStats(session);
+    d = tr_variantDictAddDict(args_out, TR_KEY_web_stats, 2);
+    tr_variantDictAddInt(d, TR_KEY_transfersDone, web_stats.transfers_done);
+    tr_variantDictAddInt(d, TR_KEY_transfersOnReusedConnection, web_stats.transfers_on_reused_connection);
+
     return nullptr;
 }
 
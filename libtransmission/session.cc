@@ -36,6 +36,7 @@
 #include "bandwidth.h"
 #include "blocklist.h"
 #include "cache.h"
+#include "crypto.h" /* tr_cryptoStartKeyPool() */
 #include "crypto-utils.h"
 #include "error-types.h"
 #include "error.h"
@@ -614,6 +615,9 @@ tr_session* tr_sessionInit(char const* configDir, bool messageQueuingEnabled, tr
         tr_logSetLevel(tr_log_level(i));
     }
 
+    tr_logStartWriter();
+    tr_cryptoStartKeyPool();
+
     /* start the libtransmission thread */
     tr_net_init(); /* must go before tr_eventInit */
     tr_eventInit(session);
@@ -2006,6 +2010,9 @@ void tr_sessionClose(tr_session* session)
     tr_free(session->resumeDir);
     tr_free(session->torrentDir);
     delete session;
+
+    tr_cryptoStopKeyPool();
+    tr_logStopWriter();
 }
 
 struct sessionLoadTorrentsData
@@ -15,6 +15,7 @@
 #define TR_NAME "Transmission"
 
 #include <array>
+#include <atomic>
 #include <cstring> // memcmp()
 #include <list>
 #include <mutex>
@@ -356,6 +357,12 @@ public:
 
     struct tr_web* web;
 
+    /* connection reuse stats; see tr_webGetStats(). They live here rather
+       than in tr_web so that they can be read while the web thread is
+       starting up or shutting down */
+    std::atomic<uint64_t> web_transfers_done = {};
+    std::atomic<uint64_t> web_transfers_on_reused_connection = {};
+
     struct tr_session_id* session_id;
 
     tr_rpc_func rpc_func;
@@ -9,9 +9,11 @@
 #include <cerrno> /* EINVAL */
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "transmission.h"
+#include "benc.h"
 #include "file.h"
 #include "magnet-metainfo.h"
 #include "session.h"
@@ -39,7 +41,11 @@ struct tr_ctor
 
     tr_priority_t priority = TR_PRI_NORMAL;
     bool isSet_metainfo = false;
-    tr_variant metainfo = {};
+
+    /* `contents` is the metainfo; this tree is only built if someone asks for it */
+    mutable bool isParsed_metainfo = false;
+    mutable tr_variant metainfo = {};
+    mutable tr_variant_arena metainfo_arena;
     std::string source_file;
 
     struct optional_args optional_args[2];
@@ -69,25 +75,91 @@ static void setSourceFile(tr_ctor* ctor, char const* source_file)
     ctor->source_file.assign(source_file ? source_file : "");
 }
 
-static void clearMetainfo(tr_ctor* ctor)
+static void clearMetainfoVariant(tr_ctor const* ctor)
 {
-    if (ctor->isSet_metainfo)
+    if (ctor->isParsed_metainfo)
     {
-        ctor->isSet_metainfo = false;
+        ctor->isParsed_metainfo = false;
         tr_variantFree(&ctor->metainfo);
+        ctor->metainfo_arena.clear();
     }
+}
 
+static tr_variant* getMetainfoVariant(tr_ctor const* ctor)
+{
+    TR_ASSERT(ctor->isSet_metainfo);
+
+    if (!ctor->isParsed_metainfo)
+    {
+        auto const& contents = ctor->contents;
+        auto const sv = std::string_view{ std::data(contents), std::size(contents) };
+        ctor->isParsed_metainfo = tr_variantFromBuf(
+            &ctor->metainfo,
+            ctor->metainfo_arena,
+            TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE,
+            sv);
+        TR_ASSERT(ctor->isParsed_metainfo);
+    }
+
+    return &ctor->metainfo;
+}
+
+static void clearMetainfo(tr_ctor* ctor)
+{
+    ctor->isSet_metainfo = false;
+    clearMetainfoVariant(ctor);
     setSourceFile(ctor, nullptr);
 }
 
 static int parseMetainfoContents(tr_ctor* ctor)
 {
     auto& contents = ctor->contents;
-    auto sv = std::string_view{ std::data(contents), std::size(contents) };
-    ctor->isSet_metainfo = tr_variantFromBuf(&ctor->metainfo, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, sv);
+    auto reader = tr_benc_reader{ std::string_view{ std::data(contents), std::size(contents) } };
+    ctor->isSet_metainfo = reader.skipValue();
     return ctor->isSet_metainfo ? 0 : EILSEQ;
 }
 
+/* true if the metainfo has an info dict, but the info dict has no name */
+static bool isInfoNameMissing(std::string_view benc)
+{
+    auto reader = tr_benc_reader{ benc };
+    auto key = std::string_view{};
+
+    if (!reader.enterDict())
+    {
+        return false;
+    }
+
+    while (reader.nextKey(&key))
+    {
+        if (key != "info"sv)
+        {
+            reader.skipValue();
+        }
+        else if (reader.enterDict())
+        {
+            auto name = std::optional<std::string_view>{};
+            auto name_utf8 = std::optional<std::string_view>{};
+
+            while (reader.nextKey(&key))
+            {
+                if (key != "name"sv && key != "name.utf-8"sv)
+                {
+                    reader.skipValue();
+                }
+                else if (auto sv = std::string_view{}; reader.readStr(&sv))
+                {
+                    (key == "name"sv ? name : name_utf8) = sv;
+                }
+            }
+
+            return std::empty(name_utf8.value_or(name.value_or(""sv)));
+        }
+    }
+
+    return false;
+}
+
 int tr_ctorSetMetainfo(tr_ctor* ctor, void const* metainfo, size_t len)
 {
     clearMetainfo(ctor);
@@ -143,24 +215,22 @@ int tr_ctorSetMetainfoFromFile(tr_ctor* ctor, char const* filename)
     /* if no `name' field was set, then set it from the filename */
     tr_variant* info = nullptr;
 
-    if (tr_variantDictFindDict(&ctor->metainfo, TR_KEY_info, &info))
+    if (isInfoNameMissing({ std::data(ctor->contents), std::size(ctor->contents) }) &&
+        tr_variantDictFindDict(getMetainfoVariant(ctor), TR_KEY_info, &info))
     {
-        auto name = std::string_view{};
+        char* base = tr_sys_path_basename(filename, nullptr);
 
-        if (!tr_variantDictFindStrView(info, TR_KEY_name_utf_8, &name) && !tr_variantDictFindStrView(info, TR_KEY_name, &name))
+        if (base != nullptr)
         {
-            name = ""sv;
-        }
-
-        if (std::empty(name))
-        {
-            char* base = tr_sys_path_basename(filename, nullptr);
-
-            if (base != nullptr)
-            {
-                tr_variantDictAddStr(info, TR_KEY_name, base);
-                tr_free(base);
-            }
+            tr_variantDictAddStr(info, TR_KEY_name, base);
+            tr_free(base);
+
+            /* the tree points into `contents`, so re-encode before replacing it */
+            auto len = size_t{};
+            char* const benc = tr_variantToStr(&ctor->metainfo, TR_VARIANT_FMT_BENC, &len);
+            clearMetainfoVariant(ctor);
+            ctor->contents.assign(benc, benc + len);
+            tr_free(benc);
         }
     }
 
@@ -191,20 +261,9 @@ void tr_ctorSetFilePriorities(tr_ctor* ctor, tr_file_index_t const* files, tr_fi
 
 void tr_ctorInitTorrentPriorities(tr_ctor const* ctor, tr_torrent* tor)
 {
-    for (auto file_index : ctor->low)
-    {
-        tr_torrentInitFilePriority(tor, file_index, TR_PRI_LOW);
-    }
-
-    for (auto file_index : ctor->normal)
-    {
-        tr_torrentInitFilePriority(tor, file_index, TR_PRI_NORMAL);
-    }
-
-    for (auto file_index : ctor->high)
-    {
-        tr_torrentInitFilePriority(tor, file_index, TR_PRI_HIGH);
-    }
+    tr_torrentInitFilePriorities(tor, std::data(ctor->low), std::size(ctor->low), TR_PRI_LOW);
+    tr_torrentInitFilePriorities(tor, std::data(ctor->normal), std::size(ctor->normal), TR_PRI_NORMAL);
+    tr_torrentInitFilePriorities(tor, std::data(ctor->high), std::size(ctor->high), TR_PRI_HIGH);
 }
 
 void tr_ctorSetFilesWanted(tr_ctor* ctor, tr_file_index_t const* files, tr_file_index_t fileCount, bool wanted)
@@ -360,12 +419,22 @@ bool tr_ctorGetMetainfo(tr_ctor const* ctor, tr_variant const** setme)
 
     if (setme != nullptr)
     {
-        *setme = &ctor->metainfo;
+        *setme = getMetainfoVariant(ctor);
     }
 
     return true;
 }
 
+std::string_view tr_ctorGetMetainfoBenc(tr_ctor const* ctor)
+{
+    if (!ctor->isSet_metainfo)
+    {
+        return {};
+    }
+
+    return { std::data(ctor->contents), std::size(ctor->contents) };
+}
+
 tr_session* tr_ctorGetSession(tr_ctor const* ctor)
 {
     return const_cast<tr_session*>(ctor->session);
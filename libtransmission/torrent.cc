@@ -14,6 +14,7 @@
 #include <cstdarg>
 #include <cstdlib> /* qsort */
 #include <cstring> /* memcmp */
+#include <iterator> /* std::back_inserter() */
 #include <set>
 #include <sstream>
 #include <string>
@@ -596,21 +597,13 @@ static constexpr bool pieceHasFile(tr_piece_index_t piece, tr_file const* file)
     return file->firstPiece <= piece && piece <= file->lastPiece;
 }
 
-static tr_priority_t calculatePiecePriority(tr_info const& info, tr_piece_index_t piece, tr_file_index_t file_hint)
+static tr_priority_t calculatePiecePriority(tr_torrent const* tor, tr_piece_index_t piece)
 {
-    // safeguard against a bad arg
-    file_hint = std::min(file_hint, info.fileCount - 1);
-
-    // find the first file with data in this piece
-    tr_file_index_t first = file_hint;
-    while (first > 0 && pieceHasFile(piece, &info.files[first - 1]))
-    {
-        --first;
-    }
+    auto const& info = tor->info;
 
     // the priority is the max of all the file priorities in the piece
     tr_priority_t priority = TR_PRI_LOW;
-    for (tr_file_index_t i = first; i < info.fileCount; ++i)
+    for (tr_file_index_t i = tor->pieceFirstFile(piece); i < info.fileCount; ++i)
     {
         tr_file const* file = &info.files[i];
 
@@ -637,48 +630,53 @@ static void tr_torrentInitFilePieces(tr_torrent* tor)
 {
     uint64_t offset = 0;
     tr_info* inf = &tor->info;
+    auto offsets = std::vector<uint64_t>{};
+    offsets.reserve(inf->fileCount);
 
     /* assign the file offsets */
     for (tr_file_index_t f = 0; f < inf->fileCount; ++f)
     {
         inf->files[f].offset = offset;
+        offsets.push_back(offset);
         offset += inf->files[f].length;
         initFilePieces(tor, f);
     }
-}
 
-static void tr_torrentInitPiecePriorities(tr_torrent* tor)
-{
-    tor->piece_priorities_.clear();
-
-    // throw away file prorities once we're done downloading,
-    // they just waste time & space
-    if (tr_torrentIsSeed(tor))
-    {
-        return;
-    }
+    /* so the completion can keep per-file byte counts */
+    tor->completion.setFileOffsets(std::move(offsets));
 
-    /* build the array of first-file hints to give calculatePiecePriority */
-    tr_info* inf = &tor->info;
-    tr_file_index_t* firstFiles = tr_new(tr_file_index_t, inf->pieceCount);
+    /* index the first file with data in each piece, so that block I/O
+     * and piece priorities don't have to search the whole file list */
+    auto& piece_first_file = tor->piece_first_file_;
+    piece_first_file.resize(inf->pieceCount);
     tr_file_index_t f = 0;
 
     for (tr_piece_index_t p = 0; p < inf->pieceCount; ++p)
     {
-        while (inf->files[f].lastPiece < p)
+        while (f + 1 < inf->fileCount && inf->files[f].lastPiece < p)
         {
             ++f;
         }
 
-        firstFiles[p] = f;
+        piece_first_file[p] = f;
     }
+}
 
-    for (tr_piece_index_t p = 0; p < inf->pieceCount; ++p)
+static void tr_torrentInitPiecePriorities(tr_torrent* tor)
+{
+    tor->piece_priorities_.clear();
+
+    // throw away file prorities once we're done downloading,
+    // they just waste time & space
+    if (tr_torrentIsSeed(tor))
     {
-        tor->setPiecePriority(p, calculatePiecePriority(*inf, p, firstFiles[p]));
+        return;
     }
 
-    tr_free(firstFiles);
+    for (tr_piece_index_t p = 0; p < tor->info.pieceCount; ++p)
+    {
+        tor->setPiecePriority(p, calculatePiecePriority(tor, p));
+    }
 }
 
 static void torrentStart(tr_torrent* tor, bool bypass_queue);
@@ -849,19 +847,22 @@ static void torrentInit(tr_torrent* tor, tr_ctor const* ctor)
     /* maybe save our own copy of the metainfo */
     if (tr_ctorGetSave(ctor))
     {
-        tr_variant const* val = nullptr;
-        if (tr_ctorGetMetainfo(ctor, &val))
+        if (auto const benc = tr_ctorGetMetainfoBenc(ctor); !std::empty(benc))
         {
-            char const* path = tor->info.torrent;
-            int const err = tr_variantToFile(val, TR_VARIANT_FMT_BENC, path);
-
-            if (err != 0)
+            tr_error* error = nullptr;
+            if (!tr_saveFile(tor->info.torrent, benc, &error))
             {
-                tr_torrentSetLocalError(tor, "Unable to save torrent file: %s", tr_strerror(err));
+                tr_torrentSetLocalError(tor, "Unable to save torrent file: %s", error->message);
+                tr_error_free(error);
             }
         }
     }
 
+    if (tor->hasAll())
+    {
+        tor->dropPieceHashes();
+    }
+
     tor->tiers = tr_announcerAddTorrent(tor, onTrackerResponse, nullptr);
 
     if (isNewTorrent)
@@ -890,13 +891,13 @@ static void torrentInit(tr_torrent* tor, tr_ctor const* ctor)
 
 tr_parse_result tr_torrentParse(tr_ctor const* ctor, tr_info* setmeInfo)
 {
-    tr_variant const* metainfo = nullptr;
-    if (!tr_ctorGetMetainfo(ctor, &metainfo))
+    auto const benc = tr_ctorGetMetainfoBenc(ctor);
+    if (std::empty(benc))
     {
         return TR_PARSE_ERR;
     }
 
-    auto parsed = tr_metainfoParse(tr_ctorGetSession(ctor), metainfo, nullptr);
+    auto parsed = tr_metainfoParse(tr_ctorGetSession(ctor), benc, nullptr);
     if (!parsed)
     {
         return TR_PARSE_ERR;
@@ -917,9 +918,7 @@ tr_torrent* tr_torrentNew(tr_ctor const* ctor, int* setme_error, int* setme_dupl
     auto* const session = tr_ctorGetSession(ctor);
     TR_ASSERT(tr_isSession(session));
 
-    tr_variant const* metainfo = nullptr;
-    tr_ctorGetMetainfo(ctor, &metainfo);
-    auto parsed = tr_metainfoParse(session, metainfo, nullptr);
+    auto parsed = tr_metainfoParse(session, tr_ctorGetMetainfoBenc(ctor), nullptr);
     if (!parsed)
     {
         if (setme_error != nullptr)
@@ -1120,6 +1119,7 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
     s->peersSendingToUs = swarm_stats.activePeerCount[TR_DOWN];
     s->peersGettingFromUs = swarm_stats.activePeerCount[TR_UP];
     s->webseedsSendingToUs = swarm_stats.activeWebseedCount;
+    s->pieceHashBytes = tor->pieceHashBytes();
 
     for (int i = 0; i < TR_PEER_FROM__MAX; i++)
     {
@@ -1261,65 +1261,19 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
 ****
 ***/
 
-static uint64_t countFileBytesCompleted(tr_torrent const* tor, tr_file_index_t index)
-{
-    tr_file const& f = tor->info.files[index];
-    if (f.length == 0)
-    {
-        return 0;
-    }
-
-    auto const [begin, end] = tr_torGetFileBlockSpan(tor, index);
-    auto const n = end - begin;
-
-    if (n == 0)
-    {
-        return 0;
-    }
-
-    if (n == 1)
-    {
-        return tor->hasBlock(begin) ? f.length : 0;
-    }
-
-    auto total = uint64_t{};
-
-    // the first block
-    if (tor->hasBlock(begin))
-    {
-        total += tor->block_size - f.offset % tor->block_size;
-    }
-
-    // the middle blocks
-    if (end - begin > 2)
-    {
-        uint64_t u = tor->completion.blocks().count(begin + 1, end - 1);
-        u *= tor->block_size;
-        total += u;
-    }
-
-    // the last block
-    if (tor->hasBlock(end - 1))
-    {
-        total += f.offset + f.length - (uint64_t)tor->block_size * (end - 1);
-    }
-
-    return total;
-}
-
 tr_file_progress tr_torrentFileProgress(tr_torrent const* torrent, tr_file_index_t file)
 {
     TR_ASSERT(tr_isTorrent(torrent));
     TR_ASSERT(file < torrent->info.fileCount);
 
-    tr_file_index_t const total = torrent->info.files[file].length;
+    uint64_t const total = torrent->info.files[file].length;
 
     if (torrent->completeness == TR_SEED || total == 0)
     {
         return { total, total, 1.0 };
     }
 
-    auto const have = countFileBytesCompleted(torrent, file);
+    auto const have = torrent->completion.fileBytesCompleted(file);
     return { have, total, have >= total ? 1.0 : have / double(total) };
 }
 
@@ -1592,6 +1546,7 @@ static void onVerifyDoneThreadFunc(void* vdata)
         if (!data->aborted)
         {
             tr_torrentRecheckCompleteness(tor);
+            tr_peerMgrOnPiecesWantedChanged(tor);
         }
 
         if (data->callback_func != nullptr)
@@ -2021,6 +1976,14 @@ void tr_torrentRecheckCompleteness(tr_torrent* tor)
             tr_torrentSave(tor);
             callScriptIfEnabled(tor, TR_SCRIPT_ON_TORRENT_DONE);
         }
+
+        /* once we have every piece, we don't need their hashes until the next verify.
+           Only do this when the torrent becomes complete: if a verify has since paid
+           to reload them, keep them rather than rereading them on every verify. */
+        if (tor->hasAll())
+        {
+            tor->dropPieceHashes();
+        }
     }
 }
 
@@ -2046,25 +2009,74 @@ void tr_torrentSetMetadataCallback(tr_torrent* tor, tr_torrent_metadata_func fun
     tor->metadata_func_user_data = user_data;
 }
 
+/**
+***  File pieces
+**/
+
+/* calls `func' once for each piece holding data from any of the sorted `files' */
+template<typename Func>
+static void forEachPieceOfFiles(tr_torrent const* tor, std::vector<tr_file_index_t> const& files, Func func)
+{
+    auto next = tr_piece_index_t{ 0 };
+
+    for (auto const file_index : files)
+    {
+        auto const& file = tor->info.files[file_index];
+
+        for (auto piece = std::max(next, file.firstPiece); piece <= file.lastPiece; ++piece)
+        {
+            func(piece);
+        }
+
+        next = std::max(next, tr_piece_index_t(file.lastPiece + 1));
+    }
+}
+
+/* sorts `files' and drops the duplicates and out-of-range indices */
+static std::vector<tr_file_index_t> getValidFiles(tr_torrent const* tor, tr_file_index_t const* files, tr_file_index_t n)
+{
+    auto ret = std::vector<tr_file_index_t>{};
+    ret.reserve(n);
+    std::copy_if(
+        files,
+        files + n,
+        std::back_inserter(ret),
+        [tor](tr_file_index_t i) { return i < tor->info.fileCount; });
+    std::sort(std::begin(ret), std::end(ret));
+    ret.erase(std::unique(std::begin(ret), std::end(ret)), std::end(ret));
+    return ret;
+}
+
+static void updatePiecePriorities(tr_torrent* tor, std::vector<tr_file_index_t> const& changed_files)
+{
+    forEachPieceOfFiles(
+        tor,
+        changed_files,
+        [tor](tr_piece_index_t piece) { tor->setPiecePriority(piece, calculatePiecePriority(tor, piece)); });
+}
+
 /**
 ***  File priorities
 **/
 
-void tr_torrentInitFilePriority(tr_torrent* tor, tr_file_index_t fileIndex, tr_priority_t priority)
+void tr_torrentInitFilePriorities(
+    tr_torrent* tor,
+    tr_file_index_t const* files,
+    tr_file_index_t fileCount,
+    tr_priority_t priority)
 {
     TR_ASSERT(tr_isTorrent(tor));
-    TR_ASSERT(fileIndex < tor->info.fileCount);
     TR_ASSERT(tr_isPriority(priority));
+    auto const lock = tor->unique_lock();
 
-    auto& info = tor->info;
-    tr_file* file = &info.files[fileIndex];
-
-    file->priority = priority;
+    auto const valid_files = getValidFiles(tor, files, fileCount);
 
-    for (tr_piece_index_t i = file->firstPiece; i <= file->lastPiece; ++i)
+    for (auto const file_index : valid_files)
     {
-        tor->setPiecePriority(i, calculatePiecePriority(info, i, fileIndex));
+        tor->info.files[file_index].priority = priority;
     }
+
+    updatePiecePriorities(tor, valid_files);
 }
 
 void tr_torrentSetFilePriorities(
@@ -2076,14 +2088,7 @@ void tr_torrentSetFilePriorities(
     TR_ASSERT(tr_isTorrent(tor));
     auto const lock = tor->unique_lock();
 
-    for (tr_file_index_t i = 0; i < fileCount; ++i)
-    {
-        if (files[i] < tor->info.fileCount)
-        {
-            tr_torrentInitFilePriority(tor, files[i], priority);
-        }
-    }
-
+    tr_torrentInitFilePriorities(tor, files, fileCount, priority);
     tr_torrentSetDirty(tor);
 }
 
@@ -2105,65 +2110,40 @@ tr_priority_t* tr_torrentGetFilePriorities(tr_torrent const* tor)
 ***  File DND
 **/
 
-static void setFileDND(tr_torrent* tor, tr_file_index_t fileIndex, bool doDownload)
+static bool calculatePieceDND(tr_torrent const* tor, tr_piece_index_t piece)
 {
-    bool const dnd = !doDownload;
-    tr_file* file = &tor->info.files[fileIndex];
-
-    file->dnd = dnd;
-    auto const firstPiece = file->firstPiece;
-    auto const lastPiece = file->lastPiece;
-
-    /* can't set the first piece to DND unless
-       every file using that piece is DND */
-    auto firstPieceDND = dnd;
+    auto const& info = tor->info;
 
-    if (fileIndex > 0)
+    /* a piece can't be DND unless every file using it is DND */
+    for (tr_file_index_t i = tor->pieceFirstFile(piece); i < info.fileCount; ++i)
     {
-        for (tr_file_index_t i = fileIndex - 1; firstPieceDND; --i)
-        {
-            if (tor->info.files[i].lastPiece != firstPiece)
-            {
-                break;
-            }
-
-            firstPieceDND = tor->info.files[i].dnd;
-
-            if (i == 0)
-            {
-                break;
-            }
-        }
-    }
-
-    /* can't set the last piece to DND unless
-       every file using that piece is DND */
-    auto lastPieceDND = dnd;
+        tr_file const* file = &info.files[i];
 
-    for (tr_file_index_t i = fileIndex + 1; lastPieceDND && i < tor->info.fileCount; ++i)
-    {
-        if (tor->info.files[i].firstPiece != lastPiece)
+        if (!pieceHasFile(piece, file))
         {
             break;
         }
 
-        lastPieceDND = tor->info.files[i].dnd;
+        if (!file->dnd)
+        {
+            return false;
+        }
     }
 
-    // update dnd_pieces_
+    return true;
+}
 
-    if (firstPiece == lastPiece)
-    {
-        tor->dnd_pieces_.set(firstPiece, firstPieceDND && lastPieceDND);
-    }
-    else
+static void updatePieceDND(tr_torrent* tor, std::vector<tr_file_index_t> const& changed_files)
+{
+    forEachPieceOfFiles(
+        tor,
+        changed_files,
+        [tor](tr_piece_index_t piece) { tor->dnd_pieces_.set(piece, calculatePieceDND(tor, piece)); });
+
+    if (!std::empty(changed_files))
     {
-        tor->dnd_pieces_.set(firstPiece, firstPieceDND);
-        tor->dnd_pieces_.set(lastPiece, lastPieceDND);
-        for (tr_piece_index_t pp = firstPiece + 1; pp < lastPiece; ++pp)
-        {
-            tor->dnd_pieces_.set(pp, dnd);
-        }
+        tor->completion.invalidateSizeWhenDone();
+        tr_peerMgrOnPiecesWantedChanged(tor);
     }
 }
 
@@ -2172,15 +2152,14 @@ void tr_torrentInitFileDLs(tr_torrent* tor, tr_file_index_t const* files, tr_fil
     TR_ASSERT(tr_isTorrent(tor));
     auto const lock = tor->unique_lock();
 
-    for (tr_file_index_t i = 0; i < fileCount; ++i)
+    auto const valid_files = getValidFiles(tor, files, fileCount);
+
+    for (auto const file_index : valid_files)
     {
-        if (files[i] < tor->info.fileCount)
-        {
-            setFileDND(tor, files[i], doDownload);
-        }
+        tor->info.files[file_index].dnd = !doDownload;
     }
 
-    tor->completion.invalidateSizeWhenDone();
+    updatePieceDND(tor, valid_files);
 }
 
 void tr_torrentSetFileDLs(tr_torrent* tor, tr_file_index_t const* files, tr_file_index_t fileCount, bool doDownload)
@@ -2193,6 +2172,55 @@ void tr_torrentSetFileDLs(tr_torrent* tor, tr_file_index_t const* files, tr_file
     tr_torrentRecheckCompleteness(tor);
 }
 
+/**
+***  File states
+**/
+
+void tr_torrentInitFileStates(tr_torrent* tor, tr_priority_t const* priorities, bool const* wanted)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    auto const lock = tor->unique_lock();
+
+    /* only the pieces of files that actually changed need updating */
+    auto priority_changed = std::vector<tr_file_index_t>{};
+    auto dnd_changed = std::vector<tr_file_index_t>{};
+
+    for (tr_file_index_t i = 0; i < tor->info.fileCount; ++i)
+    {
+        auto& file = tor->info.files[i];
+
+        if (priorities != nullptr && priorities[i] != file.priority)
+        {
+            TR_ASSERT(tr_isPriority(priorities[i]));
+            file.priority = priorities[i];
+            priority_changed.push_back(i);
+        }
+
+        if (wanted != nullptr && wanted[i] == file.dnd)
+        {
+            file.dnd = !wanted[i];
+            dnd_changed.push_back(i);
+        }
+    }
+
+    updatePiecePriorities(tor, priority_changed);
+    updatePieceDND(tor, dnd_changed);
+}
+
+void tr_torrentSetFileStates(tr_torrent* tor, tr_priority_t const* priorities, bool const* wanted)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    auto const lock = tor->unique_lock();
+
+    tr_torrentInitFileStates(tor, priorities, wanted);
+    tr_torrentSetDirty(tor);
+
+    if (wanted != nullptr)
+    {
+        tr_torrentRecheckCompleteness(tor);
+    }
+}
+
 /***
 ****
 ***/
@@ -3035,6 +3063,7 @@ void tr_torrentGotBlock(tr_torrent* tor, tr_block_index_t block)
                 tr_logAddTorErr(tor, _("Piece %" PRIu32 ", which was just downloaded, failed its checksum test"), p);
                 tor->corruptCur += n;
                 tor->downloadedCur -= std::min(tor->downloadedCur, uint64_t{ n });
+                tor->setHasPiece(p, false); /* so that it gets downloaded again */
                 tr_peerMgrGotBadPiece(tor, p);
             }
         }
@@ -3549,9 +3578,110 @@ void tr_torrentRenamePath(
     tor->renamePath(oldpath, newname, callback, callback_user_data);
 }
 
+static tr_sha1_digest_t getPieceHashesDigest(std::vector<tr_sha1_digest_t> const& hashes)
+{
+    auto digest = tr_sha1_digest_t{};
+    auto const n_bytes = std::size(hashes) * sizeof(tr_sha1_digest_t);
+    tr_sha1(reinterpret_cast<uint8_t*>(std::data(digest)), std::data(hashes), int(n_bytes), nullptr);
+    return digest;
+}
+
 void tr_torrent::swapMetainfo(tr_metainfo_parsed& parsed)
 {
+    auto const lock = std::lock_guard(this->piece_checksums_mutex_);
+
     std::swap(this->info, parsed.info);
     std::swap(this->piece_checksums_, parsed.pieces);
+    std::swap(this->piece_checksums_offset_, parsed.pieces_offset);
     std::swap(this->infoDictLength, parsed.info_dict_length);
+
+    this->piece_checksums_digest_ = getPieceHashesDigest(this->piece_checksums_);
+}
+
+/***
+****  Piece hashes
+***/
+
+bool tr_torrent::readPieceHashes(std::vector<tr_sha1_digest_t>& setme) const
+{
+    if (this->info.torrent == nullptr)
+    {
+        return false;
+    }
+
+    auto hashes = std::vector<tr_sha1_digest_t>(this->info.pieceCount);
+    auto const n_bytes = std::size(hashes) * sizeof(tr_sha1_digest_t);
+
+    /* try to read them from where they were when the .torrent was parsed */
+    tr_sys_file_t const fd = tr_sys_file_open(this->info.torrent, TR_SYS_FILE_READ, 0, nullptr);
+    if (fd != TR_BAD_SYS_FILE)
+    {
+        auto n_read = uint64_t{};
+        bool const ok = tr_sys_file_read_at(fd, std::data(hashes), n_bytes, this->piece_checksums_offset_, &n_read, nullptr) &&
+            n_read == n_bytes;
+        tr_sys_file_close(fd, nullptr);
+
+        if (ok && getPieceHashesDigest(hashes) == this->piece_checksums_digest_)
+        {
+            setme.swap(hashes);
+            return true;
+        }
+    }
+
+    /* the .torrent may have been rewritten since then, e.g. with new trackers,
+     * so parse it again to find where they are now */
+    auto benc = std::vector<char>{};
+    if (!tr_loadFile(benc, this->info.torrent))
+    {
+        return false;
+    }
+
+    auto parsed = tr_metainfoParse(nullptr, std::string_view{ std::data(benc), std::size(benc) }, nullptr);
+    if (!parsed || getPieceHashesDigest(parsed->pieces) != this->piece_checksums_digest_)
+    {
+        return false;
+    }
+
+    this->piece_checksums_offset_ = parsed->pieces_offset;
+    setme.swap(parsed->pieces);
+    return true;
+}
+
+std::optional<tr_sha1_digest_t> tr_torrent::pieceHash(tr_piece_index_t i) const
+{
+    TR_ASSERT(i < this->info.pieceCount);
+
+    auto const lock = std::lock_guard(this->piece_checksums_mutex_);
+
+    if (std::empty(this->piece_checksums_) && !readPieceHashes(this->piece_checksums_))
+    {
+        tr_logAddNamedError(this->info.name, "Couldn't reload piece hashes from \"%s\"", this->info.torrent);
+        return std::nullopt;
+    }
+
+    return this->piece_checksums_[i];
+}
+
+void tr_torrent::dropPieceHashes()
+{
+    auto const lock = std::lock_guard(this->piece_checksums_mutex_);
+
+    if (std::empty(this->piece_checksums_))
+    {
+        return;
+    }
+
+    /* don't let go of them unless we know we can get them back */
+    auto hashes = std::vector<tr_sha1_digest_t>{};
+    if (readPieceHashes(hashes))
+    {
+        this->piece_checksums_ = std::vector<tr_sha1_digest_t>{};
+    }
+}
+
+size_t tr_torrent::pieceHashBytes() const
+{
+    auto const lock = std::lock_guard(this->piece_checksums_mutex_);
+
+    return std::size(this->piece_checksums_) * sizeof(tr_sha1_digest_t);
 }
@@ -12,6 +12,7 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -48,6 +49,9 @@ void tr_ctorSetSave(tr_ctor* ctor, bool saveMetadataInOurTorrentsDir);
 
 bool tr_ctorGetSave(tr_ctor const* ctor);
 
+/* the raw bencoded metainfo, or an empty view if none is set */
+std::string_view tr_ctorGetMetainfoBenc(tr_ctor const* ctor);
+
 void tr_ctorInitTorrentPriorities(tr_ctor const* ctor, tr_torrent* tor);
 
 void tr_ctorInitTorrentWanted(tr_ctor const* ctor, tr_torrent* tor);
@@ -59,6 +63,16 @@ void tr_ctorInitTorrentWanted(tr_ctor const* ctor, tr_torrent* tor);
 /* just like tr_torrentSetFileDLs but doesn't trigger a fastresume save */
 void tr_torrentInitFileDLs(tr_torrent* tor, tr_file_index_t const* files, tr_file_index_t fileCount, bool do_download);
 
+/* just like tr_torrentSetFilePriorities but doesn't trigger a fastresume save */
+void tr_torrentInitFilePriorities(
+    tr_torrent* tor,
+    tr_file_index_t const* files,
+    tr_file_index_t fileCount,
+    tr_priority_t priority);
+
+/* just like tr_torrentSetFileStates but doesn't trigger a fastresume save */
+void tr_torrentInitFileStates(tr_torrent* tor, tr_priority_t const* priorities, bool const* wanted);
+
 using tr_labels_t = std::unordered_set<std::string>;
 
 void tr_torrentSetLabels(tr_torrent* tor, tr_labels_t&& labels);
@@ -90,8 +104,6 @@ void tr_torrentGetBlockLocation(
 
 tr_block_span_t tr_torGetFileBlockSpan(tr_torrent const* tor, tr_file_index_t const file);
 
-void tr_torrentInitFilePriority(tr_torrent* tor, tr_file_index_t fileIndex, tr_priority_t priority);
-
 void tr_torrentCheckSeedLimit(tr_torrent* tor);
 
 /** save a torrent's .resume file if it's changed since the last time it was saved */
@@ -148,11 +160,17 @@ public:
         tr_torrent_rename_done_func callback,
         void* callback_user_data);
 
-    tr_sha1_digest_t pieceHash(tr_piece_index_t i) const
-    {
-        TR_ASSERT(i < std::size(this->piece_checksums_));
-        return this->piece_checksums_[i];
-    }
+    /* Piece hashes are only needed to check downloaded pieces, so torrents
+     * drop them with dropPieceHashes() when they're loaded complete or when
+     * they become complete. After that, pieceHash() reloads them from the
+     * .torrent file on demand, e.g. for verify, and keeps them loaded.
+     * If they can't be reloaded, it returns std::nullopt. */
+    std::optional<tr_sha1_digest_t> pieceHash(tr_piece_index_t i) const;
+
+    void dropPieceHashes();
+
+    /* how much memory the piece hashes are using right now */
+    size_t pieceHashBytes() const;
 
     // these functions should become private when possible,
     // but more refactoring is needed before that can happen
@@ -276,6 +294,15 @@ public:
         return it->second;
     }
 
+    /// FILES
+
+    // the first file with data in `piece'
+    [[nodiscard]] tr_file_index_t pieceFirstFile(tr_piece_index_t piece) const
+    {
+        TR_ASSERT(piece < std::size(piece_first_file_));
+        return piece_first_file_[piece];
+    }
+
     /// CHECKSUMS
 
     bool ensurePieceIsChecked(tr_piece_index_t piece)
@@ -344,6 +371,9 @@ public:
 
     tr_bitfield checked_pieces_ = tr_bitfield{ 0 };
 
+    // indexed by piece; see pieceFirstFile()
+    std::vector<tr_file_index_t> piece_first_file_;
+
     // TODO(ckerr): make private once some of torrent.cc's `tr_torrentFoo()` methods are member functions
     tr_completion completion;
 
@@ -494,7 +524,16 @@ public:
     static auto constexpr MagicNumber = int{ 95549 };
 
 private:
+    bool readPieceHashes(std::vector<tr_sha1_digest_t>& setme) const;
+
+    /* guards the piece_checksums_ fields, since verify runs in its own thread */
+    mutable std::mutex piece_checksums_mutex_;
     mutable std::vector<tr_sha1_digest_t> piece_checksums_;
+
+    /* where the piece hashes are in the .torrent file,
+     * and a digest of them all to check them when they're reloaded */
+    mutable uint64_t piece_checksums_offset_ = 0;
+    tr_sha1_digest_t piece_checksums_digest_ = {};
 };
 
 static inline bool tr_torrentExists(tr_session const* session, uint8_t const* torrentHash)
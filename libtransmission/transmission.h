@@ -1199,6 +1199,17 @@ tr_priority_t* tr_torrentGetFilePriorities(tr_torrent const* torrent);
 /** @brief Set a batch of files to be downloaded or not. */
 void tr_torrentSetFileDLs(tr_torrent* torrent, tr_file_index_t const* files, tr_file_index_t fileCount, bool do_download);
 
+/**
+ * @brief Set every file's priority and wanted flag in one pass.
+ *
+ * This is much cheaper than a call to tr_torrentSetFilePriorities() or
+ * tr_torrentSetFileDLs() per file when a lot of files change at once.
+ *
+ * @param priorities tr_info.fileCount priorities, or NULL to leave them as-is
+ * @param wanted tr_info.fileCount wanted flags, or NULL to leave them as-is
+ */
+void tr_torrentSetFileStates(tr_torrent* torrent, tr_priority_t const* priorities, bool const* wanted);
+
 tr_info const* tr_torrentInfo(tr_torrent const* torrent);
 
 /* Raw function to change the torrent's downloadDir field.
@@ -1395,6 +1406,21 @@ struct tr_peer_stat
 
     /* how many requests we've made and are currently awaiting a response for */
     int pendingReqsToPeer;
+
+    /* how many requests we'd like to have in flight to this peer,
+       sized from the peer's rate and round-trip time */
+    int desiredReqsToPeer;
+
+    /* the peer's smoothed round-trip time in milliseconds, or 0 if not yet known */
+    uint32_t rttMsec;
+
+    /* average number of bytes sent to the peer per socket write */
+    uint32_t bytesPerWrite;
+
+    /* how many HAVE messages we've sent to the peer,
+       and how many we skipped because it already had the piece */
+    uint32_t havesToPeer;
+    uint32_t havesSuppressed;
 };
 
 tr_peer_stat* tr_torrentPeers(tr_torrent const* torrent, int* peerCount);
@@ -1854,6 +1880,10 @@ struct tr_stat
     /** True if the torrent is running, but has been idle for long enough
         to be considered stalled.  @see tr_sessionGetQueueStalledMinutes() */
     bool isStalled;
+
+    /** Bytes of memory used to hold the piece hashes. This is zero for
+        complete torrents, which only load them when verifying. */
+    uint64_t pieceHashBytes;
 };
 
 /** Return a pointer to an tr_stat structure with updated information
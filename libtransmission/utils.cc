@@ -378,6 +378,51 @@ bool tr_loadFile(std::vector<char>& setme, char const* path, tr_error** error)
     return true;
 }
 
+bool tr_saveFile(char const* filename, std::string_view contents, tr_error** error)
+{
+    /* follow symlinks to find the "real" file, to make sure the temporary
+     * we build with tr_sys_file_open_temp() is created on the right partition */
+    char* const real_filename = tr_sys_path_resolve(filename, nullptr);
+    if (real_filename != nullptr)
+    {
+        filename = real_filename;
+    }
+
+    char* const tmp = tr_strdup_printf("%s.tmp.XXXXXX", filename);
+    tr_sys_file_t const fd = tr_sys_file_open_temp(tmp, error);
+    bool ok = fd != TR_BAD_SYS_FILE;
+
+    if (ok)
+    {
+        while (ok && !std::empty(contents))
+        {
+            auto n_written = uint64_t{};
+            ok = tr_sys_file_write(fd, std::data(contents), std::size(contents), &n_written, error);
+
+            /* a write that makes no progress would otherwise loop forever */
+            if (ok && n_written == 0)
+            {
+                tr_error_set_literal(error, TR_ERROR_EIO, _("Couldn't write to file"));
+                ok = false;
+            }
+
+            contents.remove_prefix(n_written);
+        }
+
+        tr_sys_file_close(fd, nullptr);
+        ok = ok && tr_sys_path_rename(tmp, filename, error);
+
+        if (!ok)
+        {
+            tr_sys_path_remove(tmp, nullptr);
+        }
+    }
+
+    tr_free(tmp);
+    tr_free(real_filename);
+    return ok;
+}
+
 char* tr_buildPath(char const* first_element, ...)
 {
 
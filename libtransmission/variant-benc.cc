@@ -6,6 +6,7 @@
  *
  */
 
+#include <algorithm>
 #include <cstdlib>
 #include <cctype> /* isdigit() */
 #include <deque>
@@ -21,6 +22,7 @@
 
 #include "transmission.h"
 
+#include "benc.h"
 #include "tr-assert.h"
 #include "utils.h" /* tr_snprintf() */
 #include "variant-common.h"
@@ -119,7 +121,12 @@ std::optional<std::string_view> tr_bencParseStr(std::string_view* benc)
     return string;
 }
 
-static tr_variant* get_node(std::deque<tr_variant*>& stack, std::optional<tr_quark>& dict_key, tr_variant* top, int* err)
+static tr_variant* get_node(
+    std::deque<tr_variant*>& stack,
+    std::optional<tr_quark>& dict_key,
+    tr_variant* top,
+    tr_variant_arena* arena,
+    int* err)
 {
     tr_variant* node = nullptr;
 
@@ -131,6 +138,11 @@ static tr_variant* get_node(std::deque<tr_variant*>& stack, std::optional<tr_qua
     {
         auto* parent = stack.back();
 
+        if (arena != nullptr && (tr_variantIsList(parent) || tr_variantIsDict(parent)))
+        {
+            tr_variantContainerReserve(parent, 1, arena);
+        }
+
         if (tr_variantIsList(parent))
         {
             node = tr_variantListAdd(parent);
@@ -154,7 +166,12 @@ static tr_variant* get_node(std::deque<tr_variant*>& stack, std::optional<tr_qua
  * easier to read, but was vulnerable to a smash-stacking
  * attack via maliciously-crafted bencoded data. (#667)
  */
-int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc, char const** setme_end)
+int tr_variantParseBenc(
+    tr_variant& top,
+    int parse_opts,
+    std::string_view benc,
+    char const** setme_end,
+    tr_variant_arena* arena)
 {
     TR_ASSERT((parse_opts & TR_VARIANT_PARSE_BENC) != 0);
 
@@ -186,7 +203,7 @@ int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc,
                     break;
                 }
 
-                tr_variant* const v = get_node(stack, key, &top, &err);
+                tr_variant* const v = get_node(stack, key, &top, arena, &err);
                 if (v != nullptr)
                 {
                     tr_variantInitInt(v, *value);
@@ -197,7 +214,7 @@ int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc,
             {
                 benc.remove_prefix(1);
 
-                tr_variant* const v = get_node(stack, key, &top, &err);
+                tr_variant* const v = get_node(stack, key, &top, arena, &err);
                 if (v != nullptr)
                 {
                     tr_variantInitList(v, 0);
@@ -209,7 +226,7 @@ int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc,
             {
                 benc.remove_prefix(1);
 
-                tr_variant* const v = get_node(stack, key, &top, &err);
+                tr_variant* const v = get_node(stack, key, &top, arena, &err);
                 if (v != nullptr)
                 {
                     tr_variantInitDict(v, 0);
@@ -253,7 +270,7 @@ int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc,
                 }
                 else
                 {
-                    tr_variant* const v = get_node(stack, key, &top, &err);
+                    tr_variant* const v = get_node(stack, key, &top, arena, &err);
                     if (v != nullptr)
                     {
                         if ((parse_opts & TR_VARIANT_PARSE_INPLACE) != 0)
@@ -262,7 +279,7 @@ int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc,
                         }
                         else
                         {
-                            tr_variantInitStr(v, *sv);
+                            tr_variantInitStrCopy(v, *sv, arena);
                         }
                     }
                 }
@@ -300,6 +317,245 @@ int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc,
     return err;
 }
 
+/***
+****  tr_benc_reader
+***/
+
+void tr_benc_reader::skipJunk()
+{
+    // march past anything that can't start a token, same as tr_variantParseBenc()
+    auto constexpr is_token_start = [](char ch)
+    {
+        return ch == 'i' || ch == 'l' || ch == 'd' || ch == 'e' || isdigit((unsigned char)ch);
+    };
+
+    auto const it = std::find_if(std::begin(benc_), std::end(benc_), is_token_start);
+    benc_.remove_prefix(std::distance(std::begin(benc_), it));
+}
+
+tr_benc_token tr_benc_reader::lex()
+{
+    skipJunk();
+
+    if (std::empty(benc_))
+    {
+        return TR_BENC_TOKEN_ERROR;
+    }
+
+    switch (benc_.front())
+    {
+    case 'i':
+        if (auto const value = tr_bencParseInt(&benc_); value)
+        {
+            int_ = *value;
+            return TR_BENC_TOKEN_INT;
+        }
+        break;
+
+    case 'l':
+        benc_.remove_prefix(1);
+        return TR_BENC_TOKEN_LIST;
+
+    case 'd':
+        benc_.remove_prefix(1);
+        return TR_BENC_TOKEN_DICT;
+
+    case 'e':
+        benc_.remove_prefix(1);
+        return TR_BENC_TOKEN_END;
+
+    default:
+        if (auto const sv = tr_bencParseStr(&benc_); sv)
+        {
+            str_ = *sv;
+            return TR_BENC_TOKEN_STR;
+        }
+        break;
+    }
+
+    return TR_BENC_TOKEN_ERROR;
+}
+
+tr_benc_token tr_benc_reader::next()
+{
+    auto const token = failed_ ? TR_BENC_TOKEN_ERROR : lex();
+
+    // dicts must alternate between string keys and values
+    auto ok = token != TR_BENC_TOKEN_ERROR;
+    if (ok && !std::empty(stack_))
+    {
+        auto& state = stack_.back();
+
+        if (state == DictKey)
+        {
+            ok = token == TR_BENC_TOKEN_STR || token == TR_BENC_TOKEN_END;
+            state = DictValue;
+        }
+        else if (state == DictValue)
+        {
+            ok = token != TR_BENC_TOKEN_END;
+            state = DictKey;
+        }
+    }
+
+    if (ok)
+    {
+        switch (token)
+        {
+        case TR_BENC_TOKEN_LIST:
+            stack_.push_back(List);
+            break;
+
+        case TR_BENC_TOKEN_DICT:
+            stack_.push_back(DictKey);
+            break;
+
+        case TR_BENC_TOKEN_END:
+            ok = !std::empty(stack_);
+            if (ok)
+            {
+                stack_.pop_back();
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (!ok)
+    {
+        failed_ = true;
+        return TR_BENC_TOKEN_ERROR;
+    }
+
+    return token;
+}
+
+bool tr_benc_reader::skipContainer()
+{
+    TR_ASSERT(!std::empty(stack_));
+
+    for (auto const target = std::size(stack_) - 1; std::size(stack_) > target;)
+    {
+        if (next() == TR_BENC_TOKEN_ERROR)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool tr_benc_reader::skipUnwanted(tr_benc_token token)
+{
+    switch (token)
+    {
+    case TR_BENC_TOKEN_INT:
+    case TR_BENC_TOKEN_STR:
+        return true;
+
+    case TR_BENC_TOKEN_LIST:
+    case TR_BENC_TOKEN_DICT:
+        return skipContainer();
+
+    default: // a container ended where a value was expected
+        failed_ = true;
+        return false;
+    }
+}
+
+bool tr_benc_reader::skipValue()
+{
+    return skipUnwanted(next());
+}
+
+bool tr_benc_reader::nextKey(std::string_view* setme)
+{
+    if (!hasNextItem())
+    {
+        return false;
+    }
+
+    if (next() != TR_BENC_TOKEN_STR)
+    {
+        failed_ = true;
+        return false;
+    }
+
+    *setme = str_;
+    return true;
+}
+
+bool tr_benc_reader::hasNextItem()
+{
+    skipJunk();
+
+    if (failed_ || std::empty(benc_) || std::empty(stack_))
+    {
+        failed_ = true;
+        return false;
+    }
+
+    if (benc_.front() == 'e')
+    {
+        (void)next();
+        return false;
+    }
+
+    return true;
+}
+
+bool tr_benc_reader::readInt(int64_t* setme)
+{
+    auto const token = next();
+    if (token == TR_BENC_TOKEN_INT)
+    {
+        *setme = int_;
+        return true;
+    }
+
+    skipUnwanted(token);
+    return false;
+}
+
+bool tr_benc_reader::readStr(std::string_view* setme)
+{
+    auto const token = next();
+    if (token == TR_BENC_TOKEN_STR)
+    {
+        *setme = str_;
+        return true;
+    }
+
+    skipUnwanted(token);
+    return false;
+}
+
+bool tr_benc_reader::enterList()
+{
+    auto const token = next();
+    if (token == TR_BENC_TOKEN_LIST)
+    {
+        return true;
+    }
+
+    skipUnwanted(token);
+    return false;
+}
+
+bool tr_benc_reader::enterDict()
+{
+    auto const token = next();
+    if (token == TR_BENC_TOKEN_DICT)
+    {
+        return true;
+    }
+
+    skipUnwanted(token);
+    return false;
+}
+
 /****
 *****
 ****/
@@ -46,6 +46,22 @@ std::optional<int64_t> tr_bencParseInt(std::string_view* benc_inout);
 /** @brief Private function that's exposed here only for unit tests */
 std::optional<std::string_view> tr_bencParseStr(std::string_view* benc_inout);
 
-int tr_variantParseBenc(tr_variant& setme, int opts, std::string_view benc, char const** setme_end);
+/* makes room for `count` more children, taking the memory from `arena` if it's not nullptr */
+void tr_variantContainerReserve(tr_variant* container, size_t count, tr_variant_arena* arena);
 
-int tr_variantParseJson(tr_variant& setme, int opts, std::string_view benc, char const** setme_end);
+/* like tr_variantInitStr(), but copies long strings into `arena` if it's not nullptr */
+void tr_variantInitStrCopy(tr_variant* v, std::string_view str, tr_variant_arena* arena);
+
+int tr_variantParseBenc(
+    tr_variant& setme,
+    int opts,
+    std::string_view benc,
+    char const** setme_end,
+    tr_variant_arena* arena = nullptr);
+
+int tr_variantParseJson(
+    tr_variant& setme,
+    int opts,
+    std::string_view benc,
+    char const** setme_end,
+    tr_variant_arena* arena = nullptr);
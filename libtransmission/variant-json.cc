@@ -41,6 +41,7 @@ struct json_wrapper_data
     int error;
     std::deque<tr_variant*> stack;
     tr_variant* top;
+    tr_variant_arena* arena;
     int parse_opts;
 
     /* A very common pattern is for a container's children to be similar,
@@ -56,6 +57,11 @@ static tr_variant* get_node(struct jsonsl_st* jsn)
 
     auto* parent = std::empty(data->stack) ? nullptr : data->stack.back();
 
+    if (data->arena != nullptr && (tr_variantIsList(parent) || tr_variantIsDict(parent)))
+    {
+        tr_variantContainerReserve(parent, 1, data->arena);
+    }
+
     tr_variant* node = nullptr;
     if (parent == nullptr)
     {
@@ -107,12 +113,14 @@ static void action_callback_PUSH(
         size_t const n = depth < MAX_DEPTH ? data->preallocGuess[depth] : 0;
         if (state->type == JSONSL_T_LIST)
         {
-            tr_variantInitList(node, n);
+            tr_variantInitList(node, 0);
         }
         else
         {
-            tr_variantInitDict(node, n);
+            tr_variantInitDict(node, 0);
         }
+
+        tr_variantContainerReserve(node, n, data->arena);
     }
 }
 
@@ -292,7 +300,7 @@ static void action_callback_POP(
         }
         else
         {
-            tr_variantInitStr(get_node(jsn), str);
+            tr_variantInitStrCopy(get_node(jsn), str, data->arena);
         }
         data->has_content = true;
     }
@@ -340,7 +348,12 @@ static void action_callback_POP(
     }
 }
 
-int tr_variantParseJson(tr_variant& setme, int parse_opts, std::string_view benc, char const** setme_end)
+int tr_variantParseJson(
+    tr_variant& setme,
+    int parse_opts,
+    std::string_view benc,
+    char const** setme_end,
+    tr_variant_arena* arena)
 {
     TR_ASSERT((parse_opts & TR_VARIANT_PARSE_JSON) != 0);
 
@@ -362,6 +375,7 @@ int tr_variantParseJson(tr_variant& setme, int parse_opts, std::string_view benc
     data.stack = {};
     data.strbuf = evbuffer_new();
     data.top = &setme;
+    data.arena = arena;
 
     /* parse it */
     jsonsl_feed(jsn, static_cast<jsonsl_char_t const*>(std::data(benc)), std::size(benc));
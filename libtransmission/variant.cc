@@ -17,6 +17,7 @@
 
 #include <algorithm> // std::sort
 #include <cerrno>
+#include <cstddef> // std::max_align_t
 #include <stack>
 #include <cstdlib> /* strtod() */
 #include <cstring>
@@ -127,6 +128,7 @@ static bool tr_variantIsSomething(tr_variant const* v)
 void tr_variantInit(tr_variant* v, char type)
 {
     v->type = type;
+    v->in_arena = false;
     memset(&v->val, 0, sizeof(v->val));
 }
 
@@ -225,17 +227,115 @@ static constexpr char const* getStr(tr_variant const* v)
     return tr_variant_string_get_string(&v->val.s);
 }
 
+/***
+****  Dict index
+***/
+
+/* Dicts with at least this many children get a hash table mapping keys
+ * to child positions. It's built when a dict grows to this size and kept
+ * up to date as children are added or removed, so lookups never modify
+ * the dict. The children themselves stay in insertion order. */
+static auto constexpr DictIndexMinCount = size_t{ 16 };
+
+struct tr_variant_dict_index
+{
+    /* open addressing, power-of-two sized; each slot holds a child's position + 1, or 0 if empty */
+    std::vector<uint32_t> slots;
+};
+
+static size_t dictIndexFirstSlot(tr_quark const key, size_t mask)
+{
+    return (key * size_t{ 2654435761U }) & mask;
+}
+
+static void dictIndexInsert(tr_variant_dict_index* index, tr_variant const* vals, size_t pos)
+{
+    auto const mask = std::size(index->slots) - 1;
+    auto const key = vals[pos].key;
+
+    for (size_t i = dictIndexFirstSlot(key, mask);; i = (i + 1) & mask)
+    {
+        auto& slot = index->slots[i];
+
+        if (slot == 0)
+        {
+            slot = uint32_t(pos + 1);
+            return;
+        }
+
+        /* if a key appears twice, lookups find the first one -- same as a linear scan */
+        if (vals[slot - 1].key == key)
+        {
+            return;
+        }
+    }
+}
+
+static void dictIndexRebuild(tr_variant* dict)
+{
+    auto const count = dict->val.l.count;
+    auto*& index = dict->val.l.index;
+
+    if (index == nullptr)
+    {
+        index = new tr_variant_dict_index{};
+    }
+
+    /* keep the load factor at or below 1/2 */
+    auto n_slots = size_t{ DictIndexMinCount * 2 };
+    while (n_slots < count * 2)
+    {
+        n_slots *= 2;
+    }
+
+    index->slots.assign(n_slots, 0);
+
+    for (size_t pos = 0; pos < count; ++pos)
+    {
+        dictIndexInsert(index, dict->val.l.vals, pos);
+    }
+}
+
+static void dictIndexFree(tr_variant* dict)
+{
+    delete dict->val.l.index;
+    dict->val.l.index = nullptr;
+}
+
 static int dictIndexOf(tr_variant const* dict, tr_quark const key)
 {
-    if (tr_variantIsDict(dict))
+    if (!tr_variantIsDict(dict))
     {
-        for (size_t i = 0; i < dict->val.l.count; ++i)
+        return -1;
+    }
+
+    auto const count = dict->val.l.count;
+    auto const* const vals = dict->val.l.vals;
+
+    if (dict->val.l.index == nullptr)
+    {
+        TR_ASSERT(count < DictIndexMinCount);
+
+        for (size_t i = 0; i < count; ++i)
         {
-            if (dict->val.l.vals[i].key == key)
+            if (vals[i].key == key)
             {
                 return (int)i;
             }
         }
+
+        return -1;
+    }
+
+    auto const& slots = dict->val.l.index->slots;
+    auto const mask = std::size(slots) - 1;
+
+    for (size_t i = dictIndexFirstSlot(key, mask); slots[i] != 0; i = (i + 1) & mask)
+    {
+        if (vals[slots[i] - 1].key == key)
+        {
+            return (int)(slots[i] - 1);
+        }
     }
 
     return -1;
@@ -475,6 +575,21 @@ void tr_variantInitStrView(tr_variant* v, std::string_view str)
     tr_variant_string_set_string_view(&v->val.s, str);
 }
 
+void tr_variantInitStrCopy(tr_variant* v, std::string_view str, tr_variant_arena* arena)
+{
+    if (arena == nullptr || std::size(str) < sizeof(v->val.s.str.buf))
+    {
+        tr_variantInitStr(v, str);
+        return;
+    }
+
+    /* keep the trailing '\0' that tr_variantInitStr() would have added */
+    auto* const copy = static_cast<char*>(arena->alloc(std::size(str) + 1));
+    std::copy_n(std::data(str), std::size(str), copy);
+    copy[std::size(str)] = '\0';
+    tr_variantInitStrView(v, { copy, std::size(str) });
+}
+
 void tr_variantInitBool(tr_variant* v, bool value)
 {
     tr_variantInit(v, TR_VARIANT_TYPE_BOOL);
@@ -499,7 +614,69 @@ void tr_variantInitList(tr_variant* v, size_t reserve_count)
     tr_variantListReserve(v, reserve_count);
 }
 
-static tr_variant* containerReserve(tr_variant* v, size_t count)
+/***
+****  Arena
+***/
+
+static auto constexpr ArenaAlign = size_t{ alignof(std::max_align_t) };
+static auto constexpr ArenaMinBlockSize = size_t{ 16 * 1024 };
+static auto constexpr ArenaMaxBlockSize = size_t{ 1024 * 1024 };
+
+tr_variant_arena::~tr_variant_arena()
+{
+    clear();
+}
+
+void tr_variant_arena::clear()
+{
+    for (auto* block : blocks_)
+    {
+        tr_free(block);
+    }
+
+    blocks_.clear();
+    last_ = pos_ = end_ = nullptr;
+}
+
+void* tr_variant_arena::grow(void* ptr, size_t old_size, size_t new_size)
+{
+    new_size = std::max(ArenaAlign, (new_size + ArenaAlign - 1) & ~(ArenaAlign - 1));
+
+    /* the most recent allocation can grow in place */
+    if (ptr != nullptr && ptr == last_ && size_t(end_ - last_) >= new_size)
+    {
+        pos_ = last_ + new_size;
+        return last_;
+    }
+
+    if (size_t(end_ - pos_) < new_size)
+    {
+        /* blocks double in size as the arena fills up; anything bigger
+         * than that gets a block of its own */
+        auto const doublings = std::min(std::size(blocks_), size_t{ 6 });
+        auto const block_size = std::max(new_size, std::min(ArenaMinBlockSize << doublings, ArenaMaxBlockSize));
+        auto* const block = tr_new(char, block_size);
+        blocks_.push_back(block);
+        pos_ = block;
+        end_ = block + block_size;
+    }
+
+    last_ = pos_;
+    pos_ += new_size;
+
+    if (ptr != nullptr && old_size != 0)
+    {
+        std::copy_n(static_cast<char const*>(ptr), std::min(old_size, new_size), last_);
+    }
+
+    return last_;
+}
+
+/***
+****  Containers
+***/
+
+static tr_variant* containerReserve(tr_variant* v, size_t count, tr_variant_arena* arena = nullptr)
 {
     TR_ASSERT(tr_variantIsContainer(v));
 
@@ -507,21 +684,48 @@ static tr_variant* containerReserve(tr_variant* v, size_t count)
 
     if (needed > v->val.l.alloc)
     {
-        /* scale the alloc size in powers-of-2 */
-        size_t n = v->val.l.alloc != 0 ? v->val.l.alloc : 8;
+        /* scale the alloc size in powers-of-2.
+         * arena arrays start smaller since they can usually grow in place */
+        size_t n = v->val.l.alloc != 0 ? v->val.l.alloc : (arena != nullptr ? 4 : 8);
 
         while (n < needed)
         {
             n *= 2U;
         }
 
-        v->val.l.vals = tr_renew(tr_variant, v->val.l.vals, n);
+        auto* const old_vals = v->val.l.vals;
+
+        if (arena != nullptr)
+        {
+            TR_ASSERT(v->in_arena || old_vals == nullptr);
+
+            auto const old_size = v->in_arena ? sizeof(tr_variant) * v->val.l.alloc : 0;
+            v->val.l.vals = static_cast<tr_variant*>(arena->grow(old_vals, old_size, sizeof(tr_variant) * n));
+            v->in_arena = true;
+        }
+        else if (v->in_arena)
+        {
+            /* outgrew the arena; move to the heap */
+            v->val.l.vals = tr_new(tr_variant, n);
+            std::copy_n(old_vals, v->val.l.count, v->val.l.vals);
+            v->in_arena = false;
+        }
+        else
+        {
+            v->val.l.vals = tr_renew(tr_variant, old_vals, n);
+        }
+
         v->val.l.alloc = n;
     }
 
     return v->val.l.vals + v->val.l.count;
 }
 
+void tr_variantContainerReserve(tr_variant* container, size_t count, tr_variant_arena* arena)
+{
+    containerReserve(container, count, arena);
+}
+
 void tr_variantListReserve(tr_variant* list, size_t count)
 {
     TR_ASSERT(tr_variantIsList(list));
@@ -626,6 +830,22 @@ tr_variant* tr_variantDictAdd(tr_variant* dict, tr_quark const key)
     val->key = key;
     tr_variantInit(val, TR_VARIANT_TYPE_INT);
 
+    if (auto* const index = dict->val.l.index; index == nullptr)
+    {
+        if (dict->val.l.count >= DictIndexMinCount)
+        {
+            dictIndexRebuild(dict);
+        }
+    }
+    else if (dict->val.l.count * 2 > std::size(index->slots))
+    {
+        dictIndexRebuild(dict);
+    }
+    else
+    {
+        dictIndexInsert(index, dict->val.l.vals, dict->val.l.count - 1);
+    }
+
     return val;
 }
 
@@ -745,6 +965,17 @@ bool tr_variantDictRemove(tr_variant* dict, tr_quark const key)
 
         --dict->val.l.count;
 
+        /* positions have shifted. Open addressing can't just clear the
+         * removed slot without breaking probe chains, so start over */
+        if (dict->val.l.count >= DictIndexMinCount)
+        {
+            dictIndexRebuild(dict);
+        }
+        else
+        {
+            dictIndexFree(dict);
+        }
+
         removed = true;
     }
 
@@ -990,7 +1221,12 @@ static void freeStringFunc(tr_variant const* v, void* /*user_data*/)
 
 static void freeContainerEndFunc(tr_variant const* v, void* /*user_data*/)
 {
-    tr_free(v->val.l.vals);
+    if (!v->in_arena)
+    {
+        tr_free(v->val.l.vals);
+    }
+
+    delete v->val.l.index;
 }
 
 static struct VariantWalkFuncs const freeWalkFuncs = {
@@ -1292,7 +1528,13 @@ int tr_variantToFile(tr_variant const* v, tr_variant_fmt fmt, char const* filena
 ****
 ***/
 
-bool tr_variantFromBuf(tr_variant* setme, int opts, std::string_view buf, char const** setme_end, tr_error** error)
+static bool variantFromBuf(
+    tr_variant* setme,
+    tr_variant_arena* arena,
+    int opts,
+    std::string_view buf,
+    char const** setme_end,
+    tr_error** error)
 {
     // supported formats: benc, json
     TR_ASSERT((opts & (TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_JSON)) != 0);
@@ -1301,8 +1543,8 @@ bool tr_variantFromBuf(tr_variant* setme, int opts, std::string_view buf, char c
     auto locale_ctx = locale_context{};
     use_numeric_locale(&locale_ctx, "C");
 
-    auto err = (opts & TR_VARIANT_PARSE_BENC) ? tr_variantParseBenc(*setme, opts, buf, setme_end) :
-                                                tr_variantParseJson(*setme, opts, buf, setme_end);
+    auto err = (opts & TR_VARIANT_PARSE_BENC) ? tr_variantParseBenc(*setme, opts, buf, setme_end, arena) :
+                                                tr_variantParseJson(*setme, opts, buf, setme_end, arena);
 
     /* restore the previous locale */
     restore_locale(&locale_ctx);
@@ -1316,6 +1558,22 @@ bool tr_variantFromBuf(tr_variant* setme, int opts, std::string_view buf, char c
     return true;
 }
 
+bool tr_variantFromBuf(tr_variant* setme, int opts, std::string_view buf, char const** setme_end, tr_error** error)
+{
+    return variantFromBuf(setme, nullptr, opts, buf, setme_end, error);
+}
+
+bool tr_variantFromBuf(
+    tr_variant* setme,
+    tr_variant_arena& arena,
+    int opts,
+    std::string_view buf,
+    char const** setme_end,
+    tr_error** error)
+{
+    return variantFromBuf(setme, &arena, opts, buf, setme_end, error);
+}
+
 bool tr_variantFromFile(tr_variant* setme, tr_variant_parse_opts opts, char const* filename, tr_error** error)
 {
     // can't do inplace when this function is allocating & freeing the memory...
@@ -10,6 +10,7 @@
 
 #include <cstddef> // size_t
 #include <inttypes.h> // int64_t
+#include <vector>
 
 #include "tr-macros.h"
 #include "quark.h"
@@ -41,6 +42,8 @@ enum tr_string_type
 /* these are PRIVATE IMPLEMENTATION details that should not be touched.
  * I'll probably change them just to break your code! HA HA HA!
  * it's included in the header for inlining and composition */
+struct tr_variant_dict_index;
+
 struct tr_variant_string
 {
     tr_string_type type;
@@ -72,6 +75,9 @@ struct tr_variant
 {
     char type = '\0';
 
+    /* true if val.l.vals belongs to a tr_variant_arena instead of the heap */
+    bool in_arena = false;
+
     tr_quark key = TR_KEY_NONE;
 
     union
@@ -89,12 +95,55 @@ struct tr_variant
             size_t alloc;
             size_t count;
             struct tr_variant* vals;
+
+            /* key lookup table for big dicts; see DictIndexMinCount */
+            struct tr_variant_dict_index* index;
         } l;
     } val = {};
 };
 
 void tr_variantFree(tr_variant*);
 
+/**
+ * Backing memory for a parsed variant tree. Container arrays and copied
+ * strings are carved out of a few large blocks rather than being allocated
+ * one by one, and are all released together when the arena is cleared or
+ * destroyed.
+ *
+ * The arena must outlive every variant parsed into it. tr_variantFree()
+ * still needs to be called on those variants, but it skips whatever the
+ * arena owns. Variants parsed into an arena can be modified as usual;
+ * containers that outgrow their arena-backed arrays move to the heap.
+ */
+class tr_variant_arena
+{
+public:
+    tr_variant_arena() = default;
+    ~tr_variant_arena();
+
+    tr_variant_arena(tr_variant_arena const&) = delete;
+    tr_variant_arena& operator=(tr_variant_arena const&) = delete;
+
+    /* returns `new_size` bytes, suitably aligned for any type. If `ptr` is
+     * the arena's most recent allocation, it's extended in place if possible;
+     * otherwise its first `old_size` bytes are copied into the new space. */
+    [[nodiscard]] void* grow(void* ptr, size_t old_size, size_t new_size);
+
+    [[nodiscard]] void* alloc(size_t size)
+    {
+        return grow(nullptr, 0, size);
+    }
+
+    /* frees everything allocated from the arena */
+    void clear();
+
+private:
+    std::vector<char*> blocks_;
+    char* last_ = nullptr;
+    char* pos_ = nullptr;
+    char* end_ = nullptr;
+};
+
 /***
 ****  Serialization / Deserialization
 ***/
@@ -129,6 +178,15 @@ bool tr_variantFromBuf(
     char const** setme_end = nullptr,
     tr_error** error = nullptr);
 
+/* Same as above, but the parsed tree's containers and strings live in `arena`. */
+bool tr_variantFromBuf(
+    tr_variant* setme,
+    tr_variant_arena& arena,
+    int variant_parse_opts,
+    std::string_view buf,
+    char const** setme_end = nullptr,
+    tr_error** error = nullptr);
+
 constexpr bool tr_variantIsType(tr_variant const* b, int type)
 {
     return b != nullptr && b->type == type;
@@ -7,10 +7,12 @@
  */
 
 #include <algorithm>
-#include <cstdlib> /* free() */
 #include <cstring> /* memcmp() */
+#include <memory>
 #include <mutex>
 #include <set>
+#include <thread>
+#include <vector>
 
 #include "transmission.h"
 #include "completion.h"
@@ -20,7 +22,7 @@
 #include "platform.h"
 #include "torrent.h"
 #include "tr-assert.h"
-#include "utils.h" /* tr_malloc(), tr_free() */
+#include "utils.h" /* tr_free() */
 #include "verify.h"
 
 /***
@@ -29,35 +31,110 @@
 
 static auto constexpr MsecToSleepPerSecondDuringVerify = int{ 100 };
 
-static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
+/* how much piece data to read in before hashing it */
+static auto constexpr VerifyBatchBytes = size_t{ 1024 * 1024 * 16 };
+
+/* Without the piece hashes every piece would look corrupt, so rather than
+ * wiping out the torrent's progress, give up and tell the user. */
+static void setHashesMissingError(tr_torrent* tor)
+{
+    tr_torrentSetLocalError(
+        tor,
+        "%s",
+        _("Couldn't load the piece checksums from the .torrent file. Make sure it's still readable, then verify again."));
+}
+
+/* returns true if the torrent's pieces changed. `aborted' is set if it
+ * couldn't be verified at all, in which case nothing has been changed */
+static bool verifyTorrent(tr_torrent* tor, bool* stopFlag, bool* aborted)
 {
     tr_sys_file_t fd = TR_BAD_SYS_FILE;
     uint64_t filePos = 0;
     bool changed = false;
-    bool hadPiece = false;
+    bool pieceReadOk = true;
     time_t lastSleptAt = 0;
     uint32_t piecePos = 0;
     tr_file_index_t fileIndex = 0;
     tr_file_index_t prevFileIndex = !fileIndex;
     tr_piece_index_t piece = 0;
     time_t const begin = tr_time();
-    size_t const buflen = 1024 * 128; // 128 KiB buffer
-    auto* const buffer = static_cast<uint8_t*>(tr_malloc(buflen));
 
-    tr_sha1_ctx_t sha = tr_sha1_init();
+    /* pieces are read into consecutive slots of the buffer
+       and hashed together once the buffer is full. Small torrents
+       don't need a full batch. A piece's hash only counts if it was
+       read in full, so there's no need to zero the buffer first */
+    size_t const slotlen = tor->info.pieceSize;
+    size_t const n_slots = std::min(std::max(size_t{ 1 }, VerifyBatchBytes / slotlen), size_t{ tor->info.pieceCount });
+    auto const buflen = std::min(uint64_t{ n_slots * slotlen }, tor->info.totalSize);
+    auto const buffer = std::unique_ptr<uint8_t[]>(new uint8_t[buflen]);
+    auto batch_pieces = std::vector<tr_piece_index_t>{};
+    auto batch_bufs = std::vector<uint8_t const*>{};
+    auto batch_lens = std::vector<size_t>{};
+    auto batch_read_ok = std::vector<bool>{};
+    auto hashes = std::vector<tr_sha1_digest_t>(n_slots);
+    auto hashes_missing = false;
+    auto workers = tr_sha1_workers{ std::min(n_slots, size_t{ std::thread::hardware_concurrency() }) };
+
+    auto const check_batch = [&]()
+    {
+        auto const n = std::size(batch_pieces);
+        workers.start(n, std::data(batch_bufs), std::data(batch_lens), std::data(hashes));
+        auto const hashed = workers.wait();
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto const batch_piece = batch_pieces[i];
+            auto const expected = tor->pieceHash(batch_piece);
+            if (!expected)
+            {
+                hashes_missing = true;
+                break;
+            }
+
+            auto const hadPiece = tor->hasPiece(batch_piece);
+            auto const hasPiece = hashed && batch_read_ok[i] && hashes[i] == *expected;
+
+            if (hasPiece || hadPiece)
+            {
+                tor->setHasPiece(batch_piece, hasPiece);
+                changed |= hasPiece != hadPiece;
+            }
+        }
+
+        batch_pieces.clear();
+        batch_bufs.clear();
+        batch_lens.clear();
+        batch_read_ok.clear();
+
+        time_t const now = tr_time();
+        tor->anyDate = now;
+        tor->verify_progress = piece / double(tor->info.pieceCount);
+
+        /* sleeping even just a few msec per second goes a long
+         * way towards reducing IO load... */
+        if (lastSleptAt != now)
+        {
+            lastSleptAt = now;
+            tr_wait_msec(MsecToSleepPerSecondDuringVerify);
+        }
+    };
 
     tr_logAddTorDbg(tor, "%s", "verifying torrent...");
+
+    /* make sure the hashes can be loaded before touching anything */
+    if (tor->info.pieceCount > 0 && !tor->pieceHash(0))
+    {
+        setHashesMissingError(tor);
+        *aborted = true;
+        return false;
+    }
+
     tor->verify_progress = 0;
 
-    while (!*stopFlag && piece < tor->info.pieceCount)
+    while (!*stopFlag && !hashes_missing && piece < tor->info.pieceCount)
     {
         tr_file const* file = &tor->info.files[fileIndex];
-
-        /* if we're starting a new piece... */
-        if (piecePos == 0)
-        {
-            hadPiece = tor->hasPiece(piece);
-        }
+        uint8_t* const slot = buffer.get() + std::size(batch_pieces) * slotlen;
 
         /* if we're starting a new file... */
         if (filePos == 0 && fd == TR_BAD_SYS_FILE && fileIndex != prevFileIndex)
@@ -73,18 +150,18 @@ static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
         uint64_t leftInPiece = tor->pieceSize(piece) - piecePos;
         uint64_t leftInFile = file->length - filePos;
         uint64_t bytesThisPass = std::min(leftInFile, leftInPiece);
-        bytesThisPass = std::min(bytesThisPass, uint64_t{ buflen });
 
         /* read a bit */
-        if (fd != TR_BAD_SYS_FILE)
+        auto numRead = uint64_t{};
+        if (fd != TR_BAD_SYS_FILE && tr_sys_file_read_at(fd, slot + piecePos, bytesThisPass, filePos, &numRead, nullptr) &&
+            numRead > 0)
         {
-            auto numRead = uint64_t{};
-            if (tr_sys_file_read_at(fd, buffer, bytesThisPass, filePos, &numRead, nullptr) && numRead > 0)
-            {
-                bytesThisPass = numRead;
-                tr_sha1_update(sha, buffer, bytesThisPass);
-                tr_sys_file_advise(fd, filePos, bytesThisPass, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
-            }
+            bytesThisPass = numRead;
+            tr_sys_file_advise(fd, filePos, bytesThisPass, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
+        }
+        else if (bytesThisPass > 0)
+        {
+            pieceReadOk = false;
         }
 
         /* move our offsets */
@@ -96,30 +173,19 @@ static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
         /* if we're finishing a piece... */
         if (leftInPiece == 0)
         {
-            auto hash = tr_sha1_final(sha);
-            auto const hasPiece = hash && *hash == tor->pieceHash(piece);
+            batch_pieces.push_back(piece);
+            batch_bufs.push_back(slot);
+            batch_lens.push_back(piecePos);
+            batch_read_ok.push_back(pieceReadOk);
 
-            if (hasPiece || hadPiece)
-            {
-                tor->setHasPiece(piece, hasPiece);
-                changed |= hasPiece != hadPiece;
-            }
-
-            time_t const now = tr_time();
-            tor->anyDate = now;
+            ++piece;
+            piecePos = 0;
+            pieceReadOk = true;
 
-            /* sleeping even just a few msec per second goes a long
-             * way towards reducing IO load... */
-            if (lastSleptAt != now)
+            if (std::size(batch_pieces) == n_slots)
             {
-                lastSleptAt = now;
-                tr_wait_msec(MsecToSleepPerSecondDuringVerify);
+                check_batch();
             }
-
-            sha = tr_sha1_init();
-            ++piece;
-            tor->verify_progress = piece / double(tor->info.pieceCount);
-            piecePos = 0;
         }
 
         /* if we're finishing a file... */
@@ -136,6 +202,19 @@ static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
         }
     }
 
+    /* hash whatever's left over */
+    if (!hashes_missing && !std::empty(batch_pieces))
+    {
+        check_batch();
+    }
+
+    /* the hashes were dropped and couldn't be reloaded partway through */
+    if (hashes_missing)
+    {
+        setHashesMissingError(tor);
+        *aborted = true;
+    }
+
     /* cleanup */
     if (fd != TR_BAD_SYS_FILE)
     {
@@ -143,8 +222,6 @@ static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
     }
 
     tor->verify_progress.reset();
-    tr_sha1_final(sha);
-    free(buffer);
 
     /* stopwatch */
     time_t const end = tr_time();
@@ -226,7 +303,8 @@ static void verifyThreadFunc(void* /*user_data*/)
         tr_torrent* tor = currentNode.torrent;
         tr_logAddTorInfo(tor, "%s", _("Verifying torrent"));
         tr_torrentSetVerifyState(tor, TR_VERIFY_NOW);
-        changed = verifyTorrent(tor, &stopCurrent);
+        auto aborted = false;
+        changed = verifyTorrent(tor, &stopCurrent, &aborted);
         tr_torrentSetVerifyState(tor, TR_VERIFY_NONE);
         TR_ASSERT(tr_isTorrent(tor));
 
@@ -237,7 +315,7 @@ static void verifyThreadFunc(void* /*user_data*/)
 
         if (currentNode.callback_func != nullptr)
         {
-            (*currentNode.callback_func)(tor, stopCurrent, currentNode.callback_data);
+            (*currentNode.callback_func)(tor, stopCurrent || aborted, currentNode.callback_data);
         }
     }
 
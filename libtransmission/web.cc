@@ -7,8 +7,12 @@
  */
 
 #include <algorithm>
+#include <cinttypes> /* PRIu64 */
 #include <cstring> /* strlen(), strstr() */
+#include <deque>
+#include <map>
 #include <set>
+#include <string>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -33,6 +37,7 @@
 #include "utils.h"
 #include "version.h" /* User-Agent */
 #include "web.h"
+#include "web-utils.h" /* tr_urlParse() */
 
 using namespace std::literals;
 
@@ -40,8 +45,29 @@ using namespace std::literals;
 #define USE_LIBCURL_SOCKOPT
 #endif
 
+#if LIBCURL_VERSION_NUM >= 0x071E00 /* CURLMOPT_MAX_HOST_CONNECTIONS was added in 7.30.0 */
+#define USE_LIBCURL_MAX_HOST_CONNECTIONS
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x072B00 /* CURLOPT_PIPEWAIT and CURLPIPE_MULTIPLEX were added in 7.43.0 */
+#define USE_LIBCURL_MULTIPLEX
+#endif
+
 static auto constexpr ThreadfuncMaxSleepMsec = int{ 200 };
 
+/* Requests to the same host (e.g. announces to a busy tracker) reuse a few
+   keep-alive or HTTP/2 connections rather than each opening -- and
+   TLS-handshaking -- a new one. Only this many of a host's tasks are handed
+   to curl at once; the rest wait in their tr_web_host's queue, since a task waiting
+   inside curl would already be using up its CURLOPT_TIMEOUT.
+   This must not be lower than webseed.cc's MAX_WEBSEED_CONNECTIONS. */
+static auto constexpr MaxConnectionsPerHost = long{ 6 };
+
+/* how many idle connections curl keeps open for reuse */
+static auto constexpr MaxCachedConnections = long{ 64 };
+
+static auto constexpr DnsCacheTimeoutSecs = long{ 600 };
+
 #define dbgmsg(...) tr_logAddDeepNamed("web", __VA_ARGS__)
 
 /***
@@ -54,6 +80,9 @@ struct tr_web_task
     std::string range;
     std::string url;
 
+    /* "host:port", for limiting how many tasks run per host */
+    std::string host;
+
     CURL* curl_easy = nullptr;
     evbuffer* freebuf = nullptr;
     evbuffer* response = nullptr;
@@ -85,6 +114,14 @@ static void task_free(struct tr_web_task* task)
 ****
 ***/
 
+/* only used by the web thread: a host's tasks in curl, and the ones
+   waiting for a free slot in the order they were added */
+struct tr_web_host
+{
+    std::deque<tr_web_task*> queued;
+    long running = 0;
+};
+
 struct tr_web
 {
     bool curl_verbose;
@@ -97,6 +134,14 @@ struct tr_web
 
     char* cookie_filename;
     std::set<CURL*> paused_easy_handles;
+
+    /* DNS results and TLS sessions shared by all the easy handles */
+    CURLSH* share;
+
+    /* only used by the web thread: every host with tasks in curl, and
+       how many tasks are waiting across all of them */
+    std::map<std::string, tr_web_host> hosts;
+    size_t n_queued;
 };
 
 /***
@@ -242,6 +287,13 @@ static CURL* createEasy(tr_session* s, struct tr_web* web, struct tr_web_task* t
     curl_easy_setopt(e, CURLOPT_MAXREDIRS, -1L);
     curl_easy_setopt(e, CURLOPT_NOSIGNAL, 1L);
     curl_easy_setopt(e, CURLOPT_PRIVATE, task);
+    curl_easy_setopt(e, CURLOPT_SHARE, web->share);
+    curl_easy_setopt(e, CURLOPT_DNS_CACHE_TIMEOUT, DnsCacheTimeoutSecs);
+
+#ifdef USE_LIBCURL_MULTIPLEX
+    /* prefer waiting for a connection that can multiplex over opening a new one */
+    (void)curl_easy_setopt(e, CURLOPT_PIPEWAIT, 1L);
+#endif
 
 #ifdef USE_LIBCURL_SOCKOPT
     curl_easy_setopt(e, CURLOPT_SOCKOPTFUNCTION, sockoptfunction);
@@ -305,6 +357,12 @@ static CURL* createEasy(tr_session* s, struct tr_web* web, struct tr_web_task* t
     return e;
 }
 
+static void addTaskToCurl(tr_session* session, struct tr_web* web, CURLM* multi, struct tr_web_task* task)
+{
+    dbgmsg("adding task to curl: [%s]", task->url.c_str());
+    curl_multi_add_handle(multi, createEasy(session, web, task));
+}
+
 /***
 ****
 ***/
@@ -365,6 +423,11 @@ static struct tr_web_task* tr_webRunImpl(
         task->response = buffer != nullptr ? buffer : evbuffer_new();
         task->freebuf = buffer != nullptr ? nullptr : task->response;
 
+        if (auto const parsed = tr_urlParse(url); parsed)
+        {
+            task->host = std::string{ parsed->host } + ':' + std::to_string(parsed->port);
+        }
+
         auto const lock = std::unique_lock(session->web->web_tasks_mutex);
         task->next = session->web->tasks;
         session->web->tasks = task;
@@ -433,7 +496,20 @@ static void tr_webThreadFunc(void* vsession)
         web->cookie_filename = tr_strvDup(str);
     }
 
+    /* the multi handle owns the connection cache; the share handle lets
+       DNS results and TLS sessions outlive any single easy handle */
+    web->share = curl_share_init();
+    curl_share_setopt(web->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(web->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
     auto* const multi = curl_multi_init();
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, MaxCachedConnections);
+#ifdef USE_LIBCURL_MAX_HOST_CONNECTIONS
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, MaxConnectionsPerHost);
+#endif
+#ifdef USE_LIBCURL_MULTIPLEX
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
     session->web = web;
 
     auto repeats = uint32_t{};
@@ -444,12 +520,12 @@ static void tr_webThreadFunc(void* vsession)
             break;
         }
 
-        if (web->close_mode == TR_WEB_CLOSE_WHEN_IDLE && web->tasks == nullptr)
+        if (web->close_mode == TR_WEB_CLOSE_WHEN_IDLE && web->tasks == nullptr && web->n_queued == 0)
         {
             break;
         }
 
-        /* add tasks from the queue */
+        /* hand new tasks to curl, or queue them if their host has no free slot */
         {
             auto const lock = std::unique_lock(web->web_tasks_mutex);
 
@@ -460,8 +536,17 @@ static void tr_webThreadFunc(void* vsession)
                 web->tasks = task->next;
                 task->next = nullptr;
 
-                dbgmsg("adding task to curl: [%s]", task->url.c_str());
-                curl_multi_add_handle(multi, createEasy(session, web, task));
+                auto& host = web->hosts[task->host];
+                if (host.running < MaxConnectionsPerHost)
+                {
+                    ++host.running;
+                    addTaskToCurl(session, web, multi, task);
+                }
+                else
+                {
+                    host.queued.push_back(task);
+                    ++web->n_queued;
+                }
             }
         }
 
@@ -534,14 +619,48 @@ static void tr_webThreadFunc(void* vsession)
 
                 auto req_bytes_sent = long{};
                 auto total_time = double{};
+                auto num_connects = long{};
                 curl_easy_getinfo(e, CURLINFO_RESPONSE_CODE, &task->code);
                 curl_easy_getinfo(e, CURLINFO_REQUEST_SIZE, &req_bytes_sent);
                 curl_easy_getinfo(e, CURLINFO_TOTAL_TIME, &total_time);
+                curl_easy_getinfo(e, CURLINFO_NUM_CONNECTS, &num_connects);
                 task->did_connect = task->code > 0 || req_bytes_sent > 0;
                 task->did_timeout = task->code == 0 && total_time >= task->timeout_secs;
+
+                ++session->web_transfers_done;
+                if (task->did_connect && num_connects == 0)
+                {
+                    ++session->web_transfers_on_reused_connection;
+                }
+
+                dbgmsg(
+                    "task %p opened %ld new connection(s); %" PRIu64 " of %" PRIu64 " transfers reused one",
+                    (void*)task,
+                    num_connects,
+                    session->web_transfers_on_reused_connection.load(),
+                    session->web_transfers_done.load());
                 curl_multi_remove_handle(multi, e);
                 web->paused_easy_handles.erase(e);
                 curl_easy_cleanup(e);
+
+                /* hand the host's slot to its next queued task, if any */
+                if (auto const it = web->hosts.find(task->host); it != std::end(web->hosts))
+                {
+                    auto& host = it->second;
+
+                    if (!std::empty(host.queued))
+                    {
+                        auto* const next = host.queued.front();
+                        host.queued.pop_front();
+                        --web->n_queued;
+                        addTaskToCurl(session, web, multi, next);
+                    }
+                    else if (--host.running == 0)
+                    {
+                        web->hosts.erase(it);
+                    }
+                }
+
                 tr_runInEventThread(task->session, task_finish_func, task);
             }
         }
@@ -557,8 +676,24 @@ static void tr_webThreadFunc(void* vsession)
         task_free(task);
     }
 
+    for (auto const& [key, host] : web->hosts)
+    {
+        for (auto* const task : host.queued)
+        {
+            dbgmsg("Discarding task \"%s\"", task->url.c_str());
+            task_free(task);
+        }
+    }
+
+    tr_logAddNamedDbg(
+        "web",
+        "%" PRIu64 " of %" PRIu64 " transfers reused an existing connection",
+        session->web_transfers_on_reused_connection.load(),
+        session->web_transfers_done.load());
+
     /* cleanup */
     curl_multi_cleanup(multi);
+    curl_share_cleanup(web->share);
     tr_free(web->curl_ca_bundle);
     tr_free(web->cookie_filename);
     delete web;
@@ -581,6 +716,14 @@ void tr_webClose(tr_session* session, tr_web_close_mode close_mode)
     }
 }
 
+tr_web_stats tr_webGetStats(tr_session const* session)
+{
+    auto ret = tr_web_stats{};
+    ret.transfers_done = session->web_transfers_done;
+    ret.transfers_on_reused_connection = session->web_transfers_on_reused_connection;
+    return ret;
+}
+
 long tr_webGetTaskResponseCode(struct tr_web_task* task)
 {
     long code = 0;
@@ -50,6 +50,18 @@ struct tr_web_task* tr_webRunWebseed(
     void* done_func_user_data,
     struct evbuffer* buffer);
 
+struct tr_web_stats
+{
+    /* transfers that curl finished, whether or not they succeeded */
+    uint64_t transfers_done;
+
+    /* transfers that connected without opening a new connection */
+    uint64_t transfers_on_reused_connection;
+};
+
+/* returns zeroes if the session hasn't used the web thread yet */
+tr_web_stats tr_webGetStats(tr_session const* session);
+
 long tr_webGetTaskResponseCode(struct tr_web_task* task);
 
 char const* tr_webGetTaskRealUrl(struct tr_web_task* task);
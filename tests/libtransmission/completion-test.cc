@@ -6,9 +6,11 @@
  *
  */
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <set>
+#include <vector>
 
 #include "transmission.h"
 
@@ -478,3 +480,81 @@ TEST_F(CompletionTest, amountDone)
 TEST_F(CompletionTest, status)
 {
 }
+
+TEST_F(CompletionTest, fileBytesCompleted)
+{
+    auto constexpr TotalSize = uint64_t{ BlockSize * 64 + 100 };
+    auto constexpr PieceSize = uint64_t{ BlockSize * 4 };
+
+    // files that share blocks, span pieces, are empty, and fill a block exactly
+    auto lengths = std::vector<uint64_t>{ 1, 0, BlockSize - 1, BlockSize * 10 + 7, 0, 3, BlockSize * 20 - 10, BlockSize };
+    lengths.push_back(TotalSize - BlockSize * 32);
+    auto offsets = std::vector<uint64_t>{};
+    auto offset = uint64_t{};
+    for (auto const length : lengths)
+    {
+        offsets.push_back(offset);
+        offset += length;
+    }
+    EXPECT_EQ(TotalSize, offset);
+
+    auto torrent = TestTorrent{};
+    auto const block_info = tr_block_info{ TotalSize, PieceSize };
+    auto completion = tr_completion(&torrent, &block_info);
+    completion.setFileOffsets(offsets);
+
+    // count the bytes the slow way, one block at a time
+    auto const expected_bytes = [&](size_t file)
+    {
+        auto const file_begin = offsets[file];
+        auto const file_end = file_begin + lengths[file];
+        auto total = uint64_t{};
+
+        for (tr_block_index_t block = 0; block < block_info.n_blocks; ++block)
+        {
+            auto const block_begin = uint64_t{ block } * block_info.block_size;
+            auto const block_end = block_begin + block_info.blockSize(block);
+            if (completion.hasBlock(block) && block_begin < file_end && file_begin < block_end)
+            {
+                total += std::min(block_end, file_end) - std::max(block_begin, file_begin);
+            }
+        }
+
+        return total;
+    };
+
+    auto const check = [&]()
+    {
+        for (size_t file = 0; file < std::size(lengths); ++file)
+        {
+            EXPECT_EQ(expected_bytes(file), completion.fileBytesCompleted(file));
+        }
+    };
+
+    check();
+
+    for (int i = 0; i < 200; ++i)
+    {
+        completion.addBlock(tr_rand_int_weak(block_info.n_blocks));
+        check();
+    }
+
+    for (int i = 0; i < 5; ++i)
+    {
+        completion.removePiece(tr_rand_int_weak(block_info.n_pieces));
+        completion.addPiece(tr_rand_int_weak(block_info.n_pieces));
+        check();
+    }
+
+    auto blocks = tr_bitfield{ block_info.n_blocks };
+    blocks.setHasAll();
+    completion.setBlocks(blocks);
+    for (size_t file = 0; file < std::size(lengths); ++file)
+    {
+        EXPECT_EQ(lengths[file], completion.fileBytesCompleted(file));
+    }
+
+    blocks.setHasNone();
+    completion.setBlocks(blocks);
+    check();
+}
@@ -15,10 +15,12 @@
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
 #include <array>
 #include <cstring>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 using namespace std::literals;
 
@@ -102,6 +104,82 @@ TEST(Crypto, encryptDecrypt)
     tr_cryptoDestruct(&a);
 }
 
+TEST(Crypto, encryptMatchesRc4)
+{
+    auto hash = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    for (size_t i = 0; i < hash.size(); ++i)
+    {
+        hash[i] = uint8_t(i);
+    }
+
+    auto a = tr_crypto{};
+    tr_cryptoConstruct(&a, hash.data(), false);
+    auto b = tr_crypto{};
+    tr_cryptoConstruct(&b, hash.data(), true);
+    auto public_key_length = int{};
+    EXPECT_TRUE(tr_cryptoComputeSecret(&a, tr_cryptoGetMyPublicKey(&b, &public_key_length)));
+    EXPECT_TRUE(tr_cryptoComputeSecret(&b, tr_cryptoGetMyPublicKey(&a, &public_key_length)));
+
+    // textbook RC4 keyed the way MSE does it: sha1("keyA", S, SKEY), first 1024 bytes discarded
+    auto key = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    EXPECT_TRUE(tr_cryptoSecretKeySha1(&a, "keyA", 4, hash.data(), hash.size(), key.data()));
+    auto s = std::array<uint8_t, 256>{};
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        s[i] = uint8_t(i);
+    }
+
+    uint8_t i = 0;
+    uint8_t j = 0;
+    for (size_t k = 0; k < s.size(); ++k)
+    {
+        j = uint8_t(j + s[k] + key[k % key.size()]);
+        std::swap(s[k], s[j]);
+    }
+
+    j = 0;
+    auto const next = [&]()
+    {
+        i = uint8_t(i + 1);
+        j = uint8_t(j + s[i]);
+        std::swap(s[i], s[j]);
+        return s[uint8_t(s[i] + s[j])];
+    };
+
+    for (int k = 0; k < 1024; ++k)
+    {
+        next();
+    }
+
+    auto plain = std::vector<uint8_t>(4096 + 3);
+    tr_rand_buffer(std::data(plain), std::size(plain));
+    auto expected = plain;
+    for (auto& ch : expected)
+    {
+        ch ^= next();
+    }
+
+    // encrypt in place, in uneven chunks so both the word-sized and byte-sized paths get used
+    auto encrypted = plain;
+    tr_cryptoEncryptInit(&a);
+    for (size_t pos = 0, len = 1; pos < std::size(encrypted); pos += len, len = len * 2 + 1)
+    {
+        len = std::min(len, std::size(encrypted) - pos);
+        tr_cryptoEncrypt(&a, len, &encrypted[pos], &encrypted[pos]);
+    }
+
+    EXPECT_EQ(expected, encrypted);
+
+    // and the peer can decrypt it
+    auto decrypted = std::vector<uint8_t>(std::size(encrypted));
+    tr_cryptoDecryptInit(&b);
+    tr_cryptoDecrypt(&b, std::size(encrypted), std::data(encrypted), std::data(decrypted));
+    EXPECT_EQ(plain, decrypted);
+
+    tr_cryptoDestruct(&b);
+    tr_cryptoDestruct(&a);
+}
+
 TEST(Crypto, sha1)
 {
     auto hash1 = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
@@ -122,6 +200,67 @@ TEST(Crypto, sha1)
     EXPECT_EQ(0, memcmp(hash1.data(), hash2.data(), hash2.size()));
 }
 
+TEST(Crypto, sha1Batch)
+{
+    // big enough that the work gets spread across threads
+    auto constexpr NumBufs = size_t{ 8 };
+    auto constexpr BufLen = size_t{ 1024 * 1024 };
+
+    auto bufs = std::vector<std::vector<uint8_t>>{};
+    auto ptrs = std::vector<uint8_t const*>{};
+    auto lens = std::vector<size_t>{};
+    for (size_t i = 0; i < NumBufs; ++i)
+    {
+        auto& buf = bufs.emplace_back(BufLen - i);
+        tr_rand_buffer(std::data(buf), std::size(buf));
+        ptrs.push_back(std::data(buf));
+        lens.push_back(std::size(buf));
+    }
+
+    auto hashes = std::vector<tr_sha1_digest_t>(NumBufs);
+    EXPECT_TRUE(tr_sha1_batch(NumBufs, std::data(ptrs), std::data(lens), std::data(hashes)));
+
+    for (size_t i = 0; i < NumBufs; ++i)
+    {
+        auto expected = tr_sha1_digest_t{};
+        EXPECT_TRUE(tr_sha1_(reinterpret_cast<uint8_t*>(std::data(expected)), ptrs[i], int(lens[i]), nullptr));
+        EXPECT_EQ(expected, hashes[i]);
+    }
+
+    // an empty batch is a no-op
+    EXPECT_TRUE(tr_sha1_batch(0, nullptr, nullptr, nullptr));
+}
+
+TEST(Crypto, sha1Workers)
+{
+    auto constexpr NumBufs = size_t{ 16 };
+    auto constexpr BufLen = size_t{ 64 * 1024 };
+
+    auto bufs = std::vector<std::vector<uint8_t>>{};
+    auto ptrs = std::vector<uint8_t const*>{};
+    auto lens = std::vector<size_t>{};
+    for (size_t i = 0; i < NumBufs; ++i)
+    {
+        auto& buf = bufs.emplace_back(BufLen - i);
+        tr_rand_buffer(std::data(buf), std::size(buf));
+        ptrs.push_back(std::data(buf));
+        lens.push_back(std::size(buf));
+    }
+
+    auto expected = std::vector<tr_sha1_digest_t>(NumBufs);
+    EXPECT_TRUE(tr_sha1_batch(NumBufs, std::data(ptrs), std::data(lens), std::data(expected)));
+
+    // the same workers hash one batch after another, including empty ones
+    auto workers = tr_sha1_workers{ 3 };
+    for (size_t n : { NumBufs, size_t{ 1 }, size_t{ 0 }, NumBufs / 2 })
+    {
+        auto hashes = std::vector<tr_sha1_digest_t>(n);
+        workers.start(n, std::data(ptrs), std::data(lens), std::data(hashes));
+        EXPECT_TRUE(workers.wait());
+        EXPECT_TRUE(std::equal(std::begin(hashes), std::end(hashes), std::begin(expected))) << n;
+    }
+}
+
 TEST(Crypto, ssha1)
 {
     struct LocalTest
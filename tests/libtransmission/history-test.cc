@@ -8,9 +8,13 @@
 
 #include "transmission.h"
 #include "history.h"
+#include "utils.h" // tr_time_msec()
 
 #include "gtest/gtest.h"
 
+#include <thread>
+#include <vector>
+
 TEST(History, recentHistory)
 {
     auto h = tr_recentHistory{};
@@ -25,3 +29,129 @@ TEST(History, recentHistory)
     EXPECT_EQ(2, h.count(22000, 15000));
     EXPECT_EQ(2, h.count(22000, 20000));
 }
+
+TEST(History, rateMeterSteadyStream)
+{
+    auto meter = tr_rateMeter{};
+    auto now = uint64_t{ 1000000 };
+    EXPECT_EQ(0U, meter.rate(now));
+
+    // 1000 bytes every 100 msec is 10000 bytes per second
+    for (int i = 0; i < 200; ++i)
+    {
+        now += 100;
+        meter.add(now, 1000);
+    }
+
+    EXPECT_NEAR(10000, meter.rate(now), 500);
+    EXPECT_NEAR(10000, meter.rate(now + 50), 500);
+
+    // once the transfers stop, the rate falls off without any more updates
+    EXPECT_GT(meter.rate(now + 1000), 4000U);
+    EXPECT_LT(meter.rate(now + 1000), 6000U);
+    EXPECT_EQ(0U, meter.rate(now + 60000));
+
+    // and picks back up when they resume
+    now += 60000;
+    meter.add(now, 2000);
+    EXPECT_EQ(1000U, meter.rate(now));
+}
+
+TEST(History, rateMeterFallsToZeroAfterWindow)
+{
+    auto meter = tr_rateMeter{};
+    auto now = uint64_t{ 1000000 };
+
+    for (int i = 0; i < 200; ++i)
+    {
+        now += 100;
+        meter.add(now, 1000);
+    }
+
+    EXPECT_NEAR(10000, meter.rate(now), 500);
+
+    // bytes older than the window don't count at all, so anything that
+    // waits for a stalled transfer's speed to reach zero won't wait long
+    EXPECT_EQ(0U, meter.rate(now + tr_rateMeter::WindowMSec));
+
+    // and a single burst counts for the whole window, then not at all
+    now += 60000;
+    meter.add(now, 4000);
+    EXPECT_EQ(2000U, meter.rate(now));
+    EXPECT_EQ(2000U, meter.rate(now + tr_rateMeter::WindowMSec - tr_rateMeter::TickMSec));
+    EXPECT_EQ(0U, meter.rate(now + tr_rateMeter::WindowMSec));
+}
+
+TEST(History, rateMeterEpochTimestamps)
+{
+    // real clocks give msec since the epoch, which don't fit in 32-bit ticks
+    for (auto const start : { tr_time_msec(), uint64_t{ 1700000000000 }, uint64_t{ 4294967296ULL * 100 + 50 } })
+    {
+        auto meter = tr_rateMeter{};
+        auto now = start;
+        EXPECT_EQ(0U, meter.rate(now));
+
+        for (int i = 0; i < 200; ++i)
+        {
+            now += 100;
+            meter.add(now, 1000);
+        }
+
+        EXPECT_NEAR(10000, meter.rate(now), 500) << start;
+        EXPECT_EQ(0U, meter.rate(now + tr_rateMeter::WindowMSec)) << start;
+        EXPECT_EQ(0U, meter.rate(now + 60000)) << start;
+    }
+}
+
+TEST(History, rateMeterConcurrentWriters)
+{
+    auto meter = tr_rateMeter{};
+    auto constexpr NumThreads = 4;
+    auto constexpr NumAdds = 1000;
+    auto constexpr Now = uint64_t{ 1000000 };
+
+    // everything lands in one tick
+    auto threads = std::vector<std::thread>{};
+    for (int i = 0; i < NumThreads; ++i)
+    {
+        threads.emplace_back(
+            [&meter]()
+            {
+                for (int j = 0; j < NumAdds; ++j)
+                {
+                    meter.add(Now, 2);
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(NumThreads * NumAdds, meter.rate(Now));
+
+    // writers racing to start new ticks still count every byte in the window
+    threads.clear();
+    for (int i = 0; i < NumThreads; ++i)
+    {
+        threads.emplace_back(
+            [&meter]()
+            {
+                for (int j = 1; j <= NumAdds; ++j)
+                {
+                    meter.add(Now + j * tr_rateMeter::TickMSec, 100);
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    // 400 bytes per tick, over the ticks in the window
+    auto constexpr NumTicks = tr_rateMeter::WindowMSec / tr_rateMeter::TickMSec;
+    auto const rate = meter.rate(Now + NumAdds * tr_rateMeter::TickMSec);
+    EXPECT_EQ(NumThreads * 100 * NumTicks * 1000 / tr_rateMeter::WindowMSec, rate);
+}
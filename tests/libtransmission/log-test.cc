@@ -0,0 +1,200 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "transmission.h"
+#include "log.h"
+
+#include "gtest/gtest.h"
+
+using namespace std::literals;
+
+class LogTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        ::testing::Test::SetUp();
+        tr_logSetQueueEnabled(true);
+        tr_logFreeQueue(tr_logGetQueue());
+    }
+
+    void TearDown() override
+    {
+        tr_logFreeQueue(tr_logGetQueue());
+        tr_logSetQueueEnabled(false);
+        ::testing::Test::TearDown();
+    }
+
+    static std::vector<std::string> getQueuedMessages()
+    {
+        auto messages = std::vector<std::string>{};
+        tr_log_message* const queue = tr_logGetQueue();
+
+        for (auto const* msg = queue; msg != nullptr; msg = msg->next)
+        {
+            messages.emplace_back(msg->message);
+        }
+
+        tr_logFreeQueue(queue);
+        return messages;
+    }
+
+    static void logFromThreads(int n_threads, int per_thread)
+    {
+        auto threads = std::vector<std::thread>{};
+        for (int t = 0; t < n_threads; ++t)
+        {
+            threads.emplace_back(
+                [t, per_thread]()
+                {
+                    for (int i = 0; i < per_thread; ++i)
+                    {
+                        tr_logAddMessage(__FILE__, __LINE__, TR_LOG_INFO, nullptr, "thread %d message %d", t, i);
+                    }
+                });
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    // every message arrived, and messages from each thread kept their order
+    static void expectAllMessages(int n_threads, int per_thread)
+    {
+        auto next = std::vector<int>(n_threads);
+        auto const messages = getQueuedMessages();
+        EXPECT_EQ(size_t(n_threads * per_thread), std::size(messages));
+        for (auto const& message : messages)
+        {
+            int t = 0;
+            int i = 0;
+            ASSERT_EQ(2, sscanf(message.c_str(), "thread %d message %d", &t, &i));
+            EXPECT_EQ(next[t], i);
+            next[t] = i + 1;
+        }
+    }
+};
+
+TEST_F(LogTest, queuesMessages)
+{
+    auto constexpr Line = 42;
+    tr_logAddMessage("some/dir/file.cc", Line, TR_LOG_ERROR, "name", "hello %s %d", "world", 1);
+
+    tr_log_message* const queue = tr_logGetQueue();
+    ASSERT_NE(nullptr, queue);
+    EXPECT_EQ(nullptr, queue->next);
+    EXPECT_EQ(TR_LOG_ERROR, queue->level);
+    EXPECT_EQ(Line, queue->line);
+    EXPECT_STREQ("some/dir/file.cc", queue->file);
+    EXPECT_STREQ("name", queue->name);
+    EXPECT_STREQ("hello world 1", queue->message);
+    tr_logFreeQueue(queue);
+}
+
+TEST_F(LogTest, writerThread)
+{
+    auto constexpr NumThreads = 4;
+    auto constexpr PerThread = 50;
+
+    tr_logStartWriter();
+    logFromThreads(NumThreads, PerThread);
+    tr_logStopWriter();
+
+    expectAllMessages(NumThreads, PerThread);
+}
+
+TEST_F(LogTest, writerThreadCountsDroppedBursts)
+{
+    // far more than the writer's ring can hold at once
+    auto constexpr NumThreads = 8;
+    auto constexpr PerThread = 1000;
+
+    tr_logStartWriter();
+    logFromThreads(NumThreads, PerThread);
+    tr_logStopWriter();
+
+    // every message either arrived, in order, or was counted as dropped
+    auto next = std::vector<int>(NumThreads);
+    auto delivered = size_t{};
+    auto dropped = size_t{};
+    for (auto const& message : getQueuedMessages())
+    {
+        int t = 0;
+        int i = 0;
+        auto n = size_t{};
+        if (sscanf(message.c_str(), "thread %d message %d", &t, &i) == 2)
+        {
+            EXPECT_LE(next[t], i);
+            next[t] = i + 1;
+            ++delivered;
+        }
+        else
+        {
+            ASSERT_EQ(1, sscanf(message.c_str(), "%zu log messages were dropped", &n)) << message;
+            dropped += n;
+        }
+    }
+
+    EXPECT_EQ(size_t(NumThreads * PerThread), delivered + dropped);
+}
+
+TEST_F(LogTest, callSiteRateLimit)
+{
+    auto constexpr Max = tr_log_call_site::MaxPerSecond;
+
+    // the limit resets every second, so retry if we straddled one
+    for (;;)
+    {
+        auto site = tr_log_call_site{};
+        auto const start = time(nullptr);
+        auto allowed = 0;
+        for (int i = 0; i < Max * 2; ++i)
+        {
+            allowed += site.allow(__FILE__, __LINE__, TR_LOG_INFO, nullptr) ? 1 : 0;
+        }
+
+        if (time(nullptr) != start)
+        {
+            continue;
+        }
+
+        EXPECT_EQ(Max, allowed);
+
+        // once the next second starts, the suppressed messages are reported
+        while (time(nullptr) == start)
+        {
+            std::this_thread::sleep_for(10ms);
+        }
+
+        EXPECT_TRUE(site.allow(__FILE__, __LINE__, TR_LOG_INFO, nullptr));
+        auto const messages = getQueuedMessages();
+        ASSERT_EQ(1U, std::size(messages));
+        EXPECT_EQ("(" + std::to_string(Max) + " similar messages were suppressed)", messages.front());
+        break;
+    }
+}
+
+TEST_F(LogTest, callSiteRateLimitAllowsErrors)
+{
+    auto site = tr_log_call_site{};
+    for (int i = 0; i < tr_log_call_site::MaxPerSecond * 2; ++i)
+    {
+        EXPECT_TRUE(site.allow(__FILE__, __LINE__, TR_LOG_ERROR, nullptr));
+    }
+
+    EXPECT_TRUE(std::empty(getQueuedMessages()));
+}
@@ -8,14 +8,18 @@
 
 #include "transmission.h"
 
+#include "crypto-utils.h"
 #include "metainfo.h"
+#include "torrent.h"
 #include "utils.h"
+#include "variant.h"
 
 #include "gtest/gtest.h"
 
 #include <array>
 #include <cerrno>
 #include <cstring>
+#include <string>
 #include <string_view>
 
 using namespace std::literals;
@@ -186,3 +190,100 @@ TEST(Metainfo, AndroidTorrent)
 
     tr_ctorFree(ctor);
 }
+
+TEST(Metainfo, parseBencMatchesVariant)
+{
+    auto* ctor = tr_ctorNew(nullptr);
+
+    auto const filename = tr_strvPath(LIBTRANSMISSION_TEST_ASSETS_DIR, "Android-x86 8.1 r6 iso.torrent");
+    EXPECT_EQ(0, tr_ctorSetMetainfoFromFile(ctor, filename.c_str()));
+
+    auto const from_benc = tr_metainfoParse(nullptr, tr_ctorGetMetainfoBenc(ctor), nullptr);
+    tr_variant const* metainfo = nullptr;
+    EXPECT_TRUE(tr_ctorGetMetainfo(ctor, &metainfo));
+    auto const from_variant = tr_metainfoParse(nullptr, metainfo, nullptr);
+    EXPECT_TRUE(from_benc);
+    EXPECT_TRUE(from_variant);
+
+    if (from_benc && from_variant)
+    {
+        auto const& a = from_benc->info;
+        auto const& b = from_variant->info;
+        EXPECT_STREQ(b.hashString, a.hashString);
+        EXPECT_STREQ(b.name, a.name);
+        EXPECT_EQ(b.totalSize, a.totalSize);
+        EXPECT_EQ(b.pieceSize, a.pieceSize);
+        EXPECT_EQ(b.pieceCount, a.pieceCount);
+        EXPECT_EQ(b.fileCount, a.fileCount);
+        EXPECT_EQ(b.trackerCount, a.trackerCount);
+        EXPECT_EQ(from_variant->pieces, from_benc->pieces);
+        EXPECT_EQ(from_variant->info_dict_length, from_benc->info_dict_length);
+    }
+
+    tr_ctorFree(ctor);
+}
+
+TEST(Metainfo, infoHashUsesRawInfoDictFromFile)
+{
+    // this fixture's info dict has its keys out of order, so its
+    // info-hash changes if the dict is re-encoded
+    auto* ctor = tr_ctorNew(nullptr);
+    auto const filename = tr_strvPath(LIBTRANSMISSION_TEST_ASSETS_DIR, "unsorted-info-dict.torrent");
+    EXPECT_EQ(0, tr_ctorSetMetainfoFromFile(ctor, filename.c_str()));
+
+    auto const benc = tr_ctorGetMetainfoBenc(ctor);
+    auto const parsed = tr_metainfoParse(nullptr, benc, nullptr);
+    EXPECT_TRUE(parsed);
+
+    auto constexpr Key = "4:info"sv;
+    auto const pos = benc.find(Key);
+    EXPECT_NE(std::string_view::npos, pos);
+
+    if (parsed && pos != std::string_view::npos)
+    {
+        // the info-hash is the SHA1 of the info dict's bytes in the file...
+        auto const raw = benc.substr(pos + std::size(Key), parsed->info_dict_length);
+        EXPECT_EQ('d', raw.front());
+        EXPECT_EQ('e', raw.back());
+        auto expected = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+        tr_sha1(std::data(expected), std::data(raw), int(std::size(raw)), nullptr);
+        EXPECT_EQ(0, memcmp(std::data(expected), parsed->info.hash, std::size(expected)));
+        EXPECT_STREQ("hello.txt", parsed->info.name);
+
+        // ...not of the dict re-encoded in canonical order
+        tr_variant const* metainfo = nullptr;
+        tr_variant* info = nullptr;
+        EXPECT_TRUE(tr_ctorGetMetainfo(ctor, &metainfo));
+        EXPECT_TRUE(tr_variantDictFindDict(const_cast<tr_variant*>(metainfo), TR_KEY_info, &info));
+        auto len = size_t{};
+        auto* const canonical = tr_variantToStr(info, TR_VARIANT_FMT_BENC, &len);
+        EXPECT_EQ(std::size(raw), len);
+        EXPECT_NE(raw, std::string_view(canonical, len));
+        auto reencoded = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+        tr_sha1(std::data(reencoded), canonical, int(len), nullptr);
+        EXPECT_NE(0, memcmp(std::data(reencoded), parsed->info.hash, std::size(reencoded)));
+        tr_free(canonical);
+    }
+
+    tr_ctorFree(ctor);
+}
+
+TEST(Metainfo, infoHashUsesRawInfoDict)
+{
+    // "piece length" is out of order, so re-encoding the info dict would change it
+    auto constexpr Info = "d12:piece lengthi32768e6:lengthi2e4:name5:a.txt6:pieces20:aaaaaaaaaaaaaaaaaaaae"sv;
+    auto const benc = "d8:announce27:http://example.com/announce4:info"s + std::string{ Info } + "e";
+
+    auto const parsed = tr_metainfoParse(nullptr, benc, nullptr);
+    EXPECT_TRUE(parsed);
+
+    if (parsed)
+    {
+        auto expected = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+        tr_sha1(std::data(expected), std::data(Info), int(std::size(Info)), nullptr);
+        EXPECT_EQ(0, memcmp(std::data(expected), parsed->info.hash, std::size(expected)));
+        EXPECT_EQ(std::size(Info), parsed->info_dict_length);
+        EXPECT_STREQ("a.txt", parsed->info.name);
+        EXPECT_EQ(1U, parsed->info.trackerCount);
+    }
+}
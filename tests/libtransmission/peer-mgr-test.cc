@@ -0,0 +1,635 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "crypto-utils.h" // tr_rand_buffer()
+#include "net.h"
+#include "peer-mgr.h"
+#include "trevent.h" // tr_runInEventThread()
+#include "utils.h" // tr_free
+#include "variant.h"
+
+#include "test-fixtures.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <climits> // INT_MAX
+#include <cstring> // memcmp()
+#include <functional>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h> /* htonl() */
+#include <sys/select.h>
+#endif
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using PeerMgrTest = SessionTest;
+
+namespace
+{
+
+std::vector<tr_pex> makePexBurst(size_t n_ipv4, size_t n_ipv6, uint8_t flags)
+{
+    auto pex = std::vector<tr_pex>{};
+
+    for (size_t i = 0; i < n_ipv4; ++i)
+    {
+        auto p = tr_pex{};
+        p.addr.type = TR_AF_INET;
+        auto* const bytes = reinterpret_cast<uint8_t*>(&p.addr.addr.addr4);
+        bytes[0] = 11;
+        bytes[1] = uint8_t(i >> 16);
+        bytes[2] = uint8_t(i >> 8);
+        bytes[3] = uint8_t(i);
+        p.port = htons(51413);
+        p.flags = flags;
+        pex.push_back(p);
+    }
+
+    for (size_t i = 0; i < n_ipv6; ++i)
+    {
+        auto p = tr_pex{};
+        p.addr.type = TR_AF_INET6;
+        auto* const bytes = p.addr.addr.addr6.s6_addr;
+        bytes[0] = 0x20;
+        bytes[1] = 0x01;
+        bytes[2] = 0x0d;
+        bytes[3] = 0xb9;
+        bytes[14] = uint8_t(i >> 8);
+        bytes[15] = uint8_t(i);
+        p.port = htons(51413);
+        p.flags = flags;
+        pex.push_back(p);
+    }
+
+    return pex;
+}
+
+std::vector<tr_pex> getPeers(tr_torrent const* tor, uint8_t address_type)
+{
+    tr_pex* pex = nullptr;
+    auto const n = tr_peerMgrGetPeers(tor, &pex, address_type, TR_PEERS_INTERESTING, INT_MAX);
+    auto ret = std::vector<tr_pex>{ pex, pex + n };
+    tr_free(pex);
+    return ret;
+}
+
+// A BitTorrent peer on the loopback interface that connects to the
+// session. It speaks the unencrypted handshake with no extensions, and
+// sends and reads the core messages when told to.
+class FakePeer
+{
+public:
+    static auto constexpr Unchoke = uint8_t{ 1 };
+    static auto constexpr Interested = uint8_t{ 2 };
+    static auto constexpr Have = uint8_t{ 4 };
+    static auto constexpr Bitfield = uint8_t{ 5 };
+    static auto constexpr Request = uint8_t{ 6 };
+    static auto constexpr Piece = uint8_t{ 7 };
+
+    explicit FakePeer(tr_torrent const* tor)
+    {
+        auto sin = sockaddr_in{};
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(tr_sessionGetPeerPort(tor->session));
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sock_ = socket(AF_INET, SOCK_STREAM, 0);
+        EXPECT_NE(TR_BAD_SOCKET, sock_);
+        EXPECT_EQ(0, connect(sock_, reinterpret_cast<sockaddr const*>(&sin), sizeof(sin)));
+
+        auto peer_id = std::array<uint8_t, 20>{ '-', 'F', 'K', '0', '0', '0', '1', '-' };
+        tr_rand_buffer(std::data(peer_id) + 8, std::size(peer_id) - 8);
+
+        auto handshake = std::string{ "\x13"
+                                      "BitTorrent protocol" };
+        handshake.append(8, '\0');
+        handshake.append(reinterpret_cast<char const*>(tor->info.hash), SHA_DIGEST_LENGTH);
+        handshake.append(reinterpret_cast<char const*>(std::data(peer_id)), std::size(peer_id));
+        sendAll(handshake);
+
+        // the session answers with its own handshake for the same torrent
+        auto reply = std::array<uint8_t, 68>{};
+        handshake_ok_ = recvAll(std::data(reply), std::size(reply)) &&
+            memcmp(std::data(reply) + 28, tor->info.hash, SHA_DIGEST_LENGTH) == 0;
+    }
+
+    ~FakePeer()
+    {
+        tr_netCloseSocket(sock_);
+    }
+
+    FakePeer(FakePeer const&) = delete;
+    FakePeer& operator=(FakePeer const&) = delete;
+
+    [[nodiscard]] bool handshakeOk() const
+    {
+        return handshake_ok_;
+    }
+
+    void sendBitfield(std::set<tr_piece_index_t> const& pieces, tr_piece_index_t piece_count)
+    {
+        auto payload = std::string((piece_count + 7) / 8, '\0');
+        for (auto const piece : pieces)
+        {
+            payload[piece / 8] |= char(0x80 >> (piece % 8));
+        }
+
+        sendMessage(Bitfield, payload);
+    }
+
+    void sendHave(tr_piece_index_t piece)
+    {
+        sendMessage(Have, uint32Payload({ piece }));
+    }
+
+    void sendInterested()
+    {
+        sendMessage(Interested, {});
+    }
+
+    void sendRequest(tr_piece_index_t piece, uint32_t offset, uint32_t length)
+    {
+        sendMessage(Request, uint32Payload({ piece, offset, length }));
+    }
+
+    // reads messages until one of type `id' arrives, and returns its payload
+    std::optional<std::string> waitForMessage(uint8_t id)
+    {
+        for (;;)
+        {
+            auto len = uint32_t{};
+            if (!recvAll(&len, sizeof(len)))
+            {
+                return {};
+            }
+
+            auto message = std::string(ntohl(len), '\0');
+            if (!recvAll(std::data(message), std::size(message)))
+            {
+                return {};
+            }
+
+            if (!std::empty(message) && uint8_t(message.front()) == id)
+            {
+                return message.substr(1);
+            }
+        }
+    }
+
+private:
+    static std::string uint32Payload(std::initializer_list<uint32_t> values)
+    {
+        auto payload = std::string{};
+        for (auto const value : values)
+        {
+            auto const nvalue = htonl(value);
+            payload.append(reinterpret_cast<char const*>(&nvalue), sizeof(nvalue));
+        }
+
+        return payload;
+    }
+
+    void sendMessage(uint8_t id, std::string_view payload)
+    {
+        auto const len = htonl(uint32_t(1 + std::size(payload)));
+        auto message = std::string{ reinterpret_cast<char const*>(&len), sizeof(len) };
+        message += char(id);
+        message += payload;
+        sendAll(message);
+    }
+
+    void sendAll(std::string_view data)
+    {
+        EXPECT_EQ(ssize_t(std::size(data)), send(sock_, std::data(data), std::size(data), 0));
+    }
+
+    bool recvAll(void* buf, size_t buflen)
+    {
+        auto* walk = static_cast<char*>(buf);
+        auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 10 };
+
+        while (buflen > 0 && std::chrono::steady_clock::now() < deadline)
+        {
+            auto fds = fd_set{};
+            FD_ZERO(&fds);
+            FD_SET(sock_, &fds);
+            auto tv = timeval{ 0, 20000 };
+            if (select(int(sock_) + 1, &fds, nullptr, nullptr, &tv) <= 0)
+            {
+                continue;
+            }
+
+            auto const n = recv(sock_, walk, buflen, 0);
+            if (n <= 0)
+            {
+                return false;
+            }
+
+            walk += n;
+            buflen -= size_t(n);
+        }
+
+        return buflen == 0;
+    }
+
+    tr_socket_t sock_ = TR_BAD_SOCKET;
+    bool handshake_ok_ = false;
+};
+
+// a one-piece torrent called `name', with no data
+tr_torrent* makeDatalessTorrent(tr_session* session, std::string_view name)
+{
+    tr_variant top;
+    tr_variantInitDict(&top, 1);
+    auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+    tr_variantDictAddInt(info, TR_KEY_length, 16384);
+    tr_variantDictAddStrView(info, TR_KEY_name, name);
+    tr_variantDictAddInt(info, TR_KEY_piece_length, 16384);
+    auto const pieces = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+    auto len = size_t{};
+    auto* const benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC, &len);
+    tr_variantFree(&top);
+
+    auto* const ctor = tr_ctorNew(session);
+    tr_ctorSetMetainfo(ctor, reinterpret_cast<uint8_t*>(benc), len);
+    tr_ctorSetPaused(ctor, TR_FORCE, true);
+    tr_free(benc);
+
+    auto err = int{};
+    auto* const tor = tr_torrentNew(ctor, &err, nullptr);
+    EXPECT_EQ(0, err);
+    tr_ctorFree(ctor);
+    return tor;
+}
+
+// runs `func' in the session thread and waits for it to finish
+void runInSessionThread(tr_session* session, std::function<void()> func)
+{
+    struct Data
+    {
+        std::function<void()> func;
+        std::atomic<bool> done = {};
+    };
+
+    auto data = Data{ std::move(func) };
+    tr_runInEventThread(
+        session,
+        [](void* vdata)
+        {
+            auto* const d = static_cast<Data*>(vdata);
+            d->func();
+            d->done = true;
+        },
+        &data);
+    EXPECT_TRUE(waitFor([&data]() { return data.done.load(); }, 5000));
+}
+
+// the slow way of counting the pieces we'd want from a peer
+size_t countInterestingPieces(tr_torrent const* tor, std::set<tr_piece_index_t> const& peer_has)
+{
+    auto count = size_t{};
+
+    for (auto const piece : peer_has)
+    {
+        if (!tor->pieceIsDnd(piece) && !tor->hasPiece(piece))
+        {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+} // namespace
+
+TEST_F(PeerMgrTest, pexBurstsAreMerged)
+{
+    auto* tor = zeroTorrentInit();
+
+    auto constexpr NumIpv4 = size_t{ 4000 };
+    auto constexpr NumIpv6 = size_t{ 500 };
+
+    // a large burst of new addresses all become atoms
+    auto burst = makePexBurst(NumIpv4, NumIpv6, 0);
+    EXPECT_EQ(NumIpv4 + NumIpv6, tr_peerMgrAddPex(tor, TR_PEER_FROM_PEX, std::data(burst), std::size(burst)));
+    EXPECT_EQ(NumIpv4, std::size(getPeers(tor, TR_AF_INET)));
+    EXPECT_EQ(NumIpv6, std::size(getPeers(tor, TR_AF_INET6)));
+
+    // hearing about the same addresses again updates the existing atoms
+    burst = makePexBurst(NumIpv4, NumIpv6, ADDED_F_SEED_FLAG);
+    tr_peerMgrAddPex(tor, TR_PEER_FROM_PEX, std::data(burst), std::size(burst));
+
+    for (auto const address_type : { TR_AF_INET, TR_AF_INET6 })
+    {
+        auto const peers = getPeers(tor, address_type);
+        EXPECT_EQ(address_type == TR_AF_INET ? NumIpv4 : NumIpv6, std::size(peers));
+
+        auto addresses = std::set<std::string>{};
+        for (auto const& peer : peers)
+        {
+            EXPECT_NE(0, peer.flags & ADDED_F_SEED_FLAG);
+            addresses.insert(tr_address_to_string(&peer.addr));
+        }
+
+        EXPECT_EQ(std::size(peers), std::size(addresses));
+    }
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(PeerMgrTest, peerSnapshotsReuseTheirBuffer)
+{
+    auto* tor = zeroTorrentInit();
+
+    // a torrent with no peers gives an empty snapshot,
+    // but the caller's buffer keeps its capacity for next time
+    auto snapshots = std::vector<tr_peer_snapshot>(32);
+    auto const* const data = std::data(snapshots);
+    tr_peerMgrPeerSnapshots(tor, &snapshots);
+    EXPECT_TRUE(std::empty(snapshots));
+    EXPECT_EQ(32U, snapshots.capacity());
+    EXPECT_EQ(data, std::data(snapshots));
+
+    // and agrees with the tr_peer_stat API
+    auto peer_count = int{};
+    auto* const stats = tr_torrentPeers(tor, &peer_count);
+    EXPECT_EQ(0, peer_count);
+    tr_torrentPeersFree(stats, peer_count);
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(PeerMgrTest, peerCandidateIndexMatchesFullScan)
+{
+    auto* const a = zeroTorrentInit();
+    auto* const b = makeDatalessTorrent(session_, "candidates");
+    tr_torrentSetPriority(b, TR_PRI_HIGH);
+
+    // whatever the index picks, scoring every atom should pick the same
+    auto const expect_same_candidates = [this]()
+    {
+        for (auto const max : { size_t{ 1 }, size_t{ 7 }, size_t{ 1000 } })
+        {
+            auto const [indexed, scanned] = tr_peerMgrPeerCandidateScores(session_, max);
+            EXPECT_EQ(scanned, indexed) << "max " << max;
+        }
+    };
+
+    auto const count_atoms = [](tr_torrent const* tor)
+    {
+        return std::size(getPeers(tor, TR_AF_INET)) + std::size(getPeers(tor, TR_AF_INET6));
+    };
+
+    // atoms with a mix of scores
+    auto burst = makePexBurst(40, 10, 0);
+    for (size_t i = 0; i < std::size(burst); ++i)
+    {
+        burst[i].flags = (i % 3 == 0 ? ADDED_F_CONNECTABLE : 0) | (i % 5 == 0 ? ADDED_F_SEED_FLAG : 0);
+    }
+
+    tr_peerMgrAddPex(a, TR_PEER_FROM_PEX, std::data(burst), std::size(burst));
+    tr_peerMgrAddPex(b, TR_PEER_FROM_TRACKER, std::data(burst), 30);
+
+    // stopped torrents don't have any candidates
+    EXPECT_TRUE(std::empty(tr_peerMgrPeerCandidateScores(session_, 1000).second));
+
+    // but running ones do, merged across both swarms
+    tr_torrentStart(a);
+    tr_torrentStart(b);
+    EXPECT_TRUE(waitFor([this]() { return !std::empty(tr_peerMgrPeerCandidateScores(session_, 1000).second); }, 5000));
+    expect_same_candidates();
+
+    // atoms are added, and the ones we already had change their scores
+    auto more = makePexBurst(70, 0, ADDED_F_CONNECTABLE);
+    tr_peerMgrAddPex(a, TR_PEER_FROM_DHT, std::data(more), std::size(more));
+    EXPECT_EQ(80U, count_atoms(a));
+    expect_same_candidates();
+
+    for (auto& pex : burst)
+    {
+        pex.flags ^= ADDED_F_SEED_FLAG;
+    }
+
+    tr_peerMgrAddPex(b, TR_PEER_FROM_PEX, std::data(burst), std::size(burst));
+    expect_same_candidates();
+
+    // changing a torrent's priority changes how its atoms merge with the other's
+    tr_torrentSetPriority(b, TR_PRI_LOW);
+    expect_same_candidates();
+
+    // atoms are removed once a swarm has too many
+    tr_peerMgrPruneAtoms(a);
+    EXPECT_LT(count_atoms(a), 80U);
+    expect_same_candidates();
+
+    // a stopped torrent's atoms drop out
+    tr_torrentStop(b);
+    expect_same_candidates();
+
+    // cleanup
+    tr_torrentRemove(a, false, nullptr);
+    tr_torrentRemove(b, false, nullptr);
+}
+
+TEST_F(PeerMgrTest, uploadRechokeIsSkippedOnlyWhenNothingChanged)
+{
+    // a seed, so that the peer has something to ask for
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    tr_torrentStart(tor);
+
+    // the rechoke timer would race the checks below, so stay well
+    // inside its first period after the 100ms warmup run
+    tr_wait_msec(200);
+
+    auto const rechoke_happens = [tor]()
+    {
+        return waitFor([tor]() { return tr_peerMgrRechokeUploadsIfNeeded(tor); }, 5000);
+    };
+
+    // a peer connects
+    auto peer = std::make_unique<FakePeer>(tor);
+    ASSERT_TRUE(peer->handshakeOk());
+    EXPECT_TRUE(rechoke_happens());
+    EXPECT_FALSE(tr_peerMgrRechokeUploadsIfNeeded(tor));
+
+    // it becomes interested, so it gets unchoked
+    peer->sendInterested();
+    EXPECT_TRUE(rechoke_happens());
+    EXPECT_TRUE(peer->waitForMessage(FakePeer::Unchoke));
+    EXPECT_FALSE(tr_peerMgrRechokeUploadsIfNeeded(tor));
+
+    // we upload to it, so its rate changes. The rechoke keeps running
+    // until the rate settles back to zero, and then stops
+    peer->sendRequest(0, 0, 16384);
+    EXPECT_TRUE(peer->waitForMessage(FakePeer::Piece));
+    EXPECT_TRUE(rechoke_happens());
+    EXPECT_TRUE(tr_peerMgrRechokeUploadsIfNeeded(tor));
+    EXPECT_TRUE(waitFor([tor]() { return !tr_peerMgrRechokeUploadsIfNeeded(tor); }, 5000));
+    EXPECT_FALSE(tr_peerMgrRechokeUploadsIfNeeded(tor));
+
+    // it disconnects
+    peer.reset();
+    EXPECT_TRUE(rechoke_happens());
+    EXPECT_FALSE(tr_peerMgrRechokeUploadsIfNeeded(tor));
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(PeerMgrTest, interestingPieceCountsFollowPieceChanges)
+{
+    // start with every piece, then lose a few so there's something to want
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    for (tr_piece_index_t piece = 1; piece <= 5; ++piece)
+    {
+        tor->setHasPiece(piece, false);
+    }
+
+    tr_torrentRecheckCompleteness(tor);
+    tr_torrentStart(tor);
+
+    auto const expect_counts = [tor](std::set<tr_piece_index_t> const& peer_has)
+    {
+        auto const expected = std::vector<size_t>{ countInterestingPieces(tor, peer_has) };
+        EXPECT_TRUE(waitFor([tor, &expected]() { return tr_peerMgrInterestingPieceCounts(tor) == expected; }, 5000))
+            << "expected " << expected.front();
+    };
+
+    // a peer tells us what it has
+    auto peer_has = std::set<tr_piece_index_t>{ 0, 1, 2, 3 };
+    auto peer = std::make_unique<FakePeer>(tor);
+    ASSERT_TRUE(peer->handshakeOk());
+    peer->sendBitfield(peer_has, tor->info.pieceCount);
+    expect_counts(peer_has);
+    EXPECT_EQ(std::vector<size_t>{ 3 }, tr_peerMgrInterestingPieceCounts(tor));
+
+    peer->sendHave(5);
+    peer_has.insert(5);
+    expect_counts(peer_has);
+
+    auto const got_piece = [this, tor](tr_piece_index_t piece)
+    {
+        runInSessionThread(
+            session_,
+            [tor, piece]()
+            {
+                auto const [begin, end] = tor->blockSpanForPiece(piece);
+                for (auto block = begin; block < end; ++block)
+                {
+                    tr_torrentGotBlock(tor, block);
+                }
+            });
+    };
+
+    // we get a piece that the peer has. The data's already on disk
+    got_piece(1);
+    EXPECT_TRUE(tor->hasPiece(1));
+    expect_counts(peer_has);
+    EXPECT_EQ(std::vector<size_t>{ 2 + 1 }, tr_peerMgrInterestingPieceCounts(tor));
+
+    // we get a piece that fails its checksum, so we still want it
+    {
+        auto const path = makeString(tr_torrentFindFile(tor, 0));
+        auto const fd = tr_sys_file_open(path.c_str(), TR_SYS_FILE_WRITE, 0, nullptr);
+        ASSERT_NE(TR_BAD_SYS_FILE, fd);
+        auto const junk = std::string(tor->info.pieceSize, '\1');
+        EXPECT_TRUE(tr_sys_file_write_at(fd, std::data(junk), std::size(junk), 2 * tor->info.pieceSize, nullptr, nullptr));
+        tr_sys_file_close(fd, nullptr);
+    }
+
+    got_piece(2);
+    EXPECT_FALSE(tor->hasPiece(2));
+    expect_counts(peer_has);
+    EXPECT_EQ(std::vector<size_t>{ 3 }, tr_peerMgrInterestingPieceCounts(tor));
+
+    // the peer's pieces are all in the first file. Once it's DND, we want none of them
+    auto const first_file = tr_file_index_t{ 0 };
+    tr_torrentSetFileDLs(tor, &first_file, 1, false);
+    expect_counts(peer_has);
+    EXPECT_EQ(std::vector<size_t>{ 0 }, tr_peerMgrInterestingPieceCounts(tor));
+
+    tr_torrentSetFileDLs(tor, &first_file, 1, true);
+    expect_counts(peer_has);
+    EXPECT_EQ(std::vector<size_t>{ 3 }, tr_peerMgrInterestingPieceCounts(tor));
+
+    // a verify finds that only the corrupt piece is missing. It restarts
+    // the torrent, which drops the peer, so it has to connect again
+    blockingTorrentVerify(tor);
+    EXPECT_FALSE(tor->hasPiece(2));
+    EXPECT_TRUE(tor->hasPiece(3));
+    peer = std::make_unique<FakePeer>(tor);
+    ASSERT_TRUE(peer->handshakeOk());
+    peer->sendBitfield(peer_has, tor->info.pieceCount);
+    expect_counts(peer_has);
+    EXPECT_EQ(std::vector<size_t>{ 1 }, tr_peerMgrInterestingPieceCounts(tor));
+
+    // cleanup
+    peer.reset();
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(PeerMgrTest, peerSnapshotFlagStr)
+{
+    auto flagStr = [](tr_peer_snapshot const& snapshot)
+    {
+        char buf[32];
+        tr_peerSnapshotFlagStr(&snapshot, buf, sizeof(buf));
+        return std::string{ buf };
+    };
+
+    // choked and uninterested in both directions
+    auto snapshot = tr_peer_snapshot{};
+    snapshot.peerIsChoked = true;
+    snapshot.clientIsChoked = true;
+    EXPECT_EQ("", flagStr(snapshot));
+
+    // unchoked but uninterested, in both directions
+    snapshot.peerIsChoked = false;
+    snapshot.clientIsChoked = false;
+    EXPECT_EQ("K?", flagStr(snapshot));
+
+    // interested, but nothing's moving yet
+    snapshot.peerIsInterested = true;
+    snapshot.clientIsInterested = true;
+    EXPECT_EQ("du", flagStr(snapshot));
+
+    // everything at once
+    snapshot.isUTP = true;
+    snapshot.isOptimistic = true;
+    snapshot.isDownloadingFrom = true;
+    snapshot.isUploadingTo = true;
+    snapshot.isEncrypted = true;
+    snapshot.from = TR_PEER_FROM_PEX;
+    snapshot.isIncoming = true;
+    EXPECT_EQ("TODUEXI", flagStr(snapshot));
+
+    snapshot.from = TR_PEER_FROM_DHT;
+    EXPECT_EQ("TODUEHI", flagStr(snapshot));
+
+    // the output is truncated to fit the buffer
+    char small[4];
+    tr_peerSnapshotFlagStr(&snapshot, small, sizeof(small));
+    EXPECT_EQ(std::string{ "TOD" }, small);
+}
+
+} // namespace test
+
+} // namespace libtransmission
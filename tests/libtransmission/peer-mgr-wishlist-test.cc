@@ -26,6 +26,7 @@ protected:
         mutable std::map<tr_piece_index_t, size_t> missing_block_count_;
         mutable std::map<tr_piece_index_t, tr_block_span_t> block_span_;
         mutable std::map<tr_piece_index_t, tr_priority_t> piece_priority_;
+        mutable std::map<tr_piece_index_t, size_t> piece_replication_;
         mutable std::set<tr_block_index_t> can_request_block_;
         mutable std::set<tr_piece_index_t> can_request_piece_;
         tr_piece_index_t piece_count_ = 0;
@@ -70,6 +71,11 @@ protected:
         {
             return piece_priority_[piece];
         }
+
+        [[nodiscard]] size_t countPeersWithPiece(tr_piece_index_t piece) const final
+        {
+            return piece_replication_[piece];
+        }
     };
 };
 
@@ -351,3 +357,53 @@ TEST_F(PeerMgrWishlistTest, prefersNearlyCompletePieces)
         EXPECT_EQ(0, requested.count(200, 300));
     }
 }
+
+TEST_F(PeerMgrWishlistTest, prefersRarePieces)
+{
+    auto peer_info = MockPeerInfo{};
+    auto wishlist = Wishlist{};
+
+    // setup: three pieces, all missing
+    peer_info.piece_count_ = 3;
+    peer_info.missing_block_count_[0] = 100;
+    peer_info.missing_block_count_[1] = 100;
+    peer_info.missing_block_count_[2] = 100;
+    peer_info.block_span_[0] = { 0, 100 };
+    peer_info.block_span_[1] = { 100, 200 };
+    peer_info.block_span_[2] = { 200, 300 };
+
+    // and we want everything
+    for (tr_piece_index_t i = 0; i < 3; ++i)
+    {
+        peer_info.can_request_piece_.insert(i);
+    }
+    for (tr_block_index_t i = 0; i < 299; ++i)
+    {
+        peer_info.can_request_block_.insert(i);
+    }
+
+    // and the third piece is the rarest
+    peer_info.piece_replication_[0] = 10;
+    peer_info.piece_replication_[1] = 10;
+    peer_info.piece_replication_[2] = 2;
+
+    // wishlist should pick the rarest piece's blocks first.
+    // Test several times to shake out any randomness
+    auto const num_runs = 1000;
+    for (int run = 0; run < num_runs; ++run)
+    {
+        auto const n_wanted = 10;
+        auto spans = wishlist.next(peer_info, n_wanted);
+        auto n_got = size_t{};
+        for (auto const& span : spans)
+        {
+            for (auto block = span.begin; block < span.end; ++block)
+            {
+                EXPECT_LE(peer_info.block_span_[2].begin, block);
+                EXPECT_LT(block, peer_info.block_span_[2].end);
+            }
+            n_got += span.end - span.begin;
+        }
+        EXPECT_EQ(n_wanted, n_got);
+    }
+}
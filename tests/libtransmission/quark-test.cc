@@ -11,9 +11,12 @@
 
 #include "gtest/gtest.h"
 
+#include <array>
 #include <cstring>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 class QuarkTest : public ::testing::Test
 {
@@ -47,3 +50,64 @@ TEST_F(QuarkTest, newQuarkByStringView)
     EXPECT_EQ(UniqueString, tr_quark_get_string(q, &len));
     EXPECT_EQ(std::size(UniqueString), len);
 }
+
+TEST_F(QuarkTest, manyRuntimeQuarks)
+{
+    // enough runtime quarks that a linear lookup would be noticeable
+    auto constexpr N = 20000;
+
+    auto quarks = std::vector<tr_quark>{};
+    quarks.reserve(N);
+    for (int i = 0; i < N; ++i)
+    {
+        auto const key = "runtime-quark-" + std::to_string(i);
+        EXPECT_FALSE(tr_quark_lookup(key));
+        quarks.push_back(tr_quark_new(key));
+    }
+
+    for (int i = 0; i < N; ++i)
+    {
+        auto const key = "runtime-quark-" + std::to_string(i);
+        auto const q = tr_quark_lookup(key);
+        EXPECT_TRUE(q);
+        EXPECT_EQ(quarks[i], *q);
+        EXPECT_EQ(quarks[i], tr_quark_new(key));
+        EXPECT_EQ(key, tr_quark_get_string_view(quarks[i]));
+    }
+
+    // predefined keys are never duplicated as runtime keys
+    EXPECT_EQ(TR_KEY_name, tr_quark_new("name"));
+}
+
+TEST_F(QuarkTest, concurrentNewQuarks)
+{
+    auto constexpr NumThreads = 4;
+    auto constexpr N = 2000;
+
+    // every thread adds the same keys, so they must all agree on the quarks
+    auto results = std::array<std::vector<tr_quark>, NumThreads>{};
+    auto threads = std::vector<std::thread>{};
+    for (int t = 0; t < NumThreads; ++t)
+    {
+        threads.emplace_back(
+            [&results, t]()
+            {
+                for (int i = 0; i < N; ++i)
+                {
+                    auto const q = tr_quark_new("concurrent-quark-" + std::to_string(i));
+                    results[t].push_back(q);
+                    EXPECT_EQ("concurrent-quark-" + std::to_string(i), tr_quark_get_string_view(q));
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    for (int t = 1; t < NumThreads; ++t)
+    {
+        EXPECT_EQ(results[0], results[t]);
+    }
+}
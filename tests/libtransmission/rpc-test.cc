@@ -7,6 +7,9 @@
  */
 
 #include "transmission.h"
+#include "crypto.h"
+#include "handshake.h"
+#include "net.h"
 #include "rpcimpl.h"
 #include "utils.h"
 #include "variant.h"
@@ -15,6 +18,8 @@
 
 #include <algorithm>
 #include <array>
+#include <cstring>
+#include <numeric>
 #include <set>
 #include <string_view>
 #include <vector>
@@ -188,6 +193,137 @@ TEST_F(RpcTest, sessionGet)
     tr_torrentRemove(tor, false, nullptr);
 }
 
+TEST_F(RpcTest, torrentGetAvailability)
+{
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    auto const get_availability = [this, &rpc_response_func]()
+    {
+        tr_variant request;
+        tr_variantInitDict(&request, 2);
+        tr_variantDictAddStrView(&request, TR_KEY_method, "torrent-get");
+        tr_variant* args = tr_variantDictAddDict(&request, TR_KEY_arguments, 1);
+        tr_variantListAddQuark(tr_variantDictAddList(args, TR_KEY_fields, 1), TR_KEY_availability);
+        tr_variant response;
+        tr_rpc_request_exec_json(session_, &request, rpc_response_func, &response);
+        tr_variantFree(&request);
+
+        auto ret = std::vector<int64_t>{};
+        tr_variant* torrents = nullptr;
+        tr_variant* availability = nullptr;
+        EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+        EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_torrents, &torrents));
+        EXPECT_EQ(1U, tr_variantListSize(torrents));
+        EXPECT_TRUE(tr_variantDictFindList(tr_variantListChild(torrents, 0), TR_KEY_availability, &availability));
+        for (size_t i = 0, n = tr_variantListSize(availability); i < n; ++i)
+        {
+            auto val = int64_t{};
+            EXPECT_TRUE(tr_variantGetInt(tr_variantListChild(availability, i), &val));
+            ret.push_back(val);
+        }
+
+        tr_variantFree(&response);
+        return ret;
+    };
+
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+
+    // no peers have any of the pieces we're missing
+    auto const n_pieces = size_t{ tor->info.pieceCount };
+    EXPECT_EQ(std::vector<int64_t>(n_pieces, 0), get_availability());
+
+    // we have every piece
+    zeroTorrentPopulate(tor, true);
+    EXPECT_EQ(std::vector<int64_t>(n_pieces, -1), get_availability());
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(RpcTest, sessionStatsHandshakeLatency)
+{
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    auto const get_histograms = [this, &rpc_response_func]()
+    {
+        tr_variant request;
+        tr_variantInitDict(&request, 1);
+        tr_variantDictAddStrView(&request, TR_KEY_method, "session-stats");
+        tr_variant response;
+        tr_rpc_request_exec_json(session_, &request, rpc_response_func, &response);
+        tr_variantFree(&request);
+
+        auto ret = std::array<std::vector<int64_t>, 2>{};
+        tr_variant* args = nullptr;
+        tr_variant* latency = nullptr;
+        EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+        EXPECT_TRUE(tr_variantDictFindDict(args, TR_KEY_handshake_latency, &latency));
+
+        auto const keys = std::array<tr_quark, 2>{ TR_KEY_connectMsec, TR_KEY_dhUsec };
+        for (size_t i = 0; i < std::size(keys); ++i)
+        {
+            tr_variant* list = nullptr;
+            EXPECT_TRUE(tr_variantDictFindList(latency, keys[i], &list));
+            for (size_t j = 0, n = tr_variantListSize(list); j < n; ++j)
+            {
+                auto val = int64_t{};
+                EXPECT_TRUE(tr_variantGetInt(tr_variantListChild(list, j), &val));
+                ret[i].push_back(val);
+            }
+        }
+
+        tr_variantFree(&response);
+        return ret;
+    };
+
+    auto const sum = [](std::vector<int64_t> const& v)
+    {
+        return std::accumulate(std::begin(v), std::end(v), int64_t{});
+    };
+
+    // the histograms match what the handshake code reports
+    auto const before = get_histograms();
+    auto const latency = tr_handshakeGetLatency();
+    EXPECT_EQ(std::vector<int64_t>(std::begin(latency.connect_msec), std::end(latency.connect_msec)), before[0]);
+    EXPECT_EQ(std::vector<int64_t>(std::begin(latency.dh_usec), std::end(latency.dh_usec)), before[1]);
+    EXPECT_EQ(TR_HANDSHAKE_HISTOGRAM_BUCKETS, std::size(before[1]));
+
+    // connect to our own peer port and start an encrypted handshake
+    // by sending a public key. Computing the shared secret is sampled.
+    auto sin = sockaddr_in{};
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(tr_sessionGetPeerPort(session_));
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    auto const sock = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(TR_BAD_SOCKET, sock);
+    ASSERT_EQ(0, connect(sock, reinterpret_cast<sockaddr const*>(&sin), sizeof(sin)));
+
+    auto crypto = tr_crypto{};
+    tr_cryptoConstruct(&crypto, nullptr, false);
+    auto key_len = int{};
+    auto const* const key = tr_cryptoGetMyPublicKey(&crypto, &key_len);
+    EXPECT_EQ(key_len, send(sock, reinterpret_cast<char const*>(key), key_len, 0));
+
+    auto const dh_sampled = [&]()
+    {
+        return sum(get_histograms()[1]) > sum(before[1]);
+    };
+    EXPECT_TRUE(waitFor(dh_sampled, 5000));
+
+    // cleanup
+    tr_netCloseSocket(sock);
+    tr_cryptoDestruct(&crypto);
+}
+
 } // namespace test
 
 } // namespace libtransmission
@@ -0,0 +1,304 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "crypto-utils.h" // tr_sha1_digest_t
+#include "inout.h" // tr_ioFindFileLocation()
+#include "torrent.h"
+#include "utils.h" // tr_free()
+#include "variant.h"
+
+#include "test-fixtures.h"
+
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class TorrentTest : public SessionTest
+{
+protected:
+    // lots of files, some spanning several pieces,
+    // some sharing a piece with many others, and some empty
+    static std::vector<uint64_t> makeManyFileLengths(size_t n_files, uint32_t piece_size)
+    {
+        auto lengths = std::vector<uint64_t>{};
+
+        for (size_t i = 0; i < n_files; ++i)
+        {
+            lengths.push_back(i % 7 == 3 ? 0 : i % 5 == 0 ? (i * 7919) % (piece_size * 3) + 1 : i % 97 + 1);
+        }
+
+        lengths.push_back(0);
+        return lengths;
+    }
+
+    tr_torrent* createTorrent(std::vector<uint64_t> const& lengths, uint32_t piece_size) const
+    {
+        auto const total_size = std::accumulate(std::begin(lengths), std::end(lengths), uint64_t{ 0 });
+        auto const n_pieces = (total_size + piece_size - 1) / piece_size;
+
+        // build the metainfo
+        auto top = tr_variant{};
+        tr_variantInitDict(&top, 1);
+        auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+        auto* const files = tr_variantDictAddList(info, TR_KEY_files, std::size(lengths));
+        for (size_t i = 0; i < std::size(lengths); ++i)
+        {
+            auto* const file = tr_variantListAddDict(files, 2);
+            tr_variantDictAddInt(file, TR_KEY_length, lengths[i]);
+            tr_variantListAddStr(tr_variantDictAddList(file, TR_KEY_path, 1), "file-" + std::to_string(i));
+        }
+        tr_variantDictAddStr(info, TR_KEY_name, "many-files");
+        tr_variantDictAddInt(info, TR_KEY_piece_length, piece_size);
+        auto const pieces = std::string(n_pieces * SHA_DIGEST_LENGTH, '\0');
+        tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+        auto metainfo_len = size_t{};
+        auto* const metainfo = tr_variantToStr(&top, TR_VARIANT_FMT_BENC, &metainfo_len);
+        tr_variantFree(&top);
+
+        // create the torrent
+        auto* ctor = tr_ctorNew(session_);
+        tr_ctorSetMetainfo(ctor, reinterpret_cast<uint8_t const*>(metainfo), metainfo_len);
+        tr_ctorSetPaused(ctor, TR_FORCE, true);
+        auto err = int{};
+        auto* tor = tr_torrentNew(ctor, &err, nullptr);
+        EXPECT_EQ(0, err);
+        tr_ctorFree(ctor);
+        tr_free(metainfo);
+        return tor;
+    }
+
+    // compare each piece's priority and DND flag against a brute-force
+    // check of every file in the torrent
+    static void expectPiecesMatchFiles(tr_torrent const* tor)
+    {
+        auto const& info = tor->info;
+
+        for (tr_piece_index_t p = 0; p < info.pieceCount; ++p)
+        {
+            auto priority = tr_priority_t{ TR_PRI_LOW };
+            auto dnd = true;
+
+            for (tr_file_index_t i = 0; i < info.fileCount; ++i)
+            {
+                auto const& file = info.files[i];
+                if (file.firstPiece <= p && p <= file.lastPiece)
+                {
+                    priority = std::max(priority, file.priority);
+                    if (file.priority >= TR_PRI_NORMAL && (file.firstPiece == p || file.lastPiece == p))
+                    {
+                        priority = TR_PRI_HIGH;
+                    }
+
+                    dnd = dnd && file.dnd;
+                }
+            }
+
+            EXPECT_EQ(priority, tor->piecePriority(p)) << "piece " << p;
+            EXPECT_EQ(dnd, tor->pieceIsDnd(p)) << "piece " << p;
+        }
+    }
+};
+
+TEST_F(TorrentTest, completeTorrentsDropPieceHashes)
+{
+    auto* tor = zeroTorrentInit();
+    auto const n_bytes = uint64_t{ tor->info.pieceCount * sizeof(tr_sha1_digest_t) };
+    EXPECT_EQ(n_bytes, tr_torrentStat(tor)->pieceHashBytes);
+
+    auto hashes = std::vector<tr_sha1_digest_t>{};
+    for (tr_piece_index_t i = 0; i < tor->info.pieceCount; ++i)
+    {
+        auto const hash = tor->pieceHash(i);
+        ASSERT_TRUE(hash);
+        hashes.push_back(*hash);
+    }
+
+    // once the torrent is complete, the hashes are dropped
+    zeroTorrentPopulate(tor, true);
+    EXPECT_EQ(0U, tr_torrentStat(tor)->pieceHashBytes);
+
+    // verify reloads them from the .torrent file. The torrent was already
+    // complete, so they're kept instead of being reread on the next verify
+    blockingTorrentVerify(tor);
+    EXPECT_EQ(0, tr_torrentStat(tor)->leftUntilDone);
+    EXPECT_EQ(n_bytes, tr_torrentStat(tor)->pieceHashBytes);
+
+    // rechecking a complete torrent doesn't drop them either
+    tr_torrentRecheckCompleteness(tor);
+    EXPECT_EQ(n_bytes, tr_torrentStat(tor)->pieceHashBytes);
+
+    // but they're dropped when the torrent goes from incomplete to complete
+    tor->setHasPiece(0, false);
+    tr_torrentRecheckCompleteness(tor);
+    EXPECT_EQ(n_bytes, tr_torrentStat(tor)->pieceHashBytes);
+    tor->setHasPiece(0, true);
+    tr_torrentRecheckCompleteness(tor);
+    EXPECT_EQ(0U, tr_torrentStat(tor)->pieceHashBytes);
+
+    // rewriting the .torrent file moves the hashes, but they can still be found
+    auto announce = std::string{ "https://example.org/a/much/longer/tracker/url/than/before" };
+    auto tracker = tr_tracker_info{};
+    tracker.announce = announce.data();
+    EXPECT_TRUE(tr_torrentSetAnnounceList(tor, &tracker, 1));
+    for (tr_piece_index_t i = 0; i < tor->info.pieceCount; ++i)
+    {
+        EXPECT_EQ(hashes[i], tor->pieceHash(i).value_or(tr_sha1_digest_t{}));
+    }
+
+    blockingTorrentVerify(tor);
+    EXPECT_EQ(0, tr_torrentStat(tor)->leftUntilDone);
+    EXPECT_EQ(n_bytes, tr_torrentStat(tor)->pieceHashBytes);
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(TorrentTest, verifyWithoutTorrentFileKeepsProgress)
+{
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    EXPECT_EQ(0U, tr_torrentStat(tor)->pieceHashBytes);
+
+    // with the hashes dropped and the .torrent file gone, there's nothing to verify against
+    EXPECT_TRUE(tr_sys_path_remove(tor->info.torrent, nullptr));
+    EXPECT_FALSE(tor->pieceHash(0));
+
+    // so verify should give up without throwing away the torrent's progress
+    blockingTorrentVerify(tor);
+    auto const* const st = tr_torrentStat(tor);
+    EXPECT_EQ(0, st->leftUntilDone);
+    EXPECT_EQ(TR_STAT_LOCAL_ERROR, st->error);
+    EXPECT_TRUE(tr_torrentIsSeed(tor));
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(TorrentTest, incompleteTorrentsKeepPieceHashes)
+{
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, false);
+
+    auto const n_bytes = uint64_t{ tor->info.pieceCount * sizeof(tr_sha1_digest_t) };
+    EXPECT_EQ(n_bytes, tr_torrentStat(tor)->pieceHashBytes);
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(TorrentTest, findFileLocationInManyFileTorrent)
+{
+    auto constexpr PieceSize = uint32_t{ 16384 };
+    auto const lengths = makeManyFileLengths(5000, PieceSize);
+
+    auto const total_size = std::accumulate(std::begin(lengths), std::end(lengths), uint64_t{ 0 });
+
+    auto* tor = createTorrent(lengths, PieceSize);
+    ASSERT_NE(nullptr, tor);
+    ASSERT_EQ(std::size(lengths), tor->info.fileCount);
+    ASSERT_EQ((total_size + PieceSize - 1) / PieceSize, tor->info.pieceCount);
+
+    // each piece's first file is the first one that reaches it
+    auto f = tr_file_index_t{ 0 };
+    for (tr_piece_index_t p = 0; p < tor->info.pieceCount; ++p)
+    {
+        while (tor->info.files[f].lastPiece < p)
+        {
+            ++f;
+        }
+
+        EXPECT_EQ(f, tor->pieceFirstFile(p));
+    }
+
+    // the first, middle, and last bytes of every file are found in that file
+    for (tr_file_index_t i = 0; i < tor->info.fileCount; ++i)
+    {
+        auto const& file = tor->info.files[i];
+        if (file.length == 0)
+        {
+            continue;
+        }
+
+        for (auto const file_offset : { uint64_t{ 0 }, file.length / 2, file.length - 1 })
+        {
+            auto const offset = file.offset + file_offset;
+            auto found_index = tr_file_index_t{};
+            auto found_offset = uint64_t{};
+            tr_ioFindFileLocation(tor, offset / PieceSize, offset % PieceSize, &found_index, &found_offset);
+            EXPECT_EQ(i, found_index);
+            EXPECT_EQ(file_offset, found_offset);
+        }
+    }
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(TorrentTest, fileStatesMatchPieces)
+{
+    auto constexpr PieceSize = uint32_t{ 16384 };
+    auto const lengths = makeManyFileLengths(2000, PieceSize);
+    auto* tor = createTorrent(lengths, PieceSize);
+    ASSERT_NE(nullptr, tor);
+    auto const n_files = tor->info.fileCount;
+    expectPiecesMatchFiles(tor);
+
+    // set everything at once
+    auto priorities = std::vector<tr_priority_t>(n_files);
+    auto wanted = std::unique_ptr<bool[]>{ new bool[n_files] };
+    for (tr_file_index_t i = 0; i < n_files; ++i)
+    {
+        priorities[i] = tr_priority_t(int(i * 31 % 3) - 1);
+        wanted[i] = i % 11 != 0 && i % 13 != 0;
+    }
+    tr_torrentSetFileStates(tor, std::data(priorities), wanted.get());
+    for (tr_file_index_t i = 0; i < n_files; ++i)
+    {
+        EXPECT_EQ(priorities[i], tor->info.files[i].priority);
+        EXPECT_EQ(!wanted[i], tor->info.files[i].dnd);
+    }
+    expectPiecesMatchFiles(tor);
+
+    // batches of unsorted indices, duplicates, and bad indices
+    auto files = std::vector<tr_file_index_t>{};
+    for (tr_file_index_t i = 0; i < n_files; ++i)
+    {
+        files.push_back((i * 7919) % n_files);
+    }
+    files.push_back(files.front());
+    files.push_back(n_files);
+    tr_torrentSetFileDLs(tor, std::data(files), std::size(files) / 2, false);
+    tr_torrentSetFilePriorities(tor, std::data(files) + std::size(files) / 3, std::size(files) / 3, TR_PRI_HIGH);
+    expectPiecesMatchFiles(tor);
+
+    // and everything back to the defaults
+    tr_torrentSetFileDLs(tor, std::data(files), std::size(files), true);
+    tr_torrentSetFilePriorities(tor, std::data(files), std::size(files), TR_PRI_NORMAL);
+    expectPiecesMatchFiles(tor);
+    for (tr_file_index_t i = 0; i < n_files; ++i)
+    {
+        EXPECT_FALSE(tor->info.files[i].dnd);
+        EXPECT_EQ(TR_PRI_NORMAL, tor->info.files[i].priority);
+    }
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -9,6 +9,7 @@
 #define LIBTRANSMISSION_VARIANT_MODULE
 
 #include "transmission.h"
+#include "benc.h"
 #include "utils.h" /* tr_free */
 #include "variant-common.h"
 #include "variant.h"
@@ -19,6 +20,7 @@
 #include <cctype> // isspace()
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -556,3 +558,218 @@ TEST_F(VariantTest, dictFindType)
 
     tr_variantFree(&top);
 }
+
+TEST_F(VariantTest, bigDictFind)
+{
+    // big enough for the dict to be indexed
+    auto constexpr N = int64_t{ 1000 };
+
+    auto keys = std::vector<tr_quark>{};
+    for (int64_t i = 0; i < N; ++i)
+    {
+        keys.push_back(tr_quark_new("big-dict-key-" + std::to_string(i)));
+    }
+
+    tr_variant top;
+    tr_variantInitDict(&top, 0);
+    for (int64_t i = 0; i < N; ++i)
+    {
+        // the index is built partway through, and then has to keep up
+        EXPECT_EQ(nullptr, tr_variantDictFind(&top, keys[i]));
+        tr_variantDictAddInt(&top, keys[i], i);
+    }
+
+    EXPECT_EQ(size_t(N), top.val.l.count);
+
+    for (int64_t i = 0; i < N; ++i)
+    {
+        auto val = int64_t{};
+        EXPECT_TRUE(tr_variantDictFindInt(&top, keys[i], &val));
+        EXPECT_EQ(i, val);
+    }
+
+    // children stay in insertion order
+    auto key = tr_quark{};
+    tr_variant* child = nullptr;
+    EXPECT_TRUE(tr_variantDictChild(&top, 10, &key, &child));
+    EXPECT_EQ(keys[10], key);
+
+    // removing a key moves other children around
+    EXPECT_TRUE(tr_variantDictRemove(&top, keys[0]));
+    EXPECT_EQ(nullptr, tr_variantDictFind(&top, keys[0]));
+    for (int64_t i = 1; i < N; ++i)
+    {
+        auto val = int64_t{};
+        EXPECT_TRUE(tr_variantDictFindInt(&top, keys[i], &val));
+        EXPECT_EQ(i, val);
+    }
+
+    // replacing a child with one of a different type
+    tr_variantDictAddStr(&top, keys[5], "five");
+    auto sv = std::string_view{};
+    EXPECT_TRUE(tr_variantDictFindStrView(&top, keys[5], &sv));
+    EXPECT_EQ("five"sv, sv);
+
+    tr_variantFree(&top);
+}
+
+TEST_F(VariantTest, bigDictIndexedWhenParsed)
+{
+    auto constexpr N = 20;
+
+    auto json = std::string{ "{" };
+    for (int i = 0; i < N; ++i)
+    {
+        json += (i == 0 ? "" : ",") + std::string{ "\"parsed-key-" } + std::to_string(i) + "\":" + std::to_string(i);
+    }
+    json += "}";
+
+    tr_variant top;
+    EXPECT_TRUE(tr_variantFromBuf(&top, TR_VARIANT_PARSE_JSON | TR_VARIANT_PARSE_INPLACE, json));
+    EXPECT_NE(nullptr, top.val.l.index);
+
+    // lookups don't change the dict
+    auto const check = [&top](int i)
+    {
+        auto const key = tr_quark_new("parsed-key-" + std::to_string(i));
+        auto val = int64_t{};
+        EXPECT_TRUE(tr_variantDictFindInt(&top, key, &val));
+        EXPECT_EQ(i, val);
+    };
+    auto const* const index = top.val.l.index;
+    for (int i = 0; i < N; ++i)
+    {
+        check(i);
+    }
+    EXPECT_EQ(index, top.val.l.index);
+
+    // once it's small again, the index is dropped
+    for (int i = 0; i < N; ++i)
+    {
+        EXPECT_TRUE(tr_variantDictRemove(&top, tr_quark_new("parsed-key-" + std::to_string(i))));
+        EXPECT_EQ(top.val.l.count >= 16, top.val.l.index != nullptr);
+
+        for (int j = i + 1; j < N; ++j)
+        {
+            check(j);
+        }
+    }
+
+    tr_variantFree(&top);
+}
+
+TEST_F(VariantTest, arenaParse)
+{
+    // a metainfo-like file list, big enough to need several arena blocks
+    auto benc = std::string{ "d5:filesl" };
+    for (int i = 0; i < 2000; ++i)
+    {
+        auto const filename = "file-with-a-longish-name-" + std::to_string(i) + ".bin";
+        benc += "d6:lengthi" + std::to_string(i) + "e4:pathl14:some-directory" + std::to_string(std::size(filename)) +
+            ':' + filename + "ee";
+    }
+    benc += "e4:name4:teste";
+
+    auto arena = tr_variant_arena{};
+    auto top = tr_variant{};
+    EXPECT_TRUE(tr_variantFromBuf(&top, arena, TR_VARIANT_PARSE_BENC, benc));
+
+    auto len = size_t{};
+    auto* str = tr_variantToStr(&top, TR_VARIANT_FMT_BENC, &len);
+    EXPECT_EQ(benc, std::string(str, len));
+    tr_free(str);
+
+    // arena-backed containers can still be changed
+    tr_variant* files = nullptr;
+    EXPECT_TRUE(tr_variantDictFindList(&top, tr_quark_new("files"sv), &files));
+    EXPECT_EQ(2000U, tr_variantListSize(files));
+    for (int i = 0; i < 2000; ++i)
+    {
+        tr_variantListAddInt(files, i);
+    }
+    EXPECT_EQ(4000U, tr_variantListSize(files));
+    auto i = int64_t{};
+    EXPECT_TRUE(tr_variantGetInt(tr_variantListChild(files, 3999), &i));
+    EXPECT_EQ(1999, i);
+    tr_variantDictAddStr(&top, TR_KEY_comment, "a comment that's too long to fit inline"sv);
+    tr_variantFree(&top);
+
+    // json, including strings that have to be unescaped
+    auto constexpr Json =
+        R"({"method":"torrent-get","arguments":{"fields":["id","name"],"path":"C:\\Users\\someone\\Downloads"}})"sv;
+    EXPECT_TRUE(tr_variantFromBuf(&top, arena, TR_VARIANT_PARSE_JSON | TR_VARIANT_PARSE_INPLACE, Json));
+    tr_variant* args = nullptr;
+    EXPECT_TRUE(tr_variantDictFindDict(&top, TR_KEY_arguments, &args));
+    auto sv = std::string_view{};
+    EXPECT_TRUE(tr_variantDictFindStrView(args, TR_KEY_path, &sv));
+    EXPECT_EQ(R"(C:\Users\someone\Downloads)"sv, sv);
+    tr_variant* fields = nullptr;
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_fields, &fields));
+    EXPECT_EQ(2U, tr_variantListSize(fields));
+    tr_variantFree(&top);
+
+    arena.clear();
+}
+
+TEST_F(VariantTest, bencReader)
+{
+    auto constexpr Benc = "d3:cow3:moo4:listli1ei-2eld1:ai3eeee5:emptyde4:spam4:eggse"sv;
+
+    // pull out one field without looking at the rest
+    auto reader = tr_benc_reader{ Benc };
+    auto key = std::string_view{};
+    auto sv = std::string_view{};
+    auto spam = std::string_view{};
+    auto n_keys = size_t{};
+    EXPECT_TRUE(reader.enterDict());
+    while (reader.nextKey(&key))
+    {
+        ++n_keys;
+
+        if (key == "spam"sv && reader.readStr(&sv))
+        {
+            spam = sv;
+        }
+        else if (key != "spam"sv)
+        {
+            reader.skipValue();
+        }
+    }
+    EXPECT_FALSE(reader.failed());
+    EXPECT_EQ(4U, n_keys);
+    EXPECT_EQ("eggs"sv, spam);
+    EXPECT_EQ(std::data(Benc) + std::size(Benc), reader.pos());
+    EXPECT_EQ(0U, reader.depth());
+
+    // walk a list, skipping values of the wrong type
+    reader = tr_benc_reader{ "li1ei-2eld1:ai3eee3:fooe"sv };
+    auto ints = std::vector<int64_t>{};
+    EXPECT_TRUE(reader.enterList());
+    while (reader.hasNextItem())
+    {
+        if (auto i = int64_t{}; reader.readInt(&i))
+        {
+            ints.push_back(i);
+        }
+    }
+    EXPECT_FALSE(reader.failed());
+    EXPECT_EQ((std::vector<int64_t>{ 1, -2 }), ints);
+
+    // token-by-token
+    reader = tr_benc_reader{ "l4:spami42ee"sv };
+    EXPECT_EQ(TR_BENC_TOKEN_LIST, reader.next());
+    EXPECT_EQ(TR_BENC_TOKEN_STR, reader.next());
+    EXPECT_EQ("spam"sv, reader.strValue());
+    EXPECT_EQ(TR_BENC_TOKEN_INT, reader.next());
+    EXPECT_EQ(42, reader.intValue());
+    EXPECT_EQ(TR_BENC_TOKEN_END, reader.next());
+    EXPECT_EQ(TR_BENC_TOKEN_ERROR, reader.next()); // nothing left
+
+    // malformed input
+    for (auto const benc : { "d1:ai0e1:be"sv, "d1:ai0e"sv, "l5:abce"sv, "i12"sv, "e"sv, ""sv })
+    {
+        reader = tr_benc_reader{ benc };
+        EXPECT_FALSE(reader.skipValue() && !reader.failed()) << benc;
+        EXPECT_TRUE(reader.failed()) << benc;
+    }
+}
@@ -0,0 +1,269 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "net.h"
+#include "rpcimpl.h"
+#include "variant.h"
+#include "web.h"
+
+#include "test-fixtures.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h> /* htonl() */
+#include <sys/select.h>
+#endif
+
+using namespace std::literals;
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+// A keep-alive HTTP server on the loopback interface that answers every
+// request with "ok" after `delay`, and remembers how many requests it was
+// working on at once.
+class TestHttpServer
+{
+public:
+    explicit TestHttpServer(std::chrono::milliseconds delay)
+        : delay_{ delay }
+    {
+        auto sin = sockaddr_in{};
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        listener_ = socket(AF_INET, SOCK_STREAM, 0);
+        EXPECT_NE(TR_BAD_SOCKET, listener_);
+        EXPECT_EQ(0, bind(listener_, reinterpret_cast<sockaddr const*>(&sin), sizeof(sin)));
+        EXPECT_EQ(0, listen(listener_, 16));
+
+        auto len = socklen_t{ sizeof(sin) };
+        EXPECT_EQ(0, getsockname(listener_, reinterpret_cast<sockaddr*>(&sin), &len));
+        port_ = ntohs(sin.sin_port);
+
+        accept_thread_ = std::thread([this]() { acceptLoop(); });
+    }
+
+    ~TestHttpServer()
+    {
+        stopping_ = true;
+        accept_thread_.join();
+
+        auto const lock = std::lock_guard(threads_mutex_);
+        for (auto& thread : threads_)
+        {
+            thread.join();
+        }
+
+        tr_netCloseSocket(listener_);
+    }
+
+    std::string url(std::string_view path) const
+    {
+        return "http://127.0.0.1:" + std::to_string(port_) + std::string{ path };
+    }
+
+    int maxInFlight() const
+    {
+        return max_in_flight_;
+    }
+
+private:
+    bool waitReadable(tr_socket_t sock) const
+    {
+        while (!stopping_)
+        {
+            auto fds = fd_set{};
+            FD_ZERO(&fds);
+            FD_SET(sock, &fds);
+            auto tv = timeval{ 0, 20000 };
+
+            if (select(int(sock) + 1, &fds, nullptr, nullptr, &tv) > 0)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void acceptLoop()
+    {
+        while (waitReadable(listener_))
+        {
+            auto const sock = accept(listener_, nullptr, nullptr);
+            if (sock != TR_BAD_SOCKET)
+            {
+                auto const lock = std::lock_guard(threads_mutex_);
+                threads_.emplace_back([this, sock]() { serve(sock); });
+            }
+        }
+    }
+
+    void serve(tr_socket_t sock)
+    {
+        auto request = std::string{};
+
+        while (waitReadable(sock))
+        {
+            char buf[1024];
+            auto const n = recv(sock, buf, sizeof(buf), 0);
+            if (n <= 0)
+            {
+                break;
+            }
+
+            request.append(buf, size_t(n));
+
+            for (auto end = request.find("\r\n\r\n"); end != std::string::npos; end = request.find("\r\n\r\n"))
+            {
+                request.erase(0, end + 4);
+
+                auto const in_flight = ++in_flight_;
+                auto max = max_in_flight_.load();
+                while (in_flight > max && !max_in_flight_.compare_exchange_weak(max, in_flight))
+                {
+                }
+
+                std::this_thread::sleep_for(delay_);
+                --in_flight_;
+
+                auto constexpr Response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"sv;
+                send(sock, std::data(Response), std::size(Response), 0);
+            }
+        }
+
+        tr_netCloseSocket(sock);
+    }
+
+    std::chrono::milliseconds const delay_;
+    tr_socket_t listener_ = TR_BAD_SOCKET;
+    tr_port port_ = {};
+
+    std::atomic<bool> stopping_ = {};
+    std::atomic<int> in_flight_ = {};
+    std::atomic<int> max_in_flight_ = {};
+
+    std::thread accept_thread_;
+    std::mutex threads_mutex_;
+    std::vector<std::thread> threads_;
+};
+
+class WebTest : public SessionTest
+{
+protected:
+    struct Results
+    {
+        std::atomic<int> done = {};
+        std::atomic<int> ok = {};
+    };
+
+    static void onDone(
+        tr_session* /*session*/,
+        bool /*did_connect*/,
+        bool /*did_timeout*/,
+        long response_code,
+        std::string_view response,
+        void* vresults)
+    {
+        auto* const results = static_cast<Results*>(vresults);
+
+        if (response_code == 200 && response == "ok"sv)
+        {
+            ++results->ok;
+        }
+
+        ++results->done;
+    }
+
+    static bool waitForDone(Results const& results, int n)
+    {
+        return waitFor([&results, n]() { return results.done == n; }, 10000);
+    }
+};
+
+TEST_F(WebTest, statsCountTransfers)
+{
+    auto server = TestHttpServer{ 0ms };
+    auto const before = tr_webGetStats(session_);
+
+    // one at a time, so that each transfer after the first can reuse the connection
+    auto constexpr N = 3;
+    auto results = Results{};
+    for (int i = 0; i < N; ++i)
+    {
+        tr_webRun(session_, server.url("/stats"), onDone, &results);
+        EXPECT_TRUE(waitForDone(results, i + 1));
+    }
+
+    EXPECT_EQ(N, results.ok);
+
+    auto const after = tr_webGetStats(session_);
+    EXPECT_EQ(before.transfers_done + N, after.transfers_done);
+    EXPECT_EQ(before.transfers_on_reused_connection + N - 1, after.transfers_on_reused_connection);
+
+    // the same numbers are available over RPC
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    tr_variant request;
+    tr_variantInitDict(&request, 1);
+    tr_variantDictAddStrView(&request, TR_KEY_method, "session-stats");
+    tr_variant response;
+    tr_rpc_request_exec_json(session_, &request, rpc_response_func, &response);
+    tr_variantFree(&request);
+
+    tr_variant* args = nullptr;
+    tr_variant* web_stats = nullptr;
+    auto transfers_done = int64_t{};
+    auto transfers_on_reused_connection = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+    EXPECT_TRUE(tr_variantDictFindDict(args, TR_KEY_web_stats, &web_stats));
+    EXPECT_TRUE(tr_variantDictFindInt(web_stats, TR_KEY_transfersDone, &transfers_done));
+    EXPECT_TRUE(tr_variantDictFindInt(web_stats, TR_KEY_transfersOnReusedConnection, &transfers_on_reused_connection));
+    EXPECT_EQ(int64_t(after.transfers_done), transfers_done);
+    EXPECT_EQ(int64_t(after.transfers_on_reused_connection), transfers_on_reused_connection);
+
+    // cleanup
+    tr_variantFree(&response);
+}
+
+TEST_F(WebTest, limitsTasksPerHost)
+{
+    auto server = TestHttpServer{ 100ms };
+
+    // more tasks than a host is allowed at once; the rest wait their turn
+    auto constexpr N = 16;
+    auto results = Results{};
+    for (int i = 0; i < N; ++i)
+    {
+        tr_webRun(session_, server.url("/limit/" + std::to_string(i)), onDone, &results);
+    }
+
+    EXPECT_TRUE(waitForDone(results, N));
+    EXPECT_EQ(N, results.ok);
+    EXPECT_LE(server.maxInFlight(), 6);
+    EXPECT_GE(server.maxInFlight(), 1);
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -23,6 +23,7 @@
 #define MY_NAME "transmission-create"
 
 #define MAX_TRACKERS 128
+#define MAX_HASH_THREADS 1024
 static uint32_t const KiB = 1024;
 static tr_tracker_info trackers[MAX_TRACKERS];
 static int trackerCount = 0;
@@ -32,6 +33,7 @@ static char const* comment = nullptr;
 static char const* outfile = nullptr;
 static char const* infile = nullptr;
 static uint32_t piecesize_kib = 0;
+static uint32_t hash_threads = 0;
 static char const* source = NULL;
 
 static tr_option options[] = {
@@ -41,6 +43,7 @@ static tr_option options[] = {
     { 's', "piecesize", "Set how many KiB each piece should be, overriding the preferred default", "s", true, "<size in KiB>" },
     { 'c', "comment", "Add a comment", "c", true, "<comment>" },
     { 't', "tracker", "Add a tracker's announce URL", "t", true, "<url>" },
+    { 'T', "threads", "Set how many threads to hash pieces with (default: one per CPU core)", "T", true, "<count>" },
     { 'V', "version", "Show version number and exit", "V", false, nullptr },
     { 0, nullptr, nullptr, nullptr, false, nullptr }
 };
@@ -103,6 +106,26 @@ static int parseCommandLine(int argc, char const* const* argv)
             source = optarg;
             break;
 
+        case 'T':
+            {
+                char* endptr = nullptr;
+                unsigned long const n = strtoul(optarg, &endptr, 10);
+
+                if (endptr == optarg || *endptr != '\0' || n == 0 || n > MAX_HASH_THREADS)
+                {
+                    fprintf(
+                        stderr,
+                        "ERROR: Thread count must be a number from 1 to %d, not \"%s\"\n",
+                        MAX_HASH_THREADS,
+                        optarg);
+                    return 1;
+                }
+
+                hash_threads = n;
+            }
+
+            break;
+
         case TR_OPT_UNK:
             infile = optarg;
             break;
@@ -208,6 +231,8 @@ int tr_main(int argc, char* argv[])
         tr_metaInfoBuilderSetPieceSize(b, piecesize_kib * KiB);
     }
 
+    b->hashThreadCount = hash_threads;
+
     char buf[128];
     printf(
         b->fileCount > 1 ? " %" PRIu32 " files, %s\n" : " %" PRIu32 " file, %s\n",